@@ -0,0 +1,237 @@
+#ifndef _AUTH_H
+#define _AUTH_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+authorization: an external backend decides, a cache remembers
+
+The backend is a separate process on a local UNIX socket (SOCK_SEQPACKET, so every
+message arrives whole) that each worker connects to without blocking.  A lookup is one
+struct auth_request out and, whenever the backend is done with it, one struct
+auth_reply back carrying the same tag and identifier; replies may come in any order.
+Until its reply arrives, a session answers AuthorizationReq (ContractAuthenticationReq
+for DIN 70121) with EVSEProcessing=Ongoing and the worker goes on serving everyone else.
+
+Decisions are kept in a cache shared by all workers, keyed by what was looked up (the
+EVCCID, or the eMAID of a contract) and held for as long as the backend says (or
+auth_cache_ttl_s), so a vehicle that comes back, whichever worker it lands on, is
+answered at once.  The cache is set-associative: an identifier hashes to one set of
+AUTH_CACHE_WAYS entries, and a new decision replaces an expired entry or else the one
+that would expire first.  It is only touched when a session starts a lookup and when a
+reply arrives, so a mutex serves.
+
+This header is the whole interface: the stub backend includes it too (see authstub.c).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* where redux connects to the backend (authstub -s for another) */
+#define AUTH_SOCKET_PATH "/tmp/redux.auth"
+
+#define AUTH_ID_MAX 32
+
+#ifndef AUTH_CACHE_SETS
+#define AUTH_CACHE_SETS 1024
+#endif
+#define AUTH_CACHE_WAYS 4
+
+_Static_assert(0 == (AUTH_CACHE_SETS & (AUTH_CACHE_SETS - 1)), "AUTH_CACHE_SETS must be a power of two");
+
+enum auth_kind
+{
+  AUTH_EVCCID = 1,          /* the EV's MAC address, for external payment */
+  AUTH_EMAID = 2,           /* the contract ID, for contract payment */
+};
+
+enum auth_state
+{
+  AUTH_UNKNOWN,             /* nothing asked yet */
+  AUTH_PENDING,             /* asked, no reply yet */
+  AUTH_ACCEPTED,
+  AUTH_REJECTED,
+};
+
+struct auth_id
+{
+  uint8_t kind;             /* enum auth_kind */
+  uint8_t len;
+  uint8_t bytes[AUTH_ID_MAX];
+};
+
+/* SECC to backend */
+
+struct auth_request
+{
+  uint32_t tag;
+  struct auth_id id;
+};
+
+/* backend to SECC */
+
+struct auth_reply
+{
+  uint32_t tag;             /* as in the request */
+  uint8_t result;           /* AUTH_ACCEPTED or AUTH_REJECTED */
+  uint8_t reserved[3];
+  uint32_t ttl_s;           /* how long the decision may be cached; 0 for the SECC's default */
+  struct auth_id id;        /* as in the request, so that a late reply is still cached */
+};
+
+static void auth_id_set(struct auth_id *id, enum auth_kind kind, const void *bytes, size_t len)
+{
+  memset(id, 0, sizeof(*id));
+  id->kind = kind;
+  id->len = (len < AUTH_ID_MAX) ? len : AUTH_ID_MAX;
+  memcpy(id->bytes, bytes, id->len);
+}
+
+static bool auth_id_equal(const struct auth_id *x, const struct auth_id *y)
+{
+  return (x->kind == y->kind) && (x->len == y->len) && !memcmp(x->bytes, y->bytes, x->len);
+}
+
+static uint64_t auth_now_s(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/* the cache */
+
+struct auth_entry
+{
+  struct auth_id id;
+  uint8_t result;           /* AUTH_UNKNOWN if the entry is empty */
+  uint64_t expires_s;
+};
+
+struct auth_cache
+{
+  pthread_mutex_t lock;
+  uint32_t ttl_s;
+  struct auth_entry set[AUTH_CACHE_SETS][AUTH_CACHE_WAYS];
+};
+
+static void auth_cache_init(struct auth_cache *c, uint32_t ttl_s)
+{
+  memset(c, 0, sizeof(*c));
+  pthread_mutex_init(&c->lock, NULL);
+  c->ttl_s = ttl_s;
+}
+
+/* FNV-1a over the kind and the bytes */
+
+static unsigned auth_hash(const struct auth_id *id)
+{
+  uint32_t h = 2166136261u ^ id->kind;
+  h *= 16777619u;
+  for (unsigned i = 0; i < id->len; i++)
+  {
+    h ^= id->bytes[i];
+    h *= 16777619u;
+  }
+  return h & (AUTH_CACHE_SETS - 1);
+}
+
+/* AUTH_ACCEPTED or AUTH_REJECTED while a decision is held, else AUTH_UNKNOWN */
+
+static enum auth_state auth_cache_get(struct auth_cache *c, const struct auth_id *id)
+{
+  struct auth_entry *set = c->set[auth_hash(id)];
+  uint64_t now = auth_now_s();
+  enum auth_state result = AUTH_UNKNOWN;
+
+  pthread_mutex_lock(&c->lock);
+  for (unsigned i = 0; i < AUTH_CACHE_WAYS; i++)
+    if (set[i].result && (set[i].expires_s > now) && auth_id_equal(&set[i].id, id))
+    {
+      result = set[i].result;
+      break;
+    }
+  pthread_mutex_unlock(&c->lock);
+
+  return result;
+}
+
+static void auth_cache_put(struct auth_cache *c, const struct auth_id *id, enum auth_state result, uint32_t ttl_s)
+{
+  struct auth_entry *set = c->set[auth_hash(id)];
+  uint64_t now = auth_now_s();
+
+  pthread_mutex_lock(&c->lock);
+
+  /* the same identifier, else the entry that expires first (an empty or expired one has) */
+  struct auth_entry *e = &set[0];
+  for (unsigned i = 0; i < AUTH_CACHE_WAYS; i++)
+  {
+    if (set[i].result && auth_id_equal(&set[i].id, id))
+    {
+      e = &set[i];
+      break;
+    }
+    if (set[i].expires_s < e->expires_s) e = &set[i];
+  }
+
+  e->id = *id;
+  e->result = result;
+  e->expires_s = now + ((ttl_s) ? ttl_s : c->ttl_s);
+
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* the SECC's end of the backend socket: returns -1 if the backend is not there */
+
+static int auth_connect(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (sock < 0) return -1;
+
+  if (connect(sock, (const struct sockaddr *)&addr, sizeof(addr)))
+  {
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+/* returns false if the request could not be queued (errno EAGAIN if the backend is only behind) */
+
+static bool auth_send(int sock, uint32_t tag, const struct auth_id *id)
+{
+  struct auth_request req = { .tag = tag, .id = *id };
+  return sizeof(req) == send(sock, &req, sizeof(req), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/* 1 with a reply, 0 when there are no more for now, -1 once the backend has gone */
+
+static int auth_recv(int sock, struct auth_reply *reply)
+{
+  for (;;)
+  {
+    ssize_t len = recv(sock, reply, sizeof(*reply), MSG_DONTWAIT);
+    if (sizeof(*reply) == len) return 1;
+    if (len > 0) continue;  /* not one of ours */
+    if (0 == len) return -1;
+    if (EINTR == errno) continue;
+    return ((EAGAIN == errno) || (EWOULDBLOCK == errno)) ? 0 : -1;
+  }
+}
+
+#endif
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+stub authorization backend for redux
+
+Listens on the UNIX socket redux looks for (see auth.h) and answers every lookup after
+-d milliseconds, as a slow remote backend would, without ever holding one lookup up
+behind another.  -r percent of identifiers are rejected; which ones is decided by a
+hash of the identifier, so a vehicle gets the same answer each time it comes back.
+Decisions are sent with a cache lifetime of -t seconds (0 leaves it to redux).
+
+Once a second it reports the lookups answered, so the effect of redux's cache can be
+watched: a returning vehicle is not looked up again.
+
+usage: authstub [-s socket path] [-d delay in ms] [-r reject percent] [-t ttl in s] [-q]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "auth.h"
+
+#define MAX_CLIENTS 32        /* one per redux worker, and then some */
+#define MAX_QUEUED 4096       /* lookups waiting out the delay */
+
+/* the delay is the same for every lookup, so they fall due in the order they arrived */
+
+struct queued
+{
+  uint64_t due_ms;
+  int sock;
+  struct auth_reply reply;
+};
+
+static struct pollfd fds[1 + MAX_CLIENTS]; /* the listening socket, then the clients */
+static unsigned client_count;
+static struct queued queue[MAX_QUEUED];
+static unsigned head, count;
+static unsigned long accepted, rejected, dropped;
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+  running = 0;
+}
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void client_close(unsigned i)
+{
+  close(fds[i].fd);
+
+  /* its queued replies have nowhere to go */
+  for (unsigned n = 0; n < count; n++)
+    if (queue[(head + n) % MAX_QUEUED].sock == fds[i].fd) queue[(head + n) % MAX_QUEUED].sock = -1;
+
+  fds[i] = fds[client_count--];
+}
+
+static bool decide(const struct auth_id *id, unsigned reject_percent)
+{
+  uint32_t h = 2166136261u;
+  for (unsigned i = 0; i < id->len; i++)
+  {
+    h ^= id->bytes[i];
+    h *= 16777619u;
+  }
+  return (h % 100) >= reject_percent;
+}
+
+static void take_requests(int sock, unsigned delay_ms, unsigned reject_percent, uint32_t ttl_s)
+{
+  struct auth_request req;
+
+  while (recv(sock, &req, sizeof(req), MSG_DONTWAIT) == sizeof(req))
+  {
+    if (count == MAX_QUEUED)
+    {
+      dropped++;
+      continue;
+    }
+
+    struct queued *q = &queue[(head + count++) % MAX_QUEUED];
+    q->due_ms = now_ms() + delay_ms;
+    q->sock = sock;
+    memset(&q->reply, 0, sizeof(q->reply));
+    q->reply.tag = req.tag;
+    q->reply.id = req.id;
+    q->reply.ttl_s = ttl_s;
+    q->reply.result = (decide(&req.id, reject_percent)) ? AUTH_ACCEPTED : AUTH_REJECTED;
+  }
+}
+
+static void send_due(void)
+{
+  uint64_t now = now_ms();
+
+  while (count && (queue[head].due_ms <= now))
+  {
+    struct queued *q = &queue[head];
+    if ((q->sock >= 0) && (send(q->sock, &q->reply, sizeof(q->reply), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(q->reply)))
+    {
+      if (AUTH_ACCEPTED == q->reply.result) accepted++; else rejected++;
+    }
+    else
+    {
+      dropped++;
+    }
+
+    head = (head + 1) % MAX_QUEUED;
+    count--;
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s socket path] [-d delay in ms] [-r reject percent] [-t ttl in s] [-q]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *path = AUTH_SOCKET_PATH;
+  unsigned delay_ms = 200, reject_percent = 0;
+  uint32_t ttl_s = 0;
+  bool quiet = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:d:r:t:q")) != -1)
+  {
+    switch (opt)
+    {
+    case 's': path = optarg; break;
+    case 'd': delay_ms = atoi(optarg); break;
+    case 'r': reject_percent = atoi(optarg); break;
+    case 't': ttl_s = atoi(optarg); break;
+    case 'q': quiet = true; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if (reject_percent > 100)
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  int listen_sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+  if (listen_sock < 0) return -1;
+
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  unlink(path);
+
+  if (bind(listen_sock, (const struct sockaddr *)&addr, sizeof(addr)) || listen(listen_sock, SOMAXCONN))
+  {
+    fprintf(stderr, "ERROR: cannot listen on %s\n", path);
+    return -1;
+  }
+
+  printf("listening on %s: %u ms per lookup, %u%% rejected\n", path, delay_ms, reject_percent);
+  fflush(stdout);
+
+  fds[0].fd = listen_sock;
+  fds[0].events = POLLIN;
+  uint64_t report_ms = now_ms() + 1000;
+
+  while (running)
+  {
+    /* sleep until the next reply falls due, or the next report */
+    uint64_t now = now_ms();
+    uint64_t wake = (count && (queue[head].due_ms < report_ms)) ? queue[head].due_ms : report_ms;
+    int rc = poll(fds, 1 + client_count, (wake > now) ? (int)(wake - now) : 0);
+    if ((rc < 0) && (EINTR != errno)) break;
+
+    if (fds[0].revents & POLLIN)
+    {
+      int sock;
+      while ((sock = accept4(listen_sock, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+      {
+        if (client_count == MAX_CLIENTS)
+        {
+          close(sock);
+          continue;
+        }
+        fds[1 + client_count].fd = sock;
+        fds[1 + client_count].events = POLLIN;
+        fds[1 + client_count].revents = 0;
+        client_count++;
+      }
+    }
+
+    for (unsigned i = 1; i <= client_count; i++)
+    {
+      if (fds[i].revents & POLLIN) take_requests(fds[i].fd, delay_ms, reject_percent, ttl_s);
+      if (fds[i].revents & (POLLHUP | POLLERR))
+      {
+        client_close(i);
+        i--;
+      }
+    }
+
+    send_due();
+
+    if (now_ms() >= report_ms)
+    {
+      if (!quiet && (accepted || rejected || dropped))
+      {
+        printf("%u clients: %lu accepted, %lu rejected, %lu dropped, %u queued\n", client_count, accepted, rejected, dropped, count);
+        fflush(stdout);
+      }
+      accepted = rejected = dropped = 0;
+      report_ms += 1000;
+    }
+  }
+
+  for (unsigned i = 1; i <= client_count; i++)
+    close(fds[i].fd);
+  close(listen_sock);
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,291 @@
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+the site power budget, split between the sessions that are charging
+
+Every charging session holds a slot with a weight (its connector's priority) and what
+it wants: the power the EV asks for, never more than its EVSE can deliver.  The budget
+is shared out by weighted water-filling: an EV that wants less than its weighted share
+of what is left gets all it wants, and the others split the rest in proportion to their
+weights.  No power is left unallocated while some EV still wants more, which is what
+delivers the most energy through the one feeder.
+
+The slots are kept sorted by want / weight, the order in which water-filling settles
+them.  A change moves only the slot that changed, so an insertion sort restores the
+order in a pass, and one more pass shares the budget out.  This runs (under a mutex
+shared by all workers) only when a session joins, leaves, changes what it wants or draws
+by more than budget_hysteresis_w, or first reports after a cut; every other response
+just loads its slot's grant (or share), so with -t N the workers meet at the lock only on those
+events, not once per CurrentDemandReq.  redux_budget_recomputes_total counts them: if it
+grows as fast as the charge-loop messages, budget_hysteresis_w is too small.
+
+A share that goes down is granted at once.  One that goes up is granted only from power
+that no other slot can still be drawing: a slot counts for the largest of its grant,
+what it was last told to draw and, after a cut, the grant it had before, until it
+reports again.  So the site never commits more than the budget, even in the moment
+power moves from one EV to another; an EV that has been given less than its share is
+topped up as the others report that they have backed off.
+
+All powers are in watts.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifndef BUDGET_SLOTS
+#define BUDGET_SLOTS 256
+#endif
+
+struct budget_slot
+{
+  bool in_use;
+  unsigned rank;              /* position in the sorted order */
+  uint32_t weight;
+  uint32_t want;              /* what the EV asks for, up to what its EVSE can deliver */
+  uint32_t draw;              /* what the power module was last told to deliver */
+  _Atomic uint32_t held;      /* a grant since cut, which may still be drawn until the next report */
+  _Atomic uint32_t share;     /* the water-filling allocation; read without the lock */
+  _Atomic uint32_t grant;     /* what may be drawn now; read without the lock */
+  struct budget_slot *next_free;
+};
+
+struct budget
+{
+  pthread_mutex_t lock;
+  uint32_t site;              /* the feeder limit */
+  uint32_t hysteresis;        /* a change smaller than this (or 1/16 of the old value) is not worth a recompute */
+  unsigned count;
+  _Atomic unsigned waiting;   /* slots granted less than their share */
+  _Atomic unsigned sessions;  /* count, and */
+  _Atomic uint32_t granted;   /* the sum of the grants, for reading without the lock */
+  _Atomic uint64_t recomputes;
+  struct budget_slot *free;
+  struct budget_slot *order[BUDGET_SLOTS]; /* in use, by want / weight */
+  struct budget_slot slot[BUDGET_SLOTS];
+};
+
+static void budget_init(struct budget *b, uint32_t site, uint32_t hysteresis)
+{
+  memset(b, 0, sizeof(*b));
+  pthread_mutex_init(&b->lock, NULL);
+  b->site = site;
+  b->hysteresis = hysteresis;
+  for (int i = BUDGET_SLOTS - 1; i >= 0; i--)
+  {
+    b->slot[i].next_free = b->free;
+    b->free = &b->slot[i];
+  }
+}
+
+/* does x want less per unit of weight than y? */
+
+static bool budget_before(const struct budget_slot *x, const struct budget_slot *y)
+{
+  return (uint64_t)x->want * y->weight < (uint64_t)y->want * x->weight;
+}
+
+/* move a slot whose want has changed to its place in the order */
+
+static void budget_resort(struct budget *b, struct budget_slot *s)
+{
+  unsigned i = s->rank;
+
+  while ((i > 0) && budget_before(s, b->order[i - 1]))
+  {
+    b->order[i] = b->order[i - 1];
+    b->order[i]->rank = i;
+    i--;
+  }
+  while ((i + 1 < b->count) && budget_before(b->order[i + 1], s))
+  {
+    b->order[i] = b->order[i + 1];
+    b->order[i]->rank = i;
+    i++;
+  }
+
+  b->order[i] = s;
+  s->rank = i;
+}
+
+static uint32_t budget_max(uint32_t x, uint32_t y)
+{
+  return (x > y) ? x : y;
+}
+
+/* the most a slot can be drawing, granted power included */
+
+static uint32_t budget_committed(const struct budget_slot *s, uint32_t grant)
+{
+  return budget_max(budget_max(grant, s->draw), atomic_load_explicit(&s->held, memory_order_relaxed));
+}
+
+/* share the budget out again, and grant what can be granted without exceeding it; called with the lock held */
+
+static void budget_recompute(struct budget *b)
+{
+  uint64_t left = b->site, weights = 0;
+  uint64_t committed = 0, granted = 0;
+  unsigned waiting = 0;
+
+  for (unsigned i = 0; i < b->count; i++)
+    weights += b->order[i]->weight;
+
+  /* in want / weight order, each slot's weighted share of what is left is at least the one before's */
+  for (unsigned i = 0; i < b->count; i++)
+  {
+    struct budget_slot *s = b->order[i];
+    uint64_t fair = left * s->weight / weights;
+    uint32_t share = (s->want < fair) ? s->want : (uint32_t)fair;
+    atomic_store_explicit(&s->share, share, memory_order_relaxed);
+    left -= share;
+    weights -= s->weight;
+  }
+
+  /* cuts take effect at once */
+  for (unsigned i = 0; i < b->count; i++)
+  {
+    struct budget_slot *s = b->order[i];
+    uint32_t grant = atomic_load_explicit(&s->grant, memory_order_relaxed);
+    uint32_t share = atomic_load_explicit(&s->share, memory_order_relaxed);
+    if (share < grant)
+    {
+      if (grant > atomic_load_explicit(&s->held, memory_order_relaxed)) atomic_store_explicit(&s->held, grant, memory_order_relaxed);
+      atomic_store_explicit(&s->grant, grant = share, memory_order_relaxed);
+    }
+    committed += budget_committed(s, grant);
+  }
+
+  /* raises only from what nobody can still be drawing, the least served first */
+  for (unsigned i = 0; i < b->count; i++)
+  {
+    struct budget_slot *s = b->order[i];
+    uint32_t grant = atomic_load_explicit(&s->grant, memory_order_relaxed);
+    uint32_t share = atomic_load_explicit(&s->share, memory_order_relaxed);
+
+    if (share > grant)
+    {
+      uint64_t before = budget_committed(s, grant);
+      uint64_t room = (b->site > committed) ? b->site - committed : 0;
+      uint64_t raise = share - grant;
+
+      /* up to what it is drawing already is free */
+      if (raise > room + (before - grant)) raise = room + (before - grant);
+      grant += raise;
+      committed += budget_committed(s, grant) - before;
+      atomic_store_explicit(&s->grant, grant, memory_order_relaxed);
+      if (grant < share) waiting++;
+    }
+
+    granted += grant;
+  }
+
+  atomic_store_explicit(&b->waiting, waiting, memory_order_relaxed);
+  atomic_store_explicit(&b->sessions, b->count, memory_order_relaxed);
+  atomic_store_explicit(&b->granted, (uint32_t)granted, memory_order_relaxed);
+  atomic_fetch_add_explicit(&b->recomputes, 1, memory_order_relaxed);
+}
+
+/* a session starts charging; returns NULL if every slot is taken */
+
+static struct budget_slot *budget_join(struct budget *b, uint32_t weight, uint32_t want)
+{
+  /* an EV that found no slot asks again with every CurrentDemandReq; a full budget is seen without the lock */
+  if (atomic_load_explicit(&b->sessions, memory_order_relaxed) >= BUDGET_SLOTS) return NULL;
+
+  pthread_mutex_lock(&b->lock);
+
+  struct budget_slot *s = b->free;
+  if (s)
+  {
+    b->free = s->next_free;
+    s->in_use = true;
+    s->weight = (weight) ? weight : 1;
+    s->want = want;
+    s->draw = 0;
+    atomic_store_explicit(&s->share, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->held, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->grant, 0, memory_order_relaxed);
+    s->rank = b->count;
+    b->order[b->count++] = s;
+    budget_resort(b, s);
+    budget_recompute(b);
+  }
+
+  pthread_mutex_unlock(&b->lock);
+  return s;
+}
+
+static bool budget_changed(uint32_t now, uint32_t before, uint32_t hysteresis)
+{
+  uint32_t delta = (now > before) ? now - before : before - now;
+  return (delta > hysteresis) && (delta > before / 16);
+}
+
+/* what the session wants, and what its power module has just been told to deliver; only the slot's owner calls this */
+
+static void budget_report(struct budget *b, struct budget_slot *s, uint32_t want, uint32_t draw)
+{
+  /*
+  want and draw are only written by this thread, so they can be compared without the lock.
+  The draw never exceeds the grant, so a small change counts for nothing, not even to a slot
+  that is waiting (it is topped up at the next real change); what must not wait is the first
+  report after a cut, which releases the grant held until then.
+  */
+  if (!budget_changed(want, s->want, b->hysteresis) && !budget_changed(draw, s->draw, b->hysteresis))
+    if (!atomic_load_explicit(&b->waiting, memory_order_relaxed) || !atomic_load_explicit(&s->held, memory_order_relaxed)) return;
+
+  pthread_mutex_lock(&b->lock);
+  s->draw = draw;
+  atomic_store_explicit(&s->held, 0, memory_order_relaxed);
+  if (want != s->want)
+  {
+    s->want = want;
+    budget_resort(b, s);
+  }
+  budget_recompute(b);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* the session has stopped charging: its power goes to the others */
+
+static void budget_leave(struct budget *b, struct budget_slot *s)
+{
+  pthread_mutex_lock(&b->lock);
+
+  b->count--;
+  for (unsigned i = s->rank; i < b->count; i++)
+  {
+    b->order[i] = b->order[i + 1];
+    b->order[i]->rank = i;
+  }
+
+  s->in_use = false;
+  s->next_free = b->free;
+  b->free = s;
+  budget_recompute(b);
+
+  pthread_mutex_unlock(&b->lock);
+}
+
+static uint32_t budget_grant(const struct budget_slot *s)
+{
+  return atomic_load_explicit(&s->grant, memory_order_relaxed);
+}
+
+/* the slot's allocation once the others have backed off, for limits announced ahead of time */
+
+static uint32_t budget_share(const struct budget_slot *s)
+{
+  return atomic_load_explicit(&s->share, memory_order_relaxed);
+}
+
+#endif
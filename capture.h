@@ -0,0 +1,314 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+capture of the V2G traffic, to a pcapng file that is a ring
+
+Every SDP datagram and every V2GTP frame, as reassembled (and, under TLS, decrypted),
+is written into a preallocated, memory-mapped file, in both directions.  The frame is
+copied once, straight from the buffer it was received into or encoded in to its place
+in the file: no system call, no lock and no intermediate buffer, so capturing costs a
+request no more than a memcpy() and never waits on the disk.
+
+The file is valid pcapng at all times, so Wireshark reads it as it is.  After the
+section header and an interface description per interface, it is divided into slots
+of CAPTURE_SLOT bytes, used in turn; once the last has been used the first is
+overwritten, so the file always holds the most recent traffic.  A slot holds one
+enhanced packet block and a custom block that pads it out, which every reader skips;
+a slot never used is nothing but padding.  The enhanced packet block is written last
+and published by storing its type, so a slot caught half-written (by a reader, or by
+a crash) is still padding.  Workers take slots with an atomic add; a writer would only
+collide with another if the whole ring went round while it was copying.
+
+Packets are IPv6 (LINKTYPE_IPV6), with UDP or TCP headers made up around the payload
+so that Wireshark's V2GTP dissector takes them as they are; the TCP sequence numbers
+count the bytes of each direction.  The timestamps are CLOCK_REALTIME in nanoseconds,
+and a frame that belongs to a session has its SessionID in a comment.  A frame that
+does not fit a slot is truncated: its original length is kept, it has a comment
+"truncated" as well, and redux_capture_truncated_total counts it.  replay compares such
+a response only as far as it was captured, and cannot send such a request at all.
+
+replay.c reads the files back.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+
+#define CAPTURE_SLOT 4096
+
+/* pcapng */
+#define PCAPNG_SHB 0x0a0d0d0au
+#define PCAPNG_IDB 0x00000001u
+#define PCAPNG_EPB 0x00000006u
+#define PCAPNG_CUSTOM 0x40000badu  /* a custom block that is not to be copied */
+#define PCAPNG_BOM 0x1a2b3c4du
+#define PCAPNG_PEN 32473u          /* the example enterprise number (RFC 5612); the padding means nothing */
+#define LINKTYPE_IPV6 229
+
+#define OPT_ENDOFOPT 0
+#define OPT_COMMENT 1
+#define OPT_IF_NAME 2
+#define OPT_IF_TSRESOL 9
+#define OPT_EPB_FLAGS 2
+
+/* EPB flags: the direction */
+#define CAPTURE_IN 1               /* from the EV */
+#define CAPTURE_OUT 2              /* to the EV */
+
+/* made-up network headers in front of every payload */
+#define CAPTURE_NET_UDP (40 + 8)
+#define CAPTURE_NET_TCP (40 + 20)
+
+/* the enhanced packet block around a packet: its fields, a flags option, comment options with the SessionID and a truncation mark, end of options, total length */
+#define CAPTURE_EPB_FIXED 28
+#define CAPTURE_COMMENT_LEN 24     /* "session 0123456789abcdef" */
+#define CAPTURE_TRUNCATED "truncated"
+#define CAPTURE_TRUNCATED_LEN 9
+#define CAPTURE_EPB_OPTIONS (8 + 4 + CAPTURE_COMMENT_LEN + 4 + 12 + 4)
+#define CAPTURE_PAD_MIN 16         /* the smallest custom block */
+#define CAPTURE_MAX_PACKET (CAPTURE_SLOT - CAPTURE_EPB_FIXED - CAPTURE_EPB_OPTIONS - 4 - CAPTURE_PAD_MIN)
+
+/* one direction of a conversation, as the made-up headers show it */
+
+struct capture_flow
+{
+  struct in6_addr ev_addr, secc_addr;
+  uint16_t ev_port, secc_port;
+  uint8_t proto;                   /* IPPROTO_UDP or IPPROTO_TCP */
+  uint32_t seq[2];                 /* TCP: the next sequence number from the EV, and to it */
+};
+
+static struct
+{
+  uint8_t *map;                    /* NULL while not capturing */
+  size_t size;
+  size_t first;                    /* offset of the first slot */
+  uint64_t slots;
+  _Atomic uint64_t next;           /* the next slot to take, modulo slots */
+  _Atomic uint64_t frames;
+  _Atomic uint64_t truncated;
+  int fd;
+} capture = { .fd = -1 };
+
+static uint32_t capture_pad4(uint32_t n)
+{
+  return (n + 3) & ~3u;
+}
+
+static uint8_t *capture_put32(uint8_t *p, uint32_t v)
+{
+  memcpy(p, &v, 4);
+  return p + 4;
+}
+
+static uint8_t *capture_option(uint8_t *p, uint16_t code, const void *value, uint16_t len)
+{
+  memcpy(p, &code, 2);
+  memcpy(p + 2, &len, 2);
+  if (len) memcpy(p + 4, value, len);
+  memset(p + 4 + len, 0, capture_pad4(len) - len);
+  return p + 4 + capture_pad4(len);
+}
+
+/* fill a region with one custom block */
+
+static void capture_pad(uint8_t *p, uint32_t len)
+{
+  capture_put32(p, PCAPNG_CUSTOM);
+  capture_put32(p + 4, len);
+  capture_put32(p + 8, PCAPNG_PEN);
+  capture_put32(p + len - 4, len);
+}
+
+/* the network headers in front of a payload of len bytes */
+
+static uint8_t *capture_headers(uint8_t *p, struct capture_flow *flow, int dir, uint32_t len)
+{
+  bool in = (CAPTURE_IN == dir);
+  uint32_t l4 = (IPPROTO_TCP == flow->proto) ? 20 : 8;
+
+  /* IPv6 */
+  p[0] = 0x60;
+  p[1] = p[2] = p[3] = 0;
+  uint16_t plen = htons(l4 + len);
+  memcpy(p + 4, &plen, 2);
+  p[6] = flow->proto;
+  p[7] = 255;                      /* link-local traffic */
+  memcpy(p + 8, (in) ? &flow->ev_addr : &flow->secc_addr, 16);
+  memcpy(p + 24, (in) ? &flow->secc_addr : &flow->ev_addr, 16);
+  p += 40;
+
+  uint16_t sport = htons((in) ? flow->ev_port : flow->secc_port);
+  uint16_t dport = htons((in) ? flow->secc_port : flow->ev_port);
+  memcpy(p, &sport, 2);
+  memcpy(p + 2, &dport, 2);
+
+  if (IPPROTO_UDP == flow->proto)
+  {
+    uint16_t ulen = htons(8 + len);
+    memcpy(p + 4, &ulen, 2);
+    p[6] = p[7] = 0;               /* no checksum */
+    return p + 8;
+  }
+
+  uint32_t seq = htonl(flow->seq[!in]), ack = htonl(flow->seq[in]);
+  memcpy(p + 4, &seq, 4);
+  memcpy(p + 8, &ack, 4);
+  p[12] = 5 << 4;                  /* no options */
+  p[13] = 0x18;                    /* PSH, ACK */
+  p[14] = p[15] = 0xff;
+  p[16] = p[17] = p[18] = p[19] = 0;
+  flow->seq[!in] += len;
+  return p + 20;
+}
+
+static int64_t capture_realtime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/* record a payload sent or received on interface ifc (its index among redux's) with session, if it has one */
+
+static void capture_frame(unsigned ifc, int dir, struct capture_flow *flow, const uint8_t *session, const void *data, uint32_t len)
+{
+  if (!capture.map) return;
+
+  uint64_t slot = atomic_fetch_add_explicit(&capture.next, 1, memory_order_relaxed) % capture.slots;
+  uint8_t *s = capture.map + capture.first + slot * CAPTURE_SLOT;
+  uint32_t net = (IPPROTO_TCP == flow->proto) ? CAPTURE_NET_TCP : CAPTURE_NET_UDP;
+  uint32_t caplen = net + len;
+
+  if (caplen > CAPTURE_MAX_PACKET)
+  {
+    caplen = CAPTURE_MAX_PACKET;
+    atomic_fetch_add_explicit(&capture.truncated, 1, memory_order_relaxed);
+  }
+
+  /* while it is being written, the slot is one block of padding */
+  capture_pad(s, CAPTURE_SLOT);
+
+  int64_t ns = capture_realtime();
+  uint8_t *p = capture_put32(s + 8, ifc);
+  p = capture_put32(p, (uint32_t)((uint64_t)ns >> 32));
+  p = capture_put32(p, (uint32_t)ns);
+  p = capture_put32(p, caplen);
+  p = capture_put32(p, net + len);
+  p = capture_headers(p, flow, dir, len);
+  memcpy(p, data, caplen - net);
+  p += caplen - net;
+  memset(p, 0, capture_pad4(caplen) - caplen);
+  p += capture_pad4(caplen) - caplen;
+
+  uint32_t flags = dir;
+  p = capture_option(p, OPT_EPB_FLAGS, &flags, sizeof(flags));
+  if (session)
+  {
+    char comment[CAPTURE_COMMENT_LEN + 1];
+    snprintf(comment, sizeof(comment), "session %02x%02x%02x%02x%02x%02x%02x%02x", session[0], session[1], session[2], session[3], session[4], session[5], session[6], session[7]);
+    p = capture_option(p, OPT_COMMENT, comment, CAPTURE_COMMENT_LEN);
+  }
+  if (caplen < net + len) p = capture_option(p, OPT_COMMENT, CAPTURE_TRUNCATED, CAPTURE_TRUNCATED_LEN);
+  p = capture_option(p, OPT_ENDOFOPT, NULL, 0);
+
+  uint32_t epb = (uint32_t)(p - s) + 4;
+  capture_put32(p, epb);
+  capture_pad(s + epb, CAPTURE_SLOT - epb);
+
+  /* publish: the length first, then the type */
+  capture_put32(s + 4, epb);
+  atomic_store_explicit((_Atomic uint32_t *)s, PCAPNG_EPB, memory_order_release);
+  atomic_fetch_add_explicit(&capture.frames, 1, memory_order_relaxed);
+}
+
+/* create the file, size bytes, with an interface description per name; returns false if there is no capture */
+
+static bool capture_open(const char *path, size_t size, const char *const *ifnames, unsigned ifcount)
+{
+  capture.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (capture.fd < 0) return false;
+
+  size = size / CAPTURE_SLOT * CAPTURE_SLOT;
+  if ((size < 2 * CAPTURE_SLOT) || posix_fallocate(capture.fd, 0, size)) goto fail;
+
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, capture.fd, 0);
+  if (MAP_FAILED == map) goto fail;
+
+  /* the section header */
+  uint8_t *p = capture_put32(map, PCAPNG_SHB);
+  p = capture_put32(p, 28);
+  p = capture_put32(p, PCAPNG_BOM);
+  p = capture_put32(p, 1);         /* version 1.0 */
+  p = capture_put32(p, 0xffffffffu); /* section length not given */
+  p = capture_put32(p, 0xffffffffu);
+  p = capture_put32(p, 28);
+
+  /* an interface description per interface, nanosecond timestamps */
+  for (unsigned i = 0; i < ifcount; i++)
+  {
+    uint8_t *b = p;
+    const uint8_t tsresol = 9;
+
+    p = capture_put32(p + 8, LINKTYPE_IPV6);
+    p = capture_put32(p, 0);       /* no snap length */
+    p = capture_option(p, OPT_IF_NAME, ifnames[i], strlen(ifnames[i]));
+    p = capture_option(p, OPT_IF_TSRESOL, &tsresol, 1);
+    p = capture_option(p, OPT_ENDOFOPT, NULL, 0);
+
+    uint32_t len = (uint32_t)(p - b) + 4;
+    capture_put32(b, PCAPNG_IDB);
+    capture_put32(b + 4, len);
+    p = capture_put32(p, len);
+  }
+
+  /* the rest of the first slot, and every slot, starts out as padding */
+  capture.first = CAPTURE_SLOT;
+  if ((size_t)(p - map) + CAPTURE_PAD_MIN > capture.first) goto fail_unmap;
+  capture_pad(p, capture.first - (uint32_t)(p - map));
+  for (size_t off = capture.first; off < size; off += CAPTURE_SLOT)
+    capture_pad(map + off, CAPTURE_SLOT);
+
+  capture.size = size;
+  capture.slots = (size - capture.first) / CAPTURE_SLOT;
+  atomic_store(&capture.next, 0);
+  capture.map = map;
+  return true;
+
+fail_unmap:
+  munmap(map, size);
+fail:
+  close(capture.fd);
+  capture.fd = -1;
+  return false;
+}
+
+/* the workers must have stopped capturing */
+
+static void capture_close(void)
+{
+  if (!capture.map) return;
+
+  uint8_t *map = capture.map;
+  capture.map = NULL;
+  msync(map, capture.size, MS_SYNC);
+  munmap(map, capture.size);
+  close(capture.fd);
+  capture.fd = -1;
+}
+
+#endif
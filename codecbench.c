@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+codec benchmark: cost per charging-loop message of the generic iso1 path used by redux
+(zero two documents, decode, search the body, encode) versus the compact codec in fastpath.h,
+and of a request the fast path decodes and then hands to the generic path (a wrong
+SessionID or a sequence error), which pays for both decodes
+
+usage: codecbench [iterations]
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "parameters.h"
+#include "fastpath.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+static struct fastpath fastpath;
+static struct iso1EXIDocument exiIn, exiOut;
+
+static const uint8_t bench_sid[SESSION_ID_LEN] = { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0 };
+
+static size_t build_request(enum v2g_msg msg, uint8_t *frame, size_t size)
+{
+  bitstream_t stream;
+  size_t pos = V2GTP_HEADER_LENGTH;
+  const struct iso1PhysicalValueType volts = { .Multiplier = 0, .Unit = iso1unitSymbolType_V, .Value = 400 };
+  const struct iso1PhysicalValueType amps = { .Multiplier = 0, .Unit = iso1unitSymbolType_A, .Value = 125 };
+
+  memset(&exiOut, 0, sizeof(exiOut));
+  exiOut.V2G_Message_isUsed = 1u;
+  exiOut.V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+  memcpy(exiOut.V2G_Message.Header.SessionID.bytes, bench_sid, SESSION_ID_LEN);
+
+  if (MSG_CURRENT_DEMAND == msg)
+  {
+    exiOut.V2G_Message.Body.CurrentDemandReq_isUsed = 1u;
+    struct iso1CurrentDemandReqType *body = &exiOut.V2G_Message.Body.CurrentDemandReq;
+    body->DC_EVStatus.EVReady = 1;
+    body->DC_EVStatus.EVRESSSOC = 42;
+    body->EVTargetVoltage = volts;
+    body->EVTargetCurrent = amps;
+  }
+  else
+  {
+    exiOut.V2G_Message.Body.PreChargeReq_isUsed = 1u;
+    struct iso1PreChargeReqType *body = &exiOut.V2G_Message.Body.PreChargeReq;
+    body->DC_EVStatus.EVReady = 1;
+    body->DC_EVStatus.EVRESSSOC = 42;
+    body->EVTargetVoltage = volts;
+    body->EVTargetCurrent = amps;
+  }
+
+  stream.size = size;
+  stream.data = frame;
+  stream.pos = &pos;
+  if (encode_iso1ExiDocument(&stream, &exiOut)) return 0;
+  write_v2gtpHeader(frame, pos - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE);
+  return pos;
+}
+
+/* the generic path from a decoded request onwards: zero the response, search the body, encode */
+
+static size_t generic_reply(const struct iso1EXIDocument *in, uint8_t *out, size_t outsize)
+{
+  bitstream_t streamOut;
+  size_t poso = V2GTP_HEADER_LENGTH;
+
+  streamOut.size = outsize;
+  streamOut.data = out;
+  streamOut.pos = &poso;
+
+  memset(&exiOut, 0, sizeof(exiOut));
+  exiOut.V2G_Message_isUsed = 1u;
+  exiOut.V2G_Message.Header.SessionID = in->V2G_Message.Header.SessionID;
+
+  if (in->V2G_Message.Body.CurrentDemandReq_isUsed)
+  {
+    exiOut.V2G_Message.Body.CurrentDemandRes_isUsed = 1u;
+    struct iso1CurrentDemandResType *body = &exiOut.V2G_Message.Body.CurrentDemandRes;
+    body->ResponseCode = iso1responseCodeType_OK;
+    body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+    body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+    body->DC_EVSEStatus.EVSEStatusCode = iso1DC_EVSEStatusCodeType_EVSE_Ready;
+    body->EVSEPresentVoltage = in->V2G_Message.Body.CurrentDemandReq.EVTargetVoltage;
+    body->EVSEPresentCurrent = in->V2G_Message.Body.CurrentDemandReq.EVTargetCurrent;
+  }
+  else if (in->V2G_Message.Body.PreChargeReq_isUsed)
+  {
+    exiOut.V2G_Message.Body.PreChargeRes_isUsed = 1u;
+    struct iso1PreChargeResType *body = &exiOut.V2G_Message.Body.PreChargeRes;
+    body->ResponseCode = iso1responseCodeType_OK;
+    body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+    body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+    body->EVSEPresentVoltage = in->V2G_Message.Body.PreChargeReq.EVTargetVoltage;
+  }
+  else
+  {
+    return 0;
+  }
+
+  if (encode_iso1ExiDocument(&streamOut, &exiOut)) return 0;
+  write_v2gtpHeader(out, poso - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE);
+  return poso;
+}
+
+/* what redux does for every message without the fast path */
+
+static size_t generic_path(const uint8_t *frame, size_t len, uint8_t *out, size_t outsize)
+{
+  bitstream_t streamIn;
+  size_t posi = V2GTP_HEADER_LENGTH;
+
+  streamIn.size = len;
+  streamIn.data = (uint8_t *)frame;
+  streamIn.pos = &posi;
+
+  memset(&exiIn, 0, sizeof(exiIn));
+  if (decode_iso1ExiDocument(&streamIn, &exiIn)) return 0;
+  return generic_reply(&exiIn, out, outsize);
+}
+
+/* a request the fast path decodes and then turns down (as redux does for a wrong SessionID): the generic path starts over */
+
+static size_t fallback_path(const uint8_t *frame, size_t len, uint8_t *out, size_t outsize)
+{
+  struct charge_loop_req req;
+  const uint8_t *exi = frame + V2GTP_HEADER_LENGTH;
+
+  enum v2g_msg msg = fastpath_peek(&fastpath, exi, len - V2GTP_HEADER_LENGTH);
+  if (MSG_NONE == msg) return 0;
+  if (!fastpath_decode(&fastpath, msg, exi, len - V2GTP_HEADER_LENGTH, &req)) return 0;
+  return generic_path(frame, len, out, outsize);
+}
+
+static size_t fast_path(const uint8_t *frame, size_t len, uint8_t *out, size_t outsize)
+{
+  struct charge_loop_req req;
+  struct charge_loop_res res;
+  const uint8_t *exi = frame + V2GTP_HEADER_LENGTH;
+
+  enum v2g_msg msg = fastpath_peek(&fastpath, exi, len - V2GTP_HEADER_LENGTH);
+  if (MSG_NONE == msg) return 0;
+  if (!fastpath_decode(&fastpath, msg, exi, len - V2GTP_HEADER_LENGTH, &req)) return 0;
+
+  res.ResponseCode = iso1responseCodeType_OK;
+  res.EVSEPresentVoltage = req.EVTargetVoltage;
+  res.EVSEPresentCurrent = req.EVTargetCurrent;
+  return fastpath_encode(&fastpath, &req, &res, out, outsize);
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef size_t (*bench_fn)(const uint8_t *frame, size_t len, uint8_t *out, size_t outsize);
+
+static double run(const char *label, bench_fn fn, const uint8_t *frame, size_t len, long iterations)
+{
+  uint8_t out[1024];
+  size_t outlen = 0;
+
+  /* warm up caches and branch predictors before timing */
+  for (long i = 0; i < iterations / 10; i++)
+    outlen = fn(frame, len, out, sizeof(out));
+
+  if (!outlen)
+  {
+    printf("%-28s FAILED\n", label);
+    return 0;
+  }
+
+  uint64_t start = now_ns();
+#ifdef HAVE_TSC
+  uint64_t tsc = __rdtsc();
+#endif
+  for (long i = 0; i < iterations; i++)
+    fn(frame, len, out, sizeof(out));
+#ifdef HAVE_TSC
+  tsc = __rdtsc() - tsc;
+#endif
+  double ns = (double)(now_ns() - start) / iterations;
+
+#ifdef HAVE_TSC
+  printf("%-28s %9.1f ns/msg %9.0f cycles/msg  (%zu byte reply)\n", label, ns, (double)tsc / iterations, outlen);
+#else
+  printf("%-28s %9.1f ns/msg  (%zu byte reply)\n", label, ns, outlen);
+#endif
+  return ns;
+}
+
+int main(int argc, char *argv[])
+{
+  long iterations = (argc > 1) ? atol(argv[1]) : 200000;
+  static const enum v2g_msg msgs[] = { MSG_CURRENT_DEMAND, MSG_PRE_CHARGE };
+
+  /* the self-test checks the compact codec against OpenV2G and turns off any message it gets wrong */
+  if (!fastpath_init(&fastpath))
+    printf("fast path: self-test against OpenV2G failed for some messages\n");
+
+  printf("sizeof(struct iso1EXIDocument) = %zu bytes\n", sizeof(struct iso1EXIDocument));
+
+  for (unsigned i = 0; i < ARRAY_SIZE(msgs); i++)
+  {
+    uint8_t frame[512];
+    char label[64];
+    size_t len = build_request(msgs[i], frame, sizeof(frame));
+
+    if (!len)
+    {
+      fprintf(stderr, "ERROR: could not encode %sReq\n", msg_names[msgs[i]]);
+      return -1;
+    }
+
+    if (MSG_NONE == fastpath_peek(&fastpath, frame + V2GTP_HEADER_LENGTH, len - V2GTP_HEADER_LENGTH))
+      printf("%sReq: not recognised by the fast path (self-test failed?)\n", msg_names[msgs[i]]);
+
+    /* both paths must put the same bytes on the wire */
+    uint8_t generic_out[1024], fast_out[1024];
+    size_t generic_len = generic_path(frame, len, generic_out, sizeof(generic_out));
+    size_t fast_len = fast_path(frame, len, fast_out, sizeof(fast_out));
+    if (fast_len && ((fast_len != generic_len) || memcmp(generic_out, fast_out, fast_len)))
+      printf("%sRes: fast path reply differs from the generic one\n", msg_names[msgs[i]]);
+
+    snprintf(label, sizeof(label), "%sReq generic", msg_names[msgs[i]]);
+    double generic = run(label, generic_path, frame, len, iterations);
+    snprintf(label, sizeof(label), "%sReq fast", msg_names[msgs[i]]);
+    double fast = run(label, fast_path, frame, len, iterations);
+    snprintf(label, sizeof(label), "%sReq fallback", msg_names[msgs[i]]);
+    double fallback = run(label, fallback_path, frame, len, iterations);
+
+    if (generic > 0 && fast > 0)
+      printf("%-28s %9.2fx\n", "speedup", generic / fast);
+    if (generic > 0 && fallback > 0)
+      printf("%-28s %9.2fx\n", "fallback/generic", fallback / generic);
+  }
+
+  return 0;
+}
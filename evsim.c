@@ -0,0 +1,934 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+EV simulator and end-to-end benchmark for redux
+
+Finds the SECC with SDP, then has up to -c simulated EVs each run complete ISO 15118-2
+DC charging sessions (supportedAppProtocol, SessionSetup ... CableCheck, PreCharge,
+PowerDelivery, N x CurrentDemand, PowerDelivery, WeldingDetection, SessionStop) over
+their own TCP connections.  Request-to-response latency is recorded per message type
+and reported as p50/p99/max, along with completed sessions per second.
+
+Like a real EV, each one asks for no more current than the EVSEMaximumCurrentLimit of
+the last CurrentDemandRes, so the SECC's share of its site power budget can be watched
+moving between EVs as they start and stop.
+
+An AuthorizationRes with EVSEProcessing=Ongoing is answered, like a real EV would, by
+repeating the request after a pause (ONGOING_RETRY_NS); the report counts how often.
+
+With -R, the number of concurrent EVs starts at one and doubles every -R seconds until
+it reaches -c, with a report per step; this shows where latency starts to climb.
+
+usage: evsim [-i ifname] [-a address] [-c EVs] [-s sessions] [-n CurrentDemandReq per session] [-R seconds per step] [-w corpus] [-T] [-X]
+
+-w writes every frame of the first session, in both directions, to a corpus file for exibench
+
+-a sends the SDP request to (and connects to) the given address instead of relying on
+multicast and the address in the SDP response; e.g. -a ::1 when redux runs on loopback
+
+-T asks for TLS in SDP.  Each EV keeps the TLS session of its last charging session and
+offers it when it next connects, as a real EV returning to the charger would, so the
+report shows the resumption hit rate and the latency of full and resumed handshakes.
+The handshake runs to completion before the EV's first request (the SECC certificate
+is not verified).
+
+-X first checks that requests the SECC must refuse (out of sequence, or naming an unknown
+session) are refused without switching the output on or joining the site power budget
+(see probe_run()); the exit status is non-zero if any was not.  It needs a plain connection, so it does not go with -T.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include "parameters.h"
+#include "session.h"
+#include "v2gtp_stream.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+#define MAX_EVS MAX_CONNECTIONS
+
+/* an EV that waits this long for a response gives up on the session */
+#define RESPONSE_TIMEOUT_NS 2000000000ull
+
+/* and waits this long before asking again after EVSEProcessing=Ongoing */
+#define ONGOING_RETRY_NS 20000000ull
+
+/* SDP security byte */
+#define SDP_TLS 0x00
+#define SDP_NO_TLS 0x10
+
+static uint8_t sdp_request[] =
+{
+  0x01, /* V2GTP Version 1 */
+  0xfe, /* inverted protocol */
+  0x90, 0x00, /* SDP REQUEST */
+  0x00, 0x00, 0x00, 0x02, /* payload length */
+  SDP_NO_TLS, /* TLS: no (SDP_TLS with -T) */
+  0x00, /* TCP protocol */
+};
+
+/* the charging session every EV runs; MSG_NONE stands for supportedAppProtocolReq */
+
+static const enum v2g_msg script[] =
+{
+  MSG_NONE,
+  MSG_SESSION_SETUP,
+  MSG_SERVICE_DISCOVERY,
+  MSG_PAYMENT_SERVICE_SELECTION,
+  MSG_AUTHORIZATION,
+  MSG_CHARGE_PARAMETER_DISCOVERY,
+  MSG_CABLE_CHECK,
+  MSG_PRE_CHARGE,
+  MSG_POWER_DELIVERY,
+  MSG_CURRENT_DEMAND,
+  MSG_POWER_DELIVERY,
+  MSG_WELDING_DETECTION,
+  MSG_SESSION_STOP,
+};
+
+struct ev
+{
+  int sock;                 /* -1 while idle */
+  unsigned step;            /* index into script[] of the request awaiting a response */
+  unsigned loops;           /* CurrentDemandReq answered so far this session */
+  uint8_t sid[SESSION_ID_LEN];
+  uint64_t sent_ns;
+  uint64_t retry_ns;        /* when to repeat a request answered Ongoing, 0 if none */
+  bool limited;             /* current_limit holds the one from the last CurrentDemandRes */
+  struct iso1PhysicalValueType current_limit;
+  SSL *ssl;                 /* NULL without TLS */
+  SSL_SESSION *tls_session; /* from the last session, to resume */
+  struct v2gtp_rx rx;
+};
+
+/* latency samples in nanoseconds, one set per message type */
+
+struct samples
+{
+  uint32_t *v;
+  size_t n, cap;
+};
+
+static struct ev evs[MAX_EVS];
+static struct samples latency[MSG_COUNT];
+static struct samples handshakes[2];       /* TLS handshakes, full and resumed */
+static struct iso1EXIDocument exiIn, exiOut;
+
+static struct sockaddr_in6 secc_addr;
+static unsigned current_demand_loops = 100;
+static unsigned long sessions_started, sessions_done, sessions_failed, ongoing;
+static FILE *corpus;
+static SSL_CTX *tls_ctx;  /* when the SECC agreed to TLS */
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const char *msg_label(enum v2g_msg msg)
+{
+  return (MSG_NONE == msg) ? "SupportedAppProtocol" : msg_names[msg];
+}
+
+static void samples_add(struct samples *s, uint64_t ns)
+{
+  if (s->n == s->cap)
+  {
+    size_t cap = (s->cap) ? 2 * s->cap : 4096;
+    uint32_t *v = realloc(s->v, cap * sizeof(*v));
+    if (!v) return;
+    s->v = v;
+    s->cap = cap;
+  }
+  s->v[s->n++] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile_us(const struct samples *s, unsigned pct)
+{
+  size_t i = (s->n * pct) / 100;
+  if (i >= s->n) i = s->n - 1;
+  return s->v[i] / 1000.0;
+}
+
+static void report(double seconds, unsigned concurrency)
+{
+  printf("%u EVs, %lu sessions in %.2f s: %.1f sessions/s, %lu failed\n", concurrency, sessions_done, seconds, sessions_done / seconds, sessions_failed);
+  printf("%-26s %9s %10s %10s %10s\n", "message", "count", "p50 us", "p99 us", "max us");
+
+  /* report in the order the messages occur in a session */
+  for (unsigned i = 0; i < ARRAY_SIZE(script); i++)
+  {
+    enum v2g_msg msg = script[i];
+    struct samples *s = &latency[msg];
+
+    /* PowerDelivery appears twice in the script */
+    bool seen = false;
+    for (unsigned j = 0; j < i; j++)
+      if (script[j] == msg) seen = true;
+    if (seen || !s->n) continue;
+
+    qsort(s->v, s->n, sizeof(*s->v), cmp_u32);
+    printf("%-26s %9zu %10.1f %10.1f %10.1f\n", msg_label(msg), s->n, percentile_us(s, 50), percentile_us(s, 99), s->v[s->n - 1] / 1000.0);
+  }
+
+  if (ongoing) printf("AuthorizationRes Ongoing: %lu\n", ongoing);
+
+  if (!tls_ctx) return;
+
+  for (int resumed = 0; resumed < 2; resumed++)
+  {
+    struct samples *s = &handshakes[resumed];
+    if (!s->n) continue;
+
+    qsort(s->v, s->n, sizeof(*s->v), cmp_u32);
+    printf("%-26s %9zu %10.1f %10.1f %10.1f\n", (resumed) ? "TLS handshake (resumed)" : "TLS handshake (full)", s->n, percentile_us(s, 50), percentile_us(s, 99), s->v[s->n - 1] / 1000.0);
+  }
+
+  size_t total = handshakes[0].n + handshakes[1].n;
+  if (total) printf("TLS resumption: %zu of %zu handshakes (%.1f%%)\n", handshakes[1].n, total, 100.0 * handshakes[1].n / total);
+}
+
+static void stats_reset(void)
+{
+  for (int i = 0; i < MSG_COUNT; i++)
+    latency[i].n = 0;
+  handshakes[0].n = handshakes[1].n = 0;
+  sessions_done = sessions_failed = ongoing = 0;
+}
+
+/* SDP: ask for the SECC's address and port; returns false if nothing answered */
+
+static bool sdp_discover(const char *ifname, const char *address)
+{
+  uint8_t buffer[64];
+  struct sockaddr_in6 dst;
+
+  int sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) return false;
+
+  memset(&dst, 0, sizeof(dst));
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(15118);
+  dst.sin6_scope_id = if_nametoindex(ifname);
+  inet_pton(AF_INET6, (address) ? address : "ff02::1", &dst.sin6_addr);
+
+  if (!address)
+  {
+    unsigned ifindex = dst.sin6_scope_id;
+    setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+  }
+
+  /* like a real EVCC, retry a few times before giving up */
+  for (int attempt = 0; attempt < 3; attempt++)
+  {
+    sendto(sock, sdp_request, sizeof(sdp_request), 0, (struct sockaddr *)&dst, sizeof(dst));
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    if (poll(&pfd, 1, 250) <= 0) continue;
+
+    ssize_t len = recv(sock, buffer, sizeof(buffer), 0);
+    if ((len != 28) || (0x01 != buffer[0]) || (0xfe != buffer[1]) || (0x90 != buffer[2]) || (0x01 != buffer[3])) continue;
+
+    /* the SECC may not offer TLS; the EV then goes on without it */
+    if (sdp_request[8] != buffer[26])
+    {
+      printf("SECC does not offer TLS\n");
+      SSL_CTX_free(tls_ctx);
+      tls_ctx = NULL;
+    }
+
+    memset(&secc_addr, 0, sizeof(secc_addr));
+    secc_addr.sin6_family = AF_INET6;
+    secc_addr.sin6_scope_id = dst.sin6_scope_id;
+    secc_addr.sin6_port = htons(((uint16_t)buffer[24] << 8) | buffer[25]);
+    if (address)
+      secc_addr.sin6_addr = dst.sin6_addr;
+    else
+      memcpy(&secc_addr.sin6_addr, buffer + 8, sizeof(secc_addr.sin6_addr));
+
+    close(sock);
+    return true;
+  }
+
+  close(sock);
+  return false;
+}
+
+static size_t build_handshake(uint8_t *frame, size_t size)
+{
+  static struct appHandEXIDocument doc;
+  bitstream_t stream;
+  size_t pos = V2GTP_HEADER_LENGTH;
+
+  init_appHandEXIDocument(&doc);
+  doc.supportedAppProtocolReq_isUsed = 1u;
+  doc.supportedAppProtocolReq.AppProtocol.arrayLen = 1;
+
+  struct appHandAppProtocolType *offer = &doc.supportedAppProtocolReq.AppProtocol.array[0];
+  offer->ProtocolNamespace.charactersLen = ARRAY_SIZE(iso1string) - 1;
+  for (unsigned i = 0; i < ARRAY_SIZE(iso1string) - 1; i++)
+    offer->ProtocolNamespace.characters[i] = iso1string[i];
+  offer->VersionNumberMajor = 2;
+  offer->VersionNumberMinor = 0;
+  offer->SchemaID = 1;
+  offer->Priority = 1;
+
+  stream.size = size;
+  stream.data = frame;
+  stream.pos = &pos;
+  if (encode_appHandExiDocument(&stream, &doc)) return 0;
+  if (write_v2gtpHeader(frame, pos - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE)) return 0;
+  return pos;
+}
+
+static void ev_status(struct iso1DC_EVStatusType *status)
+{
+  status->EVReady = 1;
+  status->EVErrorCode = iso1DC_EVErrorCodeType_NO_ERROR;
+  status->EVRESSSOC = 42;
+}
+
+static double physical(const struct iso1PhysicalValueType *v)
+{
+  double value = v->Value;
+  for (int m = v->Multiplier; m > 0; m--) value *= 10;
+  for (int m = v->Multiplier; m < 0; m++) value /= 10;
+  return value;
+}
+
+static size_t build_message(const struct ev *ev, enum v2g_msg msg, uint8_t *frame, size_t size)
+{
+  const struct iso1PhysicalValueType volts = { .Multiplier = 0, .Unit = iso1unitSymbolType_V, .Value = 400 };
+  const struct iso1PhysicalValueType amps = { .Multiplier = 0, .Unit = iso1unitSymbolType_A, .Value = 125 };
+  const struct iso1PhysicalValueType watts = { .Multiplier = 3, .Unit = iso1unitSymbolType_W, .Value = 50 };
+  struct iso1BodyType *body = &exiOut.V2G_Message.Body;
+  bitstream_t stream;
+  size_t pos = V2GTP_HEADER_LENGTH;
+
+  if (MSG_NONE == msg) return build_handshake(frame, size);
+
+  memset(&exiOut, 0, sizeof(exiOut));
+  exiOut.V2G_Message_isUsed = 1u;
+  exiOut.V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+  memcpy(exiOut.V2G_Message.Header.SessionID.bytes, ev->sid, SESSION_ID_LEN);
+
+  switch (msg)
+  {
+  case MSG_SESSION_SETUP:
+    body->SessionSetupReq_isUsed = 1u;
+    body->SessionSetupReq.EVCCID.bytesLen = 6;
+    memcpy(body->SessionSetupReq.EVCCID.bytes, "\x02\x00\x00\x00\x00\x00", 6);
+    body->SessionSetupReq.EVCCID.bytes[5] = (uint8_t)(ev - evs);
+    break;
+  case MSG_SERVICE_DISCOVERY:
+    body->ServiceDiscoveryReq_isUsed = 1u;
+    break;
+  case MSG_PAYMENT_SERVICE_SELECTION:
+    body->PaymentServiceSelectionReq_isUsed = 1u;
+    body->PaymentServiceSelectionReq.SelectedPaymentOption = iso1paymentOptionType_ExternalPayment;
+    break;
+  case MSG_AUTHORIZATION:
+    body->AuthorizationReq_isUsed = 1u;
+    break;
+  case MSG_CHARGE_PARAMETER_DISCOVERY:
+    body->ChargeParameterDiscoveryReq_isUsed = 1u;
+    body->ChargeParameterDiscoveryReq.RequestedEnergyTransferMode = dcmode;
+    body->ChargeParameterDiscoveryReq.DC_EVChargeParameter_isUsed = 1u;
+    ev_status(&body->ChargeParameterDiscoveryReq.DC_EVChargeParameter.DC_EVStatus);
+    body->ChargeParameterDiscoveryReq.DC_EVChargeParameter.EVMaximumCurrentLimit = amps;
+    body->ChargeParameterDiscoveryReq.DC_EVChargeParameter.EVMaximumVoltageLimit = volts;
+    body->ChargeParameterDiscoveryReq.DC_EVChargeParameter.EVMaximumPowerLimit = watts;
+    body->ChargeParameterDiscoveryReq.DC_EVChargeParameter.EVMaximumPowerLimit_isUsed = 1u;
+    break;
+  case MSG_CABLE_CHECK:
+    body->CableCheckReq_isUsed = 1u;
+    ev_status(&body->CableCheckReq.DC_EVStatus);
+    break;
+  case MSG_PRE_CHARGE:
+    body->PreChargeReq_isUsed = 1u;
+    ev_status(&body->PreChargeReq.DC_EVStatus);
+    body->PreChargeReq.EVTargetVoltage = volts;
+    body->PreChargeReq.EVTargetCurrent = amps;
+    break;
+  case MSG_POWER_DELIVERY:
+    body->PowerDeliveryReq_isUsed = 1u;
+    body->PowerDeliveryReq.ChargeProgress = (MSG_CURRENT_DEMAND == script[ev->step - 1]) ? iso1chargeProgressType_Stop : iso1chargeProgressType_Start;
+    body->PowerDeliveryReq.SAScheduleTupleID = 1;
+    break;
+  case MSG_CURRENT_DEMAND:
+    body->CurrentDemandReq_isUsed = 1u;
+    ev_status(&body->CurrentDemandReq.DC_EVStatus);
+    body->CurrentDemandReq.EVTargetVoltage = volts;
+    body->CurrentDemandReq.EVTargetCurrent = (ev->limited && (physical(&ev->current_limit) < physical(&amps))) ? ev->current_limit : amps;
+    body->CurrentDemandReq.ChargingComplete = (ev->loops + 1 == current_demand_loops);
+    break;
+  case MSG_WELDING_DETECTION:
+    body->WeldingDetectionReq_isUsed = 1u;
+    ev_status(&body->WeldingDetectionReq.DC_EVStatus);
+    break;
+  case MSG_SESSION_STOP:
+    body->SessionStopReq_isUsed = 1u;
+    body->SessionStopReq.ChargingSession = iso1chargingSessionType_Terminate;
+    break;
+  default:
+    return 0;
+  }
+
+  stream.size = size;
+  stream.data = frame;
+  stream.pos = &pos;
+  if (encode_iso1ExiDocument(&stream, &exiOut)) return 0;
+  if (write_v2gtpHeader(frame, pos - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE)) return 0;
+  return pos;
+}
+
+static size_t build_request(const struct ev *ev, uint8_t *frame, size_t size)
+{
+  return build_message(ev, script[ev->step], frame, size);
+}
+
+/* the ResponseCode of the response to msg, or NULL if the body holds some other response */
+
+static const iso1responseCodeType *response_code(const struct iso1BodyType *body, enum v2g_msg msg)
+{
+  switch (msg)
+  {
+  case MSG_SESSION_SETUP: return (body->SessionSetupRes_isUsed) ? &body->SessionSetupRes.ResponseCode : NULL;
+  case MSG_SERVICE_DISCOVERY: return (body->ServiceDiscoveryRes_isUsed) ? &body->ServiceDiscoveryRes.ResponseCode : NULL;
+  case MSG_PAYMENT_SERVICE_SELECTION: return (body->PaymentServiceSelectionRes_isUsed) ? &body->PaymentServiceSelectionRes.ResponseCode : NULL;
+  case MSG_AUTHORIZATION: return (body->AuthorizationRes_isUsed) ? &body->AuthorizationRes.ResponseCode : NULL;
+  case MSG_CHARGE_PARAMETER_DISCOVERY: return (body->ChargeParameterDiscoveryRes_isUsed) ? &body->ChargeParameterDiscoveryRes.ResponseCode : NULL;
+  case MSG_CABLE_CHECK: return (body->CableCheckRes_isUsed) ? &body->CableCheckRes.ResponseCode : NULL;
+  case MSG_PRE_CHARGE: return (body->PreChargeRes_isUsed) ? &body->PreChargeRes.ResponseCode : NULL;
+  case MSG_POWER_DELIVERY: return (body->PowerDeliveryRes_isUsed) ? &body->PowerDeliveryRes.ResponseCode : NULL;
+  case MSG_CURRENT_DEMAND: return (body->CurrentDemandRes_isUsed) ? &body->CurrentDemandRes.ResponseCode : NULL;
+  case MSG_WELDING_DETECTION: return (body->WeldingDetectionRes_isUsed) ? &body->WeldingDetectionRes.ResponseCode : NULL;
+  case MSG_SESSION_STOP: return (body->SessionStopRes_isUsed) ? &body->SessionStopRes.ResponseCode : NULL;
+  default: return NULL;
+  }
+}
+
+/* check the response to the current step; returns false if the session cannot go on */
+
+static bool check_response(struct ev *ev, uint8_t *frame, size_t len)
+{
+  bitstream_t stream;
+  size_t pos = V2GTP_HEADER_LENGTH;
+  enum v2g_msg msg = script[ev->step];
+
+  stream.size = len;
+  stream.data = frame;
+  stream.pos = &pos;
+
+  if (MSG_NONE == msg)
+  {
+    static struct appHandEXIDocument doc;
+    if (decode_appHandExiDocument(&stream, &doc)) return false;
+    return doc.supportedAppProtocolRes_isUsed && (appHandresponseCodeType_Failed_NoNegotiation != doc.supportedAppProtocolRes.ResponseCode);
+  }
+
+  memset(&exiIn, 0, sizeof(exiIn));
+  if (decode_iso1ExiDocument(&stream, &exiIn) || !exiIn.V2G_Message_isUsed) return false;
+
+  const iso1responseCodeType *code = response_code(&exiIn.V2G_Message.Body, msg);
+  if (!code || (*code >= iso1responseCodeType_FAILED))
+  {
+    fprintf(stderr, "EV %d: %s failed (%d)\n", (int)(ev - evs), msg_label(msg), (code) ? (int)*code : -1);
+    return false;
+  }
+
+  if (MSG_SESSION_SETUP == msg)
+  {
+    if (SESSION_ID_LEN != exiIn.V2G_Message.Header.SessionID.bytesLen) return false;
+    memcpy(ev->sid, exiIn.V2G_Message.Header.SessionID.bytes, SESSION_ID_LEN);
+  }
+
+  if ((MSG_AUTHORIZATION == msg) && (iso1EVSEProcessingType_Finished != exiIn.V2G_Message.Body.AuthorizationRes.EVSEProcessing))
+  {
+    ev->retry_ns = now_ns() + ONGOING_RETRY_NS;
+    ongoing++;
+  }
+
+  if ((MSG_CURRENT_DEMAND == msg) && exiIn.V2G_Message.Body.CurrentDemandRes.EVSEMaximumCurrentLimit_isUsed)
+  {
+    ev->limited = true;
+    ev->current_limit = exiIn.V2G_Message.Body.CurrentDemandRes.EVSEMaximumCurrentLimit;
+  }
+
+  return true;
+}
+
+/* the first session of the first EV is recorded, frames back to back as on the wire */
+
+static void capture(const struct ev *ev, const uint8_t *frame, size_t len)
+{
+  if (corpus && (ev == evs)) fwrite(frame, 1, len, corpus);
+}
+
+static bool ev_send(struct ev *ev)
+{
+  uint8_t frame[1024];
+  size_t len = build_request(ev, frame, sizeof(frame));
+  if (!len) return false;
+  capture(ev, frame, len);
+
+  ev->sent_ns = now_ns();
+  if (ev->ssl) return SSL_write(ev->ssl, frame, len) == (int)len;
+  return send(ev->sock, frame, len, MSG_NOSIGNAL) == (ssize_t)len;
+}
+
+static void ev_stop(int epfd, struct ev *ev, bool failed)
+{
+  if (ev->sock < 0) return;
+  if (corpus && (ev == evs))
+  {
+    fclose(corpus);
+    corpus = NULL;
+  }
+  epoll_ctl(epfd, EPOLL_CTL_DEL, ev->sock, NULL);
+  if (ev->ssl)
+  {
+    SSL_shutdown(ev->ssl);
+    SSL_free(ev->ssl);
+    ev->ssl = NULL;
+  }
+  close(ev->sock);
+  ev->sock = -1;
+  if (failed) sessions_failed++;
+}
+
+/* TLS handshake on a fresh connection, resuming the EV's last session if it has one */
+
+static bool tls_start(struct ev *ev)
+{
+  ev->ssl = SSL_new(tls_ctx);
+  if (!ev->ssl) return false;
+
+  SSL_set_fd(ev->ssl, ev->sock);
+  if (ev->tls_session) SSL_set_session(ev->ssl, ev->tls_session);
+
+  uint64_t start = now_ns();
+  if (1 != SSL_connect(ev->ssl))
+  {
+    fprintf(stderr, "EV %d: TLS handshake failed\n", (int)(ev - evs));
+    SSL_free(ev->ssl);
+    ev->ssl = NULL;
+    return false;
+  }
+  samples_add(&handshakes[SSL_session_reused(ev->ssl) ? 1 : 0], now_ns() - start);
+
+  if (ev->tls_session) SSL_SESSION_free(ev->tls_session);
+  ev->tls_session = SSL_get1_session(ev->ssl);
+
+  /* responses are read as they arrive, like those of plain connections */
+  fcntl(ev->sock, F_SETFL, fcntl(ev->sock, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+/* connect and send supportedAppProtocolReq; the connect (and TLS handshake) is included in the session time */
+
+static bool ev_start(int epfd, struct ev *ev)
+{
+  ev->sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  if (ev->sock < 0) return false;
+
+  int one = 1;
+  setsockopt(ev->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (connect(ev->sock, (struct sockaddr *)&secc_addr, sizeof(secc_addr)) < 0)
+  {
+    close(ev->sock);
+    ev->sock = -1;
+    return false;
+  }
+
+  if (tls_ctx && !tls_start(ev))
+  {
+    close(ev->sock);
+    ev->sock = -1;
+    sessions_started++;
+    sessions_failed++;
+    return false;
+  }
+
+  struct epoll_event event = { .events = EPOLLIN, .data.ptr = ev };
+  epoll_ctl(epfd, EPOLL_CTL_ADD, ev->sock, &event);
+
+  ev->step = 0;
+  ev->loops = 0;
+  memset(ev->sid, 0, sizeof(ev->sid));
+  ev->limited = false;
+  ev->retry_ns = 0;
+  v2gtp_rx_init(&ev->rx);
+  sessions_started++;
+
+  if (!ev_send(ev))
+  {
+    ev_stop(epfd, ev, true);
+    return false;
+  }
+  return true;
+}
+
+/* read whatever the SECC sent and advance the script; returns false once the session is over */
+
+static bool ev_service(struct ev *ev)
+{
+  size_t space;
+  uint8_t *dst = v2gtp_rx_space(&ev->rx, &space);
+  if (!space) return false;
+
+  ssize_t len;
+  if (ev->ssl)
+  {
+    size_t n;
+    if (!SSL_read_ex(ev->ssl, dst, space, &n)) return SSL_ERROR_WANT_READ == SSL_get_error(ev->ssl, 0);
+    len = n;
+  }
+  else
+  {
+    len = recv(ev->sock, dst, space, MSG_DONTWAIT);
+    if (len < 0) return (EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno);
+    if (0 == len) return false;
+  }
+  v2gtp_rx_commit(&ev->rx, len);
+
+  uint8_t *frame;
+  uint32_t framelen;
+  int rc;
+
+  while ((rc = v2gtp_rx_peek(&ev->rx, &frame, &framelen)) > 0)
+  {
+    enum v2g_msg msg = script[ev->step];
+    samples_add(&latency[msg], now_ns() - ev->sent_ns);
+    capture(ev, frame, framelen);
+
+    bool ok = check_response(ev, frame, framelen);
+    v2gtp_rx_consume(&ev->rx, framelen);
+    if (!ok) return false;
+
+    /* the same request again, once the pause is over */
+    if (ev->retry_ns) continue;
+
+    if ((MSG_CURRENT_DEMAND != msg) || (++ev->loops >= current_demand_loops)) ev->step++;
+
+    if (ev->step == ARRAY_SIZE(script))
+    {
+      sessions_done++;
+      return false;
+    }
+
+    if (!ev_send(ev)) return false;
+  }
+
+  return rc >= 0;
+}
+
+/*
+-X: before the benchmark, requests the SECC must refuse are sent on a connection of their
+own, right after SessionSetupReq.  Each must be answered with the failure it calls for
+and must leave the output off: with the echo power backend (redux's default) a module
+that has been given a target reports it straight back, so a refused request that
+switched the output on shows up as a non-zero EVSEPresentVoltage in its own response.
+A refused ChargeParameterDiscoveryReq must likewise be offered no power.
+*/
+
+struct probe
+{
+  enum v2g_msg msg;
+  bool wrong_sid;           /* name a session other than the one set up */
+  iso1responseCodeType expect;
+};
+
+static const struct probe probes[] =
+{
+  { MSG_PRE_CHARGE, false, iso1responseCodeType_FAILED_SequenceError },
+  { MSG_CURRENT_DEMAND, false, iso1responseCodeType_FAILED_SequenceError },
+  { MSG_PRE_CHARGE, true, iso1responseCodeType_FAILED_UnknownSession },
+  { MSG_CURRENT_DEMAND, true, iso1responseCodeType_FAILED_UnknownSession },
+  { MSG_CHARGE_PARAMETER_DISCOVERY, false, iso1responseCodeType_FAILED_SequenceError },
+  { MSG_CHARGE_PARAMETER_DISCOVERY, true, iso1responseCodeType_FAILED_UnknownSession },
+};
+
+/* what a refused request must not have been given: the output on, or a share of the site budget */
+
+static double probe_given(const struct iso1BodyType *body, enum v2g_msg msg)
+{
+  switch (msg)
+  {
+  case MSG_PRE_CHARGE: return physical(&body->PreChargeRes.EVSEPresentVoltage);
+  case MSG_CURRENT_DEMAND: return physical(&body->CurrentDemandRes.EVSEPresentVoltage);
+  case MSG_CHARGE_PARAMETER_DISCOVERY: return physical(&body->ChargeParameterDiscoveryRes.DC_EVSEChargeParameter.EVSEMaximumPowerLimit);
+  default: return 0;
+  }
+}
+
+/* send msg and wait for the response, which is left in frame */
+
+static size_t probe_exchange(struct ev *ev, enum v2g_msg msg, uint8_t *frame, size_t size)
+{
+  size_t len = build_message(ev, msg, frame, size);
+  if (!len || (send(ev->sock, frame, len, MSG_NOSIGNAL) != (ssize_t)len)) return 0;
+
+  uint8_t *rx;
+  uint32_t rxlen;
+  int rc;
+  v2gtp_rx_init(&ev->rx);
+  while (!(rc = v2gtp_rx_peek(&ev->rx, &rx, &rxlen)))
+  {
+    size_t space;
+    uint8_t *dst = v2gtp_rx_space(&ev->rx, &space);
+    struct pollfd pfd = { .fd = ev->sock, .events = POLLIN };
+    if (!space || (poll(&pfd, 1, RESPONSE_TIMEOUT_NS / 1000000) <= 0)) return 0;
+
+    ssize_t n = recv(ev->sock, dst, space, 0);
+    if (n <= 0) return 0;
+    v2gtp_rx_commit(&ev->rx, n);
+  }
+  if ((rc < 0) || (rxlen > size)) return 0;
+
+  memcpy(frame, rx, rxlen);
+  return rxlen;
+}
+
+static bool probe_run(void)
+{
+  struct ev *ev = &evs[0];
+  uint8_t frame[1024];
+  size_t len;
+  bool ok = true;
+
+  ev->sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  if ((ev->sock < 0) || (connect(ev->sock, (struct sockaddr *)&secc_addr, sizeof(secc_addr)) < 0)) return false;
+  memset(ev->sid, 0, sizeof(ev->sid));
+
+  /* supportedAppProtocolReq and SessionSetupReq, as the script has them */
+  for (ev->step = 0; ev->step < 2; ev->step++)
+  {
+    len = probe_exchange(ev, script[ev->step], frame, sizeof(frame));
+    if (!len || !check_response(ev, frame, len))
+    {
+      fprintf(stderr, "probe: no session\n");
+      close(ev->sock);
+      ev->sock = -1;
+      return false;
+    }
+  }
+
+  for (unsigned i = 0; i < ARRAY_SIZE(probes); i++)
+  {
+    const struct probe *p = &probes[i];
+    if (p->wrong_sid) ev->sid[0] ^= 0xff;
+    len = probe_exchange(ev, p->msg, frame, sizeof(frame));
+    if (p->wrong_sid) ev->sid[0] ^= 0xff;
+
+    bitstream_t stream;
+    size_t pos = V2GTP_HEADER_LENGTH;
+    stream.size = len;
+    stream.data = frame;
+    stream.pos = &pos;
+    memset(&exiIn, 0, sizeof(exiIn));
+    const iso1responseCodeType *code = NULL;
+    if (len && !decode_iso1ExiDocument(&stream, &exiIn) && exiIn.V2G_Message_isUsed) code = response_code(&exiIn.V2G_Message.Body, p->msg);
+
+    double given = (code) ? probe_given(&exiIn.V2G_Message.Body, p->msg) : 0;
+    const char *unit = (MSG_CHARGE_PARAMETER_DISCOVERY == p->msg) ? "W of the budget" : "V at the output";
+
+    const char *what = (p->wrong_sid) ? "unknown session" : "out of sequence";
+    if (!code || (*code != p->expect))
+    {
+      printf("probe %s %s: answered %d, expected %d\n", msg_label(p->msg), what, (code) ? (int)*code : -1, (int)p->expect);
+      ok = false;
+    }
+    else if (given != 0)
+    {
+      printf("probe %s %s: refused, but given %.1f %s\n", msg_label(p->msg), what, given, unit);
+      ok = false;
+    }
+    else
+      printf("probe %s %s: refused, nothing given\n", msg_label(p->msg), what);
+  }
+
+  close(ev->sock);
+  ev->sock = -1;
+  return ok;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-i ifname] [-a address] [-c EVs] [-s sessions] [-n CurrentDemandReq per session] [-R seconds per step] [-w corpus] [-T] [-X]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *ifname = "seth0";
+  const char *address = NULL;
+  unsigned concurrency = 1, ramp_seconds = 0;
+  unsigned long sessions = 100;
+  bool probe = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:a:c:s:n:R:w:TX")) != -1)
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'a': address = optarg; break;
+    case 'c': concurrency = atoi(optarg); break;
+    case 's': sessions = atol(optarg); break;
+    case 'n': current_demand_loops = atoi(optarg); break;
+    case 'R': ramp_seconds = atoi(optarg); break;
+    case 'w':
+      corpus = fopen(optarg, "wb");
+      if (!corpus)
+      {
+        fprintf(stderr, "ERROR: cannot create %s\n", optarg);
+        return -1;
+      }
+      break;
+    case 'T':
+      tls_ctx = SSL_CTX_new(TLS_client_method());
+      if (!tls_ctx) return -1;
+      SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+      SSL_CTX_set_max_proto_version(tls_ctx, TLS1_2_VERSION);
+      SSL_CTX_set_cipher_list(tls_ctx, tls_ciphers);
+      sdp_request[8] = SDP_TLS;
+      break;
+    case 'X': probe = true; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if (!concurrency || (concurrency > MAX_EVS) || !current_demand_loops || (probe && tls_ctx))
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  if (!sdp_discover(ifname, address))
+  {
+    fprintf(stderr, "ERROR: no SDP response on %s\n", ifname);
+    return -1;
+  }
+
+  char text[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, &secc_addr.sin6_addr, text, sizeof(text));
+  printf("SECC at [%s]:%u\n", text, ntohs(secc_addr.sin6_port));
+
+  if (probe && !probe_run()) return 1;
+
+  int epfd = epoll_create1(0);
+  if (epfd < 0) return -1;
+
+  for (int i = 0; i < MAX_EVS; i++)
+    evs[i].sock = -1;
+
+  /* a ramp runs sessions for a fixed time per step rather than a fixed count */
+  unsigned active_limit = (ramp_seconds) ? 1 : concurrency;
+  uint64_t start = now_ns(), step_end = start + (uint64_t)ramp_seconds * 1000000000ull;
+
+  for (;;)
+  {
+    uint64_t now = now_ns();
+
+    if (ramp_seconds && (now >= step_end))
+    {
+      report((now - start) / 1e9, active_limit);
+      printf("\n");
+      if (active_limit >= concurrency) break;
+
+      active_limit = (2 * active_limit > concurrency) ? concurrency : 2 * active_limit;
+      stats_reset();
+      start = now;
+      step_end = now + (uint64_t)ramp_seconds * 1000000000ull;
+    }
+
+    unsigned active = 0;
+    for (unsigned i = 0; i < MAX_EVS; i++)
+    {
+      struct ev *ev = &evs[i];
+
+      /* a SECC that stops answering fails the session rather than hanging the benchmark */
+      if ((ev->sock >= 0) && !ev->retry_ns && (now - ev->sent_ns > RESPONSE_TIMEOUT_NS))
+      {
+        fprintf(stderr, "EV %u: no response to %s\n", i, msg_label(script[ev->step]));
+        ev_stop(epfd, ev, true);
+      }
+
+      if ((ev->sock >= 0) && ev->retry_ns && (now >= ev->retry_ns))
+      {
+        ev->retry_ns = 0;
+        if (!ev_send(ev)) ev_stop(epfd, ev, true);
+      }
+
+      if ((ev->sock < 0) && (i < active_limit) && (ramp_seconds || (sessions_started < sessions)))
+        ev_start(epfd, ev);
+
+      if (ev->sock >= 0) active++;
+    }
+
+    if (!ramp_seconds && !active && (sessions_started >= sessions)) break;
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epfd, events, ARRAY_SIZE(events), 10);
+
+    if (count < 0)
+    {
+      if (EINTR == errno) continue;
+      break;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      struct ev *ev = events[i].data.ptr;
+      if (!ev_service(ev)) ev_stop(epfd, ev, ev->step != ARRAY_SIZE(script));
+    }
+  }
+
+  if (!ramp_seconds) report((now_ns() - start) / 1e9, concurrency);
+
+  for (int i = 0; i < MAX_EVS; i++)
+    ev_stop(epfd, &evs[i], false);
+  close(epfd);
+
+  return (sessions_failed) ? 1 : 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+EXI codec benchmark over a corpus of captured V2GTP frames
+
+The corpus is a file of V2GTP frames (header included) back to back, exactly as they
+appear in a TCP stream; "evsim -w corpus" records one complete session.  Each frame is
+sorted by message type (supportedAppProtocolReq/Res or the ISO 15118-2 body element),
+then every type is decoded, and re-encoded from its decoded form, in tight loops the
+way redux does it: the iso1 document is zeroed before every decode.
+
+Reported per message type and operation: ns/message, messages/s, bytes zeroed per
+message and bytes of heap allocated per message (glibc only).
+
+usage: exibench corpus [iterations per message type]
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include "parameters.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+#define HAVE_MALLINFO2 1
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+#define MAX_TYPES 64
+
+/* the ISO 15118-2 body elements, for naming frames */
+
+#define ISO1_BODY_ELEMENTS \
+  X(SessionSetupReq) X(SessionSetupRes) \
+  X(ServiceDiscoveryReq) X(ServiceDiscoveryRes) \
+  X(ServiceDetailReq) X(ServiceDetailRes) \
+  X(PaymentServiceSelectionReq) X(PaymentServiceSelectionRes) \
+  X(PaymentDetailsReq) X(PaymentDetailsRes) \
+  X(AuthorizationReq) X(AuthorizationRes) \
+  X(ChargeParameterDiscoveryReq) X(ChargeParameterDiscoveryRes) \
+  X(PowerDeliveryReq) X(PowerDeliveryRes) \
+  X(MeteringReceiptReq) X(MeteringReceiptRes) \
+  X(SessionStopReq) X(SessionStopRes) \
+  X(CertificateUpdateReq) X(CertificateUpdateRes) \
+  X(CertificateInstallationReq) X(CertificateInstallationRes) \
+  X(ChargingStatusReq) X(ChargingStatusRes) \
+  X(CableCheckReq) X(CableCheckRes) \
+  X(PreChargeReq) X(PreChargeRes) \
+  X(CurrentDemandReq) X(CurrentDemandRes) \
+  X(WeldingDetectionReq) X(WeldingDetectionRes)
+
+struct frame
+{
+  uint8_t *data;
+  uint32_t len;
+};
+
+struct msg_type
+{
+  const char *name;
+  bool handshake;           /* appHand rather than iso1 */
+  struct frame *frames;
+  unsigned count;
+};
+
+static struct msg_type types[MAX_TYPES];
+static unsigned type_count;
+
+static struct iso1EXIDocument exiIn;
+static struct appHandEXIDocument appHandIn;
+
+/* one decoded document per frame, to encode from */
+static struct iso1EXIDocument *iso1_docs;
+static struct appHandEXIDocument *appHand_docs;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t heap_in_use(void)
+{
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static const char *iso1_body_name(const struct iso1BodyType *body)
+{
+#define X(e) if (body->e##_isUsed) return #e;
+  ISO1_BODY_ELEMENTS
+#undef X
+  return NULL;
+}
+
+static void stream_init(bitstream_t *stream, size_t *pos, uint8_t *data, size_t size)
+{
+  *pos = V2GTP_HEADER_LENGTH;
+  stream->size = size;
+  stream->data = data;
+  stream->pos = pos;
+}
+
+static int decode_iso1(const struct frame *f)
+{
+  bitstream_t stream;
+  size_t pos;
+
+  /* as redux: OpenV2G init_ helpers don't clear everything; trust only memset */
+  memset(&exiIn, 0, sizeof(exiIn));
+  stream_init(&stream, &pos, f->data, f->len);
+  return decode_iso1ExiDocument(&stream, &exiIn);
+}
+
+static int decode_appHand(const struct frame *f)
+{
+  bitstream_t stream;
+  size_t pos;
+
+  stream_init(&stream, &pos, f->data, f->len);
+  return decode_appHandExiDocument(&stream, &appHandIn);
+}
+
+static struct msg_type *type_for(const char *name, bool handshake)
+{
+  for (unsigned i = 0; i < type_count; i++)
+    if (!strcmp(types[i].name, name)) return &types[i];
+
+  if (type_count == MAX_TYPES) return NULL;
+  types[type_count].name = name;
+  types[type_count].handshake = handshake;
+  return &types[type_count++];
+}
+
+/* split the corpus into frames and sort them by message type; returns the number of frames used */
+
+static unsigned load_corpus(uint8_t *buf, size_t size)
+{
+  unsigned used = 0, skipped = 0;
+  size_t off = 0;
+
+  while (off + V2GTP_HEADER_LENGTH <= size)
+  {
+    uint32_t payload;
+    if (read_v2gtpHeader(buf + off, &payload) || (payload > size - off - V2GTP_HEADER_LENGTH))
+    {
+      fprintf(stderr, "corpus: bad V2GTP header at offset %zu\n", off);
+      break;
+    }
+
+    struct frame f = { .data = buf + off, .len = V2GTP_HEADER_LENGTH + payload };
+    const char *name = NULL;
+    bool handshake = false;
+
+    off += f.len;
+
+    /* a frame that the iso1 grammar rejects may be the supportedAppProtocol exchange */
+    if (!decode_iso1(&f) && exiIn.V2G_Message_isUsed)
+    {
+      name = iso1_body_name(&exiIn.V2G_Message.Body);
+    }
+    else if (!decode_appHand(&f))
+    {
+      handshake = true;
+      if (appHandIn.supportedAppProtocolReq_isUsed) name = "supportedAppProtocolReq";
+      if (appHandIn.supportedAppProtocolRes_isUsed) name = "supportedAppProtocolRes";
+    }
+
+    struct msg_type *t = (name) ? type_for(name, handshake) : NULL;
+    struct frame *frames = (t) ? realloc(t->frames, (t->count + 1) * sizeof(*frames)) : NULL;
+    if (!frames)
+    {
+      skipped++;
+      continue;
+    }
+
+    t->frames = frames;
+    t->frames[t->count++] = f;
+    used++;
+  }
+
+  if (skipped) fprintf(stderr, "corpus: %u frames not decodable as appHand or iso1, skipped\n", skipped);
+  return used;
+}
+
+enum op
+{
+  OP_DECODE,
+  OP_ENCODE,
+};
+
+static void run(const struct msg_type *t, enum op op, long iterations)
+{
+  static uint8_t out[4096];
+  bitstream_t stream;
+  size_t pos;
+  int errn = 0;
+
+  if (OP_ENCODE == op)
+  {
+    /* keep the decoded documents around so that the encode loop only encodes */
+    for (unsigned i = 0; i < t->count; i++)
+    {
+      if (t->handshake)
+      {
+        decode_appHand(&t->frames[i]);
+        appHand_docs[i] = appHandIn;
+      }
+      else
+      {
+        decode_iso1(&t->frames[i]);
+        iso1_docs[i] = exiIn;
+      }
+    }
+  }
+
+  size_t heap = heap_in_use();
+  uint64_t start = now_ns();
+#ifdef HAVE_TSC
+  uint64_t tsc = __rdtsc();
+#endif
+
+  for (long n = 0; n < iterations; n++)
+  {
+    unsigned i = n % t->count;
+
+    if (OP_DECODE == op)
+    {
+      errn |= (t->handshake) ? decode_appHand(&t->frames[i]) : decode_iso1(&t->frames[i]);
+    }
+    else
+    {
+      stream_init(&stream, &pos, out, sizeof(out));
+      errn |= (t->handshake) ? encode_appHandExiDocument(&stream, &appHand_docs[i]) : encode_iso1ExiDocument(&stream, &iso1_docs[i]);
+    }
+  }
+
+#ifdef HAVE_TSC
+  tsc = __rdtsc() - tsc;
+#endif
+  double ns = (double)(now_ns() - start) / iterations;
+  double heap_per_msg = (double)(heap_in_use() - heap) / iterations;
+
+  /* the handshake document is filled in by the decoder itself; redux zeroes only iso1 */
+  size_t zeroed = (OP_DECODE == op && !t->handshake) ? sizeof(struct iso1EXIDocument) : 0;
+
+  printf("%-30s %-6s %6u %9.1f %11.0f %9zu %9.1f", t->name, (OP_DECODE == op) ? "decode" : "encode", t->count, ns, 1e9 / ns, zeroed, heap_per_msg);
+#ifdef HAVE_TSC
+  printf(" %9.0f", (double)tsc / iterations);
+#endif
+  printf("%s\n", (errn) ? "  (errors)" : "");
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s corpus [iterations per message type]\n", argv[0]);
+    return -1;
+  }
+
+  long iterations = (argc > 2) ? atol(argv[2]) : 100000;
+
+  FILE *f = fopen(argv[1], "rb");
+  if (!f)
+  {
+    fprintf(stderr, "ERROR: cannot open %s\n", argv[1]);
+    return -1;
+  }
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *buf = malloc(size);
+  if (!buf || (fread(buf, 1, size, f) != (size_t)size))
+  {
+    fprintf(stderr, "ERROR: cannot read %s\n", argv[1]);
+    return -1;
+  }
+  fclose(f);
+
+  unsigned frames = load_corpus(buf, size);
+  if (!frames)
+  {
+    fprintf(stderr, "ERROR: no usable frames in %s\n", argv[1]);
+    return -1;
+  }
+
+  unsigned most = 0;
+  for (unsigned i = 0; i < type_count; i++)
+    if (types[i].count > most) most = types[i].count;
+
+  iso1_docs = malloc(most * sizeof(*iso1_docs));
+  appHand_docs = malloc(most * sizeof(*appHand_docs));
+  if (!iso1_docs || !appHand_docs) return -1;
+
+  printf("%u frames, %u message types; sizeof(struct iso1EXIDocument) = %zu, sizeof(struct appHandEXIDocument) = %zu\n",
+    frames, type_count, sizeof(struct iso1EXIDocument), sizeof(struct appHandEXIDocument));
+  printf("%-30s %-6s %6s %9s %11s %9s %9s", "message", "op", "frames", "ns/msg", "msgs/s", "zeroed B", "heap B");
+#ifdef HAVE_TSC
+  printf(" %9s", "cycles");
+#endif
+  printf("\n");
+
+  for (unsigned i = 0; i < type_count; i++)
+  {
+    run(&types[i], OP_DECODE, iterations);
+    run(&types[i], OP_ENCODE, iterations);
+  }
+
+  return 0;
+}
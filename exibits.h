@@ -0,0 +1,213 @@
+#ifndef _EXIBITS_H
+#define _EXIBITS_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/* bit-level helpers for poking at bit-packed EXI streams (MSB first, as OpenV2G writes them) */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+
+static bool bit_at(const uint8_t *buf, uint32_t bit)
+{
+  return (buf[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* copy whole bytes into a buffer starting at an arbitrary bit offset */
+
+static void put_bytes_at_bit(uint8_t *buf, uint32_t bit, const uint8_t *src, unsigned count)
+{
+  unsigned shift = bit & 7;
+  buf += bit >> 3;
+
+  if (!shift)
+  {
+    memcpy(buf, src, count);
+    return;
+  }
+
+  uint8_t keep_hi = (uint8_t)(0xFF << (8 - shift));
+  for (unsigned i = 0; i < count; i++)
+  {
+    buf[i] = (buf[i] & keep_hi) | (src[i] >> shift);
+    buf[i + 1] = (buf[i + 1] & ~keep_hi) | (uint8_t)(src[i] << (8 - shift));
+  }
+}
+
+/*
+locate the one contiguous run of bits in which two equally long encodings differ
+returns the run length (zero if the encodings are identical, -1 if the differences are not contiguous)
+*/
+
+static int diff_bit_run(const uint8_t *a, const uint8_t *b, size_t len, uint32_t *first)
+{
+  uint32_t bits = len * 8, count = 0;
+
+  *first = bits;
+  for (uint32_t i = 0; i < bits; i++)
+  {
+    if (bit_at(a, i) == bit_at(b, i)) continue;
+    if (*first == bits) *first = i;
+    if (i != *first + count) return -1;
+    count++;
+  }
+
+  return count;
+}
+
+/* first bit at which two encodings differ, or -1 if they agree over the shorter of the two */
+
+static int first_diff_bit(const uint8_t *a, size_t alen, const uint8_t *b, size_t blen)
+{
+  size_t len = (alen < blen) ? alen : blen;
+
+  for (size_t i = 0; i < len; i++)
+    if (a[i] != b[i])
+      return i * 8 + __builtin_clz((unsigned)(a[i] ^ b[i]) << 24);
+
+  return -1;
+}
+
+/*
+reading and writing the few EXI datatypes the fast path handles itself: n-bit unsigned
+integers, and the variable-length unsigned integer (7 bits per octet, least significant
+first, the top bit set on all but the last) and integer (a sign bit, then the magnitude,
+less one if negative)
+*/
+
+struct exi_reader
+{
+  const uint8_t *buf;
+  uint32_t bit, end;        /* in bits */
+  bool error;               /* read past the end, or a value out of range */
+};
+
+/* n is 1 to 32; the bits are taken from a 64-bit window where the buffer holds one */
+
+static uint32_t exi_read_bits(struct exi_reader *r, unsigned n)
+{
+  uint32_t byte = r->bit >> 3;
+  uint64_t window = 0;
+
+  if (r->bit + n > r->end)
+  {
+    r->error = true;
+    return 0;
+  }
+
+  if (byte + 8 <= (r->end + 7) / 8)
+  {
+    memcpy(&window, r->buf + byte, 8);
+    window = be64toh(window);
+  }
+  else
+  {
+    for (uint32_t i = 0; byte + i < (r->end + 7) / 8; i++)
+      window |= (uint64_t)r->buf[byte + i] << (56 - 8 * i);
+  }
+
+  r->bit += n;
+  return (uint32_t)((window << (r->bit - n - byte * 8)) >> (64 - n));
+}
+
+static uint32_t exi_read_uint(struct exi_reader *r)
+{
+  uint32_t v = 0;
+
+  for (unsigned shift = 0; shift < 35; shift += 7)
+  {
+    uint32_t octet = exi_read_bits(r, 8);
+    v |= (octet & 0x7f) << shift;
+    if (!(octet & 0x80)) return v;
+  }
+
+  r->error = true;
+  return 0;
+}
+
+static int32_t exi_read_int(struct exi_reader *r)
+{
+  bool negative = exi_read_bits(r, 1);
+  uint32_t magnitude = exi_read_uint(r);
+
+  if (magnitude > INT32_MAX)
+  {
+    r->error = true;
+    return 0;
+  }
+  return (negative) ? -(int32_t)magnitude - 1 : (int32_t)magnitude;
+}
+
+/* writes in order, holding the bits of the octet not yet complete */
+
+struct exi_writer
+{
+  uint8_t *buf;
+  uint32_t bit, end;        /* in bits */
+  uint64_t pending;         /* the last bit & 7 bits written, not yet in buf */
+  bool error;               /* ran out of room */
+};
+
+/* start at an arbitrary bit; the bits of buf before it are kept */
+
+static void exi_writer_init(struct exi_writer *w, uint8_t *buf, uint32_t bit, uint32_t end)
+{
+  w->buf = buf;
+  w->bit = bit;
+  w->end = end;
+  w->pending = (bit & 7) ? buf[bit >> 3] >> (8 - (bit & 7)) : 0;
+  w->error = false;
+}
+
+/* n is 1 to 32 */
+
+static void exi_write_bits(struct exi_writer *w, unsigned n, uint32_t v)
+{
+  uint32_t byte = w->bit >> 3;
+  unsigned held = (w->bit & 7) + n;
+
+  if (w->bit + n > w->end)
+  {
+    w->error = true;
+    return;
+  }
+
+  w->pending = (w->pending << n) | (v & (~0u >> (32 - n)));
+  w->bit += n;
+  while (held >= 8)
+  {
+    held -= 8;
+    w->buf[byte++] = (uint8_t)(w->pending >> held);
+  }
+}
+
+static void exi_write_uint(struct exi_writer *w, uint32_t v)
+{
+  while (v > 0x7f)
+  {
+    exi_write_bits(w, 8, 0x80 | (v & 0x7f));
+    v >>= 7;
+  }
+  exi_write_bits(w, 8, v);
+}
+
+static void exi_write_int(struct exi_writer *w, int32_t v)
+{
+  exi_write_bits(w, 1, v < 0);
+  exi_write_uint(w, (v < 0) ? (uint32_t)(-(v + 1)) : (uint32_t)v);
+}
+
+/* pad with zero bits to a whole octet; returns the length in octets (zero if it did not fit) */
+
+static size_t exi_write_finish(struct exi_writer *w)
+{
+  if (w->bit & 7) exi_write_bits(w, 8 - (w->bit & 7), 0);
+  return (w->error) ? 0 : w->bit / 8;
+}
+
+#endif
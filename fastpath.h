@@ -0,0 +1,697 @@
+#ifndef _FASTPATH_H
+#define _FASTPATH_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+fast path for the charging loop (CurrentDemandReq/Res, PreChargeReq/Res)
+
+The generic path zeroes two whole iso1EXIDocument structs per message, runs OpenV2G's
+decoder for the whole schema, searches the body for whichever _isUsed flag got set and
+runs the whole encoder back.  These four messages, sent several times a second for the
+length of a session, are instead decoded and encoded here, to the fixed EXI grammar of
+just these bodies:
+
+1. the message type is peeked from the raw EXI bits.  Everything before the body content
+   (EXI header, the V2G_Message and Header events, an 8-byte SessionID, the Body event
+   code) is the same in every such request but for the SessionID, so rather than
+   hard-coding event codes from the whole schema we learn that prefix at startup from
+   what OpenV2G encodes for each request type, and compare with the SessionID masked out
+2. the body is decoded from there, bit by bit, into a compact struct; only the fields the
+   SECC acts upon are kept, the optional ones are parsed and skipped
+3. the response is written as the prefix OpenV2G encodes for it, with the SessionID
+   stamped in, followed by the body encoded here
+
+The grammar is OpenV2G's (schema-informed, not strict): a state's event code takes
+enough bits for its productions plus one, the escape to second-level events such as
+xsi:nil, which are not supported here; a simple element is SE, CH (one bit, 0), the
+value and EE (one bit, 0); after the body's EE come Body's and V2G_Message's, a bit
+each, then zero bits to the octet.
+
+OpenV2G remains the reference.  At startup fastpath_init() encodes a set of requests with
+it and checks that they decode here to the same values, and encodes the responses to them
+both ways and checks that they are identical; a message type that fails any of it, or
+cannot be calibrated, is left to the generic path.  So is anything in a request that the
+grammar here does not expect (an unknown event code, a second-level event, a value out of
+range): fastpath_decode() returns false and the caller hands the frame to OpenV2G.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "v2gtp.h"
+#include "iso1EXIDatatypes.h"
+#include "iso1EXIDatatypesEncoder.h"
+#include "parameters.h"
+#include "messages.h"
+#include "session.h"
+#include "exibits.h"
+
+#define FASTPATH_SIG_BYTES 32
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+#endif
+
+/* a request type: everything before its body content, and the bits of it that are not the SessionID */
+
+struct fastpath_sig
+{
+  uint16_t bytes;           /* zero if this message type is left to the generic path */
+  uint32_t sid_bit, body_bit;
+  uint8_t ref[FASTPATH_SIG_BYTES];
+  uint8_t mask[FASTPATH_SIG_BYTES];
+};
+
+/* a response type: what OpenV2G encodes before its body content */
+
+struct fastpath_prefix
+{
+  uint32_t sid_bit, body_bit; /* body_bit zero if this message type is left to the generic path */
+  uint8_t ref[FASTPATH_SIG_BYTES];
+};
+
+/* the parts of a charging-loop request that the SECC acts upon */
+
+struct charge_loop_req
+{
+  enum v2g_msg msg;
+  uint8_t sid[SESSION_ID_LEN];
+  struct iso1DC_EVStatusType DC_EVStatus;
+  struct iso1PhysicalValueType EVTargetVoltage, EVTargetCurrent;
+  int ChargingComplete;
+};
+
+struct charge_loop_res
+{
+  iso1responseCodeType ResponseCode;
+  struct iso1PhysicalValueType EVSEPresentVoltage, EVSEPresentCurrent;
+  struct iso1PhysicalValueType EVSEMaximumCurrentLimit, EVSEMaximumPowerLimit; /* CurrentDemandRes only */
+  int EVSECurrentLimitAchieved, EVSEPowerLimitAchieved;
+};
+
+struct fastpath
+{
+  struct fastpath_sig sig[MSG_COUNT];
+  struct fastpath_prefix res[MSG_COUNT];
+};
+
+static const enum v2g_msg fastpath_msgs[] = { MSG_CURRENT_DEMAND, MSG_PRE_CHARGE };
+
+/* decoding */
+
+/* an event code among count productions; anything else (the second-level escape included) is an error */
+
+static uint32_t fp_event(struct exi_reader *r, unsigned count)
+{
+  uint32_t code = exi_read_bits(r, 32 - __builtin_clz(count));
+  if (code >= count) r->error = true;
+  return code;
+}
+
+/* the content of a simple element: CH, an n-bit value, EE */
+
+static uint32_t fp_read_simple(struct exi_reader *r, unsigned n)
+{
+  uint32_t bits = exi_read_bits(r, n + 2);
+  if (bits & ((2u << n) | 1)) r->error = true;
+  return (bits >> 1) & ((1u << n) - 1);
+}
+
+/* a mandatory simple element: its SE (the only production), CH, an n-bit value, EE */
+
+static uint32_t fp_read_field(struct exi_reader *r, unsigned n)
+{
+  uint32_t bits = exi_read_bits(r, n + 3);
+  if (bits & ((6u << n) | 1)) r->error = true;
+  return (bits >> 1) & ((1u << n) - 1);
+}
+
+static void fp_read_value(struct exi_reader *r, struct iso1PhysicalValueType *v)
+{
+  v->Multiplier = (int8_t)fp_read_field(r, 3) - 3;
+  uint32_t unit = fp_read_field(r, 3);
+  if (unit > iso1unitSymbolType_Wh) r->error = true;
+  v->Unit = (iso1unitSymbolType)unit;
+
+  /* Value's SE and CH, the integer, then its EE and PhysicalValueType's */
+  if (exi_read_bits(r, 2)) r->error = true;
+  int32_t value = exi_read_int(r);
+  if ((value < INT16_MIN) || (value > INT16_MAX)) r->error = true;
+  v->Value = (int16_t)value;
+  if (exi_read_bits(r, 2)) r->error = true;
+}
+
+static void fp_read_ev_status(struct exi_reader *r, struct iso1DC_EVStatusType *s)
+{
+  s->EVReady = fp_read_field(r, 1);
+  s->EVErrorCode = (iso1DC_EVErrorCodeType)fp_read_field(r, 4);
+  s->EVRESSSOC = (int8_t)fp_read_field(r, 7);
+  fp_event(r, 1);
+}
+
+/* EVMaximumVoltageLimit?, EVMaximumCurrentLimit?, EVMaximumPowerLimit?, BulkChargingComplete?, ChargingComplete, RemainingTimeToFullSoC?, RemainingTimeToBulkSoC?, EVTargetVoltage */
+
+static void fp_read_current_demand(struct exi_reader *r, struct charge_loop_req *req)
+{
+  struct iso1PhysicalValueType skip;
+  uint32_t next = 0, code;
+
+  fp_event(r, 1);
+  fp_read_ev_status(r, &req->DC_EVStatus);
+  fp_event(r, 1);
+  fp_read_value(r, &req->EVTargetCurrent);
+
+  do
+  {
+    code = next + fp_event(r, 5 - next);
+    next = code + 1;
+    if (code < 3)
+      fp_read_value(r, &skip);
+    else if (3 == code)
+      fp_read_simple(r, 1);
+    else
+      req->ChargingComplete = fp_read_simple(r, 1);
+  } while ((code < 4) && !r->error);
+
+  next = 0;
+  do
+  {
+    code = next + fp_event(r, 3 - next);
+    next = code + 1;
+    fp_read_value(r, (code < 2) ? &skip : &req->EVTargetVoltage);
+  } while ((code < 2) && !r->error);
+
+  fp_event(r, 1);
+}
+
+static void fp_read_pre_charge(struct exi_reader *r, struct charge_loop_req *req)
+{
+  fp_event(r, 1);
+  fp_read_ev_status(r, &req->DC_EVStatus);
+  fp_event(r, 1);
+  fp_read_value(r, &req->EVTargetVoltage);
+  fp_event(r, 1);
+  fp_read_value(r, &req->EVTargetCurrent);
+  fp_event(r, 1);
+  req->ChargingComplete = 0;
+}
+
+/* encoding */
+
+static void fp_event_out(struct exi_writer *w, unsigned count, uint32_t code)
+{
+  exi_write_bits(w, 32 - __builtin_clz(count), code);
+}
+
+static void fp_write_simple(struct exi_writer *w, unsigned n, uint32_t v)
+{
+  exi_write_bits(w, n + 2, (v & ((1u << n) - 1)) << 1);
+}
+
+static void fp_write_field(struct exi_writer *w, unsigned n, uint32_t v)
+{
+  exi_write_bits(w, n + 3, (v & ((1u << n) - 1)) << 1);
+}
+
+static void fp_write_value(struct exi_writer *w, const struct iso1PhysicalValueType *v)
+{
+  if ((v->Multiplier < -3) || (v->Multiplier > 3) || ((unsigned)v->Unit > iso1unitSymbolType_Wh)) w->error = true;
+  fp_write_field(w, 3, v->Multiplier + 3);
+  fp_write_field(w, 3, v->Unit);
+  exi_write_bits(w, 2, 0);
+  exi_write_int(w, v->Value);
+  exi_write_bits(w, 2, 0);
+}
+
+/* as the generic path fills it in: no EVSEIsolationStatus */
+
+static void fp_write_evse_status(struct exi_writer *w, iso1DC_EVSEStatusCodeType code)
+{
+  exi_write_bits(w, 2, 0);
+  exi_write_uint(w, max_delay);
+  exi_write_bits(w, 1, 0);
+  fp_write_field(w, 2, iso1EVSENotificationType_None);
+  fp_event_out(w, 2, 1);
+  fp_write_simple(w, 4, code);
+  fp_event_out(w, 1, 0);
+}
+
+/*
+ResponseCode, DC_EVSEStatus, EVSEPresentVoltage, EVSEPresentCurrent, the three LimitAchieved,
+EVSEMaximumVoltageLimit?, EVSEMaximumCurrentLimit?, EVSEMaximumPowerLimit?, EVSEID,
+SAScheduleTupleID, MeterInfo?, ReceiptRequired?; as the generic path fills it in, with both
+current and power limits, and EVSEID and SAScheduleTupleID left zero
+*/
+
+static void fp_write_current_demand(struct exi_writer *w, const struct charge_loop_res *res)
+{
+  fp_write_field(w, 5, res->ResponseCode);
+  fp_event_out(w, 1, 0);
+  fp_write_evse_status(w, iso1DC_EVSEStatusCodeType_EVSE_Ready);
+  fp_event_out(w, 1, 0);
+  fp_write_value(w, &res->EVSEPresentVoltage);
+  fp_event_out(w, 1, 0);
+  fp_write_value(w, &res->EVSEPresentCurrent);
+  fp_write_field(w, 1, res->EVSECurrentLimitAchieved);
+  fp_write_field(w, 1, 0);
+  fp_write_field(w, 1, res->EVSEPowerLimitAchieved);
+  fp_event_out(w, 4, 1);
+  fp_write_value(w, &res->EVSEMaximumCurrentLimit);
+  fp_event_out(w, 2, 0);
+  fp_write_value(w, &res->EVSEMaximumPowerLimit);
+
+  /* an empty string: its length plus two (zero and one are string table hits) */
+  exi_write_bits(w, 2, 0);
+  exi_write_uint(w, 2);
+  exi_write_bits(w, 1, 0);
+
+  /* SAIDType is 1..255, sent less one */
+  fp_write_field(w, 8, (uint8_t)(0 - 1));
+  fp_event_out(w, 3, 2);
+}
+
+static void fp_write_pre_charge(struct exi_writer *w, const struct charge_loop_res *res)
+{
+  fp_write_field(w, 5, res->ResponseCode);
+  fp_event_out(w, 1, 0);
+  fp_write_evse_status(w, iso1DC_EVSEStatusCodeType_EVSE_NotReady);
+  fp_event_out(w, 1, 0);
+  fp_write_value(w, &res->EVSEPresentVoltage);
+  fp_event_out(w, 1, 0);
+}
+
+/* classify an EXI payload (V2GTP header stripped) as one of the fast-path requests, or MSG_NONE */
+
+static enum v2g_msg fastpath_peek(const struct fastpath *fp, const uint8_t *exi, size_t len)
+{
+  for (unsigned f = 0; f < ARRAY_SIZE(fastpath_msgs); f++)
+  {
+    const struct fastpath_sig *sig = &fp->sig[fastpath_msgs[f]];
+    if (!sig->bytes || (len < sig->bytes)) continue;
+
+    uint8_t diff = 0;
+    for (unsigned i = 0; i < sig->bytes; i++)
+      diff |= (exi[i] ^ sig->ref[i]) & sig->mask[i];
+    if (!diff) return fastpath_msgs[f];
+  }
+
+  return MSG_NONE;
+}
+
+/* decode a peeked request into its compact form; false means "use the generic path" */
+
+static bool fastpath_decode(const struct fastpath *fp, enum v2g_msg msg, const uint8_t *exi, size_t len, struct charge_loop_req *req)
+{
+  const struct fastpath_sig *sig = &fp->sig[msg];
+  struct exi_reader r = { .buf = exi, .bit = sig->sid_bit, .end = len * 8 };
+
+  if (!sig->bytes || (len < sig->bytes)) return false;
+
+  req->msg = msg;
+  for (unsigned i = 0; i < SESSION_ID_LEN; i++)
+    req->sid[i] = exi_read_bits(&r, 8);
+
+  r.bit = sig->body_bit;
+  if (MSG_CURRENT_DEMAND == msg)
+    fp_read_current_demand(&r, req);
+  else
+    fp_read_pre_charge(&r, req);
+
+  /* Body and V2G_Message end */
+  fp_event(&r, 1);
+  fp_event(&r, 1);
+  return !r.error;
+}
+
+/* encode the response to a fast-path request, V2GTP header included; returns its length (zero on error) */
+
+static size_t fastpath_encode(const struct fastpath *fp, const struct charge_loop_req *req, const struct charge_loop_res *res, uint8_t *out, size_t outsize)
+{
+  const struct fastpath_prefix *prefix = &fp->res[req->msg];
+  uint8_t *exi = out + V2GTP_HEADER_LENGTH;
+  size_t bytes = (prefix->body_bit + 7) / 8;
+
+  if (!prefix->body_bit || (outsize < V2GTP_HEADER_LENGTH + bytes)) return 0;
+
+  memcpy(exi, prefix->ref, bytes);
+  put_bytes_at_bit(exi, prefix->sid_bit, req->sid, SESSION_ID_LEN);
+
+  struct exi_writer w;
+  exi_writer_init(&w, exi, prefix->body_bit, (outsize - V2GTP_HEADER_LENGTH) * 8);
+  if (MSG_CURRENT_DEMAND == req->msg)
+    fp_write_current_demand(&w, res);
+  else
+    fp_write_pre_charge(&w, res);
+
+  /* Body and V2G_Message end */
+  fp_event_out(&w, 1, 0);
+  fp_event_out(&w, 1, 0);
+
+  size_t len = exi_write_finish(&w);
+  if (!len || write_v2gtpHeader(out, len, V2GTP_EXI_TYPE)) return 0;
+  return V2GTP_HEADER_LENGTH + len;
+}
+
+/*
+the reference: OpenV2G, used at startup to calibrate and check the above, never per message
+*/
+
+typedef void (*fastpath_req_builder)(struct iso1BodyType *body);
+
+static void fp_session_setup_req(struct iso1BodyType *b) { b->SessionSetupReq_isUsed = 1u; b->SessionSetupReq.EVCCID.bytesLen = 6; }
+static void fp_service_discovery_req(struct iso1BodyType *b) { b->ServiceDiscoveryReq_isUsed = 1u; }
+static void fp_payment_service_selection_req(struct iso1BodyType *b) { b->PaymentServiceSelectionReq_isUsed = 1u; }
+static void fp_payment_details_req(struct iso1BodyType *b) { b->PaymentDetailsReq_isUsed = 1u; }
+static void fp_authorization_req(struct iso1BodyType *b) { b->AuthorizationReq_isUsed = 1u; }
+static void fp_charge_parameter_discovery_req(struct iso1BodyType *b) { b->ChargeParameterDiscoveryReq_isUsed = 1u; b->ChargeParameterDiscoveryReq.DC_EVChargeParameter_isUsed = 1u; }
+static void fp_cable_check_req(struct iso1BodyType *b) { b->CableCheckReq_isUsed = 1u; }
+static void fp_pre_charge_req(struct iso1BodyType *b) { b->PreChargeReq_isUsed = 1u; }
+static void fp_power_delivery_req(struct iso1BodyType *b) { b->PowerDeliveryReq_isUsed = 1u; }
+static void fp_current_demand_req(struct iso1BodyType *b) { b->CurrentDemandReq_isUsed = 1u; }
+static void fp_welding_detection_req(struct iso1BodyType *b) { b->WeldingDetectionReq_isUsed = 1u; }
+static void fp_session_stop_req(struct iso1BodyType *b) { b->SessionStopReq_isUsed = 1u; }
+
+static const fastpath_req_builder fastpath_req_builders[MSG_COUNT] =
+{
+  [MSG_SESSION_SETUP] = fp_session_setup_req,
+  [MSG_SERVICE_DISCOVERY] = fp_service_discovery_req,
+  [MSG_PAYMENT_SERVICE_SELECTION] = fp_payment_service_selection_req,
+  [MSG_PAYMENT_DETAILS] = fp_payment_details_req,
+  [MSG_AUTHORIZATION] = fp_authorization_req,
+  [MSG_CHARGE_PARAMETER_DISCOVERY] = fp_charge_parameter_discovery_req,
+  [MSG_CABLE_CHECK] = fp_cable_check_req,
+  [MSG_PRE_CHARGE] = fp_pre_charge_req,
+  [MSG_POWER_DELIVERY] = fp_power_delivery_req,
+  [MSG_CURRENT_DEMAND] = fp_current_demand_req,
+  [MSG_WELDING_DETECTION] = fp_welding_detection_req,
+  [MSG_SESSION_STOP] = fp_session_stop_req,
+};
+
+/* the optional elements of a sample CurrentDemandReq */
+
+#define FP_EV_MAX_VOLTAGE 0x01
+#define FP_EV_MAX_CURRENT 0x02
+#define FP_EV_MAX_POWER 0x04
+#define FP_BULK_COMPLETE 0x08
+#define FP_TIME_TO_FULL 0x10
+#define FP_TIME_TO_BULK 0x20
+
+/* what the compact codec is checked against OpenV2G with: every option, and values at the edges of each encoding */
+
+struct fastpath_sample
+{
+  uint8_t sid[SESSION_ID_LEN];
+  int ready, error, soc;
+  struct iso1PhysicalValueType voltage, current;
+  int complete;
+  unsigned options;
+  struct charge_loop_res res;
+};
+
+#define FP_V(m, u, v) { .Multiplier = (m), .Unit = iso1unitSymbolType_##u, .Value = (v) }
+
+static const struct fastpath_sample fastpath_samples[] =
+{
+  {
+    { 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0 }, 1, 0, 42, FP_V(0, V, 400), FP_V(0, A, 125), 0, 0,
+    { iso1responseCodeType_OK, FP_V(0, V, 398), FP_V(0, A, 124), FP_V(0, A, 200), FP_V(3, W, 150), 0, 0 }
+  },
+  {
+    { 0xff, 0x00, 0xff, 0x00, 0x80, 0x7f, 0x01, 0xfe }, 0, 5, 100, FP_V(-1, V, 4000), FP_V(1, A, -20), 1,
+    FP_EV_MAX_VOLTAGE | FP_EV_MAX_CURRENT | FP_EV_MAX_POWER | FP_BULK_COMPLETE | FP_TIME_TO_FULL | FP_TIME_TO_BULK,
+    { iso1responseCodeType_FAILED_SequenceError, FP_V(-1, V, 3998), FP_V(-3, A, -32768), FP_V(2, A, 32767), FP_V(-2, W, 1), 1, 1 }
+  },
+  {
+    { 0 }, 1, 11, 0, FP_V(3, V, 32767), FP_V(-3, A, -32768), 0, FP_EV_MAX_POWER | FP_TIME_TO_FULL,
+    { iso1responseCodeType_FAILED_UnknownSession, FP_V(0, V, 0), FP_V(0, A, -1), FP_V(0, A, 127), FP_V(0, W, 128), 1, 0 }
+  },
+  {
+    { 1, 2, 3, 4, 5, 6, 7, 8 }, 1, 0, 99, FP_V(0, V, 127), FP_V(0, A, 128), 1, FP_BULK_COMPLETE | FP_TIME_TO_BULK,
+    { iso1responseCodeType_FAILED, FP_V(0, V, -128), FP_V(0, A, -129), FP_V(0, A, 16383), FP_V(0, W, 16384), 0, 1 }
+  },
+  {
+    { 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55, 0xaa, 0x55 }, 0, 1, 1, FP_V(0, h, 0), FP_V(0, Wh, -1), 0, FP_EV_MAX_VOLTAGE | FP_EV_MAX_CURRENT,
+    { iso1responseCodeType_OK, FP_V(1, m, 1), FP_V(-1, s, -16384), FP_V(3, A, 255), FP_V(-3, W, 256), 0, 0 }
+  },
+};
+
+#undef FP_V
+
+static int fastpath_stream_encode(struct iso1EXIDocument *doc, uint8_t *buf, size_t size, size_t *len)
+{
+  bitstream_t stream;
+  size_t pos = 0;
+
+  stream.size = size;
+  stream.data = buf;
+  stream.pos = &pos;
+
+  int errn = encode_iso1ExiDocument(&stream, doc);
+  *len = pos;
+  return errn;
+}
+
+static void fastpath_doc_init(struct iso1EXIDocument *doc, const uint8_t *sid)
+{
+  memset(doc, 0, sizeof(*doc));
+  doc->V2G_Message_isUsed = 1u;
+  doc->V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+  memcpy(doc->V2G_Message.Header.SessionID.bytes, sid, SESSION_ID_LEN);
+}
+
+/* EXI-encode a reference request (no V2GTP header) with every SessionID byte set to fill */
+
+static int fastpath_encode_ref(struct iso1EXIDocument *doc, fastpath_req_builder build, uint8_t fill, uint8_t *buf, size_t size, size_t *len)
+{
+  uint8_t sid[SESSION_ID_LEN];
+
+  memset(sid, fill, sizeof(sid));
+  fastpath_doc_init(doc, sid);
+  build(&doc->V2G_Message.Body);
+  return fastpath_stream_encode(doc, buf, size, len);
+}
+
+/* a sample request, with OpenV2G (no V2GTP header) */
+
+static int fastpath_encode_sample_req(struct iso1EXIDocument *doc, enum v2g_msg msg, const struct fastpath_sample *s, uint8_t *buf, size_t size, size_t *len)
+{
+  struct iso1DC_EVStatusType status = { .EVReady = s->ready, .EVErrorCode = (iso1DC_EVErrorCodeType)s->error, .EVRESSSOC = (int8_t)s->soc };
+
+  fastpath_doc_init(doc, s->sid);
+
+  if (MSG_CURRENT_DEMAND == msg)
+  {
+    doc->V2G_Message.Body.CurrentDemandReq_isUsed = 1u;
+    struct iso1CurrentDemandReqType *body = &doc->V2G_Message.Body.CurrentDemandReq;
+    body->DC_EVStatus = status;
+    body->EVTargetVoltage = s->voltage;
+    body->EVTargetCurrent = s->current;
+    body->ChargingComplete = s->complete;
+    body->EVMaximumVoltageLimit_isUsed = !!(s->options & FP_EV_MAX_VOLTAGE);
+    body->EVMaximumVoltageLimit = s->voltage;
+    body->EVMaximumCurrentLimit_isUsed = !!(s->options & FP_EV_MAX_CURRENT);
+    body->EVMaximumCurrentLimit = s->current;
+    body->EVMaximumPowerLimit_isUsed = !!(s->options & FP_EV_MAX_POWER);
+    body->EVMaximumPowerLimit = s->res.EVSEMaximumPowerLimit;
+    body->BulkChargingComplete_isUsed = !!(s->options & FP_BULK_COMPLETE);
+    body->BulkChargingComplete = !s->complete;
+    body->RemainingTimeToFullSoC_isUsed = !!(s->options & FP_TIME_TO_FULL);
+    body->RemainingTimeToFullSoC = s->res.EVSEPresentCurrent;
+    body->RemainingTimeToBulkSoC_isUsed = !!(s->options & FP_TIME_TO_BULK);
+    body->RemainingTimeToBulkSoC = s->res.EVSEPresentVoltage;
+  }
+  else
+  {
+    doc->V2G_Message.Body.PreChargeReq_isUsed = 1u;
+    struct iso1PreChargeReqType *body = &doc->V2G_Message.Body.PreChargeReq;
+    body->DC_EVStatus = status;
+    body->EVTargetVoltage = s->voltage;
+    body->EVTargetCurrent = s->current;
+  }
+
+  return fastpath_stream_encode(doc, buf, size, len);
+}
+
+/* a response as the generic path builds it, with OpenV2G (no V2GTP header) */
+
+static int fastpath_encode_sample_res(struct iso1EXIDocument *doc, enum v2g_msg msg, const uint8_t *sid, const struct charge_loop_res *res, uint8_t *buf, size_t size, size_t *len)
+{
+  fastpath_doc_init(doc, sid);
+
+  if (MSG_CURRENT_DEMAND == msg)
+  {
+    doc->V2G_Message.Body.CurrentDemandRes_isUsed = 1u;
+    struct iso1CurrentDemandResType *body = &doc->V2G_Message.Body.CurrentDemandRes;
+    body->ResponseCode = res->ResponseCode;
+    body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+    body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+    body->DC_EVSEStatus.EVSEStatusCode = iso1DC_EVSEStatusCodeType_EVSE_Ready;
+    body->EVSEPresentVoltage = res->EVSEPresentVoltage;
+    body->EVSEPresentCurrent = res->EVSEPresentCurrent;
+    body->EVSEMaximumCurrentLimit_isUsed = 1u;
+    body->EVSEMaximumCurrentLimit = res->EVSEMaximumCurrentLimit;
+    body->EVSEMaximumPowerLimit_isUsed = 1u;
+    body->EVSEMaximumPowerLimit = res->EVSEMaximumPowerLimit;
+    body->EVSECurrentLimitAchieved = res->EVSECurrentLimitAchieved;
+    body->EVSEPowerLimitAchieved = res->EVSEPowerLimitAchieved;
+  }
+  else
+  {
+    doc->V2G_Message.Body.PreChargeRes_isUsed = 1u;
+    struct iso1PreChargeResType *body = &doc->V2G_Message.Body.PreChargeRes;
+    body->ResponseCode = res->ResponseCode;
+    body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+    body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+    body->EVSEPresentVoltage = res->EVSEPresentVoltage;
+  }
+
+  return fastpath_stream_encode(doc, buf, size, len);
+}
+
+static bool fp_same_value(const struct iso1PhysicalValueType *a, const struct iso1PhysicalValueType *b)
+{
+  return (a->Multiplier == b->Multiplier) && (a->Unit == b->Unit) && (a->Value == b->Value);
+}
+
+/* learn the request's prefix: where its SessionID and its body content start */
+
+static bool fastpath_calibrate_req(struct fastpath *fp, struct iso1EXIDocument *doc, enum v2g_msg m, uint8_t ref[MSG_COUNT][256], const size_t *len)
+{
+  static uint8_t buf[256];
+  struct fastpath_sample sample = fastpath_samples[0];
+  struct fastpath_sig *sig = &fp->sig[m];
+  size_t buflen;
+  uint32_t sid_bit, bit;
+
+  /* the SessionID is the one run of bits that differs between all zeroes and all ones */
+  if (fastpath_encode_ref(doc, fastpath_req_builders[m], 0xFF, buf, sizeof(buf), &buflen)) return false;
+  if ((buflen != len[m]) || ((SESSION_ID_LEN * 8) != diff_bit_run(ref[m], buf, buflen, &sid_bit))) return false;
+
+  /* the first bit of the body content is DC_EVStatus's event code, then EVReady's, its CH, its value */
+  static uint8_t ready[256];
+  size_t readylen;
+  sample.ready = 0;
+  if (fastpath_encode_sample_req(doc, m, &sample, buf, sizeof(buf), &buflen)) return false;
+  sample.ready = 1;
+  if (fastpath_encode_sample_req(doc, m, &sample, ready, sizeof(ready), &readylen)) return false;
+  int diff = first_diff_bit(buf, buflen, ready, readylen);
+  if ((diff < 3) || (diff - 3 > FASTPATH_SIG_BYTES * 8) || (diff - 3 < (int)(sid_bit + SESSION_ID_LEN * 8))) return false;
+
+  sig->sid_bit = sid_bit;
+  sig->body_bit = diff - 3;
+  sig->bytes = (sig->body_bit + 7) / 8;
+  memset(sig->mask, 0, sizeof(sig->mask));
+  for (bit = 0; bit < sig->body_bit; bit++)
+    if ((bit < sid_bit) || (bit >= sid_bit + SESSION_ID_LEN * 8))
+      sig->mask[bit >> 3] |= 0x80 >> (bit & 7);
+  memcpy(sig->ref, ref[m], FASTPATH_SIG_BYTES);
+
+  /* no other request may look like this one */
+  for (int o = 0; o < MSG_COUNT; o++)
+    if ((o != (int)m) && len[o] && (m == fastpath_peek(fp, ref[o], len[o]))) return false;
+
+  return true;
+}
+
+/* learn the response's prefix: where its SessionID and its body content (ResponseCode's event code) start */
+
+static bool fastpath_calibrate_res(struct fastpath *fp, struct iso1EXIDocument *doc, enum v2g_msg m)
+{
+  static uint8_t zero[256], ones[256];
+  struct charge_loop_res res = fastpath_samples[0].res;
+  struct fastpath_prefix *prefix = &fp->res[m];
+  uint8_t sid[SESSION_ID_LEN];
+  size_t zerolen, len;
+  uint32_t sid_bit;
+
+  memset(sid, 0x00, sizeof(sid));
+  if (fastpath_encode_sample_res(doc, m, sid, &res, zero, sizeof(zero), &zerolen)) return false;
+  memset(sid, 0xFF, sizeof(sid));
+  if (fastpath_encode_sample_res(doc, m, sid, &res, ones, sizeof(ones), &len)) return false;
+  if ((len != zerolen) || ((SESSION_ID_LEN * 8) != diff_bit_run(zero, ones, len, &sid_bit))) return false;
+
+  /* ResponseCode is 5 bits after its event code and CH; 16 differs from OK in the first */
+  res.ResponseCode = (iso1responseCodeType)16;
+  memset(sid, 0x00, sizeof(sid));
+  if (fastpath_encode_sample_res(doc, m, sid, &res, ones, sizeof(ones), &len)) return false;
+  int diff = first_diff_bit(zero, zerolen, ones, len);
+  if ((diff < 2) || (diff - 2 > FASTPATH_SIG_BYTES * 8) || (diff - 2 < (int)(sid_bit + SESSION_ID_LEN * 8))) return false;
+
+  prefix->sid_bit = sid_bit;
+  prefix->body_bit = diff - 2;
+  memcpy(prefix->ref, zero, FASTPATH_SIG_BYTES);
+  return true;
+}
+
+/* decode every sample request, and encode the responses, and compare with OpenV2G */
+
+static bool fastpath_check(const struct fastpath *fp, struct iso1EXIDocument *doc, enum v2g_msg m)
+{
+  static uint8_t buf[256], theirs[256 + V2GTP_HEADER_LENGTH], ours[256 + V2GTP_HEADER_LENGTH];
+  size_t len;
+
+  for (unsigned i = 0; i < ARRAY_SIZE(fastpath_samples); i++)
+  {
+    const struct fastpath_sample *s = &fastpath_samples[i];
+    struct charge_loop_req req;
+
+    if (fastpath_encode_sample_req(doc, m, s, buf, sizeof(buf), &len)) return false;
+    if ((m != fastpath_peek(fp, buf, len)) || !fastpath_decode(fp, m, buf, len, &req)) return false;
+    if (memcmp(req.sid, s->sid, SESSION_ID_LEN) || (req.DC_EVStatus.EVReady != s->ready) || ((int)req.DC_EVStatus.EVErrorCode != s->error) || (req.DC_EVStatus.EVRESSSOC != s->soc)) return false;
+    if (!fp_same_value(&req.EVTargetVoltage, &s->voltage) || !fp_same_value(&req.EVTargetCurrent, &s->current)) return false;
+    if ((MSG_CURRENT_DEMAND == m) && (req.ChargingComplete != s->complete)) return false;
+
+    /* a truncated request must be turned down, not read past its end */
+    if (fastpath_decode(fp, m, buf, len - 1, &req)) return false;
+
+    if (fastpath_encode_sample_res(doc, m, s->sid, &s->res, theirs + V2GTP_HEADER_LENGTH, sizeof(theirs) - V2GTP_HEADER_LENGTH, &len)) return false;
+    if (write_v2gtpHeader(theirs, len, V2GTP_EXI_TYPE)) return false;
+    len += V2GTP_HEADER_LENGTH;
+    req.msg = m;
+    memcpy(req.sid, s->sid, SESSION_ID_LEN);
+    if ((len != fastpath_encode(fp, &req, &s->res, ours, sizeof(ours))) || memcmp(ours, theirs, len)) return false;
+  }
+
+  return true;
+}
+
+/* returns false if a message type has been left to the generic path */
+
+static bool fastpath_init(struct fastpath *fp)
+{
+  static uint8_t ref[MSG_COUNT][256];
+  size_t len[MSG_COUNT];
+  bool all = true;
+
+  memset(fp, 0, sizeof(*fp));
+
+  struct iso1EXIDocument *doc = malloc(sizeof(*doc));
+  if (!doc) return false;
+
+  for (int m = 0; m < MSG_COUNT; m++)
+  {
+    len[m] = 0;
+    if (!fastpath_req_builders[m]) continue;
+    if (fastpath_encode_ref(doc, fastpath_req_builders[m], 0x00, ref[m], sizeof(ref[m]), &len[m])) len[m] = 0;
+  }
+
+  for (unsigned f = 0; f < ARRAY_SIZE(fastpath_msgs); f++)
+  {
+    enum v2g_msg m = fastpath_msgs[f];
+    if (len[m] && fastpath_calibrate_req(fp, doc, m, ref, len) && fastpath_calibrate_res(fp, doc, m) && fastpath_check(fp, doc, m)) continue;
+
+    memset(&fp->sig[m], 0, sizeof(fp->sig[m]));
+    memset(&fp->res[m], 0, sizeof(fp->res[m]));
+    all = false;
+  }
+
+  free(doc);
+  return all;
+}
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+the session journal: what each session did and the energy it drew, for billing and
+post-mortems
+
+Records are 64 bytes and are appended to a file that is preallocated (so that the disk
+cannot fill up under it) and memory-mapped.  A worker appends one by taking the next
+slot with an atomic add and copying the record into it: no lock and no system call.  A
+record lives in the page cache from the moment it is copied, so it survives the process
+crashing; a background thread makes the file durable with fdatasync(), one sync for
+everything appended in the last journal_commit_ms (group commit), so no request ever
+waits for the disk.  The thread sleeps while nothing is appended: it parks on an
+eventfd, and the first writer to fill a slot after that wakes it, with one non-blocking
+write.  Writers count the slots they have filled as well as those they take, so a sync
+covers every record that was complete when it started, however many workers were
+writing, and one finished later makes the file dirty again.  Each record carries a
+checksum, and a record that was being written when the power went (or a slot never
+written) fails it, so a reader simply skips such slots.
+
+Files are named redux-<start time>-<n>.journal and hold at most journal_file_size bytes.
+The thread prepares the next one when the current one is half full and switches to it
+at seven eighths; a writer that still holds the old one finishes first (the users
+count), and the old file is then synced and cut to what was written.  A record finds
+the current file full only if the thread has fallen far behind, and is then dropped
+and counted.
+
+journal2csv.c reads the files.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/eventfd.h>
+#include <linux/magic.h>
+
+#define JOURNAL_MAGIC 0x4c4e4a52u  /* "RJNL" */
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 4096   /* records start on a page of their own */
+
+enum journal_type
+{
+  JOURNAL_SESSION_START = 1,       /* value: the SchemaID */
+  JOURNAL_SESSION_JOIN,            /* an EV rejoined a paused (or lost) session */
+  JOURNAL_PRE_CHARGE,              /* targets, and what was measured */
+  JOURNAL_CURRENT_DEMAND,          /* the same, and the energy so far */
+  JOURNAL_SESSION_STOP,            /* value: enum journal_stop; the energy in total */
+};
+
+enum journal_stop
+{
+  JOURNAL_STOP_TERMINATE,
+  JOURNAL_STOP_PAUSE,
+  JOURNAL_STOP_EXPIRE,             /* paused or lost, and not rejoined in time */
+};
+
+struct journal_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  int64_t created_ns;              /* CLOCK_REALTIME */
+  uint64_t first_seq;              /* of the first record in this file */
+  uint32_t index;                  /* n in the name */
+};
+
+struct journal_record
+{
+  uint32_t check;                  /* FNV-1a of the rest of the record; zero in a slot never written */
+  uint8_t type;                    /* enum journal_type */
+  uint8_t worker;
+  uint8_t connector;
+  uint8_t reserved;
+  uint64_t seq;                    /* journal-wide, in the order the slots were taken (a new file skips ahead) */
+  int64_t time_ns;                 /* CLOCK_REALTIME */
+  uint8_t session[8];              /* the SessionID */
+  int32_t target_mv, target_ma;
+  int32_t present_mv, present_ma;
+  uint64_t energy_uj;              /* delivered in the session so far */
+  uint32_t value;                  /* depends on type */
+  uint32_t reserved2;
+};
+
+_Static_assert(64 == sizeof(struct journal_record), "journal records are 64 bytes");
+
+static uint32_t journal_check(const struct journal_record *r)
+{
+  const uint8_t *p = (const uint8_t *)r + sizeof(r->check);
+  uint32_t h = 2166136261u;
+
+  for (size_t i = 0; i < sizeof(*r) - sizeof(r->check); i++)
+  {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+
+  /* zero is kept for the slot nobody wrote */
+  return (h) ? h : 1;
+}
+
+/* the writer's side */
+
+struct journal_file
+{
+  _Atomic uint64_t next;           /* the next slot to take; past capacity once full */
+  _Atomic unsigned users;          /* writers that may be about to take a slot */
+  _Atomic uint64_t filled;         /* slots written in full */
+  struct journal_record *record;   /* the mapping, past the header */
+  uint64_t capacity;
+  uint64_t first_seq;
+  uint64_t synced;                 /* filled, as it was when the last sync started */
+  int fd;
+  char path[256];
+};
+
+static struct
+{
+  _Atomic(struct journal_file *) current; /* NULL while there is no journal */
+  struct journal_file *spare;      /* ready for the switch; the thread's own */
+  struct journal_file file[2];
+  _Atomic uint64_t dropped;
+  _Atomic uint64_t syncs;
+  atomic_bool sleeping;            /* the thread is parked, or about to be */
+  int wake_fd;                     /* eventfd */
+  const char *dir;
+  size_t file_size;
+  uint32_t commit_ms;
+  int64_t started_s;
+  unsigned index;
+  pthread_t tid;
+  atomic_bool running;
+} journal;
+
+static int64_t journal_realtime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/* a record has been written: wake the thread if it is parked */
+
+static void journal_kick(void)
+{
+  /* the count must be visible before sleeping is read, as the thread sets sleeping before it looks */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&journal.sleeping, memory_order_relaxed)) return;
+  if (!atomic_exchange(&journal.sleeping, false)) return;
+
+  const uint64_t one = 1;
+  if (write(journal.wake_fd, &one, sizeof(one)) < 0) return;
+}
+
+/* append a record (the check and seq are filled in); returns false if it was dropped */
+
+static bool journal_append(struct journal_record *r)
+{
+  struct journal_file *f;
+
+  /* once a writer is counted in, the file it holds stays mapped until it leaves */
+  for (;;)
+  {
+    f = atomic_load(&journal.current);
+    if (!f) return false;
+    atomic_fetch_add(&f->users, 1);
+    if (atomic_load(&journal.current) == f) break;
+    atomic_fetch_sub(&f->users, 1);
+  }
+
+  uint64_t slot = atomic_fetch_add_explicit(&f->next, 1, memory_order_relaxed);
+  bool ok = slot < f->capacity;
+
+  if (ok)
+  {
+    r->seq = f->first_seq + slot;
+    r->check = journal_check(r);
+    memcpy(&f->record[slot], r, sizeof(*r));
+    atomic_fetch_add_explicit(&f->filled, 1, memory_order_release);
+  }
+  else
+  {
+    atomic_fetch_add_explicit(&journal.dropped, 1, memory_order_relaxed);
+  }
+
+  atomic_fetch_sub_explicit(&f->users, 1, memory_order_release);
+  if (ok) journal_kick();
+  return ok;
+}
+
+/* the thread's side */
+
+static uint64_t journal_used(struct journal_file *f)
+{
+  uint64_t next = atomic_load(&f->next);
+  return (next < f->capacity) ? next : f->capacity;
+}
+
+static bool journal_open(struct journal_file *f, uint64_t first_seq)
+{
+  snprintf(f->path, sizeof(f->path), "%s/redux-%lld-%04u.journal", journal.dir, (long long)journal.started_s, journal.index);
+
+  f->fd = open(f->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (f->fd < 0) return false;
+
+  /* every block is reserved up front: a write through the mapping cannot then find the disk full */
+  void *p = MAP_FAILED;
+  if (!posix_fallocate(f->fd, 0, journal.file_size))
+    p = mmap(NULL, journal.file_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f->fd, 0);
+
+  if (MAP_FAILED == p)
+  {
+    close(f->fd);
+    unlink(f->path);
+    f->fd = -1;
+    return false;
+  }
+
+  struct journal_header *h = p;
+  h->magic = JOURNAL_MAGIC;
+  h->version = JOURNAL_VERSION;
+  h->header_size = JOURNAL_HEADER_SIZE;
+  h->record_size = sizeof(struct journal_record);
+  h->created_ns = journal_realtime();
+  h->first_seq = first_seq;
+  h->index = journal.index++;
+
+  f->record = (struct journal_record *)((uint8_t *)p + JOURNAL_HEADER_SIZE);
+  f->capacity = (journal.file_size - JOURNAL_HEADER_SIZE) / sizeof(struct journal_record);
+  f->first_seq = first_seq;
+  f->synced = 0;
+  atomic_store(&f->filled, 0);
+  atomic_store(&f->users, 0);
+  atomic_store(&f->next, 0);
+  return true;
+}
+
+/* has a record been written since the last sync started? */
+
+static bool journal_dirty(struct journal_file *f)
+{
+  return atomic_load_explicit(&f->filled, memory_order_acquire) != f->synced;
+}
+
+static void journal_sync(struct journal_file *f)
+{
+  /*
+  every record counted here is in the mapping, so the sync covers it; one still being
+  written by any number of other workers is counted later, and makes the file dirty again
+  */
+  uint64_t filled = atomic_load_explicit(&f->filled, memory_order_acquire);
+  if (filled == f->synced) return;
+
+  /* on Linux this also writes back the pages dirtied through the mapping */
+  fdatasync(f->fd);
+  f->synced = filled;
+  atomic_fetch_add_explicit(&journal.syncs, 1, memory_order_relaxed);
+}
+
+/* once no writer holds it: sync what was written and cut off the rest */
+
+static void journal_retire(struct journal_file *f)
+{
+  const struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000 };
+
+  while (atomic_load(&f->users))
+    nanosleep(&pause, NULL);
+
+  uint64_t used = journal_used(f);
+  munmap((uint8_t *)f->record - JOURNAL_HEADER_SIZE, journal.file_size);
+  if (ftruncate(f->fd, JOURNAL_HEADER_SIZE + used * sizeof(struct journal_record))) fprintf(stderr, "journal: cannot truncate %s\n", f->path);
+  fdatasync(f->fd);
+  close(f->fd);
+  f->fd = -1;
+}
+
+static void *journal_thread(void *arg)
+{
+  const struct timespec period = { .tv_sec = journal.commit_ms / 1000, .tv_nsec = (journal.commit_ms % 1000) * 1000000l };
+  uint64_t v;
+
+  while (atomic_load(&journal.running))
+  {
+    struct journal_file *f = atomic_load(&journal.current);
+
+    /* nothing new: park until a writer fills a slot; one filled meanwhile is seen by the second look */
+    if (!journal_dirty(f))
+    {
+      atomic_store(&journal.sleeping, true);
+      if (journal_dirty(f) || !atomic_load(&journal.running))
+      {
+        atomic_store(&journal.sleeping, false);
+        continue;
+      }
+      if (read(journal.wake_fd, &v, sizeof(v)) < 0) nanosleep(&period, NULL);
+      continue;
+    }
+
+    /* let the records of the next commit_ms gather, so that one sync covers them all */
+    nanosleep(&period, NULL);
+    uint64_t used = journal_used(f);
+
+    if (!journal.spare && (used >= f->capacity / 2))
+    {
+      struct journal_file *next = (f == &journal.file[0]) ? &journal.file[1] : &journal.file[0];
+      /* writers may still take slots in this one until the switch, so its whole range of seq is left to it */
+      if (journal_open(next, f->first_seq + f->capacity)) journal.spare = next;
+    }
+
+    if (journal.spare && (used >= f->capacity - f->capacity / 8))
+    {
+      atomic_store(&journal.current, journal.spare);
+      journal.spare = NULL;
+      journal_retire(f);
+      continue;
+    }
+
+    journal_sync(f);
+  }
+
+  return NULL;
+}
+
+/* open the first file in dir (made if need be) and start the commit thread; returns false if there is no journal */
+
+static bool journal_init(const char *dir, size_t file_size, uint32_t commit_ms)
+{
+  if (mkdir(dir, 0755) && (EEXIST != errno)) return false;
+
+  /* records there do not outlive the power going */
+  struct statfs fs;
+  if (!statfs(dir, &fs) && (TMPFS_MAGIC == fs.f_type)) fprintf(stderr, "WARNING: the session journal in %s is on tmpfs, and is lost on power failure\n", dir);
+
+  journal.dir = dir;
+  journal.file_size = file_size;
+  journal.commit_ms = (commit_ms) ? commit_ms : 1;
+  journal.started_s = journal_realtime() / 1000000000ll;
+  journal.index = 0;
+  journal.file[0].fd = journal.file[1].fd = -1;
+
+  if ((file_size < JOURNAL_HEADER_SIZE + 64 * sizeof(struct journal_record)) || !journal_open(&journal.file[0], 0)) return false;
+
+  journal.wake_fd = eventfd(0, EFD_CLOEXEC);
+  atomic_store(&journal.current, &journal.file[0]);
+  atomic_store(&journal.running, true);
+  if ((journal.wake_fd < 0) || pthread_create(&journal.tid, NULL, journal_thread, NULL))
+  {
+    atomic_store(&journal.running, false);
+    atomic_store(&journal.current, NULL);
+    journal_retire(&journal.file[0]);
+    if (journal.wake_fd >= 0) close(journal.wake_fd);
+    return false;
+  }
+
+  return true;
+}
+
+/* stop the thread, then sync and close everything; the workers must have stopped appending */
+
+static void journal_deinit(void)
+{
+  if (!atomic_load(&journal.running)) return;
+
+  const uint64_t one = 1;
+  atomic_store(&journal.running, false);
+  if (write(journal.wake_fd, &one, sizeof(one)) < 0) return;
+  pthread_join(journal.tid, NULL);
+  close(journal.wake_fd);
+
+  struct journal_file *f = atomic_load(&journal.current);
+  atomic_store(&journal.current, NULL);
+  journal_retire(f);
+
+  /* a spare that was never switched to holds nothing */
+  if (journal.spare)
+  {
+    munmap((uint8_t *)journal.spare->record - JOURNAL_HEADER_SIZE, journal.file_size);
+    close(journal.spare->fd);
+    unlink(journal.spare->path);
+    journal.spare = NULL;
+  }
+}
+
+#endif
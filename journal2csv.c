@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+offline reader for the session journal (see journal.h)
+
+Reads the journal files named on the command line, in that order, and writes their
+records to stdout as CSV, one line per record.  Slots that were never written, and
+records whose checksum fails (being written when the power went), are skipped; the
+damaged records, and files that are not journals, are reported on stderr.  A file
+still being written by redux can be read: its unused slots are simply skipped.
+
+Times are UTC, voltages in V, currents in A and energy in Wh.  The last column depends
+on the record: the SchemaID for a session start, the reason for a session stop.
+
+usage: journal2csv file...
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "journal.h"
+
+static const char *const type_names[] =
+{
+  [JOURNAL_SESSION_START] = "start",
+  [JOURNAL_SESSION_JOIN] = "join",
+  [JOURNAL_PRE_CHARGE] = "precharge",
+  [JOURNAL_CURRENT_DEMAND] = "currentdemand",
+  [JOURNAL_SESSION_STOP] = "stop",
+};
+
+static const char *const stop_names[] =
+{
+  [JOURNAL_STOP_TERMINATE] = "terminate",
+  [JOURNAL_STOP_PAUSE] = "pause",
+  [JOURNAL_STOP_EXPIRE] = "expire",
+};
+
+static unsigned long printed, damaged;
+
+static void print_record(const struct journal_record *r)
+{
+  time_t s = r->time_ns / 1000000000ll;
+  struct tm tm;
+  char when[32];
+
+  gmtime_r(&s, &tm);
+  strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+
+  printf("%llu,%s.%06lldZ,%u,%u,", (unsigned long long)r->seq, when, (long long)(r->time_ns % 1000000000ll) / 1000, r->worker, r->connector);
+  for (unsigned i = 0; i < sizeof(r->session); i++)
+    printf("%02X", r->session[i]);
+
+  const char *type = ((r->type < sizeof(type_names) / sizeof(*type_names)) && type_names[r->type]) ? type_names[r->type] : "unknown";
+  printf(",%s,%.3f,%.3f,%.3f,%.3f,%.6f,", type, r->target_mv / 1000.0, r->target_ma / 1000.0, r->present_mv / 1000.0, r->present_ma / 1000.0, r->energy_uj / 3.6e9);
+
+  switch (r->type)
+  {
+  case JOURNAL_SESSION_START:
+  case JOURNAL_SESSION_JOIN:
+    printf("%u\n", r->value);
+    break;
+  case JOURNAL_SESSION_STOP:
+    printf("%s\n", ((r->value < sizeof(stop_names) / sizeof(*stop_names)) && stop_names[r->value]) ? stop_names[r->value] : "unknown");
+    break;
+  default:
+    printf("\n");
+    break;
+  }
+
+  printed++;
+}
+
+static bool read_file(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  struct journal_header h;
+  if ((1 != fread(&h, sizeof(h), 1, f)) || (JOURNAL_MAGIC != h.magic) || (JOURNAL_VERSION != h.version) || (sizeof(struct journal_record) != h.record_size) || fseek(f, h.header_size, SEEK_SET))
+  {
+    fprintf(stderr, "%s: not a journal\n", path);
+    fclose(f);
+    return false;
+  }
+
+  struct journal_record r;
+  while (1 == fread(&r, sizeof(r), 1, f))
+  {
+    if (!r.check) continue;
+    if (journal_check(&r) == r.check)
+      print_record(&r);
+    else
+      damaged++;
+  }
+
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s file...\n", argv[0]);
+    return -1;
+  }
+
+  bool ok = true;
+  printf("seq,time,worker,connector,session,type,target_v,target_a,present_v,present_a,energy_wh,value\n");
+  for (int i = 1; i < argc; i++)
+    ok = read_file(argv[i]) && ok;
+
+  fprintf(stderr, "%lu records, %lu damaged records skipped\n", printed, damaged);
+  return (ok) ? 0 : -1;
+}
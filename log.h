@@ -0,0 +1,399 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+asynchronous logging
+
+Logging threads never format text or touch a file descriptor.  Each one appends binary
+records (timestamp, level, format string pointer, up to LOG_MAX_ARGS integer arguments
+and optionally a copy of a frame for hex dumping) to its own single-producer ring, with
+no locks and no system calls.  A background thread drains the rings, formats the
+records and writes them out.  If a ring is full the record is dropped and counted, so
+a slow console can never stall the event loop.
+
+While records keep coming, the log thread drains every LOG_BATCH_MS.  Once a pass finds
+nothing it parks on an eventfd and sets log_sleeping, and the first record after that
+writes the eventfd to wake it: one non-blocking system call per burst, none while the
+thread is awake, and no wakeups at all while nothing is logged.
+
+Levels below LOG_LEVEL (default LOG_LEVEL_INFO) compile to nothing.  Frame hex dumps
+(LOG_FRAME) are debug records that are only compiled in with -DLOG_HEXDUMP as well.
+
+Format strings must be string literals; each conversion consumes one argument:
+  %d %u %x  integers (stored as int64_t)
+  %s        a string that outlives the process (a literal or static table); pass it through LOG_STR()
+  %%        a literal percent sign
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 65536
+#endif
+
+#ifndef LOG_MAX_THREADS
+#define LOG_MAX_THREADS 16
+#endif
+
+#ifndef LOG_BATCH_MS
+#define LOG_BATCH_MS 2
+#endif
+
+#define LOG_MAX_ARGS 4
+#define LOG_MAX_DUMP 512
+
+_Static_assert(0 == (LOG_RING_SIZE & (LOG_RING_SIZE - 1)), "LOG_RING_SIZE must be a power of two");
+
+struct log_record
+{
+  uint32_t size;            /* whole record, a multiple of 8; zero marks the unused end of the ring */
+  uint8_t level;
+  uint8_t nargs;
+  uint16_t datalen;
+  uint64_t ns;
+  const char *fmt;
+  int64_t args[LOG_MAX_ARGS];
+  uint8_t data[];
+};
+
+struct log_ring
+{
+  _Atomic uint32_t head;    /* written only by the owning thread */
+  _Atomic uint32_t tail;    /* written only by the log thread */
+  _Atomic uint32_t dropped;
+  uint32_t dropped_reported;
+  _Alignas(64) uint8_t buf[LOG_RING_SIZE];
+};
+
+static struct log_ring log_rings[LOG_MAX_THREADS];
+static _Atomic unsigned log_ring_count;
+static __thread struct log_ring *log_local;
+
+static pthread_t log_tid;
+static atomic_bool log_running;
+static atomic_bool log_sleeping;  /* the log thread is parked, or about to be */
+static int log_wake_fd = -1;
+static int log_fd = -1;
+static uint64_t log_epoch;
+
+static uint64_t log_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a record has been queued: wake the log thread if it is parked (the first record after it parks does) */
+
+static void log_kick(void)
+{
+  /* the record must be visible before log_sleeping is read, as the log thread sets log_sleeping before it looks */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&log_sleeping, memory_order_relaxed)) return;
+  if (!atomic_exchange(&log_sleeping, false)) return;
+
+  const uint64_t one = 1;
+  if (write(log_wake_fd, &one, sizeof(one)) < 0) return;
+}
+
+static void log_emit(uint8_t level, const char *fmt, const int64_t *args, unsigned nargs, const void *data, size_t datalen)
+{
+  struct log_ring *r = log_local;
+  if (!r) return;
+
+  if (nargs > LOG_MAX_ARGS) nargs = LOG_MAX_ARGS;
+  if (datalen > LOG_MAX_DUMP) datalen = LOG_MAX_DUMP;
+
+  uint32_t size = (offsetof(struct log_record, data) + datalen + 7) & ~7u;
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  uint32_t off = head & (LOG_RING_SIZE - 1);
+  uint32_t contiguous = LOG_RING_SIZE - off;
+
+  /* records never wrap; the leftover at the end of the ring is skipped */
+  uint32_t need = size + ((contiguous < size) ? contiguous : 0);
+  if (LOG_RING_SIZE - (head - tail) < need)
+  {
+    atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+    log_kick();
+    return;
+  }
+
+  if (contiguous < size)
+  {
+    ((struct log_record *)(r->buf + off))->size = 0;
+    head += contiguous;
+    off = 0;
+  }
+
+  struct log_record *rec = (struct log_record *)(r->buf + off);
+  rec->size = size;
+  rec->level = level;
+  rec->nargs = nargs;
+  rec->datalen = datalen;
+  rec->ns = log_now();
+  rec->fmt = fmt;
+  memcpy(rec->args, args, nargs * sizeof(*args));
+  if (datalen) memcpy(rec->data, data, datalen);
+
+  atomic_store_explicit(&r->head, head + size, memory_order_release);
+  log_kick();
+}
+
+#define LOG_STR(s) ((int64_t)(intptr_t)(s))
+
+#define LOG_AT(level, fmt, ...) \
+  log_emit((level), (fmt), (const int64_t[]){ 0, ##__VA_ARGS__ } + 1, sizeof((const int64_t[]){ 0, ##__VA_ARGS__ }) / sizeof(int64_t) - 1, NULL, 0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if defined(LOG_HEXDUMP) && (LOG_LEVEL >= LOG_LEVEL_DEBUG)
+#define LOG_FRAME(label, data, len) log_emit(LOG_LEVEL_DEBUG, label " %u bytes", (const int64_t[]){ (int64_t)(len) }, 1, (data), (len))
+#else
+#define LOG_FRAME(label, data, len) do {} while (0)
+#endif
+
+/* the log thread's side */
+
+static size_t log_format(char *out, size_t size, const struct log_record *rec)
+{
+  static const char levels[] = "EWID";
+  size_t n = 0;
+  unsigned arg = 0;
+
+  uint64_t ns = rec->ns - log_epoch;
+  n += snprintf(out + n, size - n, "[%6u.%06u] %c ", (unsigned)(ns / 1000000000ull), (unsigned)(ns / 1000 % 1000000), levels[rec->level & 3]);
+
+  for (const char *p = rec->fmt; *p && (n < size - 1); p++)
+  {
+    if (('%' != *p) || !p[1])
+    {
+      out[n++] = *p;
+      continue;
+    }
+
+    int64_t v = (arg < rec->nargs) ? rec->args[arg] : 0;
+
+    switch (*++p)
+    {
+    case 'd': n += snprintf(out + n, size - n, "%lld", (long long)v); arg++; break;
+    case 'u': n += snprintf(out + n, size - n, "%llu", (unsigned long long)v); arg++; break;
+    case 'x': n += snprintf(out + n, size - n, "%llx", (unsigned long long)v); arg++; break;
+    case 's': n += snprintf(out + n, size - n, "%s", (v) ? (const char *)(intptr_t)v : "(null)"); arg++; break;
+    default: out[n++] = *p; break;
+    }
+
+    if (n >= size) n = size - 1;
+  }
+
+  if (n < size - 1) out[n++] = '\n';
+
+  for (unsigned i = 0; (i < rec->datalen) && (n < size - 64); i += 16)
+  {
+    n += snprintf(out + n, size - n, "  %04x:", i);
+    for (unsigned j = i; (j < i + 16) && (j < rec->datalen); j++)
+      n += snprintf(out + n, size - n, " %02x", rec->data[j]);
+    out[n++] = '\n';
+  }
+
+  return n;
+}
+
+static void log_write_all(const char *buf, size_t len)
+{
+  while (len)
+  {
+    ssize_t rc = write(log_fd, buf, len);
+    if (rc <= 0) return;
+    buf += rc;
+    len -= rc;
+  }
+}
+
+/* format everything queued so far; returns true if there was anything */
+
+static bool log_drain(void)
+{
+  static char out[16384];
+  size_t n = 0;
+  bool any = false;
+  unsigned count = atomic_load_explicit(&log_ring_count, memory_order_acquire);
+  if (count > LOG_MAX_THREADS) count = LOG_MAX_THREADS;
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    struct log_ring *r = &log_rings[i];
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    while (tail != head)
+    {
+      uint32_t off = tail & (LOG_RING_SIZE - 1);
+      const struct log_record *rec = (const struct log_record *)(r->buf + off);
+
+      if (!rec->size)
+      {
+        tail += LOG_RING_SIZE - off;
+        continue;
+      }
+
+      /* the longest record formats to well under 4k */
+      if (n > sizeof(out) - 4096)
+      {
+        log_write_all(out, n);
+        n = 0;
+      }
+
+      n += log_format(out + n, sizeof(out) - n, rec);
+      tail += rec->size;
+      any = true;
+    }
+
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+
+    uint32_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    if (dropped != r->dropped_reported)
+    {
+      n += snprintf(out + n, sizeof(out) - n, "log: %u records dropped\n", dropped - r->dropped_reported);
+      r->dropped_reported = dropped;
+    }
+  }
+
+  if (n) log_write_all(out, n);
+  return any;
+}
+
+/* is anything queued? */
+
+static bool log_pending(void)
+{
+  unsigned count = atomic_load_explicit(&log_ring_count, memory_order_acquire);
+  if (count > LOG_MAX_THREADS) count = LOG_MAX_THREADS;
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    struct log_ring *r = &log_rings[i];
+    if (atomic_load_explicit(&r->head, memory_order_acquire) != atomic_load_explicit(&r->tail, memory_order_relaxed)) return true;
+    if (atomic_load_explicit(&r->dropped, memory_order_relaxed) != r->dropped_reported) return true;
+  }
+
+  return false;
+}
+
+static void *log_thread(void *arg)
+{
+  const struct timespec batch = { .tv_sec = 0, .tv_nsec = LOG_BATCH_MS * 1000000l };
+  uint64_t v;
+
+  while (atomic_load(&log_running))
+  {
+    /* busy: let records gather for a while, then drain them all in one write */
+    if (log_drain())
+    {
+      nanosleep(&batch, NULL);
+      continue;
+    }
+
+    /* idle: park until a record arrives; one that came in meanwhile is seen by the second look */
+    atomic_store(&log_sleeping, true);
+    if (log_pending() || !atomic_load(&log_running))
+    {
+      atomic_store(&log_sleeping, false);
+      continue;
+    }
+    if (read(log_wake_fd, &v, sizeof(v)) < 0) nanosleep(&batch, NULL);
+  }
+
+  log_drain();
+  return NULL;
+}
+
+/* give the calling thread a ring of its own; threads that never attach log nothing */
+
+static bool log_attach(void)
+{
+  if (log_local) return true;
+
+  /* rings are handed out once and never returned */
+  unsigned i = atomic_fetch_add(&log_ring_count, 1);
+  if (i >= LOG_MAX_THREADS) return false;
+
+  log_local = &log_rings[i];
+  return true;
+}
+
+static bool log_init(int fd)
+{
+  log_fd = fd;
+  log_epoch = log_now();
+  log_wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (log_wake_fd < 0) return false;
+  atomic_store(&log_running, true);
+
+  if (pthread_create(&log_tid, NULL, log_thread, NULL))
+  {
+    atomic_store(&log_running, false);
+    close(log_wake_fd);
+    log_wake_fd = -1;
+    return false;
+  }
+
+  return log_attach();
+}
+
+/* write out whatever is still queued and stop the log thread */
+
+static void log_deinit(void)
+{
+  if (!atomic_load(&log_running)) return;
+
+  const uint64_t one = 1;
+  atomic_store(&log_running, false);
+  if (write(log_wake_fd, &one, sizeof(one)) < 0) return;
+  pthread_join(log_tid, NULL);
+  close(log_wake_fd);
+  log_wake_fd = -1;
+}
+
+#endif
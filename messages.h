@@ -0,0 +1,48 @@
+#ifndef _MESSAGES_H
+#define _MESSAGES_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/* protocol-neutral identifiers for the V2G request/response pairs handled by the SECC */
+
+enum v2g_msg
+{
+  MSG_NONE,
+  MSG_SESSION_SETUP,
+  MSG_SERVICE_DISCOVERY,
+  MSG_SERVICE_DETAIL,
+  MSG_PAYMENT_SERVICE_SELECTION,
+  MSG_PAYMENT_DETAILS,
+  MSG_AUTHORIZATION,
+  MSG_CHARGE_PARAMETER_DISCOVERY,
+  MSG_CABLE_CHECK,
+  MSG_PRE_CHARGE,
+  MSG_POWER_DELIVERY,
+  MSG_CURRENT_DEMAND,
+  MSG_WELDING_DETECTION,
+  MSG_SESSION_STOP,
+  MSG_COUNT
+};
+
+static const char *const msg_names[MSG_COUNT] =
+{
+  [MSG_NONE] = "None",
+  [MSG_SESSION_SETUP] = "SessionSetup",
+  [MSG_SERVICE_DISCOVERY] = "ServiceDiscovery",
+  [MSG_SERVICE_DETAIL] = "ServiceDetail",
+  [MSG_PAYMENT_SERVICE_SELECTION] = "PaymentServiceSelection",
+  [MSG_PAYMENT_DETAILS] = "PaymentDetails",
+  [MSG_AUTHORIZATION] = "Authorization",
+  [MSG_CHARGE_PARAMETER_DISCOVERY] = "ChargeParameterDiscovery",
+  [MSG_CABLE_CHECK] = "CableCheck",
+  [MSG_PRE_CHARGE] = "PreCharge",
+  [MSG_POWER_DELIVERY] = "PowerDelivery",
+  [MSG_CURRENT_DEMAND] = "CurrentDemand",
+  [MSG_WELDING_DETECTION] = "WeldingDetection",
+  [MSG_SESSION_STOP] = "SessionStop",
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+counters, gauges and fixed-bucket latency histograms, rendered in the Prometheus text
+exposition format
+
+Each thread that handles requests owns a struct metrics and is its only writer, so an
+update is a relaxed load and store (a plain add, without a locked instruction) rather
+than a read-modify-write.  Readers may be on any thread; rendering sums all the sets
+it is given, so the output looks the same however the work is spread.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "messages.h"
+
+typedef _Atomic uint64_t metric_t;
+
+/* upper bounds of the latency buckets, in nanoseconds; a final +Inf bucket is implicit */
+
+static const uint64_t latency_bounds_ns[] =
+{
+  5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+  25000000, 50000000, 100000000, 250000000, 500000000, 1000000000,
+};
+
+#define LATENCY_BUCKETS (sizeof(latency_bounds_ns) / sizeof(*latency_bounds_ns) + 1)
+
+struct histogram
+{
+  metric_t bucket[LATENCY_BUCKETS]; /* per bucket, not cumulative */
+  metric_t sum_ns;
+};
+
+struct metrics
+{
+  metric_t sdp_requests;
+  metric_t sdp_responses;
+  metric_t sdp_rate_limited;
+  metric_t connections_accepted;
+  metric_t connections_rejected;
+  metric_t handshakes_ok;
+  metric_t handshakes_failed;
+  metric_t bad_frames;
+  metric_t decode_errors;
+  metric_t encode_errors;
+  metric_t unhandled;
+  metric_t tls_handshakes_full;
+  metric_t tls_handshakes_resumed;
+  metric_t tls_handshakes_failed;
+  struct histogram tls_handshake;
+  metric_t power_dropped;
+  metric_t budget_rejected;
+  metric_t budget_recomputes;
+  metric_t auth_lookups;
+  metric_t auth_cache_hits;
+  metric_t auth_ongoing;
+  metric_t auth_timeouts;
+  metric_t auth_rejected;
+  metric_t journal_records;
+  metric_t journal_dropped;
+  metric_t journal_syncs;
+  metric_t capture_frames;
+  metric_t capture_truncated;
+  metric_t slac_frames;
+  metric_t slac_matches;
+  metric_t slac_failed;
+  metric_t requests[MSG_COUNT];
+  struct histogram latency[MSG_COUNT];
+
+  /* gauges */
+  metric_t connections_active;
+  metric_t sessions_active;
+  metric_t budget_sessions;
+  metric_t budget_granted_w;
+};
+
+static void metric_add(metric_t *m, uint64_t n)
+{
+  atomic_store_explicit(m, atomic_load_explicit(m, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void metric_inc(metric_t *m)
+{
+  metric_add(m, 1);
+}
+
+static void metric_set(metric_t *m, uint64_t v)
+{
+  atomic_store_explicit(m, v, memory_order_relaxed);
+}
+
+static uint64_t metric_get(const metric_t *m)
+{
+  return atomic_load_explicit((metric_t *)m, memory_order_relaxed);
+}
+
+static void histogram_observe(struct histogram *h, uint64_t ns)
+{
+  unsigned i = 0;
+  while ((i < LATENCY_BUCKETS - 1) && (ns > latency_bounds_ns[i])) i++;
+  metric_inc(&h->bucket[i]);
+  metric_add(&h->sum_ns, ns);
+}
+
+/* MSG_NONE stands for supportedAppProtocolReq, which precedes any V2G message */
+
+static const char *metrics_msg_label(enum v2g_msg msg)
+{
+  return (MSG_NONE == msg) ? "SupportedAppProtocol" : msg_names[msg];
+}
+
+#define METRICS_SUM(sets, count, field) ({ uint64_t _sum = 0; for (unsigned _i = 0; _i < (count); _i++) _sum += metric_get(&(sets)[_i]->field); _sum; })
+
+#define METRICS_PUT(...) do { int _rc = snprintf(out + n, size - n, __VA_ARGS__); if (_rc > 0) n += _rc; if (n >= size) return size - 1; } while (0)
+
+#define METRICS_COUNTER(name, help, field) do { \
+  METRICS_PUT("# HELP " name " " help "\n# TYPE " name " counter\n" name " %llu\n", (unsigned long long)METRICS_SUM(sets, count, field)); \
+} while (0)
+
+#define METRICS_GAUGE(name, help, field) do { \
+  METRICS_PUT("# HELP " name " " help "\n# TYPE " name " gauge\n" name " %llu\n", (unsigned long long)METRICS_SUM(sets, count, field)); \
+} while (0)
+
+/* render the sum of count metric sets; returns the length written (truncated to fit) */
+
+static size_t metrics_format(const struct metrics *const *sets, unsigned count, char *out, size_t size)
+{
+  size_t n = 0;
+
+  METRICS_COUNTER("redux_sdp_requests_total", "SDP requests received.", sdp_requests);
+  METRICS_COUNTER("redux_sdp_responses_total", "SDP responses sent.", sdp_responses);
+  METRICS_COUNTER("redux_sdp_rate_limited_total", "SDP requests dropped by the per-source rate limit.", sdp_rate_limited);
+  METRICS_COUNTER("redux_connections_accepted_total", "TCP connections accepted.", connections_accepted);
+  METRICS_COUNTER("redux_connections_rejected_total", "TCP connections refused because the connection table was full.", connections_rejected);
+  METRICS_GAUGE("redux_connections_active", "TCP connections currently open.", connections_active);
+  METRICS_GAUGE("redux_sessions_active", "V2G sessions held, including paused ones.", sessions_active);
+  METRICS_COUNTER("redux_bad_frames_total", "Connections dropped for a malformed V2GTP header.", bad_frames);
+  METRICS_COUNTER("redux_decode_errors_total", "EXI documents that failed to decode.", decode_errors);
+  METRICS_COUNTER("redux_encode_errors_total", "EXI responses that failed to encode.", encode_errors);
+  METRICS_COUNTER("redux_unhandled_total", "Requests of a type the SECC does not answer.", unhandled);
+  METRICS_COUNTER("redux_power_targets_dropped_total", "Power module targets lost because the controller fell behind.", power_dropped);
+  METRICS_GAUGE("redux_budget_sessions", "Sessions sharing the site power budget.", budget_sessions);
+  METRICS_GAUGE("redux_budget_granted_watts", "Power granted to those sessions, in total.", budget_granted_w);
+  METRICS_COUNTER("redux_budget_recomputes_total", "Times the site power budget was shared out again.", budget_recomputes);
+  METRICS_COUNTER("redux_budget_rejected_total", "Sessions given no power because every budget slot was taken.", budget_rejected);
+  METRICS_COUNTER("redux_auth_lookups_total", "Authorization lookups sent to the backend.", auth_lookups);
+  METRICS_COUNTER("redux_auth_cache_hits_total", "Authorizations decided from the cache, without a lookup.", auth_cache_hits);
+  METRICS_COUNTER("redux_auth_ongoing_total", "Authorization responses with EVSEProcessing=Ongoing.", auth_ongoing);
+  METRICS_COUNTER("redux_auth_timeouts_total", "Lookups the backend did not answer in time.", auth_timeouts);
+  METRICS_COUNTER("redux_auth_rejected_total", "Sessions refused authorization.", auth_rejected);
+  METRICS_COUNTER("redux_journal_records_total", "Records appended to the session journal.", journal_records);
+  METRICS_COUNTER("redux_journal_dropped_total", "Journal records lost because the file was full.", journal_dropped);
+  METRICS_COUNTER("redux_journal_syncs_total", "Journal group commits (fdatasync calls).", journal_syncs);
+  METRICS_COUNTER("redux_capture_frames_total", "Frames written to the capture.", capture_frames);
+  METRICS_COUNTER("redux_capture_truncated_total", "Captured frames that did not fit a slot and were cut short.", capture_truncated);
+  METRICS_COUNTER("redux_slac_frames_total", "HomePlug frames taken from the SLAC receive rings.", slac_frames);
+  METRICS_COUNTER("redux_slac_matches_total", "EVs matched by SLAC.", slac_matches);
+  METRICS_COUNTER("redux_slac_failed_total", "SLAC exchanges that timed out or were refused.", slac_failed);
+
+  METRICS_PUT("# HELP redux_handshakes_total supportedAppProtocol negotiations, by result.\n# TYPE redux_handshakes_total counter\n");
+  METRICS_PUT("redux_handshakes_total{result=\"ok\"} %llu\n", (unsigned long long)METRICS_SUM(sets, count, handshakes_ok));
+  METRICS_PUT("redux_handshakes_total{result=\"failed\"} %llu\n", (unsigned long long)METRICS_SUM(sets, count, handshakes_failed));
+
+  METRICS_PUT("# HELP redux_tls_handshakes_total TLS handshakes, by result; a resumed one skips the key exchange.\n# TYPE redux_tls_handshakes_total counter\n");
+  METRICS_PUT("redux_tls_handshakes_total{result=\"full\"} %llu\n", (unsigned long long)METRICS_SUM(sets, count, tls_handshakes_full));
+  METRICS_PUT("redux_tls_handshakes_total{result=\"resumed\"} %llu\n", (unsigned long long)METRICS_SUM(sets, count, tls_handshakes_resumed));
+  METRICS_PUT("redux_tls_handshakes_total{result=\"failed\"} %llu\n", (unsigned long long)METRICS_SUM(sets, count, tls_handshakes_failed));
+
+  METRICS_PUT("# HELP redux_tls_handshake_seconds Time from accepting a TLS connection to its completed handshake.\n# TYPE redux_tls_handshake_seconds histogram\n");
+  {
+    uint64_t cumulative = 0;
+
+    for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+    {
+      cumulative += METRICS_SUM(sets, count, tls_handshake.bucket[b]);
+      if (b < LATENCY_BUCKETS - 1)
+        METRICS_PUT("redux_tls_handshake_seconds_bucket{le=\"%g\"} %llu\n", latency_bounds_ns[b] / 1e9, (unsigned long long)cumulative);
+      else
+        METRICS_PUT("redux_tls_handshake_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+    }
+
+    METRICS_PUT("redux_tls_handshake_seconds_sum %.9f\n", METRICS_SUM(sets, count, tls_handshake.sum_ns) / 1e9);
+    METRICS_PUT("redux_tls_handshake_seconds_count %llu\n", (unsigned long long)cumulative);
+  }
+
+  METRICS_PUT("# HELP redux_requests_total Requests answered, by message type.\n# TYPE redux_requests_total counter\n");
+  for (int m = 0; m < MSG_COUNT; m++)
+  {
+    uint64_t v = METRICS_SUM(sets, count, requests[m]);
+    if (v) METRICS_PUT("redux_requests_total{msg=\"%s\"} %llu\n", metrics_msg_label(m), (unsigned long long)v);
+  }
+
+  METRICS_PUT("# HELP redux_response_seconds Time from a complete request frame to its queued response, by message type.\n# TYPE redux_response_seconds histogram\n");
+  for (int m = 0; m < MSG_COUNT; m++)
+  {
+    uint64_t cumulative = 0;
+
+    /* message types never seen are left out altogether */
+    if (!METRICS_SUM(sets, count, requests[m])) continue;
+
+    for (unsigned b = 0; b < LATENCY_BUCKETS; b++)
+    {
+      cumulative += METRICS_SUM(sets, count, latency[m].bucket[b]);
+      if (b < LATENCY_BUCKETS - 1)
+        METRICS_PUT("redux_response_seconds_bucket{msg=\"%s\",le=\"%g\"} %llu\n", metrics_msg_label(m), latency_bounds_ns[b] / 1e9, (unsigned long long)cumulative);
+      else
+        METRICS_PUT("redux_response_seconds_bucket{msg=\"%s\",le=\"+Inf\"} %llu\n", metrics_msg_label(m), (unsigned long long)cumulative);
+    }
+
+    METRICS_PUT("redux_response_seconds_sum{msg=\"%s\"} %.9f\n", metrics_msg_label(m), METRICS_SUM(sets, count, latency[m].sum_ns) / 1e9);
+    METRICS_PUT("redux_response_seconds_count{msg=\"%s\"} %llu\n", metrics_msg_label(m), (unsigned long long)cumulative);
+  }
+
+  return n;
+}
+
+#endif
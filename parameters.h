@@ -13,9 +13,15 @@
 #include "appHandEXIDatatypesDecoder.h"
 #include "iso1EXIDatatypesEncoder.h"
 #include "iso1EXIDatatypesDecoder.h"
+#include "dinEXIDatatypesEncoder.h"
+#include "dinEXIDatatypesDecoder.h"
 
 static const iso1EnergyTransferModeType dcmode = iso1EnergyTransferModeType_DC_extended;
 
+/* the same mode as DIN 70121 names it, when offering it and when the EV requests it */
+static const dinEVSESupportedEnergyTransferType din_dcmode = dinEVSESupportedEnergyTransferType_DC_extended;
+static const dinEVRequestedEnergyTransferType din_dcmode_requested = dinEVRequestedEnergyTransferType_DC_extended;
+
 static const struct iso1DC_EVSEChargeParameterType dccharge =
 {
   .DC_EVSEStatus = 0,
@@ -54,8 +60,92 @@ static const struct iso1DC_EVSEChargeParameterType dccharge =
 };
 
 static const char iso1string[] = "urn:iso:15118:2:2013:MsgDef";
+static const char dinstring[] = "urn:din:70121:2012:MsgDef";
 
 static const uint16_t max_delay = 12;
 
+/* number of concurrent ISO 15118-2 TCP connections served by one event loop */
+#define MAX_CONNECTIONS 512
+
+/* most network interfaces (connectors) served by one process */
+#define MAX_INTERFACES 8
+
+/* most worker threads (-t); each has its own event loop and log ring */
+#define MAX_WORKERS 16
+
+/* number of readiness events fetched per epoll_wait() call */
+#define MAX_EVENTS 64
+
+/* ISO 15118-2 SECC timeouts, in milliseconds */
+static const uint32_t communication_setup_timeout_ms = 20000; /* V2G_SECC_CommunicationSetup_Timeout: connection to SessionSetupReq */
+static const uint32_t sequence_timeout_ms = 60000;            /* V2G_SECC_Sequence_Timeout: response to next request */
+
+/* how long a session without a connection (paused, or its link lost) is held for the EV to rejoin */
+static const uint32_t session_linger_ms = 600000;
+
+/* a power module measurement older than this is not reported (as if there were none), in milliseconds */
+static const uint32_t power_stale_ms = 500;
+
+/* what the site's feeder can supply to all connectors together, in watts */
+static const uint32_t site_power_budget_w = 4000;
+
+/* a change in what a session wants or draws that is smaller than this (in watts) does not re-share the budget */
+static const uint32_t budget_hysteresis_w = 50;
+
+/* each connector's priority: sessions that all want more than their share split the budget in these proportions */
+static const uint8_t connector_weight[MAX_INTERFACES] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+
+/* how long after a failed connect to the authorization backend (AUTH_SOCKET_PATH, see auth.h) it is tried again, in milliseconds */
+static const uint32_t auth_retry_ms = 1000;
+
+/*
+how long a lookup may take before the backend is taken to be unavailable, in milliseconds, from the
+first attempt; this is also the longest AuthorizationReq is answered EVSEProcessing=Ongoing, so keep
+it well below V2G_EVCC_Ongoing_Timeout (60 s), at which the EV gives up
+*/
+static const uint32_t auth_timeout_ms = 10000;
+
+/* whether a session is authorized while the backend is unavailable */
+static const bool auth_offline_accept = true;
+
+/* how long a decision is cached, in seconds, unless the backend says otherwise */
+static const uint32_t auth_cache_ttl_s = 3600;
+
+/* SDP requests answered per source address: sdp_burst at once, then sdp_rate a second */
+static const uint32_t sdp_rate = 10;
+static const uint32_t sdp_burst = 5;
+
+/*
+the session journal (see journal.h): where its files go (made if missing; it must be on
+persistent storage, as records on tmpfs are lost on power failure), the most each may
+hold, and how often it is synced to disk, in milliseconds
+*/
+static const char journal_dir[] = "/var/lib/redux";
+static const size_t journal_file_size = 64 << 20;
+static const uint32_t journal_commit_ms = 20;
+
+/* the most the capture written with -w may hold (see capture.h); once full, it goes round and the oldest traffic is overwritten */
+static const size_t capture_file_size = 64 << 20;
+
+/* the PLC modem's address, for CM_SET_KEY.REQ with -s (the local management address of Qualcomm Atheros modems) */
+static const uint8_t slac_modem_mac[6] = { 0x00, 0xb0, 0x52, 0x00, 0x00, 0x01 };
+
+/* UNIX socket that hands a Prometheus text snapshot of the metrics to every client */
+static const char metrics_socket_path[] = "/tmp/redux.metrics";
+
+/* directory that Chrome trace dumps are written to */
+static const char trace_dir[] = "/tmp";
+
+/* TLS (for EVs that ask for it in SDP): the SECC certificate chain and its key, both PEM */
+static const char tls_cert_file[] = "/etc/redux/secc.pem";
+static const char tls_key_file[] = "/etc/redux/secc.key";
+
+/* ISO 15118-2 cipher suites; OpenSSL has no static ECDH, so only the ECDHE one is offered */
+static const char tls_ciphers[] = "ECDHE-ECDSA-AES128-SHA256";
+
+/* TLS sessions held for resumption by session ID, and how long each may be resumed for, in seconds */
+static const long tls_session_cache_size = 4096;
+static const long tls_session_timeout_s = 86400;
+
 #endif
 
@@ -0,0 +1,271 @@
+#ifndef _POWER_H
+#define _POWER_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+the power modules: targets out, measurements back
+
+A backend is picked at startup.  "echo" (the default) has no power electronics behind
+it and reports every target straight back as the measurement.  "shm" exchanges them with
+a separate power-controller process through a shared-memory region (POSIX shm,
+POWER_SHM_NAME) that holds one channel per worker, and everything in a channel has
+exactly one writer and one reader: no lock, no system call and no wakeup.
+
+Targets go out in order through a ring that the worker produces and the controller
+consumes; a record is passed with a plain store and a release of the ring index.
+Measurements come back through a mailbox per connector, a triple buffer: the
+controller writes a record into its own buffer and swaps it with the middle one, the
+worker swaps the middle one with its own when it holds something new.  Unlike a queue
+it cannot fill up or go stale while a worker is idle, and a reader always gets the
+newest measurement.  The controller polls the target rings at its own control rate and
+publishes each connector's measurement to the channel that last set its target, so a
+response reports what was measured at most one control period earlier.  A measurement
+older than power_stale_ms is not reported at all.
+
+This header is the whole interface: the controller includes it too (see powersim.c).
+Values are signed milli-units (mV, mA) and timestamps CLOCK_MONOTONIC nanoseconds,
+which both processes read from the same clock.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define POWER_SHM_NAME "/redux-power"
+#define POWER_MAGIC 0x52505752u  /* "RWPR" */
+#define POWER_VERSION 1
+
+#define POWER_CHANNELS 16         /* at least MAX_WORKERS */
+#define POWER_CONNECTORS 8        /* at least MAX_INTERFACES */
+#define POWER_RING 64
+
+_Static_assert(0 == (POWER_RING & (POWER_RING - 1)), "POWER_RING must be a power of two");
+
+/* target flags */
+#define POWER_ENABLE 0x01         /* output on (otherwise off, contactors open) */
+
+struct power_record
+{
+  uint64_t ns;                    /* when the target was set or the measurement taken */
+  int32_t voltage_mv;
+  int32_t current_ma;
+  uint8_t connector;
+  uint8_t flags;
+  uint16_t reserved;
+};
+
+struct power_ring
+{
+  _Alignas(64) _Atomic uint32_t head; /* written only by the producer */
+  _Alignas(64) _Atomic uint32_t tail; /* written only by the consumer */
+  _Alignas(64) struct power_record slot[POWER_RING];
+};
+
+#define POWER_FRESH 0x4u          /* in middle: it holds a record the reader has not taken */
+
+struct power_mailbox
+{
+  _Alignas(64) _Atomic uint32_t middle; /* index of the buffer between the two sides, | POWER_FRESH */
+  uint32_t back;                  /* the writer's buffer */
+  uint32_t front;                 /* the reader's buffer */
+  struct power_record buf[3];
+};
+
+struct power_channel
+{
+  struct power_ring targets;      /* SECC worker to controller */
+  struct power_mailbox measurements[POWER_CONNECTORS]; /* controller to SECC worker */
+};
+
+struct power_shm
+{
+  _Atomic uint32_t magic;         /* POWER_MAGIC once the rings are ready; cleared when the SECC exits */
+  uint32_t version;
+  uint32_t channels;              /* in use, one per worker */
+  uint32_t connectors;
+  struct power_channel channel[POWER_CHANNELS];
+};
+
+/* returns false (and drops the record) if the ring is full */
+
+static bool power_ring_push(struct power_ring *r, const struct power_record *rec)
+{
+  uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= POWER_RING) return false;
+
+  r->slot[head & (POWER_RING - 1)] = *rec;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return true;
+}
+
+static bool power_ring_pop(struct power_ring *r, struct power_record *rec)
+{
+  uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&r->head, memory_order_acquire)) return false;
+
+  *rec = r->slot[tail & (POWER_RING - 1)];
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+static void power_mailbox_init(struct power_mailbox *m)
+{
+  m->front = 0;
+  atomic_store_explicit(&m->middle, 1, memory_order_relaxed);
+  m->back = 2;
+}
+
+static void power_mailbox_put(struct power_mailbox *m, const struct power_record *rec)
+{
+  m->buf[m->back] = *rec;
+  m->back = atomic_exchange_explicit(&m->middle, m->back | POWER_FRESH, memory_order_acq_rel) & 3;
+}
+
+/* returns false if nothing new has been put since the last take */
+
+static bool power_mailbox_take(struct power_mailbox *m, struct power_record *rec)
+{
+  if (!(atomic_load_explicit(&m->middle, memory_order_relaxed) & POWER_FRESH)) return false;
+
+  m->front = atomic_exchange_explicit(&m->middle, m->front, memory_order_acq_rel) & 3;
+  *rec = m->buf[m->front];
+  return true;
+}
+
+static uint64_t power_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a worker's end of the backend */
+
+struct power_port
+{
+  struct power_channel *channel;  /* shm only */
+  struct power_record latest[POWER_CONNECTORS]; /* the last measurement of each connector */
+};
+
+struct power_backend
+{
+  const char *name;
+  bool (*open)(unsigned channels, unsigned connectors);
+  void (*attach)(struct power_port *port, unsigned channel);
+  bool (*target)(struct power_port *port, const struct power_record *target); /* false if it was dropped */
+  void (*poll)(struct power_port *port, unsigned connector); /* bring latest[connector] up to date */
+  void (*close)(void);
+};
+
+/* echo: the module is ideal and instantaneous */
+
+static bool power_echo_open(unsigned channels, unsigned connectors) { return true; }
+static void power_echo_attach(struct power_port *port, unsigned channel) { memset(port, 0, sizeof(*port)); }
+static void power_echo_poll(struct power_port *port, unsigned connector) {}
+static void power_echo_close(void) {}
+
+static bool power_echo_target(struct power_port *port, const struct power_record *target)
+{
+  struct power_record *m = &port->latest[target->connector];
+  *m = *target;
+  if (!(target->flags & POWER_ENABLE)) m->voltage_mv = m->current_ma = 0;
+  return true;
+}
+
+static const struct power_backend power_echo =
+{
+  .name = "echo",
+  .open = power_echo_open,
+  .attach = power_echo_attach,
+  .target = power_echo_target,
+  .poll = power_echo_poll,
+  .close = power_echo_close,
+};
+
+/* shm: a power-controller process at the other end of the rings */
+
+static struct power_shm *power_shm_region;
+
+static bool power_shm_open(unsigned channels, unsigned connectors)
+{
+  if ((channels > POWER_CHANNELS) || (connectors > POWER_CONNECTORS)) return false;
+
+  int fd = shm_open(POWER_SHM_NAME, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) return false;
+
+  bool ok = !ftruncate(fd, sizeof(struct power_shm));
+  void *p = (ok) ? mmap(NULL, sizeof(struct power_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (MAP_FAILED == p) return false;
+
+  /* a controller still attached from an earlier run sees the magic go and comes back for the fresh rings */
+  struct power_shm *shm = p;
+  atomic_store(&shm->magic, 0);
+  memset(shm->channel, 0, sizeof(shm->channel));
+  for (unsigned i = 0; i < POWER_CHANNELS; i++)
+    for (unsigned c = 0; c < POWER_CONNECTORS; c++)
+      power_mailbox_init(&shm->channel[i].measurements[c]);
+  shm->version = POWER_VERSION;
+  shm->channels = channels;
+  shm->connectors = connectors;
+  atomic_store_explicit(&shm->magic, POWER_MAGIC, memory_order_release);
+
+  power_shm_region = shm;
+  return true;
+}
+
+static void power_shm_attach(struct power_port *port, unsigned channel)
+{
+  memset(port, 0, sizeof(*port));
+  port->channel = &power_shm_region->channel[channel];
+}
+
+static bool power_shm_target(struct power_port *port, const struct power_record *target)
+{
+  return power_ring_push(&port->channel->targets, target);
+}
+
+static void power_shm_poll(struct power_port *port, unsigned connector)
+{
+  power_mailbox_take(&port->channel->measurements[connector], &port->latest[connector]);
+}
+
+static void power_shm_close(void)
+{
+  if (!power_shm_region) return;
+  atomic_store(&power_shm_region->magic, 0);
+  munmap(power_shm_region, sizeof(struct power_shm));
+  shm_unlink(POWER_SHM_NAME);
+  power_shm_region = NULL;
+}
+
+static const struct power_backend power_shm =
+{
+  .name = "shm",
+  .open = power_shm_open,
+  .attach = power_shm_attach,
+  .target = power_shm_target,
+  .poll = power_shm_poll,
+  .close = power_shm_close,
+};
+
+static const struct power_backend *const power_backends[] = { &power_echo, &power_shm };
+
+static const struct power_backend *power_backend_find(const char *name)
+{
+  for (unsigned i = 0; i < sizeof(power_backends) / sizeof(*power_backends); i++)
+    if (!strcmp(power_backends[i]->name, name)) return power_backends[i];
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+simulated power-module controller for redux -p shm
+
+Attaches to the shared-memory region that redux creates (see power.h) and runs a
+control loop at -r Hz: it takes the targets every worker has queued, moves each
+connector's output voltage and current towards its target at a limited slew rate (and
+lets the voltage decay once the output is switched off), and publishes a measurement
+per connector to the worker that last set its target.  If redux restarts, powersim
+waits for the new region and attaches to that.
+
+Once a second it reports how many targets arrived and how long they had waited in the
+rings (from the moment redux queued them to the moment the control loop took them),
+which is the latency the shared memory adds on top of the control period.
+
+usage: powersim [-r control rate in Hz] [-s slew in V/ms] [-q]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "power.h"
+
+/* at most this many target latencies are kept per report */
+#define MAX_SAMPLES 65536
+
+struct connector
+{
+  int owner;                /* channel that last set the target, -1 if none */
+  bool enabled;
+  int32_t target_mv, target_ma;
+  double voltage_mv, current_ma;
+};
+
+static struct connector connectors[POWER_CONNECTORS];
+static uint32_t samples[MAX_SAMPLES];
+static unsigned sample_count;
+static unsigned long targets_taken;
+static volatile sig_atomic_t running = 1;
+
+static void stop(int sig)
+{
+  running = 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* map the region once redux has set it up; returns NULL if interrupted first */
+
+static struct power_shm *attach(void)
+{
+  const struct timespec retry = { .tv_sec = 0, .tv_nsec = 100000000 };
+
+  while (running)
+  {
+    int fd = shm_open(POWER_SHM_NAME, O_RDWR, 0);
+    if (fd >= 0)
+    {
+      struct stat st;
+      void *p = MAP_FAILED;
+      if (!fstat(fd, &st) && (st.st_size >= (off_t)sizeof(struct power_shm)))
+        p = mmap(NULL, sizeof(struct power_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+
+      if (MAP_FAILED != p)
+      {
+        struct power_shm *shm = p;
+        if ((POWER_MAGIC == atomic_load_explicit(&shm->magic, memory_order_acquire)) && (POWER_VERSION == shm->version)) return shm;
+        munmap(p, sizeof(struct power_shm));
+      }
+    }
+
+    nanosleep(&retry, NULL);
+  }
+
+  return NULL;
+}
+
+static void take_targets(struct power_shm *shm, uint64_t now)
+{
+  struct power_record t;
+
+  for (unsigned ch = 0; (ch < shm->channels) && (ch < POWER_CHANNELS); ch++)
+    while (power_ring_pop(&shm->channel[ch].targets, &t))
+    {
+      if (t.connector >= POWER_CONNECTORS) continue;
+
+      struct connector *c = &connectors[t.connector];
+      c->owner = ch;
+      c->enabled = t.flags & POWER_ENABLE;
+      c->target_mv = t.voltage_mv;
+      c->target_ma = t.current_ma;
+
+      targets_taken++;
+      if (sample_count < MAX_SAMPLES) samples[sample_count++] = (now > t.ns) ? (uint32_t)((now - t.ns) / 1000) : 0;
+    }
+}
+
+static double approach(double value, double target, double step)
+{
+  if (value < target) return (target - value < step) ? target : value + step;
+  return (value - target < step) ? target : value - step;
+}
+
+/* one control period of dt seconds */
+
+static void step(struct power_shm *shm, double dt, double slew_mv_per_s, uint64_t now)
+{
+  for (unsigned i = 0; (i < shm->connectors) && (i < POWER_CONNECTORS); i++)
+  {
+    struct connector *c = &connectors[i];
+
+    if (c->enabled)
+    {
+      c->voltage_mv = approach(c->voltage_mv, c->target_mv, slew_mv_per_s * dt);
+      c->current_ma = approach(c->current_ma, c->target_ma, 20000000.0 * dt); /* 20 A/ms */
+    }
+    else
+    {
+      /* the output capacitance discharges through the bleeder with a 100 ms time constant */
+      c->voltage_mv -= c->voltage_mv * dt / 0.1;
+      c->current_ma = 0;
+    }
+
+    if (c->owner < 0) continue;
+
+    struct power_record m = { .ns = now, .voltage_mv = (int32_t)c->voltage_mv, .current_ma = (int32_t)c->current_ma, .connector = i };
+    power_mailbox_put(&shm->channel[c->owner].measurements[i], &m);
+  }
+}
+
+static void report(void)
+{
+  if (!targets_taken) return;
+
+  qsort(samples, sample_count, sizeof(*samples), cmp_u32);
+  printf("%lu targets, ring latency p50 %u us, p99 %u us, max %u us\n", targets_taken,
+    samples[sample_count / 2], samples[(sample_count * 99) / 100], samples[sample_count - 1]);
+
+  for (unsigned i = 0; i < POWER_CONNECTORS; i++)
+    if (connectors[i].owner >= 0)
+      printf("  connector %u: %s %.1f V %.1f A (target %.1f V %.1f A)\n", i, (connectors[i].enabled) ? "on " : "off",
+        connectors[i].voltage_mv / 1000.0, connectors[i].current_ma / 1000.0, connectors[i].target_mv / 1000.0, connectors[i].target_ma / 1000.0);
+
+  fflush(stdout);
+  targets_taken = 0;
+  sample_count = 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-r control rate in Hz] [-s slew in V/ms] [-q]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned rate = 1000;
+  double slew = 0.5;
+  bool quiet = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:s:q")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r': rate = atoi(optarg); break;
+    case 's': slew = atof(optarg); break;
+    case 'q': quiet = true; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if (!rate || (rate > 100000) || (slew <= 0))
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  const uint64_t period_ns = 1000000000ull / rate;
+  const double dt = 1.0 / rate;
+
+  while (running)
+  {
+    struct power_shm *shm = attach();
+    if (!shm) break;
+
+    printf("attached: %u channels, %u connectors, %u Hz\n", shm->channels, shm->connectors, rate);
+    fflush(stdout);
+
+    for (unsigned i = 0; i < POWER_CONNECTORS; i++)
+    {
+      memset(&connectors[i], 0, sizeof(connectors[i]));
+      connectors[i].owner = -1;
+    }
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t report_ns = power_now() + 1000000000ull;
+
+    /* redux clears the magic when it exits, or re-creates the region when it restarts */
+    while (running && (POWER_MAGIC == atomic_load_explicit(&shm->magic, memory_order_acquire)))
+    {
+      uint64_t now = power_now();
+      take_targets(shm, now);
+      step(shm, dt, slew * 1000000.0, now);
+
+      if (now >= report_ns)
+      {
+        if (!quiet) report();
+        report_ns += 1000000000ull;
+      }
+
+      next.tv_nsec += period_ns;
+      while (next.tv_nsec >= 1000000000)
+      {
+        next.tv_nsec -= 1000000000;
+        next.tv_sec++;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    printf("detached\n");
+    fflush(stdout);
+    munmap(shm, sizeof(struct power_shm));
+  }
+
+  return 0;
+}
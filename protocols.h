@@ -0,0 +1,150 @@
+#ifndef _PROTOCOLS_H
+#define _PROTOCOLS_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+registry of the V2G application protocols the SECC can speak
+
+supportedAppProtocolReq offers up to a handful of namespaces; each offer is matched
+against the registry by length and a precomputed FNV-1a hash before the (rare) full
+string comparison.  Of the offers we support with a matching major version, the one
+the EV ranks highest (lowest Priority value) wins; our own priority breaks ties.
+
+Each entry also carries everything that is particular to its protocol when handling a
+V2G message afterwards: how to decode the request, which request it is, a handler per
+message type, how to refuse one and how to encode the reply.  The session rules, the
+metrics and the tracing around them are the same for every protocol, so adding one
+(ISO 15118-20, say) means writing its handlers and adding its entry here.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "appHandEXIDatatypes.h"
+#include "iso1EXIDatatypes.h"
+#include "dinEXIDatatypes.h"
+#include "messages.h"
+
+struct connection;
+struct v2g_request;
+
+/* a request or response in whichever protocol the connection agreed */
+
+union v2g_document
+{
+  struct iso1EXIDocument iso1;
+  struct dinEXIDocument din;
+};
+
+/* act on one request and fill in the response; returns where its ResponseCode is, for refuse() */
+
+typedef void *(*protocol_handler)(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc);
+
+/* answer a whole V2GTP frame by some shortcut; zero means "not handled" and the frame is decoded as usual */
+
+typedef size_t (*protocol_shortcut_fn)(struct connection *conn, uint8_t *in, size_t len, uint8_t *out, size_t outsize);
+
+struct protocol
+{
+  const char *name;
+  const char *ns;           /* ProtocolNamespace as offered in supportedAppProtocolReq */
+  uint16_t ns_len;
+  uint32_t ns_hash;         /* filled in by protocols_init() */
+  uint32_t version_major;
+  uint32_t version_minor;
+  uint8_t priority;         /* our preference when the EV ranks two offers equally; lower wins */
+
+  /* returns an OpenV2G error code, or -1 for a document that is not a V2G_Message */
+  int (*decode)(uint8_t *in, size_t len, union v2g_document *doc);
+  /* MSG_NONE for a request we do not know; *sid is the request's SessionID */
+  enum v2g_msg (*request_type)(const union v2g_document *doc, const uint8_t **sid, uint16_t *sidlen);
+  const protocol_handler *handlers;   /* indexed by enum v2g_msg, NULL where unhandled */
+  /* a blank response echoing the request's SessionID, which SessionSetup overwrites */
+  void (*reply_init)(const union v2g_document *in_doc, union v2g_document *out_doc);
+  /* set the ResponseCode a handler returned to FAILED_UnknownSession or FAILED_SequenceError */
+  void (*refuse)(void *code, bool unknown_session);
+  /* returns an OpenV2G error code; *len is the reply length including the V2GTP header, not yet written */
+  int (*encode)(union v2g_document *doc, uint8_t *out, size_t outsize, size_t *len);
+
+  /* optional: the charging loop without the generic decode (before decode), and pre-encoded static replies (after the session check) */
+  protocol_shortcut_fn fast;
+  size_t (*cached)(struct v2g_request *req, const union v2g_document *in_doc, uint8_t *out, size_t outsize);
+};
+
+static uint32_t ns_hash_step(uint32_t hash, uint8_t c)
+{
+  return (hash ^ c) * 16777619u;
+}
+
+static void protocols_init(struct protocol *table, unsigned count)
+{
+  for (unsigned i = 0; i < count; i++)
+  {
+    uint32_t hash = 2166136261u;
+    table[i].ns_len = strlen(table[i].ns);
+    for (unsigned j = 0; j < table[i].ns_len; j++)
+      hash = ns_hash_step(hash, table[i].ns[j]);
+    table[i].ns_hash = hash;
+  }
+}
+
+static const struct protocol *protocol_match(const struct protocol *table, unsigned count, const struct appHandAppProtocolType *offer)
+{
+  uint16_t len = offer->ProtocolNamespace.charactersLen;
+  uint32_t hash = 2166136261u;
+
+  for (unsigned j = 0; j < len; j++)
+    hash = ns_hash_step(hash, offer->ProtocolNamespace.characters[j]);
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    const struct protocol *p = &table[i];
+    if ((p->ns_len != len) || (p->ns_hash != hash)) continue;
+
+    unsigned j;
+    for (j = 0; j < len; j++)
+      if (offer->ProtocolNamespace.characters[j] != p->ns[j]) break;
+    if (j == len) return p;
+  }
+
+  return NULL;
+}
+
+/*
+choose from the EV's offers; returns the chosen offer (NULL if nothing matched)
+*protocol is set to the registry entry and *minor_deviation if the minor versions differ
+*/
+
+static const struct appHandAppProtocolType *protocol_select(const struct protocol *table, unsigned count, const struct appHandEXIDocument *req, const struct protocol **protocol, bool *minor_deviation)
+{
+  const struct appHandAppProtocolType *best = NULL;
+
+  *protocol = NULL;
+
+  for (int i = 0; i < req->supportedAppProtocolReq.AppProtocol.arrayLen; i++)
+  {
+    const struct appHandAppProtocolType *offer = &req->supportedAppProtocolReq.AppProtocol.array[i];
+    const struct protocol *p = protocol_match(table, count, offer);
+
+    if (!p || (offer->VersionNumberMajor != p->version_major)) continue;
+
+    if (best)
+    {
+      if (offer->Priority > best->Priority) continue;
+      if ((offer->Priority == best->Priority) && (p->priority >= (*protocol)->priority)) continue;
+    }
+
+    best = offer;
+    *protocol = p;
+  }
+
+  if (best) *minor_deviation = (best->VersionNumberMinor != (*protocol)->version_minor);
+
+  return best;
+}
+
+#endif
@@ -1,473 +1,2756 @@
-/*
- * Copyright (C) 2025 Peter Lawrence
- *
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU Lesser General Public License as published
- * by the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU Lesser General Public License for more details.
- *
- * You should have received a copy of the GNU Lesser General Public License
- * along with this program. If not, see <http://www.gnu.org/licenses/>.
- */
-
-#include <stdio.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/types.h>
-#include <ifaddrs.h>
-#include <net/if.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include "parameters.h"
-#include "urandom.h"
-
-#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
-
-static const int tcp_server_port = 51111;
-
-static const uint8_t sdp_request[] =
-{
-  0x01, /* V2GTP Version 1 */
-  0xfe, /* inverted protocol */
-  0x90, 0x00, /* SDP REQUEST */
-  0x00, 0x00, 0x00, 0x02, /* payload length */
-  0x10, /* TLS: no */
-  0x00, /* TCP protocol */
-};
-
-static uint8_t sdp_response[28] =
-{
-  0x01, /* V2GTP Version 1 */
-  0xfe, /* inverted protocol */
-  0x90, 0x01, /* SDP RESPONSE */
-  0x00, 0x00, 0x00, 0x14, /* payload length */
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* TBD IPv6 address */
-  (uint8_t)(tcp_server_port >> 8), (uint8_t)(tcp_server_port >> 0),
-  0x10, /* TLS: no */
-  0x00, /* TCP protocol */
-};
-
-static struct in6_addr *localip = NULL;
-
-static struct iso1PhysicalValueType EVTargetVoltage, EVTargetCurrent;
-
-static void get_link_local_addr(const char *ifname)
-{
-  struct ifaddrs *ifaddr, *ifa;
-  static struct in6_addr foundip;
-
-  if (getifaddrs(&ifaddr) == -1) return;
-
-  for (ifa = ifaddr; ifa; ifa = ifa->ifa_next)
-  {
-    if (ifa->ifa_addr->sa_family != AF_INET6) continue;
-
-    if (strncmp(ifa->ifa_name, ifname, sizeof(ifname))) continue;
-
-    struct sockaddr_in6 *current_addr = (struct sockaddr_in6 *) ifa->ifa_addr;
-
-    if (!IN6_IS_ADDR_LINKLOCAL(&(current_addr->sin6_addr))) continue;
-
-    memcpy(&foundip, &current_addr->sin6_addr, sizeof(current_addr->sin6_addr));
-    localip = &foundip;
-  }
-
-  freeifaddrs(ifaddr);
-}
-
-/* utility function to configure a socket as non-blocking */
-
-static void set_nonblocking(int sock)
-{
-  int opts = fcntl(sock, F_GETFL);
-  if (opts <= 0) return;
-  opts = (opts | O_NONBLOCK);
-  fcntl(sock, F_SETFL, opts);
-}
-
-/* utility function to FD_SET and track highest socket */
-
-static int set_reads(fd_set *reads, int sock, int highest_socket)
-{
-  FD_SET(sock, reads);
-  if (sock > highest_socket) highest_socket = sock;
-  return highest_socket;
-}
-
-/* helper to translate string into OpenV2G format */
-
-static uint16_t set_chars(exi_string_character_t *chars, uint16_t maxlen, char *string)
-{
-  uint16_t len = 0;
-  while (*string && (len < maxlen))
-  {
-    *chars++ = *string++;
-    len++;
-  }
-  return len;
-}
-
-int main(int argc, char *argv[])
-{
-  int rc;
-  uint8_t buffer[4096];
-  struct sockaddr_in6 server_addr;
-  const char *ifname = (argc > 1) ? argv[1] : "seth0";
-  bool handshake_expected;
-
-  get_link_local_addr(ifname);
-
-  if (!localip)
-  {
-    fprintf(stderr, "ERROR: interface (%s) not found\n", ifname);
-    return -1;
-  }
-
-  urandom_init();
-
-  /*
-  setup SDP server
-  */
-
-  int sdp_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
-  if (sdp_sock < 0) return -1;
-
-  struct ipv6_mreq mreq;
-  inet_pton(AF_INET6, "ff02::1", &mreq.ipv6mr_multiaddr);
-  mreq.ipv6mr_interface = if_nametoindex(ifname);
-
-  rc = setsockopt(sdp_sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char *) &mreq, sizeof(mreq));
-
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin6_family = AF_INET6;
-  server_addr.sin6_addr = in6addr_any;
-  server_addr.sin6_port = htons(15118);
-  server_addr.sin6_scope_id = if_nametoindex(ifname);
-
-  memcpy(sdp_response + 8, &localip->s6_addr, sizeof(localip->s6_addr));
-
-  rc = bind(sdp_sock, (const struct sockaddr *)&server_addr, sizeof(server_addr));
-  if (rc < 0)
-  {
-    fprintf(stderr, "SDP bind error %d\n", rc);
-    return -1;
-  }
-
-  set_nonblocking(sdp_sock);
-
-  /*
-  setup ISO server
-  */
-
-  int peer_sock = -1, listen_sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
-  if (listen_sock < 0) return -1;
-
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin6_family = AF_INET6;
-  server_addr.sin6_addr = in6addr_any;
-  server_addr.sin6_port = htons(tcp_server_port);
-  server_addr.sin6_scope_id = if_nametoindex(ifname);
-
-  rc = bind(listen_sock, (const struct sockaddr *)&server_addr, sizeof(server_addr));
-  if (rc < 0)
-  {
-    fprintf(stderr, "ISO bind error %d\n", rc);
-    return -1;
-  }
-
-  set_nonblocking(listen_sock);
-
-  rc = listen(listen_sock, 1);
-
-  for (;;)
-  {
-    fd_set reads, writes;
-    FD_ZERO(&reads);
-    int highest_socket = -1;
-    highest_socket = set_reads(&reads, sdp_sock, highest_socket);
-    highest_socket = set_reads(&reads, listen_sock, highest_socket);
-    if (peer_sock > 0)
-      highest_socket = set_reads(&reads, peer_sock, highest_socket);
-    FD_ZERO(&writes);
-
-    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
-    rc = select(highest_socket + 1, &reads, &writes, NULL, &tv);
-
-    if (rc < 0) break;
-    if (0 == rc) continue;
-
-    if (FD_ISSET(sdp_sock, &reads))
-    {
-      struct sockaddr_in6 client_addr;
-      socklen_t client_len = sizeof(client_addr);
-      ssize_t len = recvfrom(sdp_sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &client_len);
-
-      printf("recv %d\n", len);
-      if (len == sizeof(sdp_request))
-        if (0 == memcmp(buffer, sdp_request, sizeof(sdp_request)))
-        {
-          rc = sendto(sdp_sock, sdp_response, sizeof(sdp_response), 0, (struct sockaddr *)&client_addr, client_len);
-          printf("xmit %d\n", rc);
-        }
-     }
-
-    if (FD_ISSET(listen_sock, &reads))
-    {
-      peer_sock = accept(listen_sock, NULL, NULL);
-      handshake_expected = true;
-    }
-
-    if (FD_ISSET(peer_sock, &reads))
-    {
-      ssize_t len = recv(peer_sock, buffer, sizeof(buffer), 0);
-      printf("recv %d\n", len);
-      if (len <= 0)
-      {
-        close(peer_sock);
-        peer_sock = -1;
-        rc = listen(listen_sock, 1);
-      }
-      else
-      {
-        bitstream_t streamIn, streamOut;
-        size_t posi = 0, poso = 0;
-        int errn;
-        uint32_t payloadLength;
-
-        streamIn.size = len;
-        streamIn.data = (uint8_t *)buffer;
-        streamIn.pos = &posi;
-
-        streamOut.size = sizeof(buffer);
-        streamOut.data = buffer;
-        streamOut.pos = &poso;
-
-        errn = read_v2gtpHeader(streamIn.data, &payloadLength);
-      printf("read %d\n", errn);
-        if (errn) continue;
-
-        *streamIn.pos += V2GTP_HEADER_LENGTH;
-
-        if (handshake_expected)
-        {
-          struct appHandEXIDocument exiDoc, appHandResp;
-
-          errn = decode_appHandExiDocument(&streamIn, &exiDoc);
-          printf("hand %d\n", errn);
-          if (errn) continue;
-
-          int selectedSchema = -1;
-          for(int i=0;i<exiDoc.supportedAppProtocolReq.AppProtocol.arrayLen;i++) {
-            if (exiDoc.supportedAppProtocolReq.AppProtocol.array[i].ProtocolNamespace.charactersLen == (ARRAY_SIZE(iso1string) - 1))
-            {
-              int j;
-              for (j = 0; j < (ARRAY_SIZE(iso1string) - 1); j++)
-                if (exiDoc.supportedAppProtocolReq.AppProtocol.array[i].ProtocolNamespace.characters[j] != iso1string[j]) break;
-              if ((ARRAY_SIZE(iso1string) - 1) == j) selectedSchema = exiDoc.supportedAppProtocolReq.AppProtocol.array[i].SchemaID;
-            }
-          }
-
-          printf("selectedSchema %d\n", selectedSchema);
-          if (-1 == selectedSchema) continue;
-
-          init_appHandEXIDocument(&appHandResp);
-          appHandResp.supportedAppProtocolRes_isUsed = 1u;
-          appHandResp.supportedAppProtocolRes.ResponseCode = appHandresponseCodeType_OK_SuccessfulNegotiation;
-          /* signal the protocol by the provided schema id */
-          appHandResp.supportedAppProtocolRes.SchemaID = selectedSchema;
-          appHandResp.supportedAppProtocolRes.SchemaID_isUsed = 1u;
-
-          *streamOut.pos = V2GTP_HEADER_LENGTH;
-          errn = encode_appHandExiDocument(&streamOut, &appHandResp);
-          printf("handenc %d\n", errn);
-          if (errn) continue;
-          errn = write_v2gtpHeader(streamOut.data, *streamOut.pos-V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE);
-          printf("handwrite %d %d\n", errn, (int)*streamOut.pos);
-
-          handshake_expected = false;
-        }
-        else
-        {
-          struct iso1EXIDocument exiIn, exiOut;
-
-          /* OpenV2G init_ helpers don't clear everything; trust only memset */
-          memset(&exiOut, 0, sizeof(exiOut)); 
-          memset(&exiIn, 0, sizeof(exiIn));
-
-          decode_iso1ExiDocument(&streamIn, &exiIn);
-          printf("iso %d %d %d\n", errn, exiIn.V2G_Message_isUsed, exiIn.V2G_Message.Body.SessionSetupReq_isUsed);
-          if (!exiIn.V2G_Message_isUsed) continue;
-          exiOut.V2G_Message_isUsed = 1u;
-
-          /*
-          NOTE: the following V2G message types are deliberately not handled:
-          ServiceDetailReq (opt VAS)
-          MeteringReceiptReq (opt Metering)
-          CertificateUpdateReq (opt Certificate Installation)
-          CertificateInstallationReq (opt Certificate Update)
-          ChargingStatusReq (specific to AC charging) 
-          */
-
-          if (exiIn.V2G_Message.Body.SessionSetupReq_isUsed) {
-
-            exiOut.V2G_Message.Header.SessionID.bytesLen = 8;
-            urandom_get(exiOut.V2G_Message.Header.SessionID.bytes, exiOut.V2G_Message.Header.SessionID.bytesLen);
-            exiOut.V2G_Message.Body.SessionSetupRes_isUsed = 1u;
-            struct iso1SessionSetupResType *body = &exiOut.V2G_Message.Body.SessionSetupRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->EVSEID.charactersLen = set_chars(body->EVSEID.characters, ARRAY_SIZE(body->EVSEID.characters), "ZZ00000");
-            body->EVSETimeStamp_isUsed = 0u;
-
-          } else if (exiIn.V2G_Message.Body.ServiceDiscoveryReq_isUsed) {
-
-            exiOut.V2G_Message.Body.ServiceDiscoveryRes_isUsed = 1u;
-            struct iso1ServiceDiscoveryResType *body = &exiOut.V2G_Message.Body.ServiceDiscoveryRes;
-            body->ServiceList_isUsed = 0u;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->PaymentOptionList.PaymentOption.array[0] = iso1paymentOptionType_ExternalPayment;
-            body->PaymentOptionList.PaymentOption.arrayLen = 1;
-            body->ChargeService.ServiceID = 1;
-            body->ChargeService.ServiceCategory = iso1serviceCategoryType_EVCharging;
-            body->ChargeService.FreeService = 1;
-            body->ChargeService.SupportedEnergyTransferMode.EnergyTransferMode.arrayLen = 1;
-            body->ChargeService.SupportedEnergyTransferMode.EnergyTransferMode.array[0] = dcmode;
-
-          } else if (exiIn.V2G_Message.Body.PaymentServiceSelectionReq_isUsed) {
-
-            exiOut.V2G_Message.Body.PaymentServiceSelectionRes_isUsed = 1u;
-            exiOut.V2G_Message.Body.ServiceDetailRes.ResponseCode = iso1responseCodeType_OK;
-
-          } else if (exiIn.V2G_Message.Body.PaymentDetailsReq_isUsed) {
-
-            exiOut.V2G_Message.Body.PaymentDetailsRes_isUsed = 1u;
-            exiOut.V2G_Message.Body.PaymentDetailsRes.ResponseCode = iso1responseCodeType_OK;
-
-          } else if (exiIn.V2G_Message.Body.AuthorizationReq_isUsed) {
-
-            exiOut.V2G_Message.Body.AuthorizationRes_isUsed = 1u;
-            exiOut.V2G_Message.Body.AuthorizationRes.ResponseCode = iso1responseCodeType_OK;
-            exiOut.V2G_Message.Body.AuthorizationRes.EVSEProcessing = iso1EVSEProcessingType_Finished;
-
-          } else if (exiIn.V2G_Message.Body.ChargeParameterDiscoveryReq_isUsed) {
-
-            exiOut.V2G_Message.Body.ChargeParameterDiscoveryRes_isUsed = 1u;
-            bool compatible = (dcmode == exiIn.V2G_Message.Body.ChargeParameterDiscoveryReq.RequestedEnergyTransferMode);
-            struct iso1ChargeParameterDiscoveryResType *body = &exiOut.V2G_Message.Body.ChargeParameterDiscoveryRes;
-            body->ResponseCode = (compatible) ? iso1responseCodeType_OK : iso1responseCodeType_FAILED_WrongEnergyTransferMode;
-            body->EVSEProcessing = iso1EVSEProcessingType_Finished;
-            body->DC_EVSEChargeParameter_isUsed = 1;
-            body->DC_EVSEChargeParameter = dccharge;
-
-          } else if (exiIn.V2G_Message.Body.PowerDeliveryReq_isUsed) {
-
-            exiOut.V2G_Message.Body.PowerDeliveryRes_isUsed = 1u;
-            struct iso1PowerDeliveryResType *body = &exiOut.V2G_Message.Body.PowerDeliveryRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->EVSEStatus_isUsed = 1;
-            body->EVSEStatus.EVSENotification = iso1EVSENotificationType_StopCharging;
-            body->EVSEStatus.NotificationMaxDelay = max_delay;
-
-          } else if (exiIn.V2G_Message.Body.SessionStopReq_isUsed) {
-
-            exiOut.V2G_Message.Body.SessionStopRes_isUsed = 1u;
-            exiOut.V2G_Message.Body.SessionStopRes.ResponseCode = iso1responseCodeType_OK;
-
-          } else if (exiIn.V2G_Message.Body.CableCheckReq_isUsed) {
-
-            exiOut.V2G_Message.Body.CableCheckRes_isUsed = 1u;
-            struct iso1CableCheckResType *body = &exiOut.V2G_Message.Body.CableCheckRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
-            body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
-            body->EVSEProcessing = iso1EVSEProcessingType_Finished;
-
-          } else if (exiIn.V2G_Message.Body.PreChargeReq_isUsed) {
-
-            /* jot down the targets */
-            EVTargetVoltage = exiIn.V2G_Message.Body.PreChargeReq.EVTargetVoltage;
-            EVTargetCurrent = exiIn.V2G_Message.Body.PreChargeReq.EVTargetCurrent;
-
-            exiOut.V2G_Message.Body.PreChargeRes_isUsed = 1u;
-            struct iso1PreChargeResType *body = &exiOut.V2G_Message.Body.PreChargeRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
-            body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
-            body->EVSEPresentVoltage = EVTargetVoltage;
-
-          } else if (exiIn.V2G_Message.Body.PowerDeliveryReq_isUsed) {
-
-            exiOut.V2G_Message.Body.PowerDeliveryRes_isUsed = 1u;
-            struct iso1PowerDeliveryResType *body = &exiOut.V2G_Message.Body.PowerDeliveryRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->DC_EVSEStatus_isUsed = 1;
-            body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
-            body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
-
-          } else if (exiIn.V2G_Message.Body.WeldingDetectionReq_isUsed) {
-
-            exiOut.V2G_Message.Body.WeldingDetectionRes_isUsed = 1u;
-            struct iso1WeldingDetectionResType *body = &exiOut.V2G_Message.Body.WeldingDetectionRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
-            body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
-            body->EVSEPresentVoltage = EVTargetVoltage;
-
-          } else if (exiIn.V2G_Message.Body.CurrentDemandReq_isUsed) {
-
-            /* jot down the targets */
-            EVTargetVoltage = exiIn.V2G_Message.Body.CurrentDemandReq.EVTargetVoltage;
-            EVTargetCurrent = exiIn.V2G_Message.Body.CurrentDemandReq.EVTargetCurrent;
-
-            exiOut.V2G_Message.Body.CurrentDemandRes_isUsed = 1u;
-            struct iso1CurrentDemandResType *body = &exiOut.V2G_Message.Body.CurrentDemandRes;
-            body->ResponseCode = iso1responseCodeType_OK;
-            body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
-            body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
-            body->DC_EVSEStatus.EVSEStatusCode = iso1DC_EVSEStatusCodeType_EVSE_Ready;
-            body->EVSEPresentVoltage = EVTargetVoltage;
-            body->EVSEPresentCurrent = EVTargetCurrent;
-
-          } else {
-
-            printf("unhandled\n");
-            continue;
-
-          }
-
-          /* if the value has not already been written, echo back the provided SessionID (if any) */
-          if (!exiOut.V2G_Message.Header.SessionID.bytesLen && exiIn.V2G_Message.Header.SessionID.bytesLen)
-          {
-            exiOut.V2G_Message.Header.SessionID.bytesLen = exiIn.V2G_Message.Header.SessionID.bytesLen;
-            memcpy(exiOut.V2G_Message.Header.SessionID.bytes, exiIn.V2G_Message.Header.SessionID.bytes, exiOut.V2G_Message.Header.SessionID.bytesLen);
-          }
-
-          *streamOut.pos = V2GTP_HEADER_LENGTH;
-          errn = encode_iso1ExiDocument(&streamOut, &exiOut);
-          printf("isoenc %d\n", errn);
-          if (errn) continue;
-          errn = write_v2gtpHeader(streamOut.data, *streamOut.pos-V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE);
-          printf("isowrite %d %d\n", errn, (int)*streamOut.pos);
-        }
-
-	      send(peer_sock, streamOut.data, *streamOut.pos, 0);
-      }
-    }
-  }
-
-  close(sdp_sock);
-  close(listen_sock);
-  if (peer_sock > 0) close(peer_sock);
-  urandom_deinit();
-
-  return 0;
-}
-
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "parameters.h"
+#include "urandom.h"
+#include "v2gtp_stream.h"
+#include "txqueue.h"
+#include "session.h"
+#include "respcache.h"
+#include "fastpath.h"
+#include "protocols.h"
+#include "log.h"
+#include "metrics.h"
+#include "timerwheel.h"
+#include "tls.h"
+#include "power.h"
+#include "budget.h"
+#include "auth.h"
+#include "journal.h"
+#include "slac.h"
+#include "capture.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static const int tcp_server_port = 51111;
+static const int tls_server_port = 51112;
+
+/* SDP security byte */
+#define SDP_TLS 0x00
+#define SDP_NO_TLS 0x10
+
+static const uint8_t sdp_request[] =
+{
+  0x01, /* V2GTP Version 1 */
+  0xfe, /* inverted protocol */
+  0x90, 0x00, /* SDP REQUEST */
+  0x00, 0x00, 0x00, 0x02, /* payload length */
+  SDP_NO_TLS, /* TLS: no (or SDP_TLS) */
+  0x00, /* TCP protocol */
+};
+
+static const uint8_t sdp_response_template[28] =
+{
+  0x01, /* V2GTP Version 1 */
+  0xfe, /* inverted protocol */
+  0x90, 0x01, /* SDP RESPONSE */
+  0x00, 0x00, 0x00, 0x14, /* payload length */
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* TBD IPv6 address */
+  (uint8_t)(tcp_server_port >> 8), (uint8_t)(tcp_server_port >> 0),
+  SDP_NO_TLS, /* TLS: no (the TLS port and SDP_TLS in the copy for TLS) */
+  0x00, /* TCP protocol */
+};
+
+enum poll_kind
+{
+  POLL_SDP,
+  POLL_LISTEN,
+  POLL_LISTEN_TLS,
+  POLL_PEER,
+  POLL_METRICS,
+  POLL_TIMER,
+  POLL_WAKE,
+  POLL_NETLINK,
+  POLL_AUTH,
+  POLL_SLAC,
+};
+
+/* every socket registered with epoll hands back a pointer to one of these */
+
+struct poll_source
+{
+  enum poll_kind kind;
+  int sock;
+};
+
+/*
+network interfaces, one per connector (PLC modem)
+
+Each has its own SDP socket and, in every worker, its own listening socket, all bound to
+the interface with SO_BINDTODEVICE.  The link-local address advertised in its SDP
+response is looked up at startup and then kept current from netlink (RTM_NEWADDR and
+RTM_DELADDR), so a modem that resets and comes back with a new address is picked up
+without a restart.  Only worker 0 reads or writes the addresses.
+
+With -s, worker 0 also runs SLAC on each interface (see slac.h), so an EV is matched to
+its modem's network by the same process that then answers its SDP request; the
+interface's address is looked up again as soon as an EV matches.
+*/
+
+struct interface
+{
+  char name[IF_NAMESIZE];
+  unsigned index;
+  bool have_addr;           /* no SDP response is given without one */
+  struct in6_addr addr;
+  struct poll_source sdp_src;
+  uint8_t sdp_response[2][sizeof(sdp_response_template)]; /* without and with TLS */
+  struct poll_source slac_src; /* -1 without SLAC */
+  bool slac_key_set;        /* the modem has confirmed the NMK */
+  struct slac_port slac;
+};
+
+static struct interface interfaces[MAX_INTERFACES];
+static unsigned interface_count;
+
+static void interface_set_addr(struct interface *ifc, const struct in6_addr *addr)
+{
+  ifc->addr = *addr;
+  ifc->have_addr = true;
+  for (int tls = 0; tls < 2; tls++)
+    memcpy(ifc->sdp_response[tls] + 8, addr->s6_addr, sizeof(addr->s6_addr));
+}
+
+static struct interface *interface_by_index(unsigned index)
+{
+  for (unsigned i = 0; i < interface_count; i++)
+    if (interfaces[i].index == index) return &interfaces[i];
+  return NULL;
+}
+
+static void get_link_local_addr(struct interface *ifc)
+{
+  struct ifaddrs *ifaddr, *ifa;
+
+  if (getifaddrs(&ifaddr) == -1) return;
+
+  ifc->have_addr = false;
+
+  for (ifa = ifaddr; ifa; ifa = ifa->ifa_next)
+  {
+    if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET6)) continue;
+
+    if (strcmp(ifa->ifa_name, ifc->name)) continue;
+
+    struct sockaddr_in6 *current_addr = (struct sockaddr_in6 *) ifa->ifa_addr;
+
+    if (!IN6_IS_ADDR_LINKLOCAL(&(current_addr->sin6_addr))) continue;
+
+    interface_set_addr(ifc, &current_addr->sin6_addr);
+  }
+
+  freeifaddrs(ifaddr);
+}
+
+/* utility function to configure a socket as non-blocking */
+
+static void set_nonblocking(int sock)
+{
+  int opts = fcntl(sock, F_GETFL);
+  if (opts <= 0) return;
+  opts = (opts | O_NONBLOCK);
+  fcntl(sock, F_SETFL, opts);
+}
+
+/* helper to translate string into OpenV2G format */
+
+static uint16_t set_chars(exi_string_character_t *chars, uint16_t maxlen, char *string)
+{
+  uint16_t len = 0;
+  while (*string && (len < maxlen))
+  {
+    *chars++ = *string++;
+    len++;
+  }
+  return len;
+}
+
+/* and back, as bytes; returns the length copied */
+
+static size_t get_chars(uint8_t *bytes, size_t maxlen, const exi_string_character_t *chars, uint16_t len)
+{
+  size_t n = 0;
+  while ((n < len) && (n < maxlen))
+  {
+    bytes[n] = (uint8_t)chars[n];
+    n++;
+  }
+  return n;
+}
+
+/*
+the connection table is preallocated; free slots are chained through next_free so that
+accepting and closing a connection is O(1) regardless of how many EVs are attached
+*/
+
+struct connection
+{
+  struct poll_source src; /* must be first member */
+  bool handshake_expected;
+  int schema;               /* SchemaID agreed by supportedAppProtocol on this connection */
+  const struct protocol *protocol; /* agreed by supportedAppProtocol on this connection */
+  struct session *session;  /* session this connection has set up or rejoined */
+  enum v2g_msg msg;         /* type of the request being answered, for the metrics */
+  SSL *ssl;                 /* NULL on a plain TCP connection */
+  unsigned connector;       /* index of the interface the EV came in on, which is its power module */
+  bool powered;             /* a target with the output on has been sent for this connection */
+  struct budget_slot *budget; /* its share of the site power budget, while charging */
+  uint32_t budget_max;      /* the most the EV could take from this EVSE, in watts */
+  uint32_t budget_told;     /* the power limit in the last response, which the EV is following */
+  struct power_record target; /* the last target sent, for the journal */
+  struct capture_flow flow; /* its addresses and byte counts, for the capture */
+  uint64_t accepted_ns;     /* for the TLS handshake latency */
+  struct trace_pending trace; /* spans of the request in hand, until its session is known */
+  struct timer timeout;     /* CommunicationSetup until a session is set up, Sequence after */
+  struct v2gtp_rx rx;
+  struct txqueue tx;
+  struct connection *next_free;
+};
+
+/*
+worker threads
+
+Each worker has its own listening socket on tcp_server_port (SO_REUSEPORT, so that the
+kernel spreads incoming connections across them), event loop, connection table, session
+shard, response cache, metrics and timers; nothing on the request path is shared or
+locked.  Worker 0 runs on the main thread and also owns the SDP responder and the
+metrics socket.
+
+A session lives in the shard of the worker that set it up.  An EV whose reconnection
+lands on another worker is given a new session rather than rejoining; the one it left
+behind lingers and expires.
+*/
+
+struct worker
+{
+  unsigned index;
+  pthread_t tid;
+  int epfd;
+  struct poll_source listen_src[MAX_INTERFACES];
+  struct poll_source tls_listen_src[MAX_INTERFACES]; /* only while TLS is offered */
+  struct poll_source timer_src;
+  struct poll_source wake_src;  /* eventfd, for requests from other threads */
+  struct poll_source auth_src;  /* the authorization backend, -1 while not connected */
+  uint64_t auth_retry_ns;       /* no reconnecting before this */
+  uint16_t auth_seq;
+  atomic_bool dump_trace;
+  struct connection *free_connections;
+  struct session_table sessions;
+  struct respcache respcache;
+  struct fastpath fastpath;
+  struct metrics metrics;
+  struct timer_wheel timers;
+  struct power_port power;
+  struct connection connections[MAX_CONNECTIONS];
+};
+
+static struct worker *workers;
+static unsigned worker_count = 1;
+static __thread struct worker *worker; /* the calling thread's own */
+
+static void connection_timeout(struct timer *t);
+
+_Static_assert((MAX_WORKERS <= POWER_CHANNELS) && (MAX_INTERFACES <= POWER_CONNECTORS), "power.h must have a channel per worker and a connector per interface");
+
+static const struct power_backend *power = &power_echo;
+static struct budget budget;
+static struct auth_cache auth_cache;
+
+/* physical values as the power modules have them, in milli-units */
+
+static int32_t power_milli(const struct iso1PhysicalValueType *v)
+{
+  int64_t milli = v->Value;
+  for (int m = v->Multiplier + 3; m > 0; m--) milli *= 10;
+  for (int m = v->Multiplier + 3; m < 0; m++) milli /= 10;
+  return (milli > INT32_MAX) ? INT32_MAX : (milli < INT32_MIN) ? INT32_MIN : (int32_t)milli;
+}
+
+/* to a tenth of a unit where that fits the 16-bit Value, coarser where it does not */
+
+static struct iso1PhysicalValueType power_value(int32_t milli, iso1unitSymbolType unit)
+{
+  struct iso1PhysicalValueType v = { .Multiplier = -1, .Unit = unit };
+  int64_t value = milli / 100;
+
+  while (((value > INT16_MAX) || (value < INT16_MIN)) && (v.Multiplier < 3))
+  {
+    value /= 10;
+    v.Multiplier++;
+  }
+
+  v.Value = value;
+  return v;
+}
+
+/* watts from milli-volts and milli-amps, never negative */
+
+static uint32_t budget_watts(int32_t voltage_mv, int32_t current_ma)
+{
+  int64_t w = (int64_t)voltage_mv * current_ma / 1000000;
+  return (w < 0) ? 0 : (w > UINT32_MAX) ? UINT32_MAX : (uint32_t)w;
+}
+
+/* the most this EVSE can deliver at a voltage, whatever the site budget */
+
+static uint32_t budget_evse_max(int32_t voltage_mv)
+{
+  uint32_t power = power_milli(&dccharge.EVSEMaximumPowerLimit) / 1000;
+  uint32_t current = budget_watts(voltage_mv, power_milli(&dccharge.EVSEMaximumCurrentLimit));
+  return (power < current) ? power : current;
+}
+
+static struct iso1PhysicalValueType budget_value(uint32_t watts)
+{
+  return power_value((watts > INT32_MAX / 1000) ? INT32_MAX : (int32_t)watts * 1000, iso1unitSymbolType_W);
+}
+
+/* a session is about to draw power: it takes a slot in the site budget, or says what it wants now if it holds one */
+
+static void budget_start(struct connection *conn, uint32_t want)
+{
+  conn->budget_max = want;
+  conn->budget_told = 0;
+
+  if (conn->budget)
+  {
+    budget_report(&budget, conn->budget, want, conn->budget->draw);
+    return;
+  }
+
+  conn->budget = budget_join(&budget, connector_weight[conn->connector], want);
+  if (!conn->budget)
+  {
+    LOG_WARN("socket %d: no budget slot left, the EV is given no power", conn->src.sock);
+    metric_inc(&worker->metrics.budget_rejected);
+  }
+}
+
+/* a session states its maximums before charging (NULL if it has not); returns its share of the site budget */
+
+static uint32_t budget_discover(struct connection *conn, const struct iso1PhysicalValueType *voltage, const struct iso1PhysicalValueType *current, const struct iso1PhysicalValueType *power)
+{
+  int32_t voltage_mv = (voltage) ? power_milli(voltage) : power_milli(&dccharge.EVSEMaximumVoltageLimit);
+  uint32_t want = budget_evse_max(voltage_mv);
+
+  uint32_t ev_max = (current) ? budget_watts(voltage_mv, power_milli(current)) : UINT32_MAX;
+  if (ev_max < want) want = ev_max;
+  ev_max = (power) ? budget_watts(power_milli(power), 1000) : UINT32_MAX;
+  if (ev_max < want) want = ev_max;
+
+  budget_start(conn, want);
+  return (conn->budget) ? budget_share(conn->budget) : 0;
+}
+
+/* the session has stopped drawing power; its share goes to the others */
+
+static void budget_stop(struct connection *conn)
+{
+  if (!conn->budget) return;
+  budget_leave(&budget, conn->budget);
+  conn->budget = NULL;
+}
+
+/*
+hold a charging EV to its grant: the current target is clamped to what the grant (and the
+EVSE) allows at the target voltage, and the limits go into the response.  An EV that asks
+for nearly all of the limit it was last given is being held back by it and is taken to
+want as much as it could take; one that asks for less wants what it asks for, and the
+rest goes to others.
+*/
+
+static void budget_follow(struct connection *conn, const struct iso1PhysicalValueType *voltage, struct iso1PhysicalValueType *current, struct charge_loop_res *res)
+{
+  int32_t voltage_mv = power_milli(voltage), current_ma = power_milli(current);
+  uint32_t asked = budget_watts(voltage_mv, current_ma);
+
+  /* an EV that went straight to charging, without ChargeParameterDiscoveryReq, wants all it can get */
+  if (!conn->budget) budget_start(conn, budget_evse_max(voltage_mv));
+
+  uint32_t grant = (conn->budget) ? budget_grant(conn->budget) : 0;
+  int32_t limit_ma = power_milli(&dccharge.EVSEMaximumCurrentLimit);
+  bool power_limited = false;
+  if (voltage_mv > 0)
+  {
+    int64_t grant_ma = (int64_t)grant * 1000000 / voltage_mv;
+    if (grant_ma < limit_ma)
+    {
+      limit_ma = grant_ma;
+      power_limited = true;
+    }
+  }
+
+  res->EVSEMaximumCurrentLimit = power_value(limit_ma, iso1unitSymbolType_A);
+  res->EVSEMaximumPowerLimit = budget_value(grant);
+  res->EVSECurrentLimitAchieved = (current_ma >= limit_ma) && !power_limited;
+  res->EVSEPowerLimitAchieved = (current_ma >= limit_ma) && power_limited;
+  if (current_ma > limit_ma)
+  {
+    *current = res->EVSEMaximumCurrentLimit;
+    current_ma = power_milli(current);
+  }
+
+  if (!conn->budget) return;
+
+  uint32_t want = ((uint64_t)asked * 20 >= (uint64_t)conn->budget_told * 19) ? conn->budget_max : asked;
+  conn->budget_told = grant;
+  uint32_t evse_max = budget_evse_max(voltage_mv);
+  budget_report(&budget, conn->budget, (want < evse_max) ? want : evse_max, budget_watts(voltage_mv, current_ma));
+}
+
+/* the limits in the response to a charge-loop request that is refused: nothing is granted */
+
+static void budget_refuse(struct charge_loop_res *res)
+{
+  res->EVSEMaximumCurrentLimit = power_value(0, iso1unitSymbolType_A);
+  res->EVSEMaximumPowerLimit = budget_value(0);
+  res->EVSECurrentLimitAchieved = 0;
+  res->EVSEPowerLimitAchieved = 0;
+}
+
+/* send the connector's power module a target; without enable, the output is switched off */
+
+static void power_set(struct connection *conn, bool enable, const struct iso1PhysicalValueType *voltage, const struct iso1PhysicalValueType *current)
+{
+  struct power_record target = { .ns = power_now(), .connector = conn->connector, .flags = (enable) ? POWER_ENABLE : 0 };
+
+  if (enable)
+  {
+    target.voltage_mv = power_milli(voltage);
+    target.current_ma = power_milli(current);
+  }
+
+  conn->powered = enable;
+  conn->target = target;
+  if (!power->target(&worker->power, &target)) metric_inc(&worker->metrics.power_dropped);
+}
+
+/* the output is switched off, and the session's share of the site budget handed back */
+
+static void power_off(struct connection *conn)
+{
+  if (conn->powered) power_set(conn, false, NULL, NULL);
+  budget_stop(conn);
+}
+
+/* the latest measurement from the connector's power module, as polled last; zero if there is none recent enough */
+
+static void power_measured(const struct connection *conn, int32_t *voltage_mv, int32_t *current_ma)
+{
+  const struct power_record *m = &worker->power.latest[conn->connector];
+  bool fresh = m->ns && (power_now() - m->ns <= power_stale_ms * 1000000ull);
+
+  *voltage_mv = (fresh) ? m->voltage_mv : 0;
+  *current_ma = (fresh) ? m->current_ma : 0;
+}
+
+static void power_present(struct connection *conn, struct iso1PhysicalValueType *voltage, struct iso1PhysicalValueType *current)
+{
+  int32_t mv, ma;
+
+  power->poll(&worker->power, conn->connector);
+  power_measured(conn, &mv, &ma);
+
+  *voltage = power_value(mv, iso1unitSymbolType_V);
+  if (current) *current = power_value(ma, iso1unitSymbolType_A);
+}
+
+/* the session journal (see journal.h) */
+
+static void journal_session(struct session *s, const struct connection *conn, enum journal_type type, uint32_t value)
+{
+  struct journal_record r = { .type = type, .worker = worker->index, .time_ns = journal_realtime(), .energy_uj = s->energy_uj, .value = value };
+  memcpy(r.session, s->id, SESSION_ID_LEN);
+
+  if (conn)
+  {
+    r.connector = conn->connector;
+    if (conn->powered)
+    {
+      r.target_mv = conn->target.voltage_mv;
+      r.target_ma = conn->target.current_ma;
+    }
+    power_measured(conn, &r.present_mv, &r.present_ma);
+  }
+
+  if (journal_append(&r)) metric_inc(&worker->metrics.journal_records);
+}
+
+/* PreChargeReq or CurrentDemandReq has been answered: meter the energy and journal the targets */
+
+static void journal_charge(struct connection *conn)
+{
+  struct session *s = conn->session;
+  if (!s) return;
+
+  if (MSG_CURRENT_DEMAND == conn->msg)
+  {
+    int32_t mv, ma;
+    uint64_t now = power_now();
+
+    /* the power measured now, over the time since the last CurrentDemandReq; a pause counts for no more than a second */
+    power_measured(conn, &mv, &ma);
+    if (s->metered_ns && (mv > 0) && (ma > 0))
+    {
+      uint64_t us = (now - s->metered_ns) / 1000;
+      if (us > 1000000) us = 1000000;
+      s->energy_uj += (uint64_t)mv * (uint64_t)ma * us / 1000000;
+    }
+    s->metered_ns = now;
+  }
+
+  journal_session(s, conn, (MSG_CURRENT_DEMAND == conn->msg) ? JOURNAL_CURRENT_DEMAND : JOURNAL_PRE_CHARGE, 0);
+}
+
+static void connections_init(void)
+{
+  worker->free_connections = NULL;
+  for (int i = MAX_CONNECTIONS - 1; i >= 0; i--)
+  {
+    struct connection *conn = &worker->connections[i];
+    conn->src.kind = POLL_PEER;
+    conn->src.sock = -1;
+    timer_init(&conn->timeout, connection_timeout);
+    conn->next_free = worker->free_connections;
+    worker->free_connections = conn;
+  }
+}
+
+static struct connection *connection_alloc(int sock)
+{
+  struct connection *conn = worker->free_connections;
+  if (!conn) return NULL;
+  worker->free_connections = conn->next_free;
+
+  conn->src.sock = sock;
+  conn->handshake_expected = true;
+  conn->schema = -1;
+  conn->protocol = NULL;
+  conn->session = NULL;
+  conn->ssl = NULL;
+  conn->connector = 0;
+  conn->powered = false;
+  conn->budget = NULL;
+  conn->trace.count = 0;
+  v2gtp_rx_init(&conn->rx);
+  txq_init(&conn->tx);
+  conn->next_free = NULL;
+  timer_arm(&worker->timers, &conn->timeout, communication_setup_timeout_ms);
+  metric_add(&worker->metrics.connections_active, 1);
+  return conn;
+}
+
+static void connection_close(struct connection *conn)
+{
+  if (conn->src.sock < 0) return;
+  timer_cancel(&worker->timers, &conn->timeout);
+
+  /* a lost link ends the power transfer */
+  power_off(conn);
+
+  /* the session stays in the table for a while so that the EV can rejoin it */
+  if (conn->session)
+  {
+    conn->session->conn = NULL;
+    timer_arm(&worker->timers, &conn->session->linger, session_linger_ms);
+  }
+  conn->session = NULL;
+  tls_close(conn->ssl);
+  conn->ssl = NULL;
+  close(conn->src.sock);
+  conn->src.sock = -1;
+  conn->next_free = worker->free_connections;
+  worker->free_connections = conn;
+  metric_set(&worker->metrics.connections_active, metric_get(&worker->metrics.connections_active) - 1);
+}
+
+/* V2G_SECC_CommunicationSetup_Timeout or V2G_SECC_Sequence_Timeout: the EV has gone quiet */
+
+static void connection_timeout(struct timer *t)
+{
+  struct connection *conn = container_of(t, struct connection, timeout);
+  LOG_INFO("socket %d: %s timeout", conn->src.sock, LOG_STR((conn->session) ? "sequence" : "communication setup"));
+  connection_close(conn);
+}
+
+static int epoll_add(int epfd, struct poll_source *src, uint32_t events)
+{
+  struct epoll_event ev = { .events = events, .data.ptr = src };
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, src->sock, &ev);
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+builders for responses whose content does not depend on the request or the session;
+used both by the dispatch below and to pre-encode the response templates
+*/
+
+static void build_service_discovery_res(struct iso1BodyType *out)
+{
+  out->ServiceDiscoveryRes_isUsed = 1u;
+  struct iso1ServiceDiscoveryResType *body = &out->ServiceDiscoveryRes;
+  body->ServiceList_isUsed = 0u;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->PaymentOptionList.PaymentOption.array[0] = iso1paymentOptionType_ExternalPayment;
+  body->PaymentOptionList.PaymentOption.arrayLen = 1;
+  body->ChargeService.ServiceID = 1;
+  body->ChargeService.ServiceCategory = iso1serviceCategoryType_EVCharging;
+  body->ChargeService.FreeService = 1;
+  body->ChargeService.SupportedEnergyTransferMode.EnergyTransferMode.arrayLen = 1;
+  body->ChargeService.SupportedEnergyTransferMode.EnergyTransferMode.array[0] = dcmode;
+}
+
+static void build_payment_service_selection_res(struct iso1BodyType *out)
+{
+  out->PaymentServiceSelectionRes_isUsed = 1u;
+  out->PaymentServiceSelectionRes.ResponseCode = iso1responseCodeType_OK;
+}
+
+/* the response for an EV that asked for our (DC) energy transfer mode */
+
+static void build_charge_parameter_discovery_res(struct iso1BodyType *out)
+{
+  out->ChargeParameterDiscoveryRes_isUsed = 1u;
+  struct iso1ChargeParameterDiscoveryResType *body = &out->ChargeParameterDiscoveryRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->EVSEProcessing = iso1EVSEProcessingType_Finished;
+  body->DC_EVSEChargeParameter_isUsed = 1;
+  body->DC_EVSEChargeParameter = dccharge;
+}
+
+static void build_session_stop_res(struct iso1BodyType *out)
+{
+  out->SessionStopRes_isUsed = 1u;
+  out->SessionStopRes.ResponseCode = iso1responseCodeType_OK;
+}
+
+static void respcache_build(struct respcache *c)
+{
+  respcache_init(c);
+  respcache_add(c, MSG_SERVICE_DISCOVERY, build_service_discovery_res);
+  respcache_add(c, MSG_PAYMENT_SERVICE_SELECTION, build_payment_service_selection_res);
+  respcache_add(c, MSG_SESSION_STOP, build_session_stop_res);
+}
+
+/*
+protocol-neutral state handed to the per-message handlers; session is the connection's
+session if the request names it and is legal at this point in the sequence, else NULL
+*/
+
+struct v2g_request
+{
+  struct connection *conn;
+  struct session *session;
+  enum v2g_msg msg;
+};
+
+enum session_check
+{
+  SESSION_OK,
+  SESSION_UNKNOWN,
+  SESSION_OUT_OF_SEQUENCE,
+};
+
+/* everything but SessionSetupReq must name this connection's session, in a legal order */
+
+static enum session_check session_check(struct v2g_request *req, const uint8_t *sid, uint16_t sidlen)
+{
+  struct session *s = req->conn->session;
+
+  req->session = NULL;
+  if (MSG_SESSION_SETUP == req->msg) return SESSION_OK;
+  if (!s || (SESSION_ID_LEN != sidlen) || memcmp(s->id, sid, SESSION_ID_LEN)) return SESSION_UNKNOWN;
+  if (!session_sequence_ok(s, req->msg)) return SESSION_OUT_OF_SEQUENCE;
+
+  /* only an authorized session goes on to charge */
+  if ((MSG_CHARGE_PARAMETER_DISCOVERY == req->msg) && (MSG_AUTHORIZATION == s->last_msg) && (AUTH_ACCEPTED != s->auth)) return SESSION_OUT_OF_SEQUENCE;
+
+  req->session = s;
+  return SESSION_OK;
+}
+
+/* an EV presenting a SessionID we still hold is resuming a paused session; returns NULL if the table is full */
+
+static struct session *session_setup(struct connection *conn, const uint8_t *sid, uint16_t sidlen, bool *joined)
+{
+  struct session *s = NULL;
+
+  if (SESSION_ID_LEN == sidlen) s = session_lookup(&worker->sessions, sid);
+  *joined = (NULL != s);
+
+  if (s)
+  {
+    /*
+    the EV may reconnect before we have noticed that its previous link died: that link
+    gives up the output and its budget slot now, so that closing it later cannot switch
+    off the connector under the session, nor its slot count twice meanwhile
+    */
+    if (s->conn && (s->conn != conn))
+    {
+      struct connection *old = s->conn;
+      power_off(old);
+      old->session = NULL;
+    }
+  }
+  else
+  {
+    s = session_create(&worker->sessions);
+    if (!s) return NULL;
+  }
+
+  if (conn->session && (conn->session != s))
+  {
+    conn->session->conn = NULL;
+    timer_arm(&worker->timers, &conn->session->linger, session_linger_ms);
+  }
+  conn->session = s;
+  s->conn = conn;
+  timer_cancel(&worker->timers, &s->linger);
+  s->schema = conn->schema;
+  s->last_msg = MSG_SESSION_SETUP;
+
+  LOG_INFO("socket %d: session %x %s", conn->src.sock, session_id64(s), LOG_STR((*joined) ? "joined" : "established"));
+  journal_session(s, conn, (*joined) ? JOURNAL_SESSION_JOIN : JOURNAL_SESSION_START, (uint32_t)conn->schema);
+  metric_set(&worker->metrics.sessions_active, worker->sessions.count);
+  return s;
+}
+
+/*
+trace dumps, as Chrome trace-event JSON: one file per session when it stops, and one per
+worker covering every session in its shard when SIGUSR1 arrives; the signal only nudges
+the workers, which each copy their own shard for the trace thread to write, as a session
+that stops does
+*/
+
+static void trace_signal(int sig)
+{
+  const uint64_t one = 1;
+
+  for (unsigned i = 0; i < worker_count; i++)
+  {
+    atomic_store(&workers[i].dump_trace, true);
+    if (write(workers[i].wake_src.sock, &one, sizeof(one)) < 0) continue;
+  }
+}
+
+static void trace_dump_shard(void)
+{
+  struct trace_shard *shard = trace_shard_new(worker->index, worker->sessions.count);
+  if (!shard) return;
+
+  for (int i = 0; i < MAX_SESSIONS; i++)
+    if (worker->sessions.slab[i].in_use) trace_shard_add(shard, &worker->sessions.slab[i].trace, session_id64(&worker->sessions.slab[i]));
+
+  unsigned count = shard->count;
+  if (trace_shard_finish(shard))
+    LOG_INFO("trace: worker %u queued %u sessions for dumping", worker->index, count);
+  else
+    LOG_WARN("trace: worker %u shard not dumped", worker->index);
+}
+
+/* a session without a connection (paused, or its link lost) that the EV has not rejoined in time */
+
+static void session_expire(struct timer *t)
+{
+  struct session *s = container_of(t, struct session, linger);
+  if (s->conn) return;
+
+  LOG_INFO("session %x expired", session_id64(s));
+  journal_session(s, NULL, JOURNAL_SESSION_STOP, JOURNAL_STOP_EXPIRE);
+  trace_finish(&s->trace, session_id64(s));
+  timer_cancel(&worker->timers, &s->auth_deadline);
+  session_destroy(&worker->sessions, s);
+  metric_set(&worker->metrics.sessions_active, worker->sessions.count);
+}
+
+/* a paused session is kept for the EV to rejoin; a terminated one is forgotten */
+
+static void session_stop(struct v2g_request *req, bool terminate)
+{
+  if (!req->session) return;
+  LOG_INFO("socket %d: session %x %s", req->conn->src.sock, session_id64(req->session), LOG_STR((terminate) ? "terminated" : "paused"));
+
+  /* the spans of this request so far are still pending on the connection */
+  trace_commit(&req->conn->trace, &req->session->trace, req->msg);
+  journal_session(req->session, req->conn, JOURNAL_SESSION_STOP, (terminate) ? JOURNAL_STOP_TERMINATE : JOURNAL_STOP_PAUSE);
+  power_off(req->conn);
+  if (!trace_finish(&req->session->trace, session_id64(req->session))) LOG_DEBUG("trace: session %x not dumped", session_id64(req->session));
+
+  if (!terminate) return;
+  timer_cancel(&worker->timers, &req->session->linger);
+  timer_cancel(&worker->timers, &req->session->auth_deadline);
+  session_destroy(&worker->sessions, req->session);
+  req->conn->session = NULL;
+  req->session = NULL;
+  metric_set(&worker->metrics.sessions_active, worker->sessions.count);
+}
+
+/*
+authorization lookups (see auth.h)
+
+A session's lookup is tagged with its index in the shard and a sequence number, so a
+reply finds its session in O(1), and one for a session that has since gone, or that has
+since asked about another identifier, is only cached.  A lookup that cannot be sent, or
+that the backend does not answer within auth_timeout_ms, is settled by
+auth_offline_accept; so is every lookup in flight when the backend goes away.
+*/
+
+static void auth_settle(struct session *s, enum auth_state result)
+{
+  timer_cancel(&worker->timers, &s->auth_deadline);
+  s->auth = result;
+  if (AUTH_REJECTED == result) metric_inc(&worker->metrics.auth_rejected);
+  LOG_INFO("session %x %s", session_id64(s), LOG_STR((AUTH_ACCEPTED == result) ? "authorized" : "not authorized"));
+}
+
+static void auth_offline(struct session *s)
+{
+  auth_settle(s, (auth_offline_accept) ? AUTH_ACCEPTED : AUTH_REJECTED);
+}
+
+static void auth_disconnect(void)
+{
+  LOG_WARN("authorization backend disconnected");
+  close(worker->auth_src.sock);
+  worker->auth_src.sock = -1;
+  worker->auth_retry_ns = now_ns() + auth_retry_ms * 1000000ull;
+
+  for (int i = 0; i < MAX_SESSIONS; i++)
+    if (worker->sessions.slab[i].in_use && (AUTH_PENDING == worker->sessions.slab[i].auth)) auth_offline(&worker->sessions.slab[i]);
+}
+
+/* connect to the backend unless connected already, or a connect has failed too recently */
+
+static bool auth_backend(void)
+{
+  if (worker->auth_src.sock >= 0) return true;
+  if (now_ns() < worker->auth_retry_ns) return false;
+
+  worker->auth_src.sock = auth_connect(AUTH_SOCKET_PATH);
+  if ((worker->auth_src.sock >= 0) && !epoll_add(worker->epfd, &worker->auth_src, EPOLLIN | EPOLLRDHUP | EPOLLET))
+  {
+    LOG_INFO("authorization backend connected");
+    return true;
+  }
+
+  if (worker->auth_src.sock >= 0) close(worker->auth_src.sock);
+  worker->auth_src.sock = -1;
+  worker->auth_retry_ns = now_ns() + auth_retry_ms * 1000000ull;
+  return false;
+}
+
+/*
+ask the backend about the session's identifier.  auth_deadline runs from the first
+attempt and is not restarted by another, so however the lookup goes, the EV is answered
+Ongoing for no longer than auth_timeout_ms before the offline policy decides.
+*/
+
+static void auth_ask(struct session *s)
+{
+  s->auth = AUTH_UNKNOWN;
+  s->auth_tag = ((uint32_t)(s - worker->sessions.slab) << 16) | ++worker->auth_seq;
+  if (!timer_pending(&s->auth_deadline)) timer_arm(&worker->timers, &s->auth_deadline, auth_timeout_ms);
+
+  /* no backend: it is unavailable, not merely slow */
+  if (!auth_backend())
+  {
+    auth_offline(s);
+    return;
+  }
+
+  if (!auth_send(worker->auth_src.sock, s->auth_tag, &s->auth_id))
+  {
+    /* a backend that is only behind keeps its connection, and is asked again on the EV's next AuthorizationReq */
+    if (EAGAIN == errno) return;
+    auth_disconnect();
+    auth_offline(s);
+    return;
+  }
+
+  s->auth = AUTH_PENDING;
+  metric_inc(&worker->metrics.auth_lookups);
+}
+
+/* the session is to be authorized by this identifier: from the cache if a decision is held, else by a lookup */
+
+static void auth_begin(struct session *s, enum auth_kind kind, const void *bytes, size_t len)
+{
+  struct auth_id id;
+  auth_id_set(&id, kind, bytes, len);
+  if ((AUTH_UNKNOWN != s->auth) && auth_id_equal(&id, &s->auth_id)) return;
+  s->auth_id = id;
+
+  enum auth_state cached = auth_cache_get(&auth_cache, &id);
+  if (AUTH_UNKNOWN == cached)
+  {
+    auth_ask(s);
+    return;
+  }
+
+  metric_inc(&worker->metrics.auth_cache_hits);
+  auth_settle(s, cached);
+}
+
+/* where the session stands when the EV asks; a lookup the backend could not take yet is sent again */
+
+static enum auth_state auth_status(struct session *s)
+{
+  if (!s) return AUTH_UNKNOWN;
+  if (AUTH_UNKNOWN == s->auth) auth_ask(s);
+  if ((AUTH_PENDING == s->auth) || (AUTH_UNKNOWN == s->auth)) metric_inc(&worker->metrics.auth_ongoing);
+  return s->auth;
+}
+
+static void auth_expire(struct timer *t)
+{
+  struct session *s = container_of(t, struct session, auth_deadline);
+  if (!s->in_use || (AUTH_ACCEPTED == s->auth) || (AUTH_REJECTED == s->auth)) return;
+
+  LOG_WARN("session %x: authorization timeout", session_id64(s));
+  metric_inc(&worker->metrics.auth_timeouts);
+  auth_offline(s);
+}
+
+static void auth_service(void)
+{
+  struct auth_reply reply;
+  int rc;
+
+  while ((rc = auth_recv(worker->auth_src.sock, &reply)) > 0)
+  {
+    enum auth_state result = (AUTH_ACCEPTED == reply.result) ? AUTH_ACCEPTED : AUTH_REJECTED;
+    if (reply.id.len > AUTH_ID_MAX) continue;
+    auth_cache_put(&auth_cache, &reply.id, result, reply.ttl_s);
+
+    unsigned index = reply.tag >> 16;
+    if (index >= MAX_SESSIONS) continue;
+
+    struct session *s = &worker->sessions.slab[index];
+    if (s->in_use && (AUTH_PENDING == s->auth) && (s->auth_tag == reply.tag) && auth_id_equal(&s->auth_id, &reply.id)) auth_settle(s, result);
+  }
+
+  if (rc < 0) auth_disconnect();
+}
+
+/* the V2GTP header is written once the EXI body (which follows it) has been encoded */
+
+static void stream_init(bitstream_t *stream, size_t *pos, uint8_t *data, size_t size)
+{
+  *pos = V2GTP_HEADER_LENGTH;
+  stream->size = size;
+  stream->data = data;
+  stream->pos = pos;
+}
+
+static size_t stream_finish(bitstream_t *stream)
+{
+  if (write_v2gtpHeader(stream->data, *stream->pos - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE)) return 0;
+  return *stream->pos;
+}
+
+/*
+ISO 15118-2
+*/
+
+static enum v2g_msg iso1_request_type(const union v2g_document *doc, const uint8_t **sid, uint16_t *sidlen)
+{
+  const struct iso1BodyType *body = &doc->iso1.V2G_Message.Body;
+
+  *sid = doc->iso1.V2G_Message.Header.SessionID.bytes;
+  *sidlen = doc->iso1.V2G_Message.Header.SessionID.bytesLen;
+
+  if (body->SessionSetupReq_isUsed) return MSG_SESSION_SETUP;
+  if (body->ServiceDiscoveryReq_isUsed) return MSG_SERVICE_DISCOVERY;
+  if (body->PaymentServiceSelectionReq_isUsed) return MSG_PAYMENT_SERVICE_SELECTION;
+  if (body->PaymentDetailsReq_isUsed) return MSG_PAYMENT_DETAILS;
+  if (body->AuthorizationReq_isUsed) return MSG_AUTHORIZATION;
+  if (body->ChargeParameterDiscoveryReq_isUsed) return MSG_CHARGE_PARAMETER_DISCOVERY;
+  if (body->PowerDeliveryReq_isUsed) return MSG_POWER_DELIVERY;
+  if (body->SessionStopReq_isUsed) return MSG_SESSION_STOP;
+  if (body->CableCheckReq_isUsed) return MSG_CABLE_CHECK;
+  if (body->PreChargeReq_isUsed) return MSG_PRE_CHARGE;
+  if (body->WeldingDetectionReq_isUsed) return MSG_WELDING_DETECTION;
+  if (body->CurrentDemandReq_isUsed) return MSG_CURRENT_DEMAND;
+  return MSG_NONE;
+}
+
+static void *iso1_session_setup(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  out->V2G_Message.Body.SessionSetupRes_isUsed = 1u;
+  struct iso1SessionSetupResType *body = &out->V2G_Message.Body.SessionSetupRes;
+
+  bool joined;
+  req->session = session_setup(req->conn, in->V2G_Message.Header.SessionID.bytes, in->V2G_Message.Header.SessionID.bytesLen, &joined);
+
+  if (req->session)
+  {
+    body->ResponseCode = (joined) ? iso1responseCodeType_OK_OldSessionJoined : iso1responseCodeType_OK_NewSessionEstablished;
+    out->V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+    memcpy(out->V2G_Message.Header.SessionID.bytes, req->session->id, SESSION_ID_LEN);
+
+    /* the answer is usually in by the time the EV gets to AuthorizationReq */
+    if (!joined) auth_begin(req->session, AUTH_EVCCID, in->V2G_Message.Body.SessionSetupReq.EVCCID.bytes, in->V2G_Message.Body.SessionSetupReq.EVCCID.bytesLen);
+  }
+  else
+  {
+    body->ResponseCode = iso1responseCodeType_FAILED;
+  }
+
+  body->EVSEID.charactersLen = set_chars(body->EVSEID.characters, ARRAY_SIZE(body->EVSEID.characters), "ZZ00000");
+  body->EVSETimeStamp_isUsed = 0u;
+  return &body->ResponseCode;
+}
+
+static void *iso1_service_discovery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  build_service_discovery_res(&out->V2G_Message.Body);
+  return &out->V2G_Message.Body.ServiceDiscoveryRes.ResponseCode;
+}
+
+static void *iso1_payment_service_selection(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  build_payment_service_selection_res(&out->V2G_Message.Body);
+  return &out->V2G_Message.Body.PaymentServiceSelectionRes.ResponseCode;
+}
+
+/* with a contract, the session is authorized by its eMAID instead of the EVCCID; only a decision already cached can refuse it here */
+
+static void *iso1_payment_details(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  out->V2G_Message.Body.PaymentDetailsRes_isUsed = 1u;
+  struct iso1PaymentDetailsResType *body = &out->V2G_Message.Body.PaymentDetailsRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+
+  if (req->session)
+  {
+    uint8_t emaid[AUTH_ID_MAX];
+    size_t len = get_chars(emaid, sizeof(emaid), in->V2G_Message.Body.PaymentDetailsReq.eMAID.characters, in->V2G_Message.Body.PaymentDetailsReq.eMAID.charactersLen);
+    auth_begin(req->session, AUTH_EMAID, emaid, len);
+    if (AUTH_REJECTED == req->session->auth) body->ResponseCode = iso1responseCodeType_FAILED;
+  }
+
+  return &body->ResponseCode;
+}
+
+static void *iso1_authorization(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  out->V2G_Message.Body.AuthorizationRes_isUsed = 1u;
+  struct iso1AuthorizationResType *body = &out->V2G_Message.Body.AuthorizationRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->EVSEProcessing = iso1EVSEProcessingType_Finished;
+
+  /* the EV repeats the request until it is Finished */
+  switch (auth_status(req->session))
+  {
+  case AUTH_UNKNOWN:
+  case AUTH_PENDING: body->EVSEProcessing = iso1EVSEProcessingType_Ongoing; break;
+  case AUTH_REJECTED: body->ResponseCode = iso1responseCodeType_FAILED; break;
+  default: break;
+  }
+
+  return &body->ResponseCode;
+}
+
+static void *iso1_charge_parameter_discovery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+  const struct iso1ChargeParameterDiscoveryReqType *cpd = &in->V2G_Message.Body.ChargeParameterDiscoveryReq;
+
+  build_charge_parameter_discovery_res(&out->V2G_Message.Body);
+  iso1responseCodeType *code = &out->V2G_Message.Body.ChargeParameterDiscoveryRes.ResponseCode;
+  if (dcmode != cpd->RequestedEnergyTransferMode)
+  {
+    *code = iso1responseCodeType_FAILED_WrongEnergyTransferMode;
+    return code;
+  }
+
+  /*
+  the voltage it will charge at is not known yet, so the current limit stays the EVSE's own; the power limit
+  is the session's share.  Only a session that passed session_check() (authorized, in sequence) joins the budget.
+  */
+  uint32_t share = 0;
+  if (req->session && cpd->DC_EVChargeParameter_isUsed)
+  {
+    const struct iso1DC_EVChargeParameterType *ev = &cpd->DC_EVChargeParameter;
+    share = budget_discover(req->conn, &ev->EVMaximumVoltageLimit, &ev->EVMaximumCurrentLimit, (ev->EVMaximumPowerLimit_isUsed) ? &ev->EVMaximumPowerLimit : NULL);
+  }
+  else if (req->session)
+    share = budget_discover(req->conn, NULL, NULL, NULL);
+
+  out->V2G_Message.Body.ChargeParameterDiscoveryRes.DC_EVSEChargeParameter.EVSEMaximumPowerLimit = budget_value(share);
+  return code;
+}
+
+static void *iso1_cable_check(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  out->V2G_Message.Body.CableCheckRes_isUsed = 1u;
+  struct iso1CableCheckResType *body = &out->V2G_Message.Body.CableCheckRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+  body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+  body->EVSEProcessing = iso1EVSEProcessingType_Finished;
+  return &body->ResponseCode;
+}
+
+static void *iso1_pre_charge(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+  const struct iso1PreChargeReqType *pre = &in->V2G_Message.Body.PreChargeReq;
+
+  /* jot down the targets */
+  if (req->session)
+  {
+    req->session->EVTargetVoltage = pre->EVTargetVoltage;
+    req->session->EVTargetCurrent = pre->EVTargetCurrent;
+  }
+
+  out->V2G_Message.Body.PreChargeRes_isUsed = 1u;
+  struct iso1PreChargeResType *body = &out->V2G_Message.Body.PreChargeRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+  body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+
+  /* a request that fails session_check() is answered with the output as it is, never switched on */
+  if (req->session)
+  {
+    power_set(req->conn, true, &pre->EVTargetVoltage, &pre->EVTargetCurrent);
+    journal_charge(req->conn);
+  }
+  power_present(req->conn, &body->EVSEPresentVoltage, NULL);
+  return &body->ResponseCode;
+}
+
+static void *iso1_power_delivery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  /* switching off is safe whatever the request, so it is not held to session_check() */
+  if (iso1chargeProgressType_Stop == in->V2G_Message.Body.PowerDeliveryReq.ChargeProgress) power_off(req->conn);
+
+  out->V2G_Message.Body.PowerDeliveryRes_isUsed = 1u;
+  struct iso1PowerDeliveryResType *body = &out->V2G_Message.Body.PowerDeliveryRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->EVSEStatus_isUsed = 1;
+  body->EVSEStatus.EVSENotification = iso1EVSENotificationType_StopCharging;
+  body->EVSEStatus.NotificationMaxDelay = max_delay;
+  return &body->ResponseCode;
+}
+
+static void *iso1_current_demand(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+  const struct iso1CurrentDemandReqType *demand = &in->V2G_Message.Body.CurrentDemandReq;
+
+  /* jot down the targets */
+  if (req->session)
+  {
+    req->session->EVTargetVoltage = demand->EVTargetVoltage;
+    req->session->EVTargetCurrent = demand->EVTargetCurrent;
+  }
+
+  out->V2G_Message.Body.CurrentDemandRes_isUsed = 1u;
+  struct iso1CurrentDemandResType *body = &out->V2G_Message.Body.CurrentDemandRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+  body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+  body->DC_EVSEStatus.EVSEStatusCode = iso1DC_EVSEStatusCodeType_EVSE_Ready;
+
+  struct charge_loop_res limits;
+  struct iso1PhysicalValueType current = demand->EVTargetCurrent;
+  if (req->session)
+    budget_follow(req->conn, &demand->EVTargetVoltage, &current, &limits);
+  else
+    budget_refuse(&limits);
+  body->EVSEMaximumCurrentLimit_isUsed = 1u;
+  body->EVSEMaximumCurrentLimit = limits.EVSEMaximumCurrentLimit;
+  body->EVSEMaximumPowerLimit_isUsed = 1u;
+  body->EVSEMaximumPowerLimit = limits.EVSEMaximumPowerLimit;
+  body->EVSECurrentLimitAchieved = limits.EVSECurrentLimitAchieved;
+  body->EVSEPowerLimitAchieved = limits.EVSEPowerLimitAchieved;
+
+  if (req->session)
+  {
+    power_set(req->conn, true, &demand->EVTargetVoltage, &current);
+    journal_charge(req->conn);
+  }
+  power_present(req->conn, &body->EVSEPresentVoltage, &body->EVSEPresentCurrent);
+  return &body->ResponseCode;
+}
+
+static void *iso1_welding_detection(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  out->V2G_Message.Body.WeldingDetectionRes_isUsed = 1u;
+  struct iso1WeldingDetectionResType *body = &out->V2G_Message.Body.WeldingDetectionRes;
+  body->ResponseCode = iso1responseCodeType_OK;
+  body->DC_EVSEStatus.EVSENotification = iso1EVSENotificationType_None;
+  body->DC_EVSEStatus.NotificationMaxDelay = max_delay;
+  power_present(req->conn, &body->EVSEPresentVoltage, NULL);
+  return &body->ResponseCode;
+}
+
+static void *iso1_session_stop(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  build_session_stop_res(&out->V2G_Message.Body);
+  session_stop(req, iso1chargingSessionType_Terminate == in->V2G_Message.Body.SessionStopReq.ChargingSession);
+  return &out->V2G_Message.Body.SessionStopRes.ResponseCode;
+}
+
+/*
+NOTE: the following V2G message types are deliberately not handled:
+ServiceDetailReq (opt VAS)
+MeteringReceiptReq (opt Metering)
+CertificateUpdateReq (opt Certificate Installation)
+CertificateInstallationReq (opt Certificate Update)
+ChargingStatusReq (specific to AC charging)
+*/
+
+static const protocol_handler iso1_handlers[MSG_COUNT] =
+{
+  [MSG_SESSION_SETUP] = iso1_session_setup,
+  [MSG_SERVICE_DISCOVERY] = iso1_service_discovery,
+  [MSG_PAYMENT_SERVICE_SELECTION] = iso1_payment_service_selection,
+  [MSG_PAYMENT_DETAILS] = iso1_payment_details,
+  [MSG_AUTHORIZATION] = iso1_authorization,
+  [MSG_CHARGE_PARAMETER_DISCOVERY] = iso1_charge_parameter_discovery,
+  [MSG_CABLE_CHECK] = iso1_cable_check,
+  [MSG_PRE_CHARGE] = iso1_pre_charge,
+  [MSG_POWER_DELIVERY] = iso1_power_delivery,
+  [MSG_CURRENT_DEMAND] = iso1_current_demand,
+  [MSG_WELDING_DETECTION] = iso1_welding_detection,
+  [MSG_SESSION_STOP] = iso1_session_stop,
+};
+
+/* CurrentDemandReq and PreChargeReq, by the compact codec in fastpath.h; zero means "not handled" */
+
+static size_t charge_loop_fast(struct connection *conn, uint8_t *in, size_t len, uint8_t *out, size_t outsize)
+{
+  struct charge_loop_req req;
+  struct charge_loop_res res;
+  struct session *session = conn->session;
+  const uint8_t *exi = in + V2GTP_HEADER_LENGTH;
+
+  /* the charging loop only ever runs in a session */
+  if (!session) return 0;
+
+  uint64_t t = trace_now();
+  len -= V2GTP_HEADER_LENGTH;
+
+  enum v2g_msg msg = fastpath_peek(&worker->fastpath, exi, len);
+  if (MSG_NONE == msg) return 0;
+  if (!fastpath_decode(&worker->fastpath, msg, exi, len, &req)) return 0;
+  t = trace_span(&conn->trace, TRACE_DECODE, t);
+
+  /* unknown sessions and sequence errors are rare; the generic path answers those */
+  if (memcmp(req.sid, session->id, SESSION_ID_LEN) || !session_sequence_ok(session, msg)) return 0;
+
+  /* jot down the targets */
+  session->EVTargetVoltage = req.EVTargetVoltage;
+  session->EVTargetCurrent = req.EVTargetCurrent;
+  session->last_msg = msg;
+
+  conn->msg = msg;
+  res.ResponseCode = iso1responseCodeType_OK;
+  struct iso1PhysicalValueType current = req.EVTargetCurrent;
+  if (MSG_CURRENT_DEMAND == msg) budget_follow(conn, &req.EVTargetVoltage, &current, &res);
+  power_set(conn, true, &req.EVTargetVoltage, &current);
+  power_present(conn, &res.EVSEPresentVoltage, &res.EVSEPresentCurrent);
+  journal_charge(conn);
+  t = trace_span(&conn->trace, TRACE_HANDLER, t);
+
+  /* the V2GTP header is written along with the body */
+  size_t replylen = fastpath_encode(&worker->fastpath, &req, &res, out, outsize);
+  trace_span(&conn->trace, TRACE_ENCODE, t);
+  return replylen;
+}
+
+static int iso1_decode(uint8_t *in, size_t len, union v2g_document *doc)
+{
+  bitstream_t stream;
+  size_t pos;
+
+  /* OpenV2G init_ helpers don't clear everything; trust only memset */
+  memset(&doc->iso1, 0, sizeof(doc->iso1));
+
+  stream_init(&stream, &pos, in, len);
+  int errn = decode_iso1ExiDocument(&stream, &doc->iso1);
+  if (!errn && !doc->iso1.V2G_Message_isUsed) errn = -1;
+  return errn;
+}
+
+static void iso1_reply_init(const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct iso1EXIDocument *in = &in_doc->iso1;
+  struct iso1EXIDocument *out = &out_doc->iso1;
+
+  memset(out, 0, sizeof(*out));
+  out->V2G_Message_isUsed = 1u;
+  out->V2G_Message.Header.SessionID = in->V2G_Message.Header.SessionID;
+}
+
+static void iso1_refuse(void *code, bool unknown_session)
+{
+  *(iso1responseCodeType *)code = (unknown_session) ? iso1responseCodeType_FAILED_UnknownSession : iso1responseCodeType_FAILED_SequenceError;
+}
+
+static int iso1_encode(union v2g_document *doc, uint8_t *out, size_t outsize, size_t *len)
+{
+  bitstream_t stream;
+
+  stream_init(&stream, len, out, outsize);
+  return encode_iso1ExiDocument(&stream, &doc->iso1);
+}
+
+/* static responses differ only in their SessionID; stamp it into the pre-encoded template */
+
+static size_t iso1_cached(struct v2g_request *req, const union v2g_document *in_doc, uint8_t *out, size_t outsize)
+{
+  if (!respcache_has(&worker->respcache, req->msg)) return 0;
+
+  uint64_t t = trace_now();
+  size_t replylen = respcache_emit(&worker->respcache, req->msg, req->session->id, out, outsize);
+  if (!replylen) return 0;
+  t = trace_span(&req->conn->trace, TRACE_ENCODE, t);
+
+  /* what the handler would have done; the reply is already written, so this span follows the encode */
+  req->session->last_msg = req->msg;
+  if (MSG_SESSION_STOP == req->msg) session_stop(req, iso1chargingSessionType_Terminate == in_doc->iso1.V2G_Message.Body.SessionStopReq.ChargingSession);
+  trace_span(&req->conn->trace, TRACE_HANDLER, t);
+  return replylen;
+}
+
+/*
+DIN 70121
+
+the DC subset of ISO 15118-2 that predates it; the same session and sequence rules apply,
+with ServicePaymentSelection in place of PaymentServiceSelection and ContractAuthentication
+in place of Authorization
+*/
+
+static enum v2g_msg din_request_type(const union v2g_document *doc, const uint8_t **sid, uint16_t *sidlen)
+{
+  const struct dinBodyType *body = &doc->din.V2G_Message.Body;
+
+  *sid = doc->din.V2G_Message.Header.SessionID.bytes;
+  *sidlen = doc->din.V2G_Message.Header.SessionID.bytesLen;
+
+  if (body->SessionSetupReq_isUsed) return MSG_SESSION_SETUP;
+  if (body->ServiceDiscoveryReq_isUsed) return MSG_SERVICE_DISCOVERY;
+  if (body->ServicePaymentSelectionReq_isUsed) return MSG_PAYMENT_SERVICE_SELECTION;
+  if (body->ContractAuthenticationReq_isUsed) return MSG_AUTHORIZATION;
+  if (body->ChargeParameterDiscoveryReq_isUsed) return MSG_CHARGE_PARAMETER_DISCOVERY;
+  if (body->PowerDeliveryReq_isUsed) return MSG_POWER_DELIVERY;
+  if (body->SessionStopReq_isUsed) return MSG_SESSION_STOP;
+  if (body->CableCheckReq_isUsed) return MSG_CABLE_CHECK;
+  if (body->PreChargeReq_isUsed) return MSG_PRE_CHARGE;
+  if (body->WeldingDetectionReq_isUsed) return MSG_WELDING_DETECTION;
+  if (body->CurrentDemandReq_isUsed) return MSG_CURRENT_DEMAND;
+  return MSG_NONE;
+}
+
+/* the charger is described once, in ISO 15118-2 terms; DIN orders its unit symbols differently */
+
+static struct dinPhysicalValueType din_value(const struct iso1PhysicalValueType *v)
+{
+  struct dinPhysicalValueType d = { .Multiplier = v->Multiplier, .Value = v->Value, .Unit_isUsed = 1u };
+
+  switch (v->Unit)
+  {
+  case iso1unitSymbolType_h: d.Unit = dinunitSymbolType_h; break;
+  case iso1unitSymbolType_m: d.Unit = dinunitSymbolType_m; break;
+  case iso1unitSymbolType_s: d.Unit = dinunitSymbolType_s; break;
+  case iso1unitSymbolType_A: d.Unit = dinunitSymbolType_A; break;
+  case iso1unitSymbolType_V: d.Unit = dinunitSymbolType_V; break;
+  case iso1unitSymbolType_W: d.Unit = dinunitSymbolType_W; break;
+  case iso1unitSymbolType_Wh: d.Unit = dinunitSymbolType_Wh; break;
+  default: d.Unit_isUsed = 0u; break;
+  }
+
+  return d;
+}
+
+/* sessions hold the EV's targets in ISO 15118-2 terms whichever protocol set them */
+
+static struct iso1PhysicalValueType iso1_value(const struct dinPhysicalValueType *d, iso1unitSymbolType unit)
+{
+  struct iso1PhysicalValueType v = { .Multiplier = d->Multiplier, .Unit = unit, .Value = d->Value };
+  return v;
+}
+
+static void din_evse_status(struct dinDC_EVSEStatusType *status)
+{
+  status->EVSEStatusCode = dinDC_EVSEStatusCodeType_EVSE_Ready;
+  status->EVSENotification = dinEVSENotificationType_None;
+  status->NotificationMaxDelay = max_delay;
+}
+
+static void *din_session_setup(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.SessionSetupRes_isUsed = 1u;
+  struct dinSessionSetupResType *body = &out->V2G_Message.Body.SessionSetupRes;
+
+  bool joined;
+  req->session = session_setup(req->conn, in->V2G_Message.Header.SessionID.bytes, in->V2G_Message.Header.SessionID.bytesLen, &joined);
+
+  if (req->session)
+  {
+    body->ResponseCode = (joined) ? dinresponseCodeType_OK_OldSessionJoined : dinresponseCodeType_OK_NewSessionEstablished;
+    out->V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+    memcpy(out->V2G_Message.Header.SessionID.bytes, req->session->id, SESSION_ID_LEN);
+    if (!joined) auth_begin(req->session, AUTH_EVCCID, in->V2G_Message.Body.SessionSetupReq.EVCCID.bytes, in->V2G_Message.Body.SessionSetupReq.EVCCID.bytesLen);
+  }
+  else
+  {
+    body->ResponseCode = dinresponseCodeType_FAILED;
+  }
+
+  /* DIN's EVSEID is hexBinary; a single zero byte means "no ID" */
+  body->EVSEID.bytes[0] = 0x00;
+  body->EVSEID.bytesLen = 1;
+  body->DateTimeNow_isUsed = 0u;
+  return &body->ResponseCode;
+}
+
+static void *din_service_discovery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.ServiceDiscoveryRes_isUsed = 1u;
+  struct dinServiceDiscoveryResType *body = &out->V2G_Message.Body.ServiceDiscoveryRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  body->ServiceList_isUsed = 0u;
+  body->PaymentOptions.PaymentOption.array[0] = dinpaymentOptionType_ExternalPayment;
+  body->PaymentOptions.PaymentOption.arrayLen = 1;
+  body->ChargeService.ServiceTag.ServiceID = 1;
+  body->ChargeService.ServiceTag.ServiceCategory = dinserviceCategoryType_EVCharging;
+  body->ChargeService.FreeService = 1;
+  body->ChargeService.EnergyTransferType = din_dcmode;
+  return &body->ResponseCode;
+}
+
+static void *din_service_payment_selection(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.ServicePaymentSelectionRes_isUsed = 1u;
+  out->V2G_Message.Body.ServicePaymentSelectionRes.ResponseCode = dinresponseCodeType_OK;
+  return &out->V2G_Message.Body.ServicePaymentSelectionRes.ResponseCode;
+}
+
+static void *din_contract_authentication(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.ContractAuthenticationRes_isUsed = 1u;
+  struct dinContractAuthenticationResType *body = &out->V2G_Message.Body.ContractAuthenticationRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  body->EVSEProcessing = dinEVSEProcessingType_Finished;
+
+  /* DIN 70121 has external payment only, so the EVCCID is all there is to go on */
+  switch (auth_status(req->session))
+  {
+  case AUTH_UNKNOWN:
+  case AUTH_PENDING: body->EVSEProcessing = dinEVSEProcessingType_Ongoing; break;
+  case AUTH_REJECTED: body->ResponseCode = dinresponseCodeType_FAILED; break;
+  default: break;
+  }
+
+  return &body->ResponseCode;
+}
+
+static void *din_charge_parameter_discovery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.ChargeParameterDiscoveryRes_isUsed = 1u;
+  struct dinChargeParameterDiscoveryResType *body = &out->V2G_Message.Body.ChargeParameterDiscoveryRes;
+
+  body->ResponseCode = dinresponseCodeType_OK;
+  if (din_dcmode_requested != in->V2G_Message.Body.ChargeParameterDiscoveryReq.EVRequestedEnergyTransferType)
+    body->ResponseCode = dinresponseCodeType_FAILED_WrongEnergyTransferType;
+  body->EVSEProcessing = dinEVSEProcessingType_Finished;
+
+  /* as for ISO 15118-2, the power limit is the session's share of the site budget, for a session that passed session_check() */
+  const struct dinChargeParameterDiscoveryReqType *cpd = &in->V2G_Message.Body.ChargeParameterDiscoveryReq;
+  uint32_t share = 0;
+  bool join = req->session && (dinresponseCodeType_OK == body->ResponseCode);
+  if (join && cpd->DC_EVChargeParameter_isUsed)
+  {
+    const struct dinDC_EVChargeParameterType *ev = &cpd->DC_EVChargeParameter;
+    struct iso1PhysicalValueType voltage = iso1_value(&ev->EVMaximumVoltageLimit, iso1unitSymbolType_V);
+    struct iso1PhysicalValueType current = iso1_value(&ev->EVMaximumCurrentLimit, iso1unitSymbolType_A);
+    struct iso1PhysicalValueType power = iso1_value(&ev->EVMaximumPowerLimit, iso1unitSymbolType_W);
+    share = budget_discover(req->conn, &voltage, &current, (ev->EVMaximumPowerLimit_isUsed) ? &power : NULL);
+  }
+  else if (join)
+    share = budget_discover(req->conn, NULL, NULL, NULL);
+  struct iso1PhysicalValueType share_value = budget_value(share);
+
+  /* DIN requires a schedule; offer that share for the next 24 hours */
+  int32_t pmax = (share > INT16_MAX) ? INT16_MAX : (int32_t)share;
+
+  body->SAScheduleList_isUsed = 1u;
+  body->SAScheduleList.SAScheduleTuple.arrayLen = 1;
+  struct dinSAScheduleTupleType *tuple = &body->SAScheduleList.SAScheduleTuple.array[0];
+  tuple->SAScheduleTupleID = 1;
+  tuple->SalesTariff_isUsed = 0u;
+  tuple->PMaxSchedule.PMaxScheduleID = 1;
+  tuple->PMaxSchedule.PMaxScheduleEntry.arrayLen = 1;
+  tuple->PMaxSchedule.PMaxScheduleEntry.array[0].RelativeTimeInterval_isUsed = 1u;
+  tuple->PMaxSchedule.PMaxScheduleEntry.array[0].RelativeTimeInterval.start = 0;
+  tuple->PMaxSchedule.PMaxScheduleEntry.array[0].RelativeTimeInterval.duration = 86400;
+  tuple->PMaxSchedule.PMaxScheduleEntry.array[0].RelativeTimeInterval.duration_isUsed = 1u;
+  tuple->PMaxSchedule.PMaxScheduleEntry.array[0].PMax = pmax;
+
+  body->DC_EVSEChargeParameter_isUsed = 1u;
+  struct dinDC_EVSEChargeParameterType *param = &body->DC_EVSEChargeParameter;
+  din_evse_status(&param->DC_EVSEStatus);
+  param->EVSEMaximumCurrentLimit = din_value(&dccharge.EVSEMaximumCurrentLimit);
+  param->EVSEMaximumPowerLimit = din_value(&share_value);
+  param->EVSEMaximumPowerLimit_isUsed = 1u;
+  param->EVSEMaximumVoltageLimit = din_value(&dccharge.EVSEMaximumVoltageLimit);
+  param->EVSEMinimumCurrentLimit = din_value(&dccharge.EVSEMinimumCurrentLimit);
+  param->EVSEMinimumVoltageLimit = din_value(&dccharge.EVSEMinimumVoltageLimit);
+  param->EVSEPeakCurrentRipple = din_value(&dccharge.EVSEPeakCurrentRipple);
+  return &body->ResponseCode;
+}
+
+static void *din_cable_check(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.CableCheckRes_isUsed = 1u;
+  struct dinCableCheckResType *body = &out->V2G_Message.Body.CableCheckRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  din_evse_status(&body->DC_EVSEStatus);
+  body->DC_EVSEStatus.EVSEIsolationStatus = dinisolationLevelType_Valid;
+  body->DC_EVSEStatus.EVSEIsolationStatus_isUsed = 1u;
+  body->EVSEProcessing = dinEVSEProcessingType_Finished;
+  return &body->ResponseCode;
+}
+
+static void *din_pre_charge(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+
+  /* jot down the targets */
+  if (req->session)
+  {
+    req->session->EVTargetVoltage = iso1_value(&in->V2G_Message.Body.PreChargeReq.EVTargetVoltage, iso1unitSymbolType_V);
+    req->session->EVTargetCurrent = iso1_value(&in->V2G_Message.Body.PreChargeReq.EVTargetCurrent, iso1unitSymbolType_A);
+  }
+
+  out->V2G_Message.Body.PreChargeRes_isUsed = 1u;
+  struct dinPreChargeResType *body = &out->V2G_Message.Body.PreChargeRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  din_evse_status(&body->DC_EVSEStatus);
+  struct iso1PhysicalValueType voltage = iso1_value(&in->V2G_Message.Body.PreChargeReq.EVTargetVoltage, iso1unitSymbolType_V);
+  struct iso1PhysicalValueType current = iso1_value(&in->V2G_Message.Body.PreChargeReq.EVTargetCurrent, iso1unitSymbolType_A);
+
+  /* as for ISO 15118-2, only a request that passed session_check() switches the output on */
+  if (req->session)
+  {
+    power_set(req->conn, true, &voltage, &current);
+    journal_charge(req->conn);
+  }
+  power_present(req->conn, &voltage, NULL);
+  body->EVSEPresentVoltage = din_value(&voltage);
+  return &body->ResponseCode;
+}
+
+static void *din_power_delivery(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+
+  if (!in->V2G_Message.Body.PowerDeliveryReq.ReadyToChargeState) power_off(req->conn);
+
+  out->V2G_Message.Body.PowerDeliveryRes_isUsed = 1u;
+  struct dinPowerDeliveryResType *body = &out->V2G_Message.Body.PowerDeliveryRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  body->DC_EVSEStatus_isUsed = 1u;
+  din_evse_status(&body->DC_EVSEStatus);
+  return &body->ResponseCode;
+}
+
+static void *din_current_demand(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+  const struct dinCurrentDemandReqType *demand = &in->V2G_Message.Body.CurrentDemandReq;
+
+  /* jot down the targets */
+  if (req->session)
+  {
+    req->session->EVTargetVoltage = iso1_value(&demand->EVTargetVoltage, iso1unitSymbolType_V);
+    req->session->EVTargetCurrent = iso1_value(&demand->EVTargetCurrent, iso1unitSymbolType_A);
+  }
+
+  out->V2G_Message.Body.CurrentDemandRes_isUsed = 1u;
+  struct dinCurrentDemandResType *body = &out->V2G_Message.Body.CurrentDemandRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  din_evse_status(&body->DC_EVSEStatus);
+  struct iso1PhysicalValueType voltage = iso1_value(&demand->EVTargetVoltage, iso1unitSymbolType_V);
+  struct iso1PhysicalValueType current = iso1_value(&demand->EVTargetCurrent, iso1unitSymbolType_A);
+
+  struct charge_loop_res limits;
+  if (req->session)
+    budget_follow(req->conn, &voltage, &current, &limits);
+  else
+    budget_refuse(&limits);
+  body->EVSEMaximumCurrentLimit_isUsed = 1u;
+  body->EVSEMaximumCurrentLimit = din_value(&limits.EVSEMaximumCurrentLimit);
+  body->EVSEMaximumPowerLimit_isUsed = 1u;
+  body->EVSEMaximumPowerLimit = din_value(&limits.EVSEMaximumPowerLimit);
+  body->EVSECurrentLimitAchieved = limits.EVSECurrentLimitAchieved;
+  body->EVSEVoltageLimitAchieved = 0;
+  body->EVSEPowerLimitAchieved = limits.EVSEPowerLimitAchieved;
+
+  if (req->session)
+  {
+    power_set(req->conn, true, &voltage, &current);
+    journal_charge(req->conn);
+  }
+  power_present(req->conn, &voltage, &current);
+  body->EVSEPresentVoltage = din_value(&voltage);
+  body->EVSEPresentCurrent = din_value(&current);
+  return &body->ResponseCode;
+}
+
+static void *din_welding_detection(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.WeldingDetectionRes_isUsed = 1u;
+  struct dinWeldingDetectionResType *body = &out->V2G_Message.Body.WeldingDetectionRes;
+  body->ResponseCode = dinresponseCodeType_OK;
+  din_evse_status(&body->DC_EVSEStatus);
+  struct iso1PhysicalValueType voltage;
+  power_present(req->conn, &voltage, NULL);
+  body->EVSEPresentVoltage = din_value(&voltage);
+  return &body->ResponseCode;
+}
+
+/* DIN has no pause: SessionStopReq always ends the session */
+
+static void *din_session_stop(struct v2g_request *req, const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  struct dinEXIDocument *out = &out_doc->din;
+
+  out->V2G_Message.Body.SessionStopRes_isUsed = 1u;
+  out->V2G_Message.Body.SessionStopRes.ResponseCode = dinresponseCodeType_OK;
+  session_stop(req, true);
+  return &out->V2G_Message.Body.SessionStopRes.ResponseCode;
+}
+
+static const protocol_handler din_handlers[MSG_COUNT] =
+{
+  [MSG_SESSION_SETUP] = din_session_setup,
+  [MSG_SERVICE_DISCOVERY] = din_service_discovery,
+  [MSG_PAYMENT_SERVICE_SELECTION] = din_service_payment_selection,
+  [MSG_AUTHORIZATION] = din_contract_authentication,
+  [MSG_CHARGE_PARAMETER_DISCOVERY] = din_charge_parameter_discovery,
+  [MSG_CABLE_CHECK] = din_cable_check,
+  [MSG_PRE_CHARGE] = din_pre_charge,
+  [MSG_POWER_DELIVERY] = din_power_delivery,
+  [MSG_CURRENT_DEMAND] = din_current_demand,
+  [MSG_WELDING_DETECTION] = din_welding_detection,
+  [MSG_SESSION_STOP] = din_session_stop,
+};
+
+static int din_decode(uint8_t *in, size_t len, union v2g_document *doc)
+{
+  bitstream_t stream;
+  size_t pos;
+
+  memset(&doc->din, 0, sizeof(doc->din));
+
+  stream_init(&stream, &pos, in, len);
+  int errn = decode_dinExiDocument(&stream, &doc->din);
+  if (!errn && !doc->din.V2G_Message_isUsed) errn = -1;
+  return errn;
+}
+
+static void din_reply_init(const union v2g_document *in_doc, union v2g_document *out_doc)
+{
+  const struct dinEXIDocument *in = &in_doc->din;
+  struct dinEXIDocument *out = &out_doc->din;
+
+  memset(out, 0, sizeof(*out));
+  out->V2G_Message_isUsed = 1u;
+  out->V2G_Message.Header.SessionID = in->V2G_Message.Header.SessionID;
+}
+
+static void din_refuse(void *code, bool unknown_session)
+{
+  *(dinresponseCodeType *)code = (unknown_session) ? dinresponseCodeType_FAILED_UnknownSession : dinresponseCodeType_FAILED_SequenceError;
+}
+
+static int din_encode(union v2g_document *doc, uint8_t *out, size_t outsize, size_t *len)
+{
+  bitstream_t stream;
+
+  stream_init(&stream, len, out, outsize);
+  return encode_dinExiDocument(&stream, &doc->din);
+}
+
+/*
+one V2G message in the protocol agreed on this connection; its registry entry supplies
+the codec and the handlers, the session rules are the same for all
+*/
+
+static size_t v2g_process(struct connection *conn, uint8_t *in, size_t len, uint8_t *out, size_t outsize)
+{
+  const struct protocol *p = conn->protocol;
+  union v2g_document exiIn, exiOut;
+  const uint8_t *sid;
+  uint16_t sidlen;
+
+  /* a request the fast path turns down (wrong SessionID, out of sequence) is decoded again below; that is rare */
+  if (p->fast)
+  {
+    size_t replylen = p->fast(conn, in, len, out, outsize);
+    if (replylen) return replylen;
+  }
+
+  uint64_t t = trace_now();
+
+  int errn = p->decode(in, len, &exiIn);
+  t = trace_span(&conn->trace, TRACE_DECODE, t);
+  if (errn)
+  {
+    LOG_WARN("socket %d: %s decode error %d", conn->src.sock, LOG_STR(p->name), errn);
+    metric_inc(&worker->metrics.decode_errors);
+    return 0;
+  }
+
+  struct v2g_request req = { .conn = conn, .msg = p->request_type(&exiIn, &sid, &sidlen) };
+  protocol_handler handler = p->handlers[req.msg];
+
+  if (!handler)
+  {
+    LOG_WARN("socket %d: unhandled request", conn->src.sock);
+    metric_inc(&worker->metrics.unhandled);
+    return 0;
+  }
+
+  conn->msg = req.msg;
+
+  enum session_check check = session_check(&req, sid, sidlen);
+
+  if (req.session && p->cached)
+  {
+    size_t replylen = p->cached(&req, &exiIn, out, outsize);
+    if (replylen) return replylen;
+  }
+
+  p->reply_init(&exiIn, &exiOut);
+  void *code = handler(&req, &exiIn, &exiOut);
+  t = trace_span(&conn->trace, TRACE_HANDLER, t);
+
+  if (SESSION_OK != check)
+    p->refuse(code, SESSION_UNKNOWN == check);
+  else if (req.session)
+    req.session->last_msg = req.msg;
+
+  size_t replylen;
+  errn = p->encode(&exiOut, out, outsize, &replylen);
+  t = trace_span(&conn->trace, TRACE_ENCODE, t);
+  if (errn)
+  {
+    LOG_ERROR("socket %d: %s %sRes encode error %d", conn->src.sock, LOG_STR(p->name), LOG_STR(msg_names[req.msg]), errn);
+    metric_inc(&worker->metrics.encode_errors);
+    return 0;
+  }
+
+  if (write_v2gtpHeader(out, replylen - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE)) return 0;
+  trace_span(&conn->trace, TRACE_FRAME, t);
+  return replylen;
+}
+
+/*
+registry of the application protocols offered in supportedAppProtocolReq
+
+OpenV2G's iso2 codec is the 2016 draft of ISO 15118-2, which no EV offers, so it is not
+registered; neither is ISO 15118-20, for which OpenV2G has no codec
+*/
+
+static struct protocol protocols[] =
+{
+  {
+    .name = "ISO 15118-2", .ns = iso1string, .version_major = 2, .version_minor = 0, .priority = 0,
+    .decode = iso1_decode, .request_type = iso1_request_type, .handlers = iso1_handlers,
+    .reply_init = iso1_reply_init, .refuse = iso1_refuse, .encode = iso1_encode,
+    .fast = charge_loop_fast, .cached = iso1_cached,
+  },
+  {
+    .name = "DIN 70121", .ns = dinstring, .version_major = 2, .version_minor = 0, .priority = 1,
+    .decode = din_decode, .request_type = din_request_type, .handlers = din_handlers,
+    .reply_init = din_reply_init, .refuse = din_refuse, .encode = din_encode,
+  },
+};
+
+static size_t handshake_process(struct connection *conn, uint8_t *in, size_t len, uint8_t *out, size_t outsize)
+{
+  struct appHandEXIDocument exiDoc, appHandResp;
+  bitstream_t streamIn, streamOut;
+  size_t posi, poso;
+  int errn;
+
+  uint64_t t = trace_now();
+
+  stream_init(&streamIn, &posi, in, len);
+  errn = decode_appHandExiDocument(&streamIn, &exiDoc);
+  t = trace_span(&conn->trace, TRACE_DECODE, t);
+  if (errn || !exiDoc.supportedAppProtocolReq_isUsed)
+  {
+    LOG_WARN("socket %d: supportedAppProtocolReq decode error %d", conn->src.sock, errn);
+    metric_inc(&worker->metrics.decode_errors);
+    metric_inc(&worker->metrics.handshakes_failed);
+    return 0;
+  }
+
+  const struct protocol *protocol;
+  bool minor_deviation = false;
+  const struct appHandAppProtocolType *offer = protocol_select(protocols, ARRAY_SIZE(protocols), &exiDoc, &protocol, &minor_deviation);
+
+  init_appHandEXIDocument(&appHandResp);
+  appHandResp.supportedAppProtocolRes_isUsed = 1u;
+
+  if (offer)
+  {
+    LOG_INFO("socket %d: %s selected, SchemaID %d", conn->src.sock, LOG_STR(protocol->name), offer->SchemaID);
+    appHandResp.supportedAppProtocolRes.ResponseCode = (minor_deviation) ? appHandresponseCodeType_OK_SuccessfulNegotiationWithMinorDeviation : appHandresponseCodeType_OK_SuccessfulNegotiation;
+    /* signal the protocol by the provided schema id */
+    appHandResp.supportedAppProtocolRes.SchemaID = offer->SchemaID;
+    appHandResp.supportedAppProtocolRes.SchemaID_isUsed = 1u;
+  }
+  else
+  {
+    appHandResp.supportedAppProtocolRes.ResponseCode = appHandresponseCodeType_Failed_NoNegotiation;
+    appHandResp.supportedAppProtocolRes.SchemaID_isUsed = 0u;
+    LOG_WARN("socket %d: no supported protocol offered", conn->src.sock);
+  }
+
+  metric_inc((offer) ? &worker->metrics.handshakes_ok : &worker->metrics.handshakes_failed);
+  t = trace_span(&conn->trace, TRACE_HANDLER, t);
+
+  stream_init(&streamOut, &poso, out, outsize);
+  errn = encode_appHandExiDocument(&streamOut, &appHandResp);
+  t = trace_span(&conn->trace, TRACE_ENCODE, t);
+  if (errn)
+  {
+    LOG_ERROR("socket %d: supportedAppProtocolRes encode error %d", conn->src.sock, errn);
+    metric_inc(&worker->metrics.encode_errors);
+    return 0;
+  }
+
+  /* the EV closes the connection after a failed negotiation */
+  if (offer)
+  {
+    conn->protocol = protocol;
+    conn->schema = offer->SchemaID;
+    conn->handshake_expected = false;
+  }
+
+  size_t replylen = stream_finish(&streamOut);
+  trace_span(&conn->trace, TRACE_FRAME, t);
+  return replylen;
+}
+
+/* decode one V2GTP message from the EV and encode the reply; returns the reply length (zero if none) */
+
+static size_t process_message(struct connection *conn, uint8_t *in, size_t len, uint8_t *out, size_t outsize)
+{
+  uint32_t payloadLength;
+
+  uint64_t t = trace_now();
+  int errn = read_v2gtpHeader(in, &payloadLength);
+  trace_span(&conn->trace, TRACE_HEADER, t);
+  if (errn) return 0;
+
+  if (conn->handshake_expected) return handshake_process(conn, in, len, out, outsize);
+
+  return v2g_process(conn, in, len, out, outsize);
+}
+
+/*
+answer buffered frames, flush queued replies and read more from the socket until the
+socket is drained or the output queue is full; returns false if the connection is dead
+*/
+
+static bool connection_service(struct connection *conn)
+{
+  if (conn->ssl && !SSL_is_init_finished(conn->ssl))
+  {
+    int rc = tls_handshake(conn->ssl);
+    if (rc < 0)
+    {
+      LOG_INFO("socket %d: TLS handshake failed", conn->src.sock);
+      metric_inc(&worker->metrics.tls_handshakes_failed);
+      return false;
+    }
+    if (0 == rc) return true;
+
+    bool resumed = tls_resumed(conn->ssl);
+    metric_inc((resumed) ? &worker->metrics.tls_handshakes_resumed : &worker->metrics.tls_handshakes_full);
+    histogram_observe(&worker->metrics.tls_handshake, now_ns() - conn->accepted_ns);
+    LOG_DEBUG("socket %d: TLS session %s", conn->src.sock, LOG_STR((resumed) ? "resumed" : "established"));
+  }
+
+  for (;;)
+  {
+    uint8_t *frame;
+    uint32_t framelen;
+
+    /* a single segment may carry several pipelined frames, or only part of one */
+    while (!txq_full(&conn->tx))
+    {
+      int rc = v2gtp_rx_peek(&conn->rx, &frame, &framelen);
+      if (rc < 0)
+      {
+        LOG_WARN("socket %d: bad V2GTP header", conn->src.sock);
+        metric_inc(&worker->metrics.bad_frames);
+        return false;
+      }
+      if (0 == rc) break;
+
+      LOG_FRAME("rx", frame, framelen);
+      capture_frame(conn->connector, CAPTURE_IN, &conn->flow, (conn->session) ? conn->session->id : NULL, frame, framelen);
+
+      uint8_t *slot = txq_reserve(&conn->tx);
+      uint64_t start = now_ns();
+      conn->msg = MSG_NONE;
+      size_t replylen = process_message(conn, frame, framelen, slot, TX_SLOT_SIZE);
+      v2gtp_rx_consume(&conn->rx, framelen);
+      trace_commit(&conn->trace, (conn->session) ? &conn->session->trace : NULL, conn->msg);
+      if (replylen)
+      {
+        /* V2G_SECC_Sequence_Timeout runs from each response to the next request */
+        if (conn->session) timer_arm(&worker->timers, &conn->timeout, sequence_timeout_ms);
+        metric_inc(&worker->metrics.requests[conn->msg]);
+        histogram_observe(&worker->metrics.latency[conn->msg], now_ns() - start);
+        LOG_FRAME("tx", slot, replylen);
+        capture_frame(conn->connector, CAPTURE_OUT, &conn->flow, (conn->session) ? conn->session->id : NULL, slot, replylen);
+        txq_commit(&conn->tx, replylen);
+      }
+    }
+
+    uint64_t t = trace_now();
+    if (!txq_empty(&conn->tx))
+    {
+      int sent = (conn->ssl) ? tls_flush(&conn->tx, conn->ssl) : txq_flush(&conn->tx, conn->src.sock);
+      trace_span(&conn->trace, TRACE_SEND, t);
+      trace_commit(&conn->trace, (conn->session) ? &conn->session->trace : NULL, TRACE_NO_MSG);
+      if (sent < 0) return false;
+    }
+
+    /* stop reading until EPOLLOUT reports the EV has caught up */
+    if (txq_full(&conn->tx)) return true;
+
+    size_t space;
+    uint8_t *dst = v2gtp_rx_space(&conn->rx, &space);
+    if (!space) return false;
+
+    t = trace_now();
+    ssize_t len = (conn->ssl) ? tls_recv(conn->ssl, dst, space) : recv(conn->src.sock, dst, space, 0);
+    if (len < 0)
+    {
+      if (EINTR == errno) continue;
+      return (EAGAIN == errno) || (EWOULDBLOCK == errno);
+    }
+    trace_span(&conn->trace, TRACE_RECV, t);
+    LOG_DEBUG("socket %d: recv %d", conn->src.sock, len);
+    if (0 == len) return false;
+    v2gtp_rx_commit(&conn->rx, len);
+  }
+}
+
+/* each client of the metrics socket is sent one snapshot and disconnected */
+
+static void metrics_serve(int sock)
+{
+  static char text[65536];
+  const struct metrics *sets[MAX_WORKERS];
+
+  /* the other workers' counters are read as they are being updated; each is a single atomic load */
+  for (unsigned i = 0; i < worker_count; i++)
+    sets[i] = &workers[i].metrics;
+
+  /* the budget is not any one worker's; its figures are shown as worker 0's */
+  metric_set(&workers[0].metrics.budget_sessions, atomic_load(&budget.sessions));
+  metric_set(&workers[0].metrics.budget_granted_w, atomic_load(&budget.granted));
+  metric_set(&workers[0].metrics.budget_recomputes, atomic_load(&budget.recomputes));
+  metric_set(&workers[0].metrics.journal_dropped, atomic_load(&journal.dropped));
+  metric_set(&workers[0].metrics.journal_syncs, atomic_load(&journal.syncs));
+  metric_set(&workers[0].metrics.capture_frames, atomic_load(&capture.frames));
+  metric_set(&workers[0].metrics.capture_truncated, atomic_load(&capture.truncated));
+
+  size_t len = metrics_format(sets, worker_count, text, sizeof(text));
+
+  /* the snapshot fits the socket buffer; a reader that is not ready simply misses it */
+  if (send(sock, text, len, MSG_DONTWAIT) < 0) LOG_DEBUG("metrics: send error %d", errno);
+  close(sock);
+}
+
+
+/* link-local address changes on the interfaces we serve; the kernel sends them as they happen */
+
+static void netlink_service(int sock)
+{
+  uint8_t buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  for (;;)
+  {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      /* notifications were lost: start again from what the interfaces hold now */
+      if (ENOBUFS == errno)
+      {
+        LOG_WARN("netlink: overrun, rescanning addresses");
+        for (unsigned i = 0; i < interface_count; i++)
+          get_link_local_addr(&interfaces[i]);
+        continue;
+      }
+      return;
+    }
+
+    for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+    {
+      if ((RTM_NEWADDR != nh->nlmsg_type) && (RTM_DELADDR != nh->nlmsg_type)) continue;
+
+      struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+      struct interface *ifc = interface_by_index(ifa->ifa_index);
+      if (!ifc || (AF_INET6 != ifa->ifa_family) || (RT_SCOPE_LINK != ifa->ifa_scope)) continue;
+
+      const struct in6_addr *addr = NULL;
+      int attrlen = IFA_PAYLOAD(nh);
+      for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen))
+        if ((IFA_ADDRESS == rta->rta_type) && (RTA_PAYLOAD(rta) == sizeof(*addr))) addr = RTA_DATA(rta);
+
+      if (!addr) continue;
+
+      if (RTM_NEWADDR == nh->nlmsg_type)
+      {
+        /* duplicate address detection is still running; the kernel reports again when it is done */
+        if (ifa->ifa_flags & IFA_F_TENTATIVE) continue;
+        interface_set_addr(ifc, addr);
+        LOG_INFO("%s: link-local address %x:%x", LOG_STR(ifc->name), (int64_t)ntohl(((const uint32_t *)addr->s6_addr)[2]), (int64_t)ntohl(((const uint32_t *)addr->s6_addr)[3]));
+      }
+      else if (ifc->have_addr && !memcmp(&ifc->addr, addr, sizeof(*addr)))
+      {
+        /* fall back on any other link-local address the interface still has */
+        get_link_local_addr(ifc);
+        if (!ifc->have_addr) LOG_WARN("%s: link-local address removed, SDP suspended", LOG_STR(ifc->name));
+      }
+    }
+  }
+}
+
+/*
+SDP, served by worker 0
+
+Datagrams are taken SDP_BATCH at a time with recvmmsg() and the responses sent with a
+single sendmmsg(), each straight from the interface's prebuilt response for the
+security asked for, without a copy.  One batch is taken per wakeup (the socket is
+level-triggered), so however many EVs ask at once, the connections on worker 0 are
+served between batches.
+
+An EV repeats its request only every 250 ms or so (V2G_EVCC_SDP_Timeout), so each
+source address may have sdp_burst requests answered at once and then sdp_rate a
+second; the rest are dropped unanswered, as a datagram lost on the line would be.  The
+token bucket of each source is kept as the time at which it will next be full (GCRA),
+in a table of SDP_WAYS-way sets indexed by a hash of the address.  A source not in its
+set takes over the stalest entry, the one whose bucket fills first; if even that one
+is not full yet, the newcomer inherits its bucket rather than a full one, so sources
+that collide, or addresses forged to collide, cannot get more answers than one source.
+*/
+
+#define SDP_BATCH 32
+#define SDP_SOURCES 4096
+#define SDP_WAYS 4
+
+struct sdp_source
+{
+  struct in6_addr addr;
+  uint64_t full_ns;         /* when the bucket will be full again */
+};
+
+static struct sdp_source sdp_sources[SDP_SOURCES];
+
+static bool sdp_admit(const struct in6_addr *addr, uint64_t now)
+{
+  const uint64_t interval = 1000000000ull / sdp_rate, burst = interval * sdp_burst;
+  uint32_t h = 2166136261u;
+  for (unsigned i = 0; i < sizeof(addr->s6_addr); i++)
+    h = (h ^ addr->s6_addr[i]) * 16777619u;
+
+  struct sdp_source *set = &sdp_sources[(h % (SDP_SOURCES / SDP_WAYS)) * SDP_WAYS], *s = set;
+  for (unsigned i = 0; i < SDP_WAYS; i++)
+  {
+    if (!memcmp(&set[i].addr, addr, sizeof(*addr)))
+    {
+      s = &set[i];
+      break;
+    }
+    if (set[i].full_ns < s->full_ns) s = &set[i];
+  }
+  /* a newcomer keeps the full_ns of the entry it replaces */
+  s->addr = *addr;
+
+  uint64_t full = (s->full_ns > now) ? s->full_ns : now;
+  if (full + interval > now + burst) return false;
+  s->full_ns = full + interval;
+  return true;
+}
+
+static void sdp_service(struct interface *ifc)
+{
+  uint8_t buffers[SDP_BATCH][64];
+  struct sockaddr_in6 addrs[SDP_BATCH];
+  struct iovec rx_iov[SDP_BATCH], tx_iov[SDP_BATCH];
+  struct mmsghdr rx[SDP_BATCH], tx[SDP_BATCH];
+
+  for (unsigned i = 0; i < SDP_BATCH; i++)
+  {
+    rx_iov[i] = (struct iovec){ .iov_base = buffers[i], .iov_len = sizeof(buffers[i]) };
+    rx[i] = (struct mmsghdr){ .msg_hdr = { .msg_name = &addrs[i], .msg_namelen = sizeof(addrs[i]), .msg_iov = &rx_iov[i], .msg_iovlen = 1 } };
+  }
+
+  int count = recvmmsg(ifc->sdp_src.sock, rx, SDP_BATCH, MSG_DONTWAIT, NULL);
+  if (count <= 0) return;
+  LOG_DEBUG("SDP: %d datagrams", count);
+
+  uint64_t now = now_ns();
+  unsigned replies = 0;
+  for (int i = 0; i < count; i++)
+  {
+    const uint8_t *req = buffers[i];
+    if ((rx[i].msg_len != sizeof(sdp_request)) || memcmp(req, sdp_request, 8) || (sdp_request[9] != req[9]) || ((SDP_NO_TLS != req[8]) && (SDP_TLS != req[8]))) continue;
+    metric_inc(&worker->metrics.sdp_requests);
+    if (!ifc->have_addr) continue;
+
+    if (!sdp_admit(&addrs[i].sin6_addr, now))
+    {
+      metric_inc(&worker->metrics.sdp_rate_limited);
+      continue;
+    }
+
+    /* an EV that asks for TLS when it is not offered is told so, and decides for itself whether to go on */
+    int tls = (SDP_TLS == req[8]) && tls_ctx;
+
+    struct capture_flow flow = { .ev_addr = addrs[i].sin6_addr, .secc_addr = ifc->addr, .ev_port = ntohs(addrs[i].sin6_port), .secc_port = 15118, .proto = IPPROTO_UDP };
+    capture_frame(ifc - interfaces, CAPTURE_IN, &flow, NULL, req, rx[i].msg_len);
+    capture_frame(ifc - interfaces, CAPTURE_OUT, &flow, NULL, ifc->sdp_response[tls], sizeof(ifc->sdp_response[tls]));
+
+    tx_iov[replies] = (struct iovec){ .iov_base = ifc->sdp_response[tls], .iov_len = sizeof(ifc->sdp_response[tls]) };
+    tx[replies] = (struct mmsghdr){ .msg_hdr = { .msg_name = &addrs[i], .msg_namelen = rx[i].msg_hdr.msg_namelen, .msg_iov = &tx_iov[replies], .msg_iovlen = 1 } };
+    replies++;
+  }
+
+  /* a response the socket buffer has no room for is dropped, like any other datagram */
+  for (unsigned done = 0; done < replies;)
+  {
+    int sent = sendmmsg(ifc->sdp_src.sock, tx + done, replies - done, MSG_DONTWAIT);
+    if (sent <= 0)
+    {
+      LOG_WARN("SDP: sendmmsg error %d", errno);
+      break;
+    }
+    metric_add(&worker->metrics.sdp_responses, sent);
+    done += sent;
+  }
+}
+
+/* SLAC on an interface (see slac.h); runs on worker 0 */
+
+static void slac_event(struct slac_port *port, const struct slac_ev *ev, enum slac_event e)
+{
+  struct interface *ifc = container_of(port, struct interface, slac);
+  int64_t mac = 0;
+
+  for (int i = 0; ev && (i < ETH_ALEN); i++)
+    mac = (mac << 8) | ev->mac[i];
+
+  switch (e)
+  {
+  case SLAC_EVENT_STARTED:
+    LOG_DEBUG("%s: SLAC with %x", LOG_STR(ifc->name), mac);
+    /* until the modem confirms the key, it is offered again with every EV that comes along */
+    if (!ifc->slac_key_set) slac_set_key(port, 0);
+    break;
+  case SLAC_EVENT_MATCHED:
+    metric_inc(&worker->metrics.slac_matches);
+    LOG_INFO("%s: SLAC matched %x in %u ms", LOG_STR(ifc->name), mac, (int64_t)((slac_now() - ev->started_ns) / 1000000));
+    /* the EV goes on to SDP next: have the address it will be given */
+    if (!ifc->have_addr) get_link_local_addr(ifc);
+    if (!ifc->have_addr) LOG_WARN("%s: matched, but no link-local address for SDP", LOG_STR(ifc->name));
+    break;
+  case SLAC_EVENT_FAILED:
+    metric_inc(&worker->metrics.slac_failed);
+    LOG_INFO("%s: SLAC with %x failed", LOG_STR(ifc->name), mac);
+    break;
+  case SLAC_EVENT_KEY_SET:
+    if (!ifc->slac_key_set) LOG_INFO("%s: modem NMK set", LOG_STR(ifc->name));
+    ifc->slac_key_set = true;
+    break;
+  case SLAC_EVENT_KEY_REFUSED:
+    LOG_WARN("%s: modem refused the NMK", LOG_STR(ifc->name));
+    break;
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-t worker threads] [-p power backend] [-s] [-w capture file] [ifname ...]\n", name);
+}
+
+/* the metrics and netlink sockets, served by worker 0 */
+
+static struct poll_source metrics_src = { .kind = POLL_METRICS, .sock = -1 };
+static struct poll_source netlink_src = { .kind = POLL_NETLINK, .sock = -1 };
+
+/* tie a socket to one interface; with a single interface, an unprivileged process may go without */
+
+static bool bind_to_interface(int sock, const struct interface *ifc)
+{
+  if (!setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, ifc->name, strlen(ifc->name))) return true;
+  if (interface_count > 1) return false;
+
+  static bool warned;
+  if (!warned) fprintf(stderr, "WARNING: cannot bind to %s (error %d); serving all interfaces\n", ifc->name, errno);
+  warned = true;
+  return true;
+}
+
+/* a listening socket of this worker's on one interface */
+
+static bool listen_on(struct worker *w, struct poll_source *src, enum poll_kind kind, const struct interface *ifc, int port)
+{
+  struct sockaddr_in6 server_addr;
+  const int on = 1;
+  int rc;
+
+  src->kind = kind;
+  int listen_sock = src->sock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
+  if (listen_sock < 0) return false;
+
+  /* every worker listens on the same port; the kernel picks one for each new connection */
+  setsockopt(listen_sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  if (!bind_to_interface(listen_sock, ifc))
+  {
+    fprintf(stderr, "ISO bind to %s error %d\n", ifc->name, errno);
+    return false;
+  }
+
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin6_family = AF_INET6;
+  server_addr.sin6_addr = in6addr_any;
+  server_addr.sin6_port = htons(port);
+  server_addr.sin6_scope_id = ifc->index;
+
+  rc = bind(listen_sock, (const struct sockaddr *)&server_addr, sizeof(server_addr));
+  if (rc < 0)
+  {
+    fprintf(stderr, "ISO bind error %d\n", rc);
+    return false;
+  }
+
+  set_nonblocking(listen_sock);
+
+  rc = listen(listen_sock, SOMAXCONN);
+  epoll_add(w->epfd, src, EPOLLIN | EPOLLET);
+  return true;
+}
+
+/* runs on the main thread, one worker after another (building the response cache is not reentrant) */
+
+static bool worker_init(struct worker *w, unsigned index)
+{
+  worker = w;
+  w->index = index;
+  connections_init();
+  session_table_init(&w->sessions);
+  for (int i = 0; i < MAX_SESSIONS; i++)
+  {
+    timer_init(&w->sessions.slab[i].linger, session_expire);
+    timer_init(&w->sessions.slab[i].auth_deadline, auth_expire);
+  }
+  respcache_build(&w->respcache);
+  if (!fastpath_init(&w->fastpath)) LOG_WARN("worker %u: fast path disagrees with OpenV2G for some messages, left to the generic path", index);
+  power->attach(&w->power, index);
+
+  w->epfd = epoll_create1(0);
+  if (w->epfd < 0) return false;
+
+  /* every protocol timeout is on one wheel, behind one timerfd */
+  if (!timer_wheel_init(&w->timers)) return false;
+  w->timer_src.kind = POLL_TIMER;
+  w->timer_src.sock = w->timers.fd;
+  epoll_add(w->epfd, &w->timer_src, EPOLLIN | EPOLLET);
+
+  w->wake_src.kind = POLL_WAKE;
+  w->wake_src.sock = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (w->wake_src.sock < 0) return false;
+  epoll_add(w->epfd, &w->wake_src, EPOLLIN | EPOLLET);
+
+  /* connected when the first session needs it */
+  w->auth_src.kind = POLL_AUTH;
+  w->auth_src.sock = -1;
+
+  /*
+  setup ISO server, on each interface
+  */
+
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    w->tls_listen_src[i].sock = -1;
+    if (!listen_on(w, &w->listen_src[i], POLL_LISTEN, &interfaces[i], tcp_server_port)) return false;
+    if (tls_ctx && !listen_on(w, &w->tls_listen_src[i], POLL_LISTEN_TLS, &interfaces[i], tls_server_port)) return false;
+  }
+
+  return true;
+}
+
+static void worker_loop(void)
+{
+  for (;;)
+  {
+    struct epoll_event events[MAX_EVENTS];
+    bool timers_due = false;
+
+    timer_wheel_rearm(&worker->timers);
+
+    int count = epoll_wait(worker->epfd, events, ARRAY_SIZE(events), -1);
+
+    if (count < 0)
+    {
+      if (EINTR == errno) continue;
+      break;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      struct poll_source *src = events[i].data.ptr;
+
+      if (POLL_SDP == src->kind)
+      {
+        sdp_service(container_of(src, struct interface, sdp_src));
+      }
+      else if ((POLL_LISTEN == src->kind) || (POLL_LISTEN_TLS == src->kind))
+      {
+        for (;;)
+        {
+          struct sockaddr_in6 ev_addr;
+          socklen_t ev_len = sizeof(ev_addr);
+          int sock = accept4(src->sock, (struct sockaddr *)&ev_addr, &ev_len, SOCK_NONBLOCK);
+          if (sock < 0) break;
+
+          struct connection *conn = connection_alloc(sock);
+          if (conn)
+          {
+            conn->connector = (POLL_LISTEN_TLS == src->kind) ? src - worker->tls_listen_src : src - worker->listen_src;
+            conn->flow = (struct capture_flow){ .ev_addr = ev_addr.sin6_addr, .secc_addr = interfaces[conn->connector].addr, .ev_port = ntohs(ev_addr.sin6_port),
+              .secc_port = (POLL_LISTEN_TLS == src->kind) ? tls_server_port : tcp_server_port, .proto = IPPROTO_TCP };
+          }
+          if (conn && (POLL_LISTEN_TLS == src->kind))
+          {
+            conn->ssl = tls_accept(sock);
+            conn->accepted_ns = now_ns();
+          }
+
+          if (!conn || ((POLL_LISTEN_TLS == src->kind) && !conn->ssl) || epoll_add(worker->epfd, &conn->src, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET))
+          {
+            metric_inc(&worker->metrics.connections_rejected);
+            if (conn) connection_close(conn); else close(sock);
+            continue;
+          }
+          metric_inc(&worker->metrics.connections_accepted);
+        }
+      }
+      else if (POLL_TIMER == src->kind)
+      {
+        timers_due = true;
+      }
+      else if (POLL_WAKE == src->kind)
+      {
+        uint64_t n;
+        while (read(src->sock, &n, sizeof(n)) > 0);
+        if (atomic_exchange(&worker->dump_trace, false)) trace_dump_shard();
+      }
+      else if (POLL_NETLINK == src->kind)
+      {
+        netlink_service(src->sock);
+      }
+      else if (POLL_AUTH == src->kind)
+      {
+        auth_service();
+      }
+      else if (POLL_SLAC == src->kind)
+      {
+        struct interface *ifc = container_of(src, struct interface, slac_src);
+        metric_add(&worker->metrics.slac_frames, slac_service(&ifc->slac));
+      }
+      else if (POLL_METRICS == src->kind)
+      {
+        for (;;)
+        {
+          int sock = accept4(src->sock, NULL, NULL, SOCK_NONBLOCK);
+          if (sock < 0) break;
+          metrics_serve(sock);
+        }
+      }
+      else
+      {
+        struct connection *conn = (struct connection *)src;
+        bool dead = events[i].events & (EPOLLERR | EPOLLHUP);
+
+        if (dead || !connection_service(conn)) connection_close(conn);
+      }
+    }
+
+    /* after the batch, so that no event above refers to a connection a timeout has closed */
+    if (timers_due) timer_wheel_expire(&worker->timers);
+  }
+}
+
+static void *worker_thread(void *arg)
+{
+  worker = arg;
+  log_attach();
+  worker_loop();
+  return NULL;
+}
+
+static void worker_deinit(struct worker *w)
+{
+  worker = w;
+  for (int i = 0; i < MAX_CONNECTIONS; i++)
+    connection_close(&w->connections[i]);
+  close(w->epfd);
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    close(w->listen_src[i].sock);
+    if (w->tls_listen_src[i].sock >= 0) close(w->tls_listen_src[i].sock);
+  }
+  close(w->wake_src.sock);
+  if (w->auth_src.sock >= 0) close(w->auth_src.sock);
+  timer_wheel_deinit(&w->timers);
+}
+
+int main(int argc, char *argv[])
+{
+  int rc, opt;
+  struct sockaddr_in6 server_addr;
+  bool slac = false;
+  const char *capture_file = NULL;
+
+  while ((opt = getopt(argc, argv, "t:p:sw:")) != -1)
+  {
+    switch (opt)
+    {
+    case 't': worker_count = atoi(optarg); break;
+    case 's': slac = true; break;
+    case 'w': capture_file = optarg; break;
+    case 'p':
+      power = power_backend_find(optarg);
+      if (!power)
+      {
+        fprintf(stderr, "ERROR: no power backend %s (echo or shm)\n", optarg);
+        return -1;
+      }
+      break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if ((worker_count < 1) || (worker_count > MAX_WORKERS))
+  {
+    fprintf(stderr, "ERROR: between 1 and %d worker threads\n", MAX_WORKERS);
+    return -1;
+  }
+
+  static const char *const default_ifname[] = { "seth0" };
+  const char *const *ifnames = (optind < argc) ? (const char *const *)&argv[optind] : default_ifname;
+  interface_count = (optind < argc) ? argc - optind : 1;
+
+  if (interface_count > MAX_INTERFACES)
+  {
+    fprintf(stderr, "ERROR: at most %d interfaces\n", MAX_INTERFACES);
+    return -1;
+  }
+
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    struct interface *ifc = &interfaces[i];
+    snprintf(ifc->name, sizeof(ifc->name), "%s", ifnames[i]);
+    ifc->index = if_nametoindex(ifc->name);
+    memcpy(ifc->sdp_response[0], sdp_response_template, sizeof(sdp_response_template));
+    memcpy(ifc->sdp_response[1], sdp_response_template, sizeof(sdp_response_template));
+    ifc->sdp_response[1][24] = (uint8_t)(tls_server_port >> 8);
+    ifc->sdp_response[1][25] = (uint8_t)(tls_server_port >> 0);
+    ifc->sdp_response[1][26] = SDP_TLS;
+
+    if (!ifc->index || strcmp(ifc->name, ifnames[i]))
+    {
+      fprintf(stderr, "ERROR: interface (%s) not found\n", ifnames[i]);
+      return -1;
+    }
+
+    /* a modem that is still coming up gets its address later, through netlink */
+    get_link_local_addr(ifc);
+    if (!ifc->have_addr) fprintf(stderr, "WARNING: interface (%s) has no link-local address yet\n", ifc->name);
+  }
+
+  urandom_init();
+  log_init(STDOUT_FILENO);
+  trace_init(trace_dir);
+  protocols_init(protocols, ARRAY_SIZE(protocols));
+
+  /* without a certificate, EVs that ask for TLS are answered that it is not offered */
+  if (!tls_init(tls_cert_file, tls_key_file, tls_ciphers, tls_session_cache_size, tls_session_timeout_s))
+    fprintf(stderr, "WARNING: no TLS (cannot load %s and %s)\n", tls_cert_file, tls_key_file);
+
+  if (!power->open(worker_count, interface_count))
+  {
+    fprintf(stderr, "ERROR: cannot open the %s power backend\n", power->name);
+    return -1;
+  }
+
+  budget_init(&budget, site_power_budget_w, budget_hysteresis_w);
+  auth_cache_init(&auth_cache, auth_cache_ttl_s);
+
+  /* sessions that are not recorded cannot be billed */
+  if (!journal_init(journal_dir, journal_file_size, journal_commit_ms))
+  {
+    fprintf(stderr, "ERROR: no session journal: cannot create a %zu byte file in %s (%s; journal_dir in parameters.h)\n", journal_file_size, journal_dir, strerror(errno));
+    return -1;
+  }
+
+  if (capture_file && !capture_open(capture_file, capture_file_size, ifnames, interface_count))
+  {
+    fprintf(stderr, "ERROR: cannot create a %zu byte capture in %s\n", capture_file_size, capture_file);
+    return -1;
+  }
+
+  workers = calloc(worker_count, sizeof(*workers));
+  if (!workers) return -1;
+
+  for (unsigned i = 0; i < worker_count; i++)
+    if (!worker_init(&workers[i], i)) return -1;
+
+  /* a peer that vanishes mid-writev() must not take the whole process down */
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGUSR1, trace_signal);
+
+  /*
+  setup SDP server, on each interface
+  */
+
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    struct interface *ifc = &interfaces[i];
+    const int on = 1;
+
+    ifc->sdp_src.kind = POLL_SDP;
+    int sdp_sock = ifc->sdp_src.sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (sdp_sock < 0) return -1;
+
+    /* one SDP socket per interface, all on port 15118 */
+    setsockopt(sdp_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (!bind_to_interface(sdp_sock, ifc))
+    {
+      fprintf(stderr, "SDP bind to %s error %d\n", ifc->name, errno);
+      return -1;
+    }
+
+    struct ipv6_mreq mreq;
+    inet_pton(AF_INET6, "ff02::1", &mreq.ipv6mr_multiaddr);
+    mreq.ipv6mr_interface = ifc->index;
+
+    rc = setsockopt(sdp_sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char *) &mreq, sizeof(mreq));
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_addr = in6addr_any;
+    server_addr.sin6_port = htons(15118);
+    server_addr.sin6_scope_id = ifc->index;
+
+    rc = bind(sdp_sock, (const struct sockaddr *)&server_addr, sizeof(server_addr));
+    if (rc < 0)
+    {
+      fprintf(stderr, "SDP bind error %d\n", rc);
+      return -1;
+    }
+
+    /* level-triggered: sdp_service() takes one batch at a time, and is called again for the rest */
+    set_nonblocking(sdp_sock);
+    epoll_add(workers[0].epfd, &ifc->sdp_src, EPOLLIN);
+  }
+
+  /*
+  setup SLAC, on each interface; every interface's modem gets a key of its own
+  */
+
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    struct interface *ifc = &interfaces[i];
+    uint8_t nmk[16];
+
+    ifc->slac_src.kind = POLL_SLAC;
+    ifc->slac_src.sock = -1;
+    if (!slac) continue;
+
+    urandom_get(nmk, sizeof(nmk));
+    if (!slac_open(&ifc->slac, ifc->index, slac_modem_mac, nmk, &workers[0].timers, slac_event))
+    {
+      fprintf(stderr, "SLAC on %s error %d\n", ifc->name, errno);
+      return -1;
+    }
+
+    ifc->slac_src.sock = ifc->slac.sock;
+    epoll_add(workers[0].epfd, &ifc->slac_src, EPOLLIN | EPOLLET);
+    slac_set_key(&ifc->slac, 0);
+  }
+
+  /*
+  setup netlink, to follow the interfaces' addresses
+  */
+
+  int netlink_sock = netlink_src.sock = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (netlink_sock < 0) return -1;
+
+  struct sockaddr_nl netlink_addr = { .nl_family = AF_NETLINK, .nl_groups = RTMGRP_IPV6_IFADDR };
+  rc = bind(netlink_sock, (const struct sockaddr *)&netlink_addr, sizeof(netlink_addr));
+  if (rc < 0)
+  {
+    fprintf(stderr, "netlink bind error %d\n", rc);
+    return -1;
+  }
+
+  epoll_add(workers[0].epfd, &netlink_src, EPOLLIN | EPOLLET);
+
+  /*
+  setup metrics socket
+  */
+
+  int metrics_sock = metrics_src.sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (metrics_sock < 0) return -1;
+
+  struct sockaddr_un metrics_addr = { .sun_family = AF_UNIX };
+  strncpy(metrics_addr.sun_path, metrics_socket_path, sizeof(metrics_addr.sun_path) - 1);
+  unlink(metrics_socket_path);
+
+  rc = bind(metrics_sock, (const struct sockaddr *)&metrics_addr, sizeof(metrics_addr));
+  if (rc < 0)
+  {
+    fprintf(stderr, "metrics bind error %d\n", rc);
+    return -1;
+  }
+
+  rc = listen(metrics_sock, SOMAXCONN);
+  epoll_add(workers[0].epfd, &metrics_src, EPOLLIN | EPOLLET);
+
+  /* the main thread is worker 0 */
+  for (unsigned i = 1; i < worker_count; i++)
+    if (pthread_create(&workers[i].tid, NULL, worker_thread, &workers[i]))
+    {
+      fprintf(stderr, "ERROR: cannot start worker %u\n", i);
+      return -1;
+    }
+
+  worker = &workers[0];
+  worker_loop();
+
+  worker_deinit(&workers[0]);
+  journal_deinit();
+  capture_close();
+  for (unsigned i = 0; i < interface_count; i++)
+  {
+    close(interfaces[i].sdp_src.sock);
+    if (interfaces[i].slac_src.sock >= 0) slac_close(&interfaces[i].slac);
+  }
+  close(netlink_sock);
+  close(metrics_sock);
+  unlink(metrics_socket_path);
+  tls_deinit();
+  power->close();
+  urandom_deinit();
+  trace_deinit();
+  log_deinit();
+
+  return 0;
+}
@@ -0,0 +1,576 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+replays a capture (see capture.h) against redux, and diffs the responses
+
+Reads the frames of a capture in timestamp order (a capture whose ring has gone round
+starts part way through the file) and splits them into the conversations of each EV:
+an SDP exchange, or a TCP connection.  Each conversation is played again on a
+connection of its own, all of them at once: every frame the EV sent is sent as it was,
+and every frame the SECC sent is compared with what comes back in its place.
+
+The SessionID is the one thing that cannot be the same the second time round.  When
+the SECC's response carries a new SessionID where the capture had the old one, the old
+one is replaced by the new in every later request (wherever its bits are, since EXI is
+not byte aligned), and the new by the old in every later response before it is
+compared.  An SDP response is compared without the SECC address in it.
+
+A frame that did not fit its capture slot was truncated.  A truncated response is
+compared as far as it goes (and by its original length), and counted apart; a
+truncated request cannot be sent again, so its conversation ends there, and is also
+counted apart rather than as missing responses.
+
+With -t, each request is sent no earlier than it was in the capture, relative to the
+first frame, so a field capture plays back as the load it was; without, each is sent
+as soon as the response to the one before has arrived.  A response that does not come
+within RESPONSE_TIMEOUT_NS ends its conversation.
+
+usage: replay [-a address] [-i ifname] [-p port] [-t] [-v] capture.pcapng
+
+-a is the SECC's address (::1 by default), -i the interface for a link-local address,
+-p its TCP port; -v dumps every mismatch in full.  The exit status is non-zero if any
+response differed or went missing, so a capture can serve as a regression test.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "capture.h"
+
+#define SDP_PORT 15118
+#define MAX_STREAMS 1024
+#define MAX_FRAME 16384
+#define MAX_SESSIONS 4096
+#define RESPONSE_TIMEOUT_NS 5000000000ull
+
+struct packet
+{
+  uint64_t ns;
+  uint64_t order;           /* in the file, to keep equal timestamps in order */
+  int dir;                  /* CAPTURE_IN or CAPTURE_OUT */
+  uint8_t proto;
+  struct in6_addr ev_addr;
+  uint16_t ev_port;
+  uint32_t seq;             /* TCP: the capture counts from zero at the start of the connection */
+  bool truncated;
+  uint32_t full_len;        /* before truncation */
+  bool has_session;
+  uint64_t session;         /* from the comment */
+  const uint8_t *data;
+  uint32_t len;
+};
+
+struct stream
+{
+  uint8_t proto;
+  struct in6_addr ev_addr;
+  uint16_t ev_port;
+  struct packet **packets;
+  unsigned count, next;     /* packets in all, and the next to send or expect */
+  int sock;
+  uint8_t rx[MAX_FRAME];
+  size_t rxlen;
+  uint64_t waiting_ns;      /* since when a response is awaited, zero if none */
+  bool done;
+};
+
+/* captured SessionID to the one the SECC gave this time */
+
+static struct { uint64_t old, new; } sessions[MAX_SESSIONS];
+static unsigned session_count;
+
+static struct packet *packets;
+static size_t packet_count;
+static struct stream streams[MAX_STREAMS];
+static unsigned stream_count;
+static struct sockaddr_in6 secc;
+static bool timed, verbose;
+static uint64_t first_ns, start_ns;
+static unsigned long sent, matched, differed, missing, partial, cut_short;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+/* the capture */
+
+static bool parse_epb(const uint8_t *b, uint32_t len, uint64_t order)
+{
+  uint32_t caplen = get32(b + 20), origlen = get32(b + 24);
+  if ((28 + capture_pad4(caplen) + 4 > len) || (caplen < CAPTURE_NET_UDP)) return false;
+
+  const uint8_t *pkt = b + 28;
+  struct packet p = { .ns = ((uint64_t)get32(b + 12) << 32) | get32(b + 16), .order = order, .truncated = caplen < origlen };
+
+  /* the direction is in the options */
+  for (const uint8_t *o = pkt + capture_pad4(caplen); o + 4 <= b + len - 4;)
+  {
+    uint16_t code, olen;
+    memcpy(&code, o, 2);
+    memcpy(&olen, o + 2, 2);
+    if (OPT_ENDOFOPT == code) break;
+    if ((OPT_EPB_FLAGS == code) && (4 == olen)) p.dir = get32(o + 4) & 3;
+    if ((OPT_COMMENT == code) && (CAPTURE_COMMENT_LEN == olen) && !memcmp(o + 4, "session ", 8))
+    {
+      char hex[17];
+      memcpy(hex, o + 12, 16);
+      hex[16] = 0;
+      p.session = strtoull(hex, NULL, 16);
+      p.has_session = true;
+    }
+    o += 4 + capture_pad4(olen);
+  }
+
+  p.proto = pkt[6];
+  uint32_t net = (IPPROTO_TCP == p.proto) ? CAPTURE_NET_TCP : CAPTURE_NET_UDP;
+  if (((IPPROTO_TCP != p.proto) && (IPPROTO_UDP != p.proto)) || (caplen < net) || ((CAPTURE_IN != p.dir) && (CAPTURE_OUT != p.dir))) return false;
+
+  bool in = (CAPTURE_IN == p.dir);
+  memcpy(&p.ev_addr, pkt + ((in) ? 8 : 24), 16);
+  p.ev_port = (pkt[40 + ((in) ? 0 : 2)] << 8) | pkt[41 + ((in) ? 0 : 2)];
+  if (IPPROTO_TCP == p.proto) p.seq = (uint32_t)pkt[44] << 24 | (uint32_t)pkt[45] << 16 | (uint32_t)pkt[46] << 8 | pkt[47];
+  p.data = pkt + net;
+  p.len = caplen - net;
+  p.full_len = (origlen > caplen) ? origlen - net : p.len;
+
+  packets[packet_count++] = p;
+  return true;
+}
+
+static bool load(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if ((fd < 0) || fstat(fd, &st) || (st.st_size < 28)) return false;
+
+  const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == map) return false;
+  if ((PCAPNG_SHB != get32(map)) || (PCAPNG_BOM != get32(map + 8))) return false;
+
+  /* a slot holds at most one packet */
+  packets = calloc(st.st_size / CAPTURE_SLOT + 1, sizeof(*packets));
+  if (!packets) return false;
+
+  size_t off = 0;
+  uint64_t order = 0;
+  while (off + 12 <= (size_t)st.st_size)
+  {
+    uint32_t type = get32(map + off), len = get32(map + off + 4);
+    if ((len < 12) || (len & 3) || (off + len > (size_t)st.st_size)) break;
+    if ((PCAPNG_EPB == type) && (len >= 32) && (packet_count <= (size_t)st.st_size / CAPTURE_SLOT)) parse_epb(map + off, len, order++);
+    off += len;
+  }
+
+  return true;
+}
+
+static int compare_packets(const void *a, const void *b)
+{
+  const struct packet *x = a, *y = b;
+  if (x->ns != y->ns) return (x->ns > y->ns) - (x->ns < y->ns);
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+/* split into conversations; a TCP connection that lost its start to the ring going round is left out */
+
+static void split(void)
+{
+  for (size_t i = 0; i < packet_count; i++)
+  {
+    struct packet *p = &packets[i];
+    struct stream *s = NULL;
+
+    for (unsigned j = 0; j < stream_count; j++)
+      if ((streams[j].proto == p->proto) && (streams[j].ev_port == p->ev_port) && !memcmp(&streams[j].ev_addr, &p->ev_addr, 16)) s = &streams[j];
+
+    /* the port may be used again by a later connection */
+    bool first = (CAPTURE_IN == p->dir) && ((IPPROTO_UDP == p->proto) || !p->seq);
+    if (s && first && (IPPROTO_TCP == p->proto)) s = NULL;
+
+    if (!s)
+    {
+      if ((stream_count == MAX_STREAMS) || !first) continue;
+      s = &streams[stream_count++];
+      s->proto = p->proto;
+      s->ev_addr = p->ev_addr;
+      s->ev_port = p->ev_port;
+      s->packets = calloc(packet_count, sizeof(*s->packets));
+      s->sock = -1;
+      if (!s->packets) exit(-1);
+    }
+
+    s->packets[s->count++] = p;
+  }
+}
+
+/* SessionIDs, wherever their 64 bits are */
+
+static uint64_t get_bits(const uint8_t *p, size_t bit)
+{
+  uint64_t v = 0;
+  for (unsigned i = 0; i < 64; i++, bit++)
+    v = (v << 1) | ((p[bit / 8] >> (7 - bit % 8)) & 1);
+  return v;
+}
+
+static void put_bits(uint8_t *p, size_t bit, uint64_t v)
+{
+  for (int i = 63; i >= 0; i--, bit++)
+  {
+    uint8_t mask = 0x80 >> (bit % 8);
+    p[bit / 8] = ((v >> i) & 1) ? (p[bit / 8] | mask) : (p[bit / 8] & ~mask);
+  }
+}
+
+/* where id is in the EXI body of a frame, in bits; -1 if it is not */
+
+static long find_bits(const uint8_t *frame, uint32_t len, uint64_t id)
+{
+  if (len < 16) return -1;
+  for (size_t bit = 8 * 8; bit + 64 <= (size_t)len * 8; bit++)
+    if (get_bits(frame, bit) == id) return (long)bit;
+  return -1;
+}
+
+static void substitute(uint8_t *frame, uint32_t len, bool to_new)
+{
+  for (unsigned i = 0; i < session_count; i++)
+  {
+    uint64_t from = (to_new) ? sessions[i].old : sessions[i].new, to = (to_new) ? sessions[i].new : sessions[i].old;
+    long bit = find_bits(frame, len, from);
+    if (bit >= 0)
+    {
+      put_bits(frame, bit, to);
+      return;
+    }
+  }
+}
+
+/* learn the SessionID the SECC gave in place of the one in the capture, from where the old one was */
+
+static void learn(const struct packet *expected, const uint8_t *got, uint32_t len)
+{
+  if (!expected->has_session) return;
+
+  for (unsigned i = 0; i < session_count; i++)
+    if (sessions[i].old == expected->session) return;
+
+  long bit = find_bits(expected->data, expected->len, expected->session);
+  if ((bit < 0) || ((size_t)bit + 64 > (size_t)len * 8) || (session_count == MAX_SESSIONS)) return;
+
+  sessions[session_count].old = expected->session;
+  sessions[session_count].new = get_bits(got, bit);
+  session_count++;
+}
+
+/* the conversations */
+
+static void hexdump(const char *label, const uint8_t *p, uint32_t len)
+{
+  printf("  %s (%u bytes):", label, len);
+  for (uint32_t i = 0; i < len; i++)
+    printf("%s%02x", (i % 32) ? " " : "\n    ", p[i]);
+  printf("\n");
+}
+
+static void compare(struct stream *s, const struct packet *expected, uint8_t *got, uint32_t len)
+{
+  /* the SDP response carries the SECC's address, which is where it is now */
+  if ((IPPROTO_UDP == s->proto) && (len == expected->len) && (len >= 24)) memcpy(got + 8, expected->data + 8, 16);
+
+  if (IPPROTO_TCP == s->proto)
+  {
+    learn(expected, got, len);
+    substitute(got, len, false);
+  }
+
+  /* a frame truncated in the capture can only be compared as far as it goes */
+  unsigned index = s->next;
+  if ((len == expected->full_len) && !memcmp(got, expected->data, expected->len))
+  {
+    matched++;
+    if (expected->truncated) partial++;
+    return;
+  }
+
+  differed++;
+  uint32_t at = 0;
+  while ((at < len) && (at < expected->len) && (got[at] == expected->data[at]))
+    at++;
+
+  char addr[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, &s->ev_addr, addr, sizeof(addr));
+  printf("%s [%s]:%u frame %u: %u bytes, expected %u%s; first difference at byte %u\n", (IPPROTO_TCP == s->proto) ? "TCP" : "SDP", addr, s->ev_port, index, len, expected->full_len, (expected->truncated) ? " (truncated in the capture)" : "", at);
+  if (verbose)
+  {
+    hexdump("expected", expected->data, expected->len);
+    hexdump("got", got, len);
+  }
+}
+
+static bool stream_connect(struct stream *s)
+{
+  s->sock = socket(AF_INET6, ((IPPROTO_TCP == s->proto) ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK, 0);
+  if (s->sock < 0) return false;
+
+  struct sockaddr_in6 addr = secc;
+  if (IPPROTO_UDP == s->proto) addr.sin6_port = htons(SDP_PORT);
+
+  int rc = connect(s->sock, (const struct sockaddr *)&addr, sizeof(addr));
+  return !rc || (EINPROGRESS == errno);
+}
+
+static void stream_end(struct stream *s)
+{
+  /* whatever was still expected is missing */
+  for (; s->next < s->count; s->next++)
+    if (CAPTURE_OUT == s->packets[s->next]->dir) missing++;
+
+  if (s->sock >= 0) close(s->sock);
+  s->sock = -1;
+  s->done = true;
+}
+
+/* send what is due; returns when the next request falls due (or zero if nothing is waiting on time) */
+
+static uint64_t stream_send(struct stream *s, uint64_t now)
+{
+  while (!s->done && !s->waiting_ns && (s->next < s->count))
+  {
+    struct packet *p = s->packets[s->next];
+    if (CAPTURE_OUT == p->dir)
+    {
+      s->waiting_ns = now;
+      break;
+    }
+
+    /* what the EV sent is not all there: nothing after it can be played */
+    if (p->truncated)
+    {
+      cut_short++;
+      s->next = s->count;
+      stream_end(s);
+      break;
+    }
+
+    uint64_t due = start_ns + (p->ns - first_ns);
+    if (p->len > MAX_FRAME) p->len = MAX_FRAME;
+    if (timed && (due > now)) return due;
+
+    if ((s->sock < 0) && !stream_connect(s))
+    {
+      stream_end(s);
+      break;
+    }
+
+    uint8_t frame[MAX_FRAME];
+    memcpy(frame, p->data, p->len);
+    if (IPPROTO_TCP == s->proto) substitute(frame, p->len, true);
+
+    /* a request is small next to the socket buffer: it goes out whole, or the connection is gone */
+    if (send(s->sock, frame, p->len, MSG_NOSIGNAL) != (ssize_t)p->len)
+    {
+      stream_end(s);
+      break;
+    }
+    sent++;
+    s->next++;
+  }
+
+  if (!s->done && (s->next == s->count)) stream_end(s);
+  return 0;
+}
+
+static void stream_receive(struct stream *s)
+{
+  for (;;)
+  {
+    ssize_t len = recv(s->sock, s->rx + s->rxlen, sizeof(s->rx) - s->rxlen, 0);
+    if (len <= 0)
+    {
+      if ((0 == len) || ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))) stream_end(s);
+      return;
+    }
+
+    /* a datagram is a frame; on TCP, frames are cut out of the stream by their V2GTP length */
+    if (IPPROTO_UDP == s->proto)
+    {
+      if (s->waiting_ns) compare(s, s->packets[s->next++], s->rx, len);
+      s->waiting_ns = 0;
+      continue;
+    }
+
+    s->rxlen += len;
+    while (s->rxlen >= 8)
+    {
+      uint32_t framelen = 8 + ((uint32_t)s->rx[4] << 24 | (uint32_t)s->rx[5] << 16 | (uint32_t)s->rx[6] << 8 | s->rx[7]);
+      if (framelen > sizeof(s->rx))
+      {
+        stream_end(s);
+        return;
+      }
+      if (s->rxlen < framelen) break;
+
+      if (s->waiting_ns && (s->next < s->count))
+      {
+        compare(s, s->packets[s->next++], s->rx, framelen);
+        s->waiting_ns = 0;
+      }
+      else
+      {
+        differed++;
+      }
+
+      memmove(s->rx, s->rx + framelen, s->rxlen - framelen);
+      s->rxlen -= framelen;
+
+      /* several responses in a row are each expected in turn */
+      if ((s->next < s->count) && (CAPTURE_OUT == s->packets[s->next]->dir)) s->waiting_ns = now_ns();
+    }
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-a address] [-i ifname] [-p port] [-t] [-v] capture.pcapng\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *address = "::1", *ifname = NULL;
+  int port = 51111, opt;
+
+  while ((opt = getopt(argc, argv, "a:i:p:tv")) != -1)
+  {
+    switch (opt)
+    {
+    case 'a': address = optarg; break;
+    case 'i': ifname = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 't': timed = true; break;
+    case 'v': verbose = true; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  secc.sin6_family = AF_INET6;
+  secc.sin6_port = htons(port);
+  if (ifname) secc.sin6_scope_id = if_nametoindex(ifname);
+  if (1 != inet_pton(AF_INET6, address, &secc.sin6_addr))
+  {
+    fprintf(stderr, "ERROR: bad address %s\n", address);
+    return -1;
+  }
+
+  if (!load(argv[optind]))
+  {
+    fprintf(stderr, "ERROR: cannot read %s as a capture\n", argv[optind]);
+    return -1;
+  }
+
+  qsort(packets, packet_count, sizeof(*packets), compare_packets);
+  split();
+  if (!stream_count)
+  {
+    fprintf(stderr, "no conversations in %s\n", argv[optind]);
+    return -1;
+  }
+
+  printf("%zu frames, %u conversations\n", packet_count, stream_count);
+
+  first_ns = packets[0].ns;
+  start_ns = now_ns();
+
+  struct pollfd *fds = calloc(stream_count, sizeof(*fds));
+  unsigned *index = calloc(stream_count, sizeof(*index));
+  if (!fds || !index) return -1;
+
+  for (;;)
+  {
+    uint64_t now = now_ns(), wake = 0;
+    unsigned n = 0;
+
+    for (unsigned i = 0; i < stream_count; i++)
+    {
+      struct stream *s = &streams[i];
+      if (s->done) continue;
+
+      uint64_t due = stream_send(s, now);
+      if (due && (!wake || (due < wake))) wake = due;
+
+      if (s->waiting_ns && (now - s->waiting_ns > RESPONSE_TIMEOUT_NS)) stream_end(s);
+      if (s->done) continue;
+
+      if (s->waiting_ns && (!wake || (s->waiting_ns + RESPONSE_TIMEOUT_NS < wake))) wake = s->waiting_ns + RESPONSE_TIMEOUT_NS;
+      if (s->sock >= 0)
+      {
+        fds[n].fd = s->sock;
+        fds[n].events = POLLIN;
+        index[n++] = i;
+      }
+    }
+
+    bool active = false;
+    for (unsigned i = 0; i < stream_count; i++)
+      active |= !streams[i].done;
+    if (!active) break;
+
+    int timeout = (wake > now) ? (int)((wake - now) / 1000000 + 1) : (wake) ? 0 : 100;
+    if (poll(fds, n, timeout) < 0) continue;
+
+    for (unsigned i = 0; i < n; i++)
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) stream_receive(&streams[index[i]]);
+  }
+
+  double seconds = (now_ns() - start_ns) / 1e9;
+  printf("%lu requests sent in %.2f s (%.0f/s): %lu responses matched, %lu differed, %lu missing\n", sent, seconds, (seconds > 0) ? sent / seconds : 0.0, matched, differed, missing);
+  if (partial || cut_short) printf("truncated in the capture: %lu responses matched as far as they went, %lu conversations ended at a request\n", partial, cut_short);
+
+  return (differed || missing) ? 1 : 0;
+}
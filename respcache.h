@@ -0,0 +1,122 @@
+#ifndef _RESPCACHE_H
+#define _RESPCACHE_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+pre-encoded response templates
+
+Several ISO 15118-2 responses are identical for every session apart from the SessionID
+in the message header.  Those are EXI-encoded once (V2GTP header included) and, per
+request, copied out with only the 64 SessionID bits overwritten.
+
+EXI is bit-packed, so the SessionID need not start on a byte boundary.  Its position is
+found by encoding each template twice, once with an all-zero and once with an all-ones
+SessionID: the bits that differ are exactly the SessionID.  If they are not one run of
+64 bits, the template is not cached and the message goes through the encoder as usual.
+
+Templates must be rebuilt (respcache_add() again) whenever the values they were built
+from change.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "v2gtp.h"
+#include "iso1EXIDatatypes.h"
+#include "iso1EXIDatatypesEncoder.h"
+#include "messages.h"
+#include "session.h"
+#include "exibits.h"
+
+#ifndef RESP_TEMPLATE_SIZE
+#define RESP_TEMPLATE_SIZE 512
+#endif
+
+struct resp_template
+{
+  uint16_t len;     /* zero if this message is not cached */
+  uint16_t sid_bit; /* bit offset of the SessionID from the start of data */
+  uint8_t data[RESP_TEMPLATE_SIZE];
+};
+
+struct respcache
+{
+  struct resp_template tpl[MSG_COUNT];
+};
+
+typedef void (*respcache_builder)(struct iso1BodyType *body);
+
+static int respcache_encode(respcache_builder build, uint8_t fill, uint8_t *buf, size_t *len)
+{
+  static struct iso1EXIDocument doc;
+  bitstream_t stream;
+  size_t pos = V2GTP_HEADER_LENGTH;
+  int errn;
+
+  memset(&doc, 0, sizeof(doc));
+  doc.V2G_Message_isUsed = 1u;
+  doc.V2G_Message.Header.SessionID.bytesLen = SESSION_ID_LEN;
+  memset(doc.V2G_Message.Header.SessionID.bytes, fill, SESSION_ID_LEN);
+  build(&doc.V2G_Message.Body);
+
+  stream.size = RESP_TEMPLATE_SIZE;
+  stream.data = buf;
+  stream.pos = &pos;
+
+  errn = encode_iso1ExiDocument(&stream, &doc);
+  if (errn) return errn;
+  errn = write_v2gtpHeader(buf, pos - V2GTP_HEADER_LENGTH, V2GTP_EXI_TYPE);
+  *len = pos;
+  return errn;
+}
+
+static void respcache_init(struct respcache *c)
+{
+  for (int i = 0; i < MSG_COUNT; i++)
+    c->tpl[i].len = 0;
+}
+
+static bool respcache_add(struct respcache *c, enum v2g_msg msg, respcache_builder build)
+{
+  static uint8_t zeros[RESP_TEMPLATE_SIZE], ones[RESP_TEMPLATE_SIZE];
+  size_t len0, len1;
+  struct resp_template *tpl = &c->tpl[msg];
+
+  tpl->len = 0;
+
+  if (respcache_encode(build, 0x00, zeros, &len0)) return false;
+  if (respcache_encode(build, 0xFF, ones, &len1)) return false;
+  if (len0 != len1) return false;
+
+  uint32_t first;
+  if ((SESSION_ID_LEN * 8) != diff_bit_run(zeros, ones, len0, &first)) return false;
+
+  memcpy(tpl->data, zeros, len0);
+  tpl->sid_bit = first;
+  tpl->len = len0;
+  return true;
+}
+
+static bool respcache_has(const struct respcache *c, enum v2g_msg msg)
+{
+  return 0 != c->tpl[msg].len;
+}
+
+/* write the cached response for msg, stamped with the given SessionID; returns its length */
+
+static size_t respcache_emit(const struct respcache *c, enum v2g_msg msg, const uint8_t *sid, uint8_t *out, size_t outsize)
+{
+  const struct resp_template *tpl = &c->tpl[msg];
+
+  if (!tpl->len || (tpl->len > outsize)) return 0;
+
+  memcpy(out, tpl->data, tpl->len);
+  put_bytes_at_bit(out, tpl->sid_bit, sid, SESSION_ID_LEN);
+  return tpl->len;
+}
+
+#endif
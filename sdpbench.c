@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+SDP load test for redux
+
+-c sources each keep -w SDP requests outstanding for -d seconds, sending another as
+each response comes back, and the responses per second and their latency (p50/p99/max)
+are reported.  A request not answered within SDP_TIMEOUT_NS (V2G_EVCC_SDP_Timeout) is
+counted as unanswered and sent again, as an EV would.
+
+redux limits the requests it answers from each source address (sdp_rate and sdp_burst
+in parameters.h), so sources that share an address share a limit: run like this, the
+test shows the limit at work.  To measure the responder itself, give each source an
+address of its own with -b: source n binds to the given address plus n, which works
+for any prefix routed to the host, e.g. after
+  ip -6 route add local fd00::/64 dev lo
+with redux serving lo and -a ::1.
+
+usage: sdpbench [-i ifname] [-a address] [-b source address] [-c sources] [-w requests per source] [-d seconds] [-T]
+
+-a sends to the given address instead of ff02::1; -T asks for TLS.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+#define MAX_SOURCES 4096
+#define MAX_WINDOW 64
+#define MAX_SAMPLES (1 << 20)
+
+/* V2G_EVCC_SDP_Timeout */
+#define SDP_TIMEOUT_NS 250000000ull
+
+/* SDP security byte */
+#define SDP_TLS 0x00
+#define SDP_NO_TLS 0x10
+
+static uint8_t sdp_request[] =
+{
+  0x01, /* V2GTP Version 1 */
+  0xfe, /* inverted protocol */
+  0x90, 0x00, /* SDP REQUEST */
+  0x00, 0x00, 0x00, 0x02, /* payload length */
+  SDP_NO_TLS, /* TLS: no (SDP_TLS with -T) */
+  0x00, /* TCP protocol */
+};
+
+struct source
+{
+  int sock;
+  uint64_t sent_ns[MAX_WINDOW]; /* the requests outstanding, oldest first */
+  unsigned head, outstanding;
+};
+
+static struct source sources[MAX_SOURCES];
+static struct sockaddr_in6 dst;
+static unsigned window = 1;
+
+static uint64_t *samples;
+static unsigned long sample_count, requests, responses, unanswered, bad;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void source_send(struct source *s, uint64_t now)
+{
+  while (s->outstanding < window)
+  {
+    if (sendto(s->sock, sdp_request, sizeof(sdp_request), 0, (struct sockaddr *)&dst, sizeof(dst)) < 0) break;
+    s->sent_ns[(s->head + s->outstanding++) % MAX_WINDOW] = now;
+    requests++;
+  }
+}
+
+static void source_receive(struct source *s, uint64_t now)
+{
+  uint8_t buffer[64];
+  ssize_t len;
+
+  while ((len = recv(s->sock, buffer, sizeof(buffer), MSG_DONTWAIT)) >= 0)
+  {
+    if ((len != 28) || (0x01 != buffer[0]) || (0xfe != buffer[1]) || (0x90 != buffer[2]) || (0x01 != buffer[3]))
+    {
+      bad++;
+      continue;
+    }
+
+    /* a response to a request already given up on is still a response */
+    responses++;
+    if (!s->outstanding) continue;
+
+    if (sample_count < MAX_SAMPLES) samples[sample_count++] = now - s->sent_ns[s->head];
+    s->head = (s->head + 1) % MAX_WINDOW;
+    s->outstanding--;
+  }
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-i ifname] [-a address] [-b source address] [-c sources] [-w requests per source] [-d seconds] [-T]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *ifname = "seth0", *address = "ff02::1", *base = NULL;
+  unsigned count = 64, seconds = 10;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:a:b:c:w:d:T")) != -1)
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'a': address = optarg; break;
+    case 'b': base = optarg; break;
+    case 'c': count = atoi(optarg); break;
+    case 'w': window = atoi(optarg); break;
+    case 'd': seconds = atoi(optarg); break;
+    case 'T': sdp_request[8] = SDP_TLS; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if (!count || (count > MAX_SOURCES) || !window || (window > MAX_WINDOW) || !seconds)
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(15118);
+  dst.sin6_scope_id = if_nametoindex(ifname);
+  if (1 != inet_pton(AF_INET6, address, &dst.sin6_addr))
+  {
+    fprintf(stderr, "ERROR: bad address %s\n", address);
+    return -1;
+  }
+
+  struct in6_addr src_addr;
+  if (base && (1 != inet_pton(AF_INET6, base, &src_addr)))
+  {
+    fprintf(stderr, "ERROR: bad address %s\n", base);
+    return -1;
+  }
+
+  samples = malloc(MAX_SAMPLES * sizeof(*samples));
+  int epfd = epoll_create1(0);
+  if (!samples || (epfd < 0)) return -1;
+
+  for (unsigned i = 0; i < count; i++)
+  {
+    struct source *s = &sources[i];
+    s->sock = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+    if (s->sock < 0)
+    {
+      fprintf(stderr, "ERROR: cannot open source %u (%d)\n", i, errno);
+      return -1;
+    }
+
+    unsigned ifindex = dst.sin6_scope_id;
+    setsockopt(s->sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+
+    if (base)
+    {
+      /* the address need not be configured, only routed here */
+      const int on = 1;
+      struct sockaddr_in6 a = { .sin6_family = AF_INET6, .sin6_addr = src_addr };
+      uint32_t low = ntohl(a.sin6_addr.s6_addr32[3]) + i;
+      a.sin6_addr.s6_addr32[3] = htonl(low);
+      setsockopt(s->sock, IPPROTO_IPV6, IPV6_FREEBIND, &on, sizeof(on));
+      if (bind(s->sock, (struct sockaddr *)&a, sizeof(a)))
+      {
+        fprintf(stderr, "ERROR: cannot bind source %u (%d)\n", i, errno);
+        return -1;
+      }
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->sock, &ev);
+  }
+
+  uint64_t start = now_ns(), end = start + seconds * 1000000000ull;
+  for (unsigned i = 0; i < count; i++)
+    source_send(&sources[i], start);
+
+  uint64_t now = start, next_check = start + SDP_TIMEOUT_NS / 10;
+  while (now < end)
+  {
+    struct epoll_event events[64];
+    int n = epoll_wait(epfd, events, ARRAY_SIZE(events), 10);
+    now = now_ns();
+
+    for (int i = 0; i < n; i++)
+    {
+      struct source *s = events[i].data.ptr;
+      source_receive(s, now);
+      source_send(s, now);
+    }
+
+    /* the oldest request of a source that has waited too long: give up on all of them, and start again */
+    if (now >= next_check)
+    {
+      for (unsigned i = 0; i < count; i++)
+      {
+        struct source *s = &sources[i];
+        if (s->outstanding && (now - s->sent_ns[s->head] > SDP_TIMEOUT_NS))
+        {
+          unanswered += s->outstanding;
+          s->outstanding = 0;
+          source_send(s, now);
+        }
+      }
+      next_check = now + SDP_TIMEOUT_NS / 10;
+    }
+  }
+
+  double elapsed = (now - start) / 1e9;
+  printf("%u sources, %u outstanding each, %.1f s: %lu requests, %lu responses (%.0f/s), %lu unanswered", count, window, elapsed, requests, responses, responses / elapsed, unanswered);
+  if (bad) printf(", %lu bad responses", bad);
+  printf("\n");
+
+  if (sample_count)
+  {
+    qsort(samples, sample_count, sizeof(*samples), compare_u64);
+    printf("latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", samples[sample_count / 2] / 1e3, samples[sample_count * 99 / 100] / 1e3, samples[sample_count - 1] / 1e3);
+  }
+
+  for (unsigned i = 0; i < count; i++)
+    close(sources[i].sock);
+  close(epfd);
+
+  return (responses) ? 0 : -1;
+}
@@ -0,0 +1,196 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+V2G sessions, keyed by the 8-byte SessionID handed out in SessionSetupRes
+
+Session structs come from a preallocated slab and are indexed by an open-addressing
+(linear probing) hash table that is twice the size of the slab, so lookups stay O(1)
+and nothing is allocated on the request path.  A session outlives its TCP connection
+when the EV pauses (SessionStopReq with ChargingSession=Pause) or drops the link, so
+that an EV reconnecting with the same SessionID can rejoin it.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "iso1EXIDatatypes.h"
+#include "messages.h"
+#include "urandom.h"
+#include "trace.h"
+#include "timerwheel.h"
+#include "auth.h"
+
+#define SESSION_ID_LEN 8
+
+#ifndef MAX_SESSIONS
+#define MAX_SESSIONS 1024
+#endif
+
+#define SESSION_BUCKETS (2 * MAX_SESSIONS)
+
+_Static_assert(0 == (SESSION_BUCKETS & (SESSION_BUCKETS - 1)), "SESSION_BUCKETS must be a power of two");
+
+struct session
+{
+  uint8_t id[SESSION_ID_LEN];
+  bool in_use;
+  int schema;               /* SchemaID negotiated by supportedAppProtocol */
+  enum v2g_msg last_msg;    /* most recent request, for sequence checking */
+  void *conn;               /* connection currently attached, if any */
+  struct iso1PhysicalValueType EVTargetVoltage, EVTargetCurrent;
+  uint64_t energy_uj;       /* delivered so far, as measured */
+  uint64_t metered_ns;      /* when the energy was last brought up to date */
+  struct trace_buf trace;   /* the most recent pipeline spans */
+  uint8_t auth;             /* enum auth_state of auth_id */
+  struct auth_id auth_id;   /* what the EV is authorized by: its EVCCID, or its contract's eMAID */
+  uint32_t auth_tag;        /* of the lookup in flight */
+  struct timer auth_deadline; /* runs while the lookup is in flight */
+  struct timer linger;      /* runs while no connection is attached */
+  struct session *next_free;
+};
+
+struct session_table
+{
+  struct session *free;
+  unsigned count;
+  struct session *index[SESSION_BUCKETS];
+  struct session slab[MAX_SESSIONS];
+};
+
+/* which requests may follow which (ISO 15118-2 DC message sequence); SessionStop may follow anything */
+
+#define MSG_BIT(m) (1u << (m))
+
+static const uint32_t msg_allowed_after[MSG_COUNT] =
+{
+  [MSG_SESSION_SETUP] = MSG_BIT(MSG_SERVICE_DISCOVERY),
+  [MSG_SERVICE_DISCOVERY] = MSG_BIT(MSG_SERVICE_DETAIL) | MSG_BIT(MSG_PAYMENT_SERVICE_SELECTION),
+  [MSG_SERVICE_DETAIL] = MSG_BIT(MSG_SERVICE_DETAIL) | MSG_BIT(MSG_PAYMENT_SERVICE_SELECTION),
+  [MSG_PAYMENT_SERVICE_SELECTION] = MSG_BIT(MSG_PAYMENT_DETAILS) | MSG_BIT(MSG_AUTHORIZATION),
+  [MSG_PAYMENT_DETAILS] = MSG_BIT(MSG_AUTHORIZATION),
+  [MSG_AUTHORIZATION] = MSG_BIT(MSG_AUTHORIZATION) | MSG_BIT(MSG_CHARGE_PARAMETER_DISCOVERY),
+  [MSG_CHARGE_PARAMETER_DISCOVERY] = MSG_BIT(MSG_CHARGE_PARAMETER_DISCOVERY) | MSG_BIT(MSG_CABLE_CHECK) | MSG_BIT(MSG_POWER_DELIVERY),
+  [MSG_CABLE_CHECK] = MSG_BIT(MSG_CABLE_CHECK) | MSG_BIT(MSG_PRE_CHARGE),
+  [MSG_PRE_CHARGE] = MSG_BIT(MSG_PRE_CHARGE) | MSG_BIT(MSG_POWER_DELIVERY),
+  [MSG_POWER_DELIVERY] = MSG_BIT(MSG_CURRENT_DEMAND) | MSG_BIT(MSG_WELDING_DETECTION) | MSG_BIT(MSG_CHARGE_PARAMETER_DISCOVERY) | MSG_BIT(MSG_POWER_DELIVERY),
+  [MSG_CURRENT_DEMAND] = MSG_BIT(MSG_CURRENT_DEMAND) | MSG_BIT(MSG_POWER_DELIVERY),
+  [MSG_WELDING_DETECTION] = MSG_BIT(MSG_WELDING_DETECTION),
+};
+
+static bool session_sequence_ok(const struct session *s, enum v2g_msg msg)
+{
+  if (MSG_SESSION_STOP == msg) return true;
+  return msg_allowed_after[s->last_msg] & MSG_BIT(msg);
+}
+
+/* SessionIDs are random, but EV-supplied ones are not to be trusted, so mix the bits anyway */
+
+static unsigned session_hash(const uint8_t *id)
+{
+  uint64_t key;
+  memcpy(&key, id, sizeof(key));
+  return (unsigned)((key * 0x9E3779B97F4A7C15ull) >> 32) & (SESSION_BUCKETS - 1);
+}
+
+static void session_table_init(struct session_table *t)
+{
+  memset(t->index, 0, sizeof(t->index));
+  t->free = NULL;
+  t->count = 0;
+  for (int i = MAX_SESSIONS - 1; i >= 0; i--)
+  {
+    t->slab[i].in_use = false;
+    t->slab[i].next_free = t->free;
+    t->free = &t->slab[i];
+  }
+}
+
+static struct session *session_lookup(struct session_table *t, const uint8_t *id)
+{
+  for (unsigned b = session_hash(id); t->index[b]; b = (b + 1) & (SESSION_BUCKETS - 1))
+    if (0 == memcmp(t->index[b]->id, id, SESSION_ID_LEN)) return t->index[b];
+
+  return NULL;
+}
+
+/* the SessionID as one number, most significant byte first, for logging */
+
+static uint64_t session_id64(const struct session *s)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < SESSION_ID_LEN; i++)
+    v = (v << 8) | s->id[i];
+  return v;
+}
+
+/* allocate a session under a fresh random SessionID; returns NULL when the slab is exhausted */
+
+static struct session *session_create(struct session_table *t)
+{
+  static const uint8_t zero_id[SESSION_ID_LEN];
+  struct session *s = t->free;
+  if (!s) return NULL;
+
+  /* an all-zero SessionID means "no session" on the wire, and IDs must be unique */
+  do
+    urandom_get(s->id, SESSION_ID_LEN);
+  while (!memcmp(s->id, zero_id, SESSION_ID_LEN) || session_lookup(t, s->id));
+
+  t->free = s->next_free;
+  t->count++;
+
+  s->in_use = true;
+  s->schema = -1;
+  s->last_msg = MSG_SESSION_SETUP;
+  s->conn = NULL;
+  memset(&s->EVTargetVoltage, 0, sizeof(s->EVTargetVoltage));
+  memset(&s->EVTargetCurrent, 0, sizeof(s->EVTargetCurrent));
+  s->energy_uj = 0;
+  s->metered_ns = 0;
+  trace_reset(&s->trace);
+  s->auth = AUTH_UNKNOWN;
+  memset(&s->auth_id, 0, sizeof(s->auth_id));
+  s->next_free = NULL;
+
+  unsigned b = session_hash(s->id);
+  while (t->index[b]) b = (b + 1) & (SESSION_BUCKETS - 1);
+  t->index[b] = s;
+
+  return s;
+}
+
+static void session_destroy(struct session_table *t, struct session *s)
+{
+  if (!s->in_use) return;
+
+  unsigned b = session_hash(s->id);
+  while (t->index[b] != s) b = (b + 1) & (SESSION_BUCKETS - 1);
+
+  /* backward-shift deletion keeps probe chains intact without tombstones */
+  unsigned hole = b;
+  for (unsigned next = (hole + 1) & (SESSION_BUCKETS - 1); t->index[next]; next = (next + 1) & (SESSION_BUCKETS - 1))
+  {
+    unsigned home = session_hash(t->index[next]->id);
+    if (((next - home) & (SESSION_BUCKETS - 1)) >= ((next - hole) & (SESSION_BUCKETS - 1)))
+    {
+      t->index[hole] = t->index[next];
+      hole = next;
+    }
+  }
+  t->index[hole] = NULL;
+
+  s->in_use = false;
+  s->conn = NULL;
+  s->next_free = t->free;
+  t->free = s;
+  t->count--;
+}
+
+#endif
@@ -0,0 +1,719 @@
+#ifndef _SLAC_H
+#define _SLAC_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+SLAC (ISO 15118-3): matching an EV to this EVSE over HomePlug Green PHY
+
+The EVSE side of the exchange, one port per interface (PLC modem):
+
+  EV                                   EVSE
+  CM_SLAC_PARM.REQ (broadcast)    ->
+                                  <-   CM_SLAC_PARM.CNF
+  CM_START_ATTEN_CHAR.IND x3      ->
+  CM_MNBC_SOUND.IND x N           ->   (the modem measures each sound and hands the host
+                                        a CM_ATTEN_PROFILE.IND with its attenuation
+                                        per carrier group)
+                                  <-   CM_ATTEN_CHAR.IND (the average of the profiles)
+  CM_ATTEN_CHAR.RSP               ->
+  CM_SLAC_MATCH.REQ               ->
+                                  <-   CM_SLAC_MATCH.CNF (the NID and NMK to join with)
+
+and, to the local modem, CM_SET_KEY.REQ with that same NMK, so that the EV's modem
+joins ours once it has been given the key.  The NMK is random and set once at startup;
+the NID is derived from it as HomePlug AV requires.
+
+Frames are taken from a TPACKET_V3 receive ring shared with the kernel: it fills whole
+blocks, and the event loop is woken once per block (at the latest SLAC_BLOCK_TOV_MS
+after its first frame), so a burst of soundings from several EVs costs one wakeup and
+no system call per frame.  The few replies go out with send().
+
+The profiles of an EV are summed as they arrive, eight carrier groups to a vector, and
+averaged once sounding is over.  Up to SLAC_EVS EVs may be in the middle of SLAC on a
+port at once; each has a timer on the caller's wheel for the step it is waiting on,
+and the port's event hook is told when one starts, matches or fails.
+
+This header is the whole interface: the EV simulator includes it too (see slacsim.c).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <openssl/sha.h>
+#include "timerwheel.h"
+
+#define ETH_P_HOMEPLUG_GP 0x88e1
+#define SLAC_MMV 0x01               /* HomePlug AV 1.1 */
+
+/* MMTYPE base values; the two low bits give the variant */
+#define MMTYPE_CM_SET_KEY 0x6008
+#define MMTYPE_CM_SLAC_PARM 0x6064
+#define MMTYPE_CM_START_ATTEN_CHAR 0x6068
+#define MMTYPE_CM_ATTEN_CHAR 0x606c
+#define MMTYPE_CM_MNBC_SOUND 0x6074
+#define MMTYPE_CM_SLAC_MATCH 0x607c
+#define MMTYPE_CM_ATTEN_PROFILE 0x6084
+#define MMTYPE_REQ 0
+#define MMTYPE_CNF 1
+#define MMTYPE_IND 2
+#define MMTYPE_RSP 3
+
+#define SLAC_GROUPS 58              /* carrier groups in an attenuation profile */
+#define SLAC_ID_LEN 17              /* PEV ID, EVSE ID and the sender ID of a sound */
+
+/* ISO 15118-3 parameters */
+#define SLAC_SOUNDS 10              /* C_EV_match_MNBC */
+#define SLAC_SOUNDING_TIMEOUT 6     /* TT_EVSE_match_MNBS, in units of 100 ms */
+#define SLAC_RESPONSE_MS 200        /* TT_match_response */
+#define SLAC_RETRIES 2              /* C_EV_match_retry */
+#define SLAC_SEQUENCE_MS 400        /* TT_match_sequence */
+#define SLAC_SESSION_MS 10000       /* TT_EVSE_match_session */
+
+/* EVs in SLAC on one port at once */
+#ifndef SLAC_EVS
+#define SLAC_EVS 8
+#endif
+
+/* the receive ring */
+#define SLAC_BLOCK_SIZE (1 << 14)
+#define SLAC_BLOCKS 16
+#define SLAC_FRAME_SIZE 2048
+#define SLAC_BLOCK_TOV_MS 4
+
+struct slac_header
+{
+  uint8_t dst[ETH_ALEN];
+  uint8_t src[ETH_ALEN];
+  uint16_t ethertype;               /* big-endian, like every Ethernet type */
+  uint8_t mmv;
+  uint16_t mmtype;                  /* little-endian, like everything else in a HomePlug MME */
+  uint8_t fmi[2];
+} __attribute__((packed));
+
+struct cm_slac_parm_req
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t run_id[8];
+} __attribute__((packed));
+
+struct cm_slac_parm_cnf
+{
+  struct slac_header h;
+  uint8_t msound_target[ETH_ALEN];
+  uint8_t num_sounds;
+  uint8_t time_out;
+  uint8_t resp_type;
+  uint8_t forwarding_sta[ETH_ALEN];
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t run_id[8];
+} __attribute__((packed));
+
+struct cm_start_atten_char_ind
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t num_sounds;
+  uint8_t time_out;
+  uint8_t resp_type;
+  uint8_t forwarding_sta[ETH_ALEN];
+  uint8_t run_id[8];
+} __attribute__((packed));
+
+struct cm_mnbc_sound_ind
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t sender_id[SLAC_ID_LEN];
+  uint8_t cnt;                      /* sounds still to come */
+  uint8_t run_id[8];
+  uint8_t reserved[8];
+  uint8_t rnd[16];
+} __attribute__((packed));
+
+struct cm_atten_profile_ind
+{
+  struct slac_header h;
+  uint8_t pev_mac[ETH_ALEN];
+  uint8_t num_groups;
+  uint8_t reserved;
+  uint8_t aag[SLAC_GROUPS];         /* attenuation per group, in dB */
+} __attribute__((packed));
+
+struct cm_atten_char_ind
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t source_address[ETH_ALEN];
+  uint8_t run_id[8];
+  uint8_t source_id[SLAC_ID_LEN];
+  uint8_t resp_id[SLAC_ID_LEN];
+  uint8_t num_sounds;
+  uint8_t num_groups;
+  uint8_t aag[SLAC_GROUPS];
+} __attribute__((packed));
+
+struct cm_atten_char_rsp
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint8_t source_address[ETH_ALEN];
+  uint8_t run_id[8];
+  uint8_t source_id[SLAC_ID_LEN];
+  uint8_t resp_id[SLAC_ID_LEN];
+  uint8_t result;                   /* zero on success */
+} __attribute__((packed));
+
+struct cm_slac_match_req
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint16_t mvf_length;
+  uint8_t pev_id[SLAC_ID_LEN];
+  uint8_t pev_mac[ETH_ALEN];
+  uint8_t evse_id[SLAC_ID_LEN];
+  uint8_t evse_mac[ETH_ALEN];
+  uint8_t run_id[8];
+  uint8_t reserved[8];
+} __attribute__((packed));
+
+struct cm_slac_match_cnf
+{
+  struct slac_header h;
+  uint8_t application_type;
+  uint8_t security_type;
+  uint16_t mvf_length;
+  uint8_t pev_id[SLAC_ID_LEN];
+  uint8_t pev_mac[ETH_ALEN];
+  uint8_t evse_id[SLAC_ID_LEN];
+  uint8_t evse_mac[ETH_ALEN];
+  uint8_t run_id[8];
+  uint8_t reserved[8];
+  uint8_t nid[7];
+  uint8_t reserved2;
+  uint8_t nmk[16];
+} __attribute__((packed));
+
+struct cm_set_key_req
+{
+  struct slac_header h;
+  uint8_t key_type;                 /* 0x01: NMK */
+  uint32_t my_nonce;
+  uint32_t your_nonce;
+  uint8_t pid;                      /* 0x04: HLE protocol */
+  uint16_t prn;
+  uint8_t pmn;
+  uint8_t cco_capability;
+  uint8_t nid[7];
+  uint8_t new_eks;                  /* 0x01: NMK */
+  uint8_t new_key[16];
+} __attribute__((packed));
+
+struct cm_set_key_cnf
+{
+  struct slac_header h;
+  uint8_t result;                   /* zero on success */
+  uint32_t my_nonce;
+  uint32_t your_nonce;
+  uint8_t pid;
+  uint16_t prn;
+  uint8_t pmn;
+  uint8_t cco_capability;
+} __attribute__((packed));
+
+/* an Ethernet frame is padded to its minimum length; every MME above fits in this */
+#define SLAC_FRAME_MIN 60
+#define SLAC_FRAME_MAX 128
+
+_Static_assert(sizeof(struct cm_slac_match_cnf) <= SLAC_FRAME_MAX, "SLAC_FRAME_MAX must hold every MME sent");
+
+static const uint8_t slac_broadcast[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+/* fill in the header of an MME to dst; returns the frame length for a body of the given type */
+
+static size_t slac_header_fill(struct slac_header *h, const uint8_t *dst, const uint8_t *src, uint16_t mmtype, size_t size)
+{
+  memcpy(h->dst, dst, ETH_ALEN);
+  memcpy(h->src, src, ETH_ALEN);
+  h->ethertype = htobe16(ETH_P_HOMEPLUG_GP);
+  h->mmv = SLAC_MMV;
+  h->mmtype = htole16(mmtype);
+  h->fmi[0] = h->fmi[1] = 0;
+  return (size < SLAC_FRAME_MIN) ? SLAC_FRAME_MIN : size;
+}
+
+/* the MMTYPE of a received frame that is long enough to hold a header, or zero */
+
+static uint16_t slac_mmtype(const uint8_t *frame, size_t len)
+{
+  const struct slac_header *h = (const struct slac_header *)frame;
+  if ((len < sizeof(*h)) || (htobe16(ETH_P_HOMEPLUG_GP) != h->ethertype) || (SLAC_MMV != h->mmv)) return 0;
+  return le16toh(h->mmtype);
+}
+
+/* the NID of an NMK, as HomePlug AV derives it: PBKDF1 with SHA-256, five rounds, and the security level in the last octet */
+
+static void slac_nid(const uint8_t *nmk, uint8_t *nid)
+{
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+
+  SHA256(nmk, 16, digest);
+  for (int i = 1; i < 5; i++)
+    SHA256(digest, sizeof(digest), digest);
+
+  memcpy(nid, digest, 7);
+  nid[6] >>= 4;                     /* security level 0: simple connect */
+}
+
+/*
+attenuation profiles, eight groups to a vector
+
+A sum fits 16 bits for up to 257 profiles of 255 dB, which is more than num_sounds can
+ask for.
+*/
+
+typedef uint16_t slac_sum_t __attribute__((vector_size(16)));
+typedef uint8_t slac_aag_t __attribute__((vector_size(8)));
+
+#define SLAC_VECS ((SLAC_GROUPS + 7) / 8)
+
+static void slac_accumulate(slac_sum_t *sum, const uint8_t *aag, unsigned groups)
+{
+  uint8_t padded[SLAC_VECS * 8] = { 0 };
+  memcpy(padded, aag, (groups < SLAC_GROUPS) ? groups : SLAC_GROUPS);
+
+  for (unsigned i = 0; i < SLAC_VECS; i++)
+  {
+    slac_aag_t v;
+    memcpy(&v, padded + 8 * i, sizeof(v));
+    sum[i] += __builtin_convertvector(v, slac_sum_t);
+  }
+}
+
+static void slac_average(const slac_sum_t *sum, unsigned count, uint8_t *aag)
+{
+  uint8_t padded[SLAC_VECS * 8];
+  uint16_t n = (count) ? count : 1;
+
+  for (unsigned i = 0; i < SLAC_VECS; i++)
+  {
+    slac_aag_t v = __builtin_convertvector((sum[i] + (uint16_t)(n / 2)) / n, slac_aag_t);
+    memcpy(padded + 8 * i, &v, sizeof(v));
+  }
+
+  memcpy(aag, padded, SLAC_GROUPS);
+}
+
+/* the EVSE side */
+
+enum slac_state
+{
+  SLAC_FREE,
+  SLAC_PARM,                        /* CM_SLAC_PARM.CNF sent, waiting for CM_START_ATTEN_CHAR.IND */
+  SLAC_SOUNDING,                    /* collecting profiles */
+  SLAC_ATTEN_CHAR,                  /* CM_ATTEN_CHAR.IND sent, waiting for the response */
+  SLAC_WAIT_MATCH,                  /* waiting for CM_SLAC_MATCH.REQ */
+  SLAC_MATCHED,                     /* kept to answer a repeated CM_SLAC_MATCH.REQ; free for the next EV */
+};
+
+enum slac_event
+{
+  SLAC_EVENT_STARTED,
+  SLAC_EVENT_MATCHED,
+  SLAC_EVENT_FAILED,
+  SLAC_EVENT_KEY_SET,               /* the modem took the NMK (no EV) */
+  SLAC_EVENT_KEY_REFUSED,
+};
+
+struct slac_port;
+
+struct slac_ev
+{
+  uint8_t state;                    /* enum slac_state */
+  uint8_t mac[ETH_ALEN];
+  uint8_t run_id[8];
+  uint8_t sounds;                   /* announced by CM_START_ATTEN_CHAR.IND */
+  uint8_t time_out;                 /* likewise, in units of 100 ms */
+  uint8_t profiles;                 /* received so far */
+  uint8_t retries;
+  slac_sum_t sum[SLAC_VECS];
+  uint64_t started_ns;              /* CLOCK_MONOTONIC, at CM_SLAC_PARM.REQ */
+  struct timer timer;               /* for the step it is on */
+  struct slac_port *port;
+};
+
+struct slac_port
+{
+  int sock;
+  unsigned ifindex;
+  uint8_t mac[ETH_ALEN];
+  uint8_t modem[ETH_ALEN];          /* where CM_SET_KEY.REQ goes */
+  uint8_t nmk[16];
+  uint8_t nid[7];
+  uint8_t *ring;
+  unsigned block;                   /* the next block to look at */
+  struct timer_wheel *timers;
+  void (*event)(struct slac_port *port, const struct slac_ev *ev, enum slac_event e);
+  struct slac_ev ev[SLAC_EVS];
+};
+
+static uint64_t slac_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool slac_send(struct slac_port *p, const void *frame, size_t len)
+{
+  return send(p->sock, frame, len, MSG_DONTWAIT) == (ssize_t)len;
+}
+
+static void slac_fail(struct slac_ev *ev)
+{
+  struct slac_port *p = ev->port;
+
+  timer_cancel(p->timers, &ev->timer);
+  ev->state = SLAC_FREE;
+  p->event(p, ev, SLAC_EVENT_FAILED);
+}
+
+static void slac_send_atten_char(struct slac_ev *ev)
+{
+  struct slac_port *p = ev->port;
+  union { struct cm_atten_char_ind ind; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.ind.h, ev->mac, p->mac, MMTYPE_CM_ATTEN_CHAR | MMTYPE_IND, sizeof(u.ind));
+  memcpy(u.ind.source_address, ev->mac, ETH_ALEN);
+  memcpy(u.ind.run_id, ev->run_id, sizeof(ev->run_id));
+  u.ind.num_sounds = ev->profiles;
+  u.ind.num_groups = SLAC_GROUPS;
+  slac_average(ev->sum, ev->profiles, u.ind.aag);
+
+  slac_send(p, u.frame, len);
+  ev->state = SLAC_ATTEN_CHAR;
+  timer_arm(p->timers, &ev->timer, SLAC_RESPONSE_MS);
+}
+
+/* the timer of the step an EV is on has run out */
+
+static void slac_timeout(struct timer *t)
+{
+  struct slac_ev *ev = (struct slac_ev *)((char *)t - offsetof(struct slac_ev, timer));
+
+  switch (ev->state)
+  {
+  case SLAC_SOUNDING:
+    /* sounding is over: characterize with the profiles there are */
+    if (ev->profiles) slac_send_atten_char(ev); else slac_fail(ev);
+    break;
+  case SLAC_ATTEN_CHAR:
+    if (ev->retries++ < SLAC_RETRIES) slac_send_atten_char(ev); else slac_fail(ev);
+    break;
+  case SLAC_PARM:
+  case SLAC_WAIT_MATCH:
+    slac_fail(ev);
+    break;
+  }
+}
+
+/* the EV with this MAC in the given run; NULL if there is none */
+
+static struct slac_ev *slac_find(struct slac_port *p, const uint8_t *mac, const uint8_t *run_id)
+{
+  for (unsigned i = 0; i < SLAC_EVS; i++)
+  {
+    struct slac_ev *ev = &p->ev[i];
+    if ((SLAC_FREE != ev->state) && !memcmp(ev->mac, mac, ETH_ALEN) && (!run_id || !memcmp(ev->run_id, run_id, sizeof(ev->run_id)))) return ev;
+  }
+  return NULL;
+}
+
+/* an EV starting over takes its own entry again, a new one a free entry, or else one that has matched */
+
+static struct slac_ev *slac_take(struct slac_port *p, const uint8_t *mac)
+{
+  struct slac_ev *ev = slac_find(p, mac, NULL);
+  if (ev) return ev;
+
+  for (unsigned i = 0; i < SLAC_EVS; i++)
+    if (SLAC_FREE == p->ev[i].state) return &p->ev[i];
+  for (unsigned i = 0; i < SLAC_EVS; i++)
+    if (SLAC_MATCHED == p->ev[i].state) return &p->ev[i];
+  return NULL;
+}
+
+static void slac_parm_req(struct slac_port *p, const struct cm_slac_parm_req *req)
+{
+  union { struct cm_slac_parm_cnf cnf; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  /* only PnC-less, unsecured SLAC is offered */
+  if (req->application_type || req->security_type) return;
+
+  struct slac_ev *ev = slac_take(p, req->h.src);
+  if (!ev) return;
+
+  timer_cancel(p->timers, &ev->timer);
+  ev->state = SLAC_PARM;
+  memcpy(ev->mac, req->h.src, ETH_ALEN);
+  memcpy(ev->run_id, req->run_id, sizeof(ev->run_id));
+  ev->profiles = 0;
+  ev->retries = 0;
+  memset(ev->sum, 0, sizeof(ev->sum));
+  ev->started_ns = slac_now();
+
+  size_t len = slac_header_fill(&u.cnf.h, ev->mac, p->mac, MMTYPE_CM_SLAC_PARM | MMTYPE_CNF, sizeof(u.cnf));
+  memcpy(u.cnf.msound_target, slac_broadcast, ETH_ALEN);
+  u.cnf.num_sounds = SLAC_SOUNDS;
+  u.cnf.time_out = SLAC_SOUNDING_TIMEOUT;
+  u.cnf.resp_type = 1;              /* to the host behind the modem */
+  memcpy(u.cnf.forwarding_sta, ev->mac, ETH_ALEN);
+  memcpy(u.cnf.run_id, ev->run_id, sizeof(ev->run_id));
+
+  slac_send(p, u.frame, len);
+  timer_arm(p->timers, &ev->timer, SLAC_SEQUENCE_MS);
+  p->event(p, ev, SLAC_EVENT_STARTED);
+}
+
+static void slac_start_atten_char(struct slac_port *p, const struct cm_start_atten_char_ind *ind)
+{
+  struct slac_ev *ev = slac_find(p, ind->h.src, ind->run_id);
+
+  /* the EV sends it three times; the first starts the sounding window */
+  if (!ev || (SLAC_PARM != ev->state)) return;
+
+  ev->state = SLAC_SOUNDING;
+  ev->sounds = (ind->num_sounds) ? ind->num_sounds : SLAC_SOUNDS;
+  ev->time_out = (ind->time_out) ? ind->time_out : SLAC_SOUNDING_TIMEOUT;
+  timer_arm(p->timers, &ev->timer, ev->time_out * 100u);
+}
+
+static void slac_atten_profile(struct slac_port *p, const struct cm_atten_profile_ind *ind)
+{
+  struct slac_ev *ev = slac_find(p, ind->pev_mac, NULL);
+
+  /* a sound may be measured before its CM_START_ATTEN_CHAR.IND has arrived */
+  if (!ev || ((SLAC_SOUNDING != ev->state) && (SLAC_PARM != ev->state))) return;
+  if (ev->profiles == UINT8_MAX) return;
+
+  slac_accumulate(ev->sum, ind->aag, ind->num_groups);
+  ev->profiles++;
+
+  /* all the sounds are in: there is no need to wait out the window */
+  if ((SLAC_SOUNDING == ev->state) && (ev->profiles >= ev->sounds))
+  {
+    timer_cancel(p->timers, &ev->timer);
+    slac_send_atten_char(ev);
+  }
+}
+
+static void slac_atten_char_rsp(struct slac_port *p, const struct cm_atten_char_rsp *rsp)
+{
+  struct slac_ev *ev = slac_find(p, rsp->h.src, rsp->run_id);
+  if (!ev || (SLAC_ATTEN_CHAR != ev->state)) return;
+
+  if (rsp->result)
+  {
+    slac_fail(ev);
+    return;
+  }
+
+  ev->state = SLAC_WAIT_MATCH;
+  timer_arm(p->timers, &ev->timer, SLAC_SESSION_MS);
+}
+
+static void slac_match_req(struct slac_port *p, const struct cm_slac_match_req *req)
+{
+  union { struct cm_slac_match_cnf cnf; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+  struct slac_ev *ev = slac_find(p, req->h.src, req->run_id);
+
+  /* a lost CM_ATTEN_CHAR.RSP, or a lost CM_SLAC_MATCH.CNF, is no reason to start over */
+  if (!ev || ((SLAC_ATTEN_CHAR != ev->state) && (SLAC_WAIT_MATCH != ev->state) && (SLAC_MATCHED != ev->state))) return;
+
+  size_t len = slac_header_fill(&u.cnf.h, ev->mac, p->mac, MMTYPE_CM_SLAC_MATCH | MMTYPE_CNF, sizeof(u.cnf));
+  u.cnf.mvf_length = htole16(sizeof(u.cnf) - offsetof(struct cm_slac_match_cnf, pev_id));
+  memcpy(u.cnf.pev_id, req->pev_id, SLAC_ID_LEN);
+  memcpy(u.cnf.pev_mac, ev->mac, ETH_ALEN);
+  memcpy(u.cnf.evse_mac, p->mac, ETH_ALEN);
+  memcpy(u.cnf.run_id, ev->run_id, sizeof(ev->run_id));
+  memcpy(u.cnf.nid, p->nid, sizeof(p->nid));
+  memcpy(u.cnf.nmk, p->nmk, sizeof(p->nmk));
+  slac_send(p, u.frame, len);
+
+  if (SLAC_MATCHED == ev->state) return;
+  timer_cancel(p->timers, &ev->timer);
+  ev->state = SLAC_MATCHED;
+  p->event(p, ev, SLAC_EVENT_MATCHED);
+}
+
+static void slac_frame(struct slac_port *p, const uint8_t *frame, size_t len)
+{
+  const struct slac_header *h = (const struct slac_header *)frame;
+  uint16_t mmtype = slac_mmtype(frame, len);
+
+  /* what we sent ourselves, or what was meant for another station */
+  if (!mmtype || !memcmp(h->src, p->mac, ETH_ALEN)) return;
+  if (memcmp(h->dst, p->mac, ETH_ALEN) && memcmp(h->dst, slac_broadcast, ETH_ALEN)) return;
+
+#define SLAC_FITS(type) (len >= sizeof(type))
+  switch (mmtype)
+  {
+  case MMTYPE_CM_SLAC_PARM | MMTYPE_REQ:
+    if (SLAC_FITS(struct cm_slac_parm_req)) slac_parm_req(p, (const struct cm_slac_parm_req *)frame);
+    break;
+  case MMTYPE_CM_START_ATTEN_CHAR | MMTYPE_IND:
+    if (SLAC_FITS(struct cm_start_atten_char_ind)) slac_start_atten_char(p, (const struct cm_start_atten_char_ind *)frame);
+    break;
+  case MMTYPE_CM_ATTEN_PROFILE | MMTYPE_IND:
+    if (SLAC_FITS(struct cm_atten_profile_ind)) slac_atten_profile(p, (const struct cm_atten_profile_ind *)frame);
+    break;
+  case MMTYPE_CM_ATTEN_CHAR | MMTYPE_RSP:
+    if (SLAC_FITS(struct cm_atten_char_rsp)) slac_atten_char_rsp(p, (const struct cm_atten_char_rsp *)frame);
+    break;
+  case MMTYPE_CM_SLAC_MATCH | MMTYPE_REQ:
+    if (SLAC_FITS(struct cm_slac_match_req)) slac_match_req(p, (const struct cm_slac_match_req *)frame);
+    break;
+  case MMTYPE_CM_SET_KEY | MMTYPE_CNF:
+    if (SLAC_FITS(struct cm_set_key_cnf)) p->event(p, NULL, (((const struct cm_set_key_cnf *)frame)->result) ? SLAC_EVENT_KEY_REFUSED : SLAC_EVENT_KEY_SET);
+    break;
+  default:
+    /* the sounds themselves only matter to the modem, which measures them */
+    break;
+  }
+#undef SLAC_FITS
+}
+
+/* hand the local modem the NMK that matched EVs are given */
+
+static bool slac_set_key(struct slac_port *p, uint32_t nonce)
+{
+  union { struct cm_set_key_req req; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.req.h, p->modem, p->mac, MMTYPE_CM_SET_KEY | MMTYPE_REQ, sizeof(u.req));
+  u.req.key_type = 0x01;
+  u.req.my_nonce = nonce;
+  u.req.pid = 0x04;
+  u.req.cco_capability = 0x00;
+  memcpy(u.req.nid, p->nid, sizeof(p->nid));
+  u.req.new_eks = 0x01;
+  memcpy(u.req.new_key, p->nmk, sizeof(p->nmk));
+  return slac_send(p, u.frame, len);
+}
+
+/* take every block the kernel has filled; returns the number of frames */
+
+static unsigned slac_service(struct slac_port *p)
+{
+  unsigned frames = 0;
+
+  for (;;)
+  {
+    struct tpacket_block_desc *b = (struct tpacket_block_desc *)(p->ring + (size_t)p->block * SLAC_BLOCK_SIZE);
+    if (!(__atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) break;
+
+    const uint8_t *pkt = (const uint8_t *)b + b->hdr.bh1.offset_to_first_pkt;
+    for (uint32_t i = 0; i < b->hdr.bh1.num_pkts; i++)
+    {
+      const struct tpacket3_hdr *h = (const struct tpacket3_hdr *)pkt;
+      slac_frame(p, pkt + h->tp_mac, h->tp_snaplen);
+      pkt += h->tp_next_offset;
+    }
+
+    frames += b->hdr.bh1.num_pkts;
+    __atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    p->block = (p->block + 1) % SLAC_BLOCKS;
+  }
+
+  return frames;
+}
+
+/* open the raw socket and its ring on an interface; nmk is this port's key; returns false (with errno) on failure */
+
+static bool slac_open(struct slac_port *p, unsigned ifindex, const uint8_t *modem, const uint8_t *nmk, struct timer_wheel *timers, void (*event)(struct slac_port *, const struct slac_ev *, enum slac_event))
+{
+  const int version = TPACKET_V3;
+  struct tpacket_req3 req =
+  {
+    .tp_block_size = SLAC_BLOCK_SIZE,
+    .tp_block_nr = SLAC_BLOCKS,
+    .tp_frame_size = SLAC_FRAME_SIZE,
+    .tp_frame_nr = SLAC_BLOCK_SIZE / SLAC_FRAME_SIZE * SLAC_BLOCKS,
+    .tp_retire_blk_tov = SLAC_BLOCK_TOV_MS,
+  };
+  struct ifreq ifr = { 0 };
+
+  memset(p, 0, sizeof(*p));
+  p->ifindex = ifindex;
+  p->timers = timers;
+  p->event = event;
+  memcpy(p->modem, modem, ETH_ALEN);
+  memcpy(p->nmk, nmk, sizeof(p->nmk));
+  slac_nid(p->nmk, p->nid);
+  for (unsigned i = 0; i < SLAC_EVS; i++)
+  {
+    p->ev[i].port = p;
+    timer_init(&p->ev[i].timer, slac_timeout);
+  }
+
+  p->sock = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_HOMEPLUG_GP));
+  if (p->sock < 0) return false;
+
+  if (!if_indextoname(ifindex, ifr.ifr_name) || ioctl(p->sock, SIOCGIFHWADDR, &ifr)) goto fail;
+  memcpy(p->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+  if (setsockopt(p->sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) || setsockopt(p->sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) goto fail;
+
+  void *ring = mmap(NULL, (size_t)SLAC_BLOCK_SIZE * SLAC_BLOCKS, PROT_READ | PROT_WRITE, MAP_SHARED, p->sock, 0);
+  if (MAP_FAILED == ring) goto fail;
+  p->ring = ring;
+
+  struct sockaddr_ll addr = { .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_HOMEPLUG_GP), .sll_ifindex = ifindex };
+  if (bind(p->sock, (const struct sockaddr *)&addr, sizeof(addr))) goto fail;
+  return true;
+
+fail:
+  {
+    int err = errno;
+    if (p->ring) munmap(p->ring, (size_t)SLAC_BLOCK_SIZE * SLAC_BLOCKS);
+    close(p->sock);
+    p->ring = NULL;
+    p->sock = -1;
+    errno = err;
+  }
+  return false;
+}
+
+static void slac_close(struct slac_port *p)
+{
+  if (p->sock < 0) return;
+  for (unsigned i = 0; i < SLAC_EVS; i++)
+    timer_cancel(p->timers, &p->ev[i].timer);
+  munmap(p->ring, (size_t)SLAC_BLOCK_SIZE * SLAC_BLOCKS);
+  close(p->sock);
+  p->sock = -1;
+}
+
+#endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2025 Peter Lawrence
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+simulated EV side of SLAC for redux -s, with the EVSE's modem thrown in
+
+Up to -c EVs, each with a MAC address of its own, run SLAC (see slac.h) against the
+EVSE at the same time, -n runs in all.  Over a veth pair there is no HomePlug modem to
+measure the sounds, so slacsim plays the EVSE's modem too: along with each
+CM_MNBC_SOUND.IND it sends the EVSE the CM_ATTEN_PROFILE.IND that the modem would have,
+from the modem's address (SLAC_MODEM, as redux has it in parameters.h), and it answers
+the EVSE's CM_SET_KEY.REQ.
+
+Each EV checks that the attenuation the EVSE characterized is the average of the
+profiles it was sent, and that the NID it is given belongs to the NMK.  The report
+gives the time from CM_SLAC_PARM.REQ to CM_SLAC_MATCH.CNF as p50/p99/max, and the runs
+that failed or came back with the wrong figures.
+
+usage: slacsim [-i ifname] [-c EVs] [-n runs] [-g ms between sounds] [-q]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include "slac.h"
+
+#define MAX_EVS 64
+
+/* the EVSE's modem, as far as the EVSE is concerned */
+static const uint8_t SLAC_MODEM[ETH_ALEN] = { 0x00, 0xb0, 0x52, 0x00, 0x00, 0x01 };
+
+/* an EV waits this long for CM_ATTEN_CHAR.IND once it has sounded (TT_EV_atten_results) */
+#define ATTEN_RESULTS_MS 1200
+
+enum ev_state
+{
+  EV_IDLE,
+  EV_PARM,                  /* CM_SLAC_PARM.REQ sent */
+  EV_SOUNDING,
+  EV_ATTEN,                 /* all sounds sent, waiting for CM_ATTEN_CHAR.IND */
+  EV_MATCH,                 /* CM_SLAC_MATCH.REQ sent */
+};
+
+struct ev
+{
+  enum ev_state state;
+  uint8_t mac[ETH_ALEN];
+  uint8_t evse[ETH_ALEN];
+  uint8_t run_id[8];
+  unsigned retries;
+  unsigned sounds_left;
+  uint64_t deadline_ns;     /* for the response it is waiting on */
+  uint64_t next_sound_ns;
+  uint64_t started_ns;
+  uint32_t sum[SLAC_GROUPS]; /* of the profiles sent for it */
+  unsigned profiles;
+};
+
+static struct ev evs[MAX_EVS];
+static int sock;
+static uint8_t own_mac[ETH_ALEN];
+static unsigned sound_gap_ms = 20;
+static unsigned runs_started, runs_total;
+static unsigned matched, failed, wrong_atten, wrong_nid, keys_set;
+static uint64_t *latencies;
+static bool quiet;
+
+static void send_frame(const void *frame, size_t len)
+{
+  if (send(sock, frame, len, 0) != (ssize_t)len) fprintf(stderr, "send error %d\n", errno);
+}
+
+static void ev_parm_req(struct ev *ev)
+{
+  union { struct cm_slac_parm_req req; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.req.h, slac_broadcast, ev->mac, MMTYPE_CM_SLAC_PARM | MMTYPE_REQ, sizeof(u.req));
+  memcpy(u.req.run_id, ev->run_id, sizeof(ev->run_id));
+  send_frame(u.frame, len);
+  ev->deadline_ns = slac_now() + SLAC_RESPONSE_MS * 1000000ull;
+}
+
+static void ev_start(struct ev *ev)
+{
+  ev->state = EV_PARM;
+  ev->retries = 0;
+  ev->profiles = 0;
+  memset(ev->sum, 0, sizeof(ev->sum));
+  for (unsigned i = 0; i < sizeof(ev->run_id); i++)
+    ev->run_id[i] = rand();
+  ev->started_ns = slac_now();
+  runs_started++;
+  ev_parm_req(ev);
+}
+
+/* a run is over: start the next one, if there is one to start */
+
+static void ev_done(struct ev *ev, bool ok)
+{
+  if (ok)
+    latencies[matched++] = slac_now() - ev->started_ns;
+  else
+    failed++;
+
+  ev->state = EV_IDLE;
+  if (runs_started < runs_total) ev_start(ev);
+}
+
+static void ev_start_atten_char(struct ev *ev)
+{
+  union { struct cm_start_atten_char_ind ind; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.ind.h, slac_broadcast, ev->mac, MMTYPE_CM_START_ATTEN_CHAR | MMTYPE_IND, sizeof(u.ind));
+  u.ind.num_sounds = SLAC_SOUNDS;
+  u.ind.time_out = SLAC_SOUNDING_TIMEOUT;
+  u.ind.resp_type = 1;
+  memcpy(u.ind.forwarding_sta, ev->mac, ETH_ALEN);
+  memcpy(u.ind.run_id, ev->run_id, sizeof(ev->run_id));
+
+  for (int i = 0; i < 3; i++)
+    send_frame(u.frame, len);
+}
+
+/* a sound, and the profile the EVSE's modem measures from it: each EV sits at its own distance, give or take a few dB */
+
+static void ev_sound(struct ev *ev)
+{
+  union { struct cm_mnbc_sound_ind ind; uint8_t frame[SLAC_FRAME_MAX]; } s = { 0 };
+  union { struct cm_atten_profile_ind ind; uint8_t frame[SLAC_FRAME_MAX]; } p = { 0 };
+
+  size_t len = slac_header_fill(&s.ind.h, slac_broadcast, ev->mac, MMTYPE_CM_MNBC_SOUND | MMTYPE_IND, sizeof(s.ind));
+  s.ind.cnt = --ev->sounds_left;
+  memcpy(s.ind.run_id, ev->run_id, sizeof(ev->run_id));
+  for (unsigned i = 0; i < sizeof(s.ind.rnd); i++)
+    s.ind.rnd[i] = rand();
+  send_frame(s.frame, len);
+
+  len = slac_header_fill(&p.ind.h, ev->evse, SLAC_MODEM, MMTYPE_CM_ATTEN_PROFILE | MMTYPE_IND, sizeof(p.ind));
+  memcpy(p.ind.pev_mac, ev->mac, ETH_ALEN);
+  p.ind.num_groups = SLAC_GROUPS;
+  unsigned base = 10 + (ev - evs) % 40;
+  for (unsigned g = 0; g < SLAC_GROUPS; g++)
+  {
+    p.ind.aag[g] = base + g / 8 + rand() % 8;
+    ev->sum[g] += p.ind.aag[g];
+  }
+  ev->profiles++;
+  send_frame(p.frame, len);
+
+  if (ev->sounds_left)
+  {
+    ev->next_sound_ns = slac_now() + sound_gap_ms * 1000000ull;
+  }
+  else
+  {
+    ev->state = EV_ATTEN;
+    ev->deadline_ns = slac_now() + ATTEN_RESULTS_MS * 1000000ull;
+  }
+}
+
+static void ev_match_req(struct ev *ev)
+{
+  union { struct cm_slac_match_req req; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.req.h, ev->evse, ev->mac, MMTYPE_CM_SLAC_MATCH | MMTYPE_REQ, sizeof(u.req));
+  u.req.mvf_length = htole16(sizeof(u.req) - offsetof(struct cm_slac_match_req, pev_id));
+  memcpy(u.req.pev_mac, ev->mac, ETH_ALEN);
+  memcpy(u.req.evse_mac, ev->evse, ETH_ALEN);
+  memcpy(u.req.run_id, ev->run_id, sizeof(ev->run_id));
+  send_frame(u.frame, len);
+  ev->deadline_ns = slac_now() + SLAC_RESPONSE_MS * 1000000ull;
+}
+
+static void ev_atten_char(struct ev *ev, const struct cm_atten_char_ind *ind)
+{
+  union { struct cm_atten_char_rsp rsp; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  /* the EVSE may have characterized before the last profile reached it, and then the average is of fewer */
+  bool right = (ind->num_sounds == ev->profiles) && (SLAC_GROUPS == ind->num_groups);
+  for (unsigned g = 0; right && (g < SLAC_GROUPS); g++)
+    right = ind->aag[g] == (ev->sum[g] + ev->profiles / 2) / ev->profiles;
+  if (!right) wrong_atten++;
+
+  size_t len = slac_header_fill(&u.rsp.h, ev->evse, ev->mac, MMTYPE_CM_ATTEN_CHAR | MMTYPE_RSP, sizeof(u.rsp));
+  memcpy(u.rsp.source_address, ev->mac, ETH_ALEN);
+  memcpy(u.rsp.run_id, ev->run_id, sizeof(ev->run_id));
+  send_frame(u.frame, len);
+
+  ev->state = EV_MATCH;
+  ev->retries = 0;
+  ev_match_req(ev);
+}
+
+static void ev_match_cnf(struct ev *ev, const struct cm_slac_match_cnf *cnf)
+{
+  uint8_t nid[7];
+
+  slac_nid(cnf->nmk, nid);
+  if (memcmp(nid, cnf->nid, sizeof(nid))) wrong_nid++;
+  ev_done(ev, true);
+}
+
+static struct ev *ev_by_mac(const uint8_t *mac)
+{
+  for (unsigned i = 0; i < MAX_EVS; i++)
+    if ((EV_IDLE != evs[i].state) && !memcmp(evs[i].mac, mac, ETH_ALEN)) return &evs[i];
+  return NULL;
+}
+
+/* the modem's part: take the key, and say so */
+
+static void modem_set_key(const struct cm_set_key_req *req)
+{
+  union { struct cm_set_key_cnf cnf; uint8_t frame[SLAC_FRAME_MAX]; } u = { 0 };
+
+  size_t len = slac_header_fill(&u.cnf.h, req->h.src, SLAC_MODEM, MMTYPE_CM_SET_KEY | MMTYPE_CNF, sizeof(u.cnf));
+  u.cnf.your_nonce = req->my_nonce;
+  u.cnf.pid = req->pid;
+  send_frame(u.frame, len);
+  keys_set++;
+}
+
+static void receive(void)
+{
+  uint8_t frame[1536];
+  ssize_t len;
+
+  while ((len = recv(sock, frame, sizeof(frame), MSG_DONTWAIT)) > 0)
+  {
+    const struct slac_header *h = (const struct slac_header *)frame;
+    uint16_t mmtype = slac_mmtype(frame, len);
+
+    if ((MMTYPE_CM_SET_KEY | MMTYPE_REQ) == mmtype)
+    {
+      if (!memcmp(h->dst, SLAC_MODEM, ETH_ALEN) && (len >= (ssize_t)sizeof(struct cm_set_key_req))) modem_set_key((const struct cm_set_key_req *)frame);
+      continue;
+    }
+
+    struct ev *ev = ev_by_mac(h->dst);
+    if (!mmtype || !ev) continue;
+
+    if (((MMTYPE_CM_SLAC_PARM | MMTYPE_CNF) == mmtype) && (EV_PARM == ev->state) && (len >= (ssize_t)sizeof(struct cm_slac_parm_cnf)))
+    {
+      const struct cm_slac_parm_cnf *cnf = (const struct cm_slac_parm_cnf *)frame;
+      if (memcmp(cnf->run_id, ev->run_id, sizeof(ev->run_id))) continue;
+
+      memcpy(ev->evse, h->src, ETH_ALEN);
+      ev->state = EV_SOUNDING;
+      ev->sounds_left = SLAC_SOUNDS;
+      ev_start_atten_char(ev);
+      ev->next_sound_ns = slac_now();
+    }
+    else if (((MMTYPE_CM_ATTEN_CHAR | MMTYPE_IND) == mmtype) && (EV_ATTEN == ev->state) && (len >= (ssize_t)sizeof(struct cm_atten_char_ind)))
+    {
+      const struct cm_atten_char_ind *ind = (const struct cm_atten_char_ind *)frame;
+      if (!memcmp(ind->run_id, ev->run_id, sizeof(ev->run_id))) ev_atten_char(ev, ind);
+    }
+    else if (((MMTYPE_CM_SLAC_MATCH | MMTYPE_CNF) == mmtype) && (EV_MATCH == ev->state) && (len >= (ssize_t)sizeof(struct cm_slac_match_cnf)))
+    {
+      const struct cm_slac_match_cnf *cnf = (const struct cm_slac_match_cnf *)frame;
+      if (!memcmp(cnf->run_id, ev->run_id, sizeof(ev->run_id))) ev_match_cnf(ev, cnf);
+    }
+  }
+}
+
+/* send the sounds that are due, repeat what went unanswered; returns the next time anything is due */
+
+static uint64_t service(uint64_t now)
+{
+  uint64_t next = now + 100000000ull;
+
+  for (unsigned i = 0; i < MAX_EVS; i++)
+  {
+    struct ev *ev = &evs[i];
+
+    if (EV_SOUNDING == ev->state)
+    {
+      if (ev->next_sound_ns <= now) ev_sound(ev);
+    }
+    else if ((EV_PARM == ev->state) || (EV_MATCH == ev->state))
+    {
+      if (ev->deadline_ns > now) {}
+      else if (ev->retries++ >= SLAC_RETRIES) ev_done(ev, false);
+      else if (EV_PARM == ev->state) ev_parm_req(ev);
+      else ev_match_req(ev);
+    }
+    else if ((EV_ATTEN == ev->state) && (ev->deadline_ns <= now))
+    {
+      ev_done(ev, false);
+    }
+
+    if (EV_SOUNDING == ev->state)
+    {
+      if (ev->next_sound_ns < next) next = ev->next_sound_ns;
+    }
+    else if ((EV_IDLE != ev->state) && (ev->deadline_ns < next))
+    {
+      next = ev->deadline_ns;
+    }
+  }
+
+  return next;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-i ifname] [-c EVs] [-n runs] [-g ms between sounds] [-q]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *ifname = "ev0";
+  unsigned ev_count = 1;
+  int opt;
+
+  runs_total = 10;
+
+  while ((opt = getopt(argc, argv, "i:c:n:g:q")) != -1)
+  {
+    switch (opt)
+    {
+    case 'i': ifname = optarg; break;
+    case 'c': ev_count = atoi(optarg); break;
+    case 'n': runs_total = atoi(optarg); break;
+    case 'g': sound_gap_ms = atoi(optarg); break;
+    case 'q': quiet = true; break;
+    default: usage(argv[0]); return -1;
+    }
+  }
+
+  if ((ev_count < 1) || (ev_count > MAX_EVS) || (runs_total < 1))
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  unsigned ifindex = if_nametoindex(ifname);
+  if (!ifindex)
+  {
+    fprintf(stderr, "ERROR: interface (%s) not found\n", ifname);
+    return -1;
+  }
+
+  sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_HOMEPLUG_GP));
+  struct sockaddr_ll addr = { .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_HOMEPLUG_GP), .sll_ifindex = ifindex };
+  if ((sock < 0) || bind(sock, (const struct sockaddr *)&addr, sizeof(addr)))
+  {
+    fprintf(stderr, "ERROR: cannot open a raw socket on %s (error %d)\n", ifname, errno);
+    return -1;
+  }
+
+  struct ifreq ifr = { 0 };
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  if (!ioctl(sock, SIOCGIFHWADDR, &ifr)) memcpy(own_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+  latencies = calloc(runs_total, sizeof(*latencies));
+  if (!latencies) return -1;
+  srand(time(NULL));
+
+  /* locally administered addresses, one per EV */
+  for (unsigned i = 0; i < ev_count; i++)
+  {
+    memcpy(evs[i].mac, "\x02\x00\x00\x00\x00\x00", ETH_ALEN);
+    evs[i].mac[4] = own_mac[5];
+    evs[i].mac[5] = (uint8_t)i;
+  }
+
+  uint64_t begun = slac_now();
+  for (unsigned i = 0; (i < ev_count) && (runs_started < runs_total); i++)
+    ev_start(&evs[i]);
+
+  while (matched + failed < runs_total)
+  {
+    uint64_t now = slac_now();
+    uint64_t next = service(now);
+    int wait_ms = (next > now) ? (int)((next - now + 999999) / 1000000) : 0;
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    if ((poll(&pfd, 1, wait_ms) > 0) && (pfd.revents & POLLIN)) receive();
+  }
+
+  double seconds = (slac_now() - begun) / 1e9;
+  qsort(latencies, matched, sizeof(*latencies), compare_u64);
+
+  if (!quiet) printf("%u EVs, %u runs in %.2f s: %u matched, %u failed; modem keys set %u\n", ev_count, runs_total, seconds, matched, failed, keys_set);
+  if (matched) printf("SLAC p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", latencies[matched / 2] / 1e6, latencies[(matched * 99) / 100] / 1e6, latencies[matched - 1] / 1e6);
+  if (wrong_atten || wrong_nid) printf("WRONG: %u attenuation characterizations, %u NIDs\n", wrong_atten, wrong_nid);
+
+  free(latencies);
+  close(sock);
+  return (failed || wrong_atten || wrong_nid) ? 1 : 0;
+}
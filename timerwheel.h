@@ -0,0 +1,242 @@
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+hierarchical timer wheel, driven by a single timerfd
+
+Time advances in ticks of TIMER_TICK_MS.  Level 0 has a slot per tick for the next 64
+ticks; each level above covers 64 times the span of the one below, and its slots are
+cascaded (redistributed downwards) as the wheel reaches them, so arming, re-arming and
+cancelling a timer are O(1) however many are pending.  Timers are embedded in their
+owners and never allocated.
+
+The timerfd is armed for the next tick at which anything can happen (a level 0 slot
+that holds timers, or a cascade of a slot that does), and disarmed when the wheel is
+empty, so an idle loop is never woken.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#ifndef TIMER_TICK_MS
+#define TIMER_TICK_MS 10
+#endif
+
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1u << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 4          /* 64^4 ticks of 10 ms: 46 hours */
+
+struct timer
+{
+  struct timer *next, **pprev; /* pprev is NULL while the timer is not pending */
+  uint64_t expires;         /* in ticks */
+  void (*expire)(struct timer *t);
+};
+
+struct timer_wheel
+{
+  int fd;
+  uint64_t now;             /* ticks; every slot up to and including this one has run */
+  uint64_t armed;           /* tick the timerfd is set for, zero if disarmed */
+  unsigned pending;
+  uint64_t occupied[TIMER_LEVELS]; /* a bit per non-empty slot */
+  struct timer *slot[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+static uint64_t timer_ticks(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000u + ts.tv_nsec / 1000000u) / TIMER_TICK_MS;
+}
+
+static bool timer_pending(const struct timer *t)
+{
+  return NULL != t->pprev;
+}
+
+static void timer_init(struct timer *t, void (*expire)(struct timer *t))
+{
+  t->next = NULL;
+  t->pprev = NULL;
+  t->expire = expire;
+}
+
+/* a timer is never put in a slot that has already run: earliest is the current tick while cascading (that slot runs next), otherwise the one after */
+
+static void timer_link(struct timer_wheel *w, struct timer *t, uint64_t earliest)
+{
+  uint64_t expires = (t->expires > earliest) ? t->expires : earliest;
+  unsigned level = 0;
+
+  /* the lowest level at which the expiry is less than a full turn of the wheel ahead */
+  while ((level < TIMER_LEVELS - 1) && (((expires >> (level * TIMER_LEVEL_BITS)) - (w->now >> (level * TIMER_LEVEL_BITS))) >= TIMER_SLOTS))
+    level++;
+
+  /* beyond the top level: park it in the furthest top slot, to be cascaded again from there */
+  uint64_t ahead = (expires >> (level * TIMER_LEVEL_BITS)) - (w->now >> (level * TIMER_LEVEL_BITS));
+  if (ahead >= TIMER_SLOTS) expires = ((w->now >> (level * TIMER_LEVEL_BITS)) + TIMER_SLOTS - 1) << (level * TIMER_LEVEL_BITS);
+
+  unsigned index = (expires >> (level * TIMER_LEVEL_BITS)) & (TIMER_SLOTS - 1);
+  struct timer **head = &w->slot[level][index];
+
+  t->next = *head;
+  if (t->next) t->next->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+  w->occupied[level] |= 1ull << index;
+}
+
+static void timer_unlink(struct timer_wheel *w, struct timer *t)
+{
+  /* the first timer in a slot is pointed to by the slot itself; if it was also the last, the slot is now empty */
+  ptrdiff_t head = t->pprev - &w->slot[0][0];
+  if ((head >= 0) && (head < TIMER_LEVELS * TIMER_SLOTS) && !t->next)
+    w->occupied[head / TIMER_SLOTS] &= ~(1ull << (head % TIMER_SLOTS));
+
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+/* (re)arm a timer to expire after ms milliseconds */
+
+static void timer_arm(struct timer_wheel *w, struct timer *t, uint32_t ms)
+{
+  if (timer_pending(t)) timer_unlink(w, t); else w->pending++;
+  t->expires = timer_ticks() + (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+  timer_link(w, t, w->now + 1);
+}
+
+static void timer_cancel(struct timer_wheel *w, struct timer *t)
+{
+  if (!timer_pending(t)) return;
+  timer_unlink(w, t);
+  w->pending--;
+}
+
+/* the next tick at which a slot holding timers is due to run or to be cascaded */
+
+static uint64_t timer_next(const struct timer_wheel *w)
+{
+  uint64_t next = UINT64_MAX;
+
+  for (unsigned level = 0; level < TIMER_LEVELS; level++)
+  {
+    if (!w->occupied[level]) continue;
+
+    uint64_t base = w->now >> (level * TIMER_LEVEL_BITS);
+    unsigned current = base & (TIMER_SLOTS - 1);
+
+    /* rotate so that bit 0 is the slot after the current one */
+    unsigned shift = (current + 1) & (TIMER_SLOTS - 1);
+    uint64_t rotated = (w->occupied[level] >> shift) | ((shift) ? w->occupied[level] << (TIMER_SLOTS - shift) : 0);
+    uint64_t when = (base + 1 + __builtin_ctzll(rotated)) << (level * TIMER_LEVEL_BITS);
+
+    if (when < next) next = when;
+  }
+
+  return next;
+}
+
+/* run every timer that has expired by tick now */
+
+static void timer_advance(struct timer_wheel *w, uint64_t now)
+{
+  while (w->now < now)
+  {
+    /* skip the ticks at which there is nothing to cascade or run */
+    uint64_t next = timer_next(w);
+    if (next > now)
+    {
+      w->now = now;
+      break;
+    }
+
+    w->now = next;
+
+    /* highest level first, so that what it cascades can be cascaded again below */
+    for (int level = TIMER_LEVELS - 1; level > 0; level--)
+    {
+      if (w->now & ((1ull << (level * TIMER_LEVEL_BITS)) - 1)) continue;
+
+      unsigned index = (w->now >> (level * TIMER_LEVEL_BITS)) & (TIMER_SLOTS - 1);
+      struct timer *t = w->slot[level][index];
+      w->slot[level][index] = NULL;
+      w->occupied[level] &= ~(1ull << index);
+
+      while (t)
+      {
+        struct timer *next = t->next;
+        timer_link(w, t, w->now);
+        t = next;
+      }
+    }
+
+    unsigned index = w->now & (TIMER_SLOTS - 1);
+    while (w->slot[0][index])
+    {
+      struct timer *t = w->slot[0][index];
+      timer_unlink(w, t);
+      w->pending--;
+      t->expire(t);           /* may re-arm itself, into a later slot */
+    }
+  }
+}
+
+static bool timer_wheel_init(struct timer_wheel *w)
+{
+  memset(w, 0, sizeof(*w));
+  w->now = timer_ticks();
+  w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  return w->fd >= 0;
+}
+
+/* point the timerfd at the next tick of interest, or disarm it; cheap when nothing changed */
+
+static void timer_wheel_rearm(struct timer_wheel *w)
+{
+  uint64_t next = (w->pending) ? timer_next(w) : 0;
+  if (next == w->armed) return;
+
+  struct itimerspec its = { 0 };
+  if (next)
+  {
+    uint64_t ms = next * TIMER_TICK_MS;
+    its.it_value.tv_sec = ms / 1000u;
+    its.it_value.tv_nsec = (ms % 1000u) * 1000000u;
+  }
+
+  timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &its, NULL);
+  w->armed = next;
+}
+
+/* the timerfd is readable: run whatever has expired */
+
+static void timer_wheel_expire(struct timer_wheel *w)
+{
+  uint64_t expirations;
+  while (read(w->fd, &expirations, sizeof(expirations)) > 0);
+
+  w->armed = 0;
+  timer_advance(w, timer_ticks());
+}
+
+static void timer_wheel_deinit(struct timer_wheel *w)
+{
+  if (w->fd >= 0) close(w->fd);
+  w->fd = -1;
+}
+
+#endif
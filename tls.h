@@ -0,0 +1,164 @@
+#ifndef _TLS_H
+#define _TLS_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+TLS for the connections of EVs that ask for it in SDP, on top of OpenSSL
+
+ISO 15118-2 requires TLS 1.2 with the server authenticated by an ECDSA certificate, so
+that is all the context offers.  On a small controller the ECDHE key exchange and the
+ECDSA signature of a full handshake take hundreds of milliseconds; an EV that
+reconnects (after a pause, or a lost link) resumes its TLS session instead and skips
+both.  Both ways of resuming are served: by session ID, from a server-side cache of up
+to tls_session_cache_size sessions, and by session ticket, which needs no server state.
+The one SSL_CTX, and with it the cache, is shared by all workers, so an EV resumes
+whichever worker its new connection lands on; only handshakes take the cache lock.
+
+The calls below never block.  Like their plain counterparts they report a socket that
+would block with errno EAGAIN, so the event loop treats both kinds of connection alike.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "txqueue.h"
+
+static SSL_CTX *tls_ctx; /* NULL when TLS is not offered */
+
+/* load the SECC certificate (with its chain) and key; returns false if TLS cannot be offered */
+
+static bool tls_init(const char *cert, const char *key, const char *ciphers, long cache_size, long timeout_s)
+{
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  if (!ctx) return false;
+
+  static const unsigned char context[] = "redux";
+
+  if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) ||
+      !SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION) ||
+      !SSL_CTX_set_cipher_list(ctx, ciphers) ||
+      (1 != SSL_CTX_use_certificate_chain_file(ctx, cert)) ||
+      (1 != SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM)) ||
+      !SSL_CTX_check_private_key(ctx) ||
+      !SSL_CTX_set_session_id_context(ctx, context, sizeof(context) - 1))
+  {
+    SSL_CTX_free(ctx);
+    return false;
+  }
+
+  SSL_CTX_set_options(ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_COMPRESSION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+  /* a reply may go out in pieces, and is resumed from wherever the last write stopped */
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, cache_size);
+  SSL_CTX_set_timeout(ctx, timeout_s);
+
+  tls_ctx = ctx;
+  return true;
+}
+
+static void tls_deinit(void)
+{
+  SSL_CTX_free(tls_ctx);
+  tls_ctx = NULL;
+}
+
+/* the server side of a freshly accepted connection; the handshake is driven by tls_handshake() */
+
+static SSL *tls_accept(int sock)
+{
+  SSL *ssl = SSL_new(tls_ctx);
+  if (!ssl) return NULL;
+
+  if (!SSL_set_fd(ssl, sock))
+  {
+    SSL_free(ssl);
+    return NULL;
+  }
+
+  SSL_set_accept_state(ssl);
+  return ssl;
+}
+
+/* returns 1 once the handshake is complete, 0 while it waits for the socket, and -1 if it failed */
+
+static int tls_handshake(SSL *ssl)
+{
+  ERR_clear_error();
+  int rc = SSL_do_handshake(ssl);
+  if (1 == rc) return 1;
+
+  int err = SSL_get_error(ssl, rc);
+  return ((SSL_ERROR_WANT_READ == err) || (SSL_ERROR_WANT_WRITE == err)) ? 0 : -1;
+}
+
+static bool tls_resumed(SSL *ssl)
+{
+  return SSL_session_reused(ssl);
+}
+
+/* as recv(): the length read, 0 once the EV has closed, or -1 with errno set */
+
+static ssize_t tls_recv(SSL *ssl, void *buf, size_t len)
+{
+  size_t n;
+
+  ERR_clear_error();
+  if (SSL_read_ex(ssl, buf, len, &n)) return n;
+
+  switch (SSL_get_error(ssl, 0))
+  {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    errno = EAGAIN;
+    return -1;
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+  default:
+    errno = EPROTO;
+    return -1;
+  }
+}
+
+/* as txq_flush(), one TLS record per queued reply */
+
+static int tls_flush(struct txqueue *q, SSL *ssl)
+{
+  while (q->count)
+  {
+    struct tx_slot *slot = &q->slot[q->head];
+    size_t written;
+
+    ERR_clear_error();
+    if (!SSL_write_ex(ssl, slot->data + q->offset, slot->len - q->offset, &written))
+    {
+      int err = SSL_get_error(ssl, 0);
+      return ((SSL_ERROR_WANT_WRITE == err) || (SSL_ERROR_WANT_READ == err)) ? 1 : -1;
+    }
+
+    txq_retire(q, written);
+  }
+
+  return 0;
+}
+
+/* send close_notify if the handshake got that far (a session torn down without it cannot be resumed) and free the connection state */
+
+static void tls_close(SSL *ssl)
+{
+  if (!ssl) return;
+
+  ERR_clear_error();
+  if (SSL_is_init_finished(ssl)) SSL_shutdown(ssl);
+  SSL_free(ssl);
+}
+
+#endif
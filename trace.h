@@ -0,0 +1,373 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+per-session tracing of the request pipeline, exported as Chrome trace-event JSON
+
+Each stage a request passes through (recv, V2GTP header, EXI decode, handler, EXI
+encode, V2GTP header write, send) is timed with CLOCK_MONOTONIC_RAW, which the vDSO
+answers without a system call.  Stages are chained, so a stage costs one clock read and
+one 16-byte store.  Spans are first gathered per connection, since the session is not
+known until the request has been handled (or, for SessionSetupReq, created), then
+committed to a ring of the last TRACE_SPANS spans in the session itself; nothing is
+allocated and nothing is written out until a dump is asked for.  The JSON loads in
+chrome://tracing or Perfetto, with one track per session.
+
+A session that ends hands a copy of its ring to a writer thread (trace_finish()), so
+file I/O never delays a response.  A dump of a worker's whole shard, on SIGUSR1, is
+copied the same way, into one block allocated for it (trace_shard_new(), _add() and
+_finish()), and written by the same thread.  If the writer falls TRACE_QUEUE sessions
+or shards behind, further traces are dropped.
+
+Build with -DTRACE=0 to compile the tracepoints out.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "messages.h"
+
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+/* spans kept per session; a CurrentDemand round trip takes seven */
+#ifndef TRACE_SPANS
+#define TRACE_SPANS 256
+#endif
+
+/* spans gathered per connection between commits */
+#define TRACE_PENDING 16
+
+/* finished sessions waiting for the writer thread */
+#define TRACE_QUEUE 16
+
+_Static_assert(0 == (TRACE_SPANS & (TRACE_SPANS - 1)), "TRACE_SPANS must be a power of two");
+
+enum trace_stage
+{
+  TRACE_RECV,
+  TRACE_HEADER,
+  TRACE_DECODE,
+  TRACE_HANDLER,
+  TRACE_ENCODE,
+  TRACE_FRAME,
+  TRACE_SEND,
+  TRACE_STAGES,
+};
+
+static const char *const trace_stage_names[TRACE_STAGES] =
+{
+  [TRACE_RECV] = "recv",
+  [TRACE_HEADER] = "read_v2gtpHeader",
+  [TRACE_DECODE] = "decode",
+  [TRACE_HANDLER] = "handler",
+  [TRACE_ENCODE] = "encode",
+  [TRACE_FRAME] = "write_v2gtpHeader",
+  [TRACE_SEND] = "send",
+};
+
+/* a span that belongs to no particular request: one writev() may carry several replies */
+#define TRACE_NO_MSG 0xff
+
+struct trace_span
+{
+  uint64_t start_ns;
+  uint32_t dur_ns;
+  uint8_t stage;
+  uint8_t msg;
+};
+
+#if TRACE
+
+struct trace_buf
+{
+  uint32_t head;            /* spans ever written; the ring holds the last TRACE_SPANS */
+  struct trace_span span[TRACE_SPANS];
+};
+
+struct trace_pending
+{
+  uint8_t count;
+  struct trace_span span[TRACE_PENDING];
+};
+
+static uint64_t trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* close a stage that began at start; returns the time, which is where the next stage begins */
+
+static uint64_t trace_span(struct trace_pending *p, enum trace_stage stage, uint64_t start)
+{
+  uint64_t now = trace_now();
+  if (p->count < TRACE_PENDING)
+  {
+    struct trace_span *s = &p->span[p->count++];
+    s->start_ns = start;
+    s->dur_ns = (uint32_t)(now - start);
+    s->stage = stage;
+  }
+  return now;
+}
+
+/* move the gathered spans into the session's ring (or drop them if there is none), tagged with the request; a recv is charged to the request it completed */
+
+static void trace_commit(struct trace_pending *p, struct trace_buf *b, unsigned msg)
+{
+  if (b)
+    for (unsigned i = 0; i < p->count; i++)
+    {
+      struct trace_span *s = &b->span[b->head++ & (TRACE_SPANS - 1)];
+      *s = p->span[i];
+      s->msg = msg;
+    }
+
+  p->count = 0;
+}
+
+static void trace_reset(struct trace_buf *b)
+{
+  b->head = 0;
+}
+
+#else
+
+struct trace_buf
+{
+  uint32_t head;
+};
+
+struct trace_pending
+{
+  uint8_t count;
+};
+
+static uint64_t trace_now(void) { return 0; }
+static uint64_t trace_span(struct trace_pending *p, enum trace_stage stage, uint64_t start) { return 0; }
+static void trace_commit(struct trace_pending *p, struct trace_buf *b, unsigned msg) {}
+static void trace_reset(struct trace_buf *b) {}
+
+#endif
+
+/*
+JSON output: trace_open() and trace_close() bracket any number of trace_write() calls,
+one per session, each on a track (tid) of its own
+*/
+
+static FILE *trace_open(const char *path)
+{
+  FILE *f = fopen(path, "w");
+  if (f) fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", f);
+  return f;
+}
+
+static void trace_close(FILE *f)
+{
+  fputs("{}]}\n", f);
+  fclose(f);
+}
+
+static void trace_write(FILE *f, const struct trace_buf *b, uint64_t sid)
+{
+#if TRACE
+  unsigned tid = (unsigned)sid & 0x7fffffff;
+  uint32_t first = (b->head > TRACE_SPANS) ? b->head - TRACE_SPANS : 0;
+
+  fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"session %016llx\"}},\n", tid, (unsigned long long)sid);
+
+  for (uint32_t i = first; i != b->head; i++)
+  {
+    const struct trace_span *s = &b->span[i & (TRACE_SPANS - 1)];
+    const char *msg = (TRACE_NO_MSG == s->msg) ? NULL : (MSG_NONE == s->msg) ? "SupportedAppProtocol" : msg_names[s->msg];
+
+    fprintf(f, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u,\"dur\":%u.%03u",
+      trace_stage_names[s->stage], (msg) ? msg : "io", tid,
+      (unsigned long long)(s->start_ns / 1000), (unsigned)(s->start_ns % 1000), s->dur_ns / 1000, s->dur_ns % 1000);
+    if (msg) fprintf(f, ",\"args\":{\"msg\":\"%s\"}", msg);
+    fputs("},\n", f);
+  }
+#endif
+}
+
+/* the writer thread */
+
+struct trace_finished
+{
+  uint64_t sid;
+  struct trace_shard *shard; /* a shard to dump instead, or NULL */
+  struct trace_buf buf;
+};
+
+/* a copy of every session in a worker's shard */
+
+struct trace_shard
+{
+  unsigned worker;
+  unsigned count, size;
+  struct trace_finished session[];
+};
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t tid;
+  bool running;
+  const char *dir;
+  unsigned head, tail;
+  struct trace_finished queue[TRACE_QUEUE];
+} trace_writer = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static void trace_write_file(const struct trace_finished *t)
+{
+  char path[256];
+  struct trace_shard *shard = t->shard;
+
+  if (shard)
+    snprintf(path, sizeof(path), "%s/redux-trace-w%u.json", trace_writer.dir, shard->worker);
+  else
+    snprintf(path, sizeof(path), "%s/redux-trace-%016llx.json", trace_writer.dir, (unsigned long long)t->sid);
+
+  FILE *f = trace_open(path);
+  if (f)
+  {
+    if (shard)
+      for (unsigned i = 0; i < shard->count; i++)
+        trace_write(f, &shard->session[i].buf, shard->session[i].sid);
+    else
+      trace_write(f, &t->buf, t->sid);
+    trace_close(f);
+  }
+
+  free(shard);
+}
+
+static void *trace_thread(void *arg)
+{
+  static struct trace_finished t;
+
+  /* only run when the event loop has nothing to do */
+  struct sched_param param = { .sched_priority = 0 };
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+  pthread_mutex_lock(&trace_writer.lock);
+  for (;;)
+  {
+    while (trace_writer.running && (trace_writer.head == trace_writer.tail))
+      pthread_cond_wait(&trace_writer.wake, &trace_writer.lock);
+    if (trace_writer.head == trace_writer.tail) break;
+
+    t = trace_writer.queue[trace_writer.tail % TRACE_QUEUE];
+    trace_writer.tail++;
+
+    pthread_mutex_unlock(&trace_writer.lock);
+    trace_write_file(&t);
+    pthread_mutex_lock(&trace_writer.lock);
+  }
+  pthread_mutex_unlock(&trace_writer.lock);
+  return NULL;
+}
+
+/* start the writer thread; session traces are written to dir as redux-trace-<SessionID>.json */
+
+static bool trace_init(const char *dir)
+{
+  if (!TRACE) return true;
+  trace_writer.dir = dir;
+  trace_writer.running = true;
+  if (pthread_create(&trace_writer.tid, NULL, trace_thread, NULL))
+  {
+    trace_writer.running = false;
+    return false;
+  }
+  return true;
+}
+
+/* hand the writer thread a session's trace (b) or a shard; returns false if it had to be dropped */
+
+static bool trace_queue(const struct trace_buf *b, uint64_t sid, struct trace_shard *shard)
+{
+  bool queued = false;
+
+  pthread_mutex_lock(&trace_writer.lock);
+  if (trace_writer.running && (trace_writer.head - trace_writer.tail < TRACE_QUEUE))
+  {
+    struct trace_finished *t = &trace_writer.queue[trace_writer.head % TRACE_QUEUE];
+    t->sid = sid;
+    t->shard = shard;
+    if (b) t->buf = *b;
+    trace_writer.head++;
+    queued = true;
+    pthread_cond_signal(&trace_writer.wake);
+  }
+  pthread_mutex_unlock(&trace_writer.lock);
+  return queued;
+}
+
+/* queue a copy of a session's trace for writing; returns false if it had to be dropped */
+
+static bool trace_finish(const struct trace_buf *b, uint64_t sid)
+{
+  if (!TRACE || !b->head) return false;
+  return trace_queue(b, sid, NULL);
+}
+
+/* a shard dump: room for size sessions, each copied in by trace_shard_add(), then queued by trace_shard_finish() */
+
+static struct trace_shard *trace_shard_new(unsigned worker, unsigned size)
+{
+  if (!TRACE) return NULL;
+
+  struct trace_shard *shard = malloc(sizeof(*shard) + size * sizeof(shard->session[0]));
+  if (!shard) return NULL;
+  shard->worker = worker;
+  shard->count = 0;
+  shard->size = size;
+  return shard;
+}
+
+static void trace_shard_add(struct trace_shard *shard, const struct trace_buf *b, uint64_t sid)
+{
+  if (shard->count == shard->size) return;
+  struct trace_finished *t = &shard->session[shard->count++];
+  t->sid = sid;
+  t->shard = NULL;
+  t->buf = *b;
+}
+
+/* returns false if the shard had to be dropped (and is freed) */
+
+static bool trace_shard_finish(struct trace_shard *shard)
+{
+  if (trace_queue(NULL, 0, shard)) return true;
+  free(shard);
+  return false;
+}
+
+/* write out whatever is still queued and stop the writer thread */
+
+static void trace_deinit(void)
+{
+  pthread_mutex_lock(&trace_writer.lock);
+  bool running = trace_writer.running;
+  trace_writer.running = false;
+  pthread_cond_signal(&trace_writer.wake);
+  pthread_mutex_unlock(&trace_writer.lock);
+
+  if (running) pthread_join(trace_writer.tid, NULL);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef _TXQUEUE_H
+#define _TXQUEUE_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+per-connection output queue
+
+Each response is encoded straight into its own slot.  Queued slots are written with a
+single writev(), and a short write simply leaves the remainder queued (with the offset
+into the first slot remembered) until the socket reports it is writable again.
+A connection whose queue is full stops being read, which is the backpressure that
+keeps one slow EV from consuming unbounded memory or delaying the others.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#ifndef TX_SLOTS
+#define TX_SLOTS 8
+#endif
+
+#ifndef TX_SLOT_SIZE
+#define TX_SLOT_SIZE 1024
+#endif
+
+struct tx_slot
+{
+  uint32_t len;
+  uint8_t data[TX_SLOT_SIZE];
+};
+
+struct txqueue
+{
+  uint32_t head;   /* index of the oldest queued slot */
+  uint32_t count;  /* number of queued slots */
+  uint32_t offset; /* bytes of the oldest slot already written */
+  struct tx_slot slot[TX_SLOTS];
+};
+
+static void txq_init(struct txqueue *q)
+{
+  q->head = q->count = q->offset = 0;
+}
+
+static bool txq_full(const struct txqueue *q)
+{
+  return TX_SLOTS == q->count;
+}
+
+static bool txq_empty(const struct txqueue *q)
+{
+  return 0 == q->count;
+}
+
+/* returns the slot that the next response should be encoded into (NULL if the queue is full) */
+
+static uint8_t *txq_reserve(struct txqueue *q)
+{
+  if (txq_full(q)) return NULL;
+  return q->slot[(q->head + q->count) % TX_SLOTS].data;
+}
+
+static void txq_commit(struct txqueue *q, uint32_t len)
+{
+  q->slot[(q->head + q->count) % TX_SLOTS].len = len;
+  q->count++;
+}
+
+/* retire fully written slots and remember how far into the next one a write got */
+
+static void txq_retire(struct txqueue *q, size_t written)
+{
+  while (written && q->count)
+  {
+    struct tx_slot *slot = &q->slot[q->head];
+    uint32_t remaining = slot->len - q->offset;
+
+    if (written < remaining)
+    {
+      q->offset += written;
+      break;
+    }
+
+    written -= remaining;
+    q->offset = 0;
+    q->head = (q->head + 1) % TX_SLOTS;
+    q->count--;
+  }
+}
+
+/* returns 0 when everything was written, 1 when data remains queued, and -1 on a socket error */
+
+static int txq_flush(struct txqueue *q, int sock)
+{
+  while (q->count)
+  {
+    struct iovec iov[TX_SLOTS];
+    uint32_t i;
+
+    for (i = 0; i < q->count; i++)
+    {
+      struct tx_slot *slot = &q->slot[(q->head + i) % TX_SLOTS];
+      uint32_t skip = (0 == i) ? q->offset : 0;
+      iov[i].iov_base = slot->data + skip;
+      iov[i].iov_len = slot->len - skip;
+    }
+
+    ssize_t written = writev(sock, iov, q->count);
+
+    if (written < 0)
+    {
+      if (EINTR == errno) continue;
+      if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) return 1;
+      return -1;
+    }
+
+    txq_retire(q, written);
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _V2GTP_STREAM_H
+#define _V2GTP_STREAM_H
+
+/*****************************************************************************
+ * THIS FILE IS PROVIDED AS IS WITH NO WARRANTY OF ANY KIND, INCLUDING THE   *
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE. *
+ *****************************************************************************/
+
+/*
+per-connection V2GTP frame reassembly
+
+TCP is free to split or coalesce V2GTP frames, so received bytes are appended to a
+receive ring and frames are only handed out once the payload length announced by the
+V2GTP header has fully arrived.  Frames are handed out as pointers into the ring, so
+the EXI decoder works on the bytes where recv() left them.  The ring never lets a
+frame wrap: when the free space at the end runs out, only the bytes of the (partial)
+frame still in progress are moved back to the start.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "v2gtp.h"
+
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE 4096
+#endif
+
+struct v2gtp_rx
+{
+  uint32_t head; /* offset of the first unconsumed byte */
+  uint32_t tail; /* offset one past the last received byte */
+  uint8_t data[RX_BUFFER_SIZE];
+};
+
+static void v2gtp_rx_init(struct v2gtp_rx *rx)
+{
+  rx->head = rx->tail = 0;
+}
+
+/* returns where the next recv() should write, and how much room is available there */
+
+static uint8_t *v2gtp_rx_space(struct v2gtp_rx *rx, size_t *len)
+{
+  if (rx->head == rx->tail)
+  {
+    rx->head = rx->tail = 0;
+  }
+  else if ((rx->tail == sizeof(rx->data)) && rx->head)
+  {
+    memmove(rx->data, rx->data + rx->head, rx->tail - rx->head);
+    rx->tail -= rx->head;
+    rx->head = 0;
+  }
+
+  *len = sizeof(rx->data) - rx->tail;
+  return rx->data + rx->tail;
+}
+
+static void v2gtp_rx_commit(struct v2gtp_rx *rx, size_t len)
+{
+  rx->tail += len;
+}
+
+/*
+look for a complete frame (header plus payload) at the head of the ring
+returns 1 and the frame if one is ready, 0 if more bytes are needed, and -1 if the
+stream is not V2GTP or announces a frame that could never fit in the ring
+*/
+
+static int v2gtp_rx_peek(struct v2gtp_rx *rx, uint8_t **frame, uint32_t *framelen)
+{
+  uint32_t avail = rx->tail - rx->head;
+  const uint8_t *hdr = rx->data + rx->head;
+
+  if (avail < V2GTP_HEADER_LENGTH) return 0;
+
+  if ((V2GTP_VERSION != hdr[0]) || (V2GTP_VERSION_INV != hdr[1])) return -1;
+
+  uint32_t payload = ((uint32_t)hdr[4] << 24) | ((uint32_t)hdr[5] << 16) | ((uint32_t)hdr[6] << 8) | hdr[7];
+
+  if (payload > (sizeof(rx->data) - V2GTP_HEADER_LENGTH)) return -1;
+
+  if (avail < (V2GTP_HEADER_LENGTH + payload)) return 0;
+
+  *frame = rx->data + rx->head;
+  *framelen = V2GTP_HEADER_LENGTH + payload;
+  return 1;
+}
+
+static void v2gtp_rx_consume(struct v2gtp_rx *rx, uint32_t framelen)
+{
+  rx->head += framelen;
+}
+
+#endif